@@ -0,0 +1,270 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "memory.h"
+#include "context.h"
+
+#define BLOCK_MAX_INSTRUCTIONS 64
+#define BLOCK_CACHE_MAX_BLOCKS 16384
+#define BLOCK_CACHE_MAX_INSTRUCTIONS (BLOCK_CACHE_MAX_BLOCKS * 8)
+#define IDLE_LOOP_MAX_INSTRUCTIONS 8 // Longest block that can be detected as an idle loop
+#define CODE_PAGE_SHIFT 12 // 4 KiB pages for the code tracking of main RAM
+#define CODE_PAGE_SIZE (1 << CODE_PAGE_SHIFT)
+#define CODE_PAGE_COUNT (RAM_SIZE / CODE_PAGE_SIZE)
+
+/// <summary>
+/// Functions and state for the cached interpreter, which decodes runs of guest code into blocks
+/// once and then replays them without fetching and decoding every instruction again
+/// </summary>
+
+/// <summary>
+/// How a decoded instruction is run: the common ALU and branch instructions are done inline by
+/// run_cached_block() from the pre-decoded operands, the others call their function
+/// </summary>
+typedef enum
+{
+	CACHED_OP_HANDLER,
+	CACHED_OP_ADDIU,
+	CACHED_OP_SLTI,
+	CACHED_OP_SLTIU,
+	CACHED_OP_ANDI,
+	CACHED_OP_ORI,
+	CACHED_OP_XORI,
+	CACHED_OP_LUI,
+	CACHED_OP_SLL,
+	CACHED_OP_SRL,
+	CACHED_OP_SRA,
+	CACHED_OP_SLLV,
+	CACHED_OP_SRLV,
+	CACHED_OP_SRAV,
+	CACHED_OP_ADDU,
+	CACHED_OP_SUBU,
+	CACHED_OP_AND,
+	CACHED_OP_OR,
+	CACHED_OP_XOR,
+	CACHED_OP_NOR,
+	CACHED_OP_SLT,
+	CACHED_OP_SLTU,
+	CACHED_OP_MFHI,
+	CACHED_OP_MTHI,
+	CACHED_OP_MFLO,
+	CACHED_OP_MTLO,
+	CACHED_OP_BEQ,
+	CACHED_OP_BNE,
+	CACHED_OP_BLEZ,
+	CACHED_OP_BGTZ,
+	CACHED_OP_J,
+	CACHED_OP_JAL,
+	CACHED_OP_JR,
+	CACHED_OP_JALR,
+} CachedOperation;
+
+/// <summary>
+/// A guest instruction with its handler already looked up in the opcode tables and its fields extracted
+/// </summary>
+typedef struct
+{
+	/// <summary>
+	/// The 32 bit value of the opcode
+	/// </summary>
+	uint32_t opcode;
+
+	/// <summary>
+	/// The function implementing the opcode
+	/// </summary>
+	void* function;
+
+	/// <summary>
+	/// The immediate value ready to use: sign extended for arithmetic, zero extended for logic,
+	/// shifted for lui, the offset in bytes for branches and the low 28 bits of the target for jumps
+	/// </summary>
+	uint32_t immediate;
+
+	/// <summary>
+	/// How the instruction is run, a CachedOperation
+	/// </summary>
+	uint8_t operation;
+
+	/// <summary>
+	/// The register fields and the shift amount of the opcode
+	/// </summary>
+	uint8_t rs;
+	uint8_t rt;
+	uint8_t rd;
+	uint8_t shamt;
+
+	/// <summary>
+	/// Whether the instruction can change the interrupt state or raise an exception (stores,
+	/// coprocessor instructions, traps), so the interrupts are serviced again after it
+	/// </summary>
+	bool sync;
+} DecodedInstruction;
+
+/// <summary>
+/// A run of sequential guest instructions, ending after the delay slot of a branch/jump
+/// </summary>
+typedef struct
+{
+	/// <summary>
+	/// The address of the first instruction of the block
+	/// </summary>
+	uint32_t address;
+
+	/// <summary>
+	/// The number of instructions in the block
+	/// </summary>
+	int length;
+
+	/// <summary>
+	/// The decoded instructions of the block
+	/// </summary>
+	DecodedInstruction* instructions;
+
+	/// <summary>
+	/// The native code translated from the block by the recompiler, NULL if not translated yet
+	/// </summary>
+	void* recompiled;
+
+	/// <summary>
+	/// Whether the block is a loop branching back to its own start, which only reads memory and
+	/// recomputes the same registers each iteration, so it can't exit until memory changes
+	/// </summary>
+	bool idle_loop;
+} Block;
+
+typedef struct
+{
+	/// <summary>
+	/// All the blocks currently decoded, BLOCK_CACHE_MAX_BLOCKS of them are allocated by init_block_cache()
+	/// </summary>
+	Block* blocks;
+
+	/// <summary>
+	/// The number of blocks in use
+	/// </summary>
+	int block_count;
+
+	/// <summary>
+	/// Storage for the decoded instructions of all the blocks, BLOCK_CACHE_MAX_INSTRUCTIONS of them
+	/// </summary>
+	DecodedInstruction* instructions;
+
+	/// <summary>
+	/// The number of decoded instructions in use
+	/// </summary>
+	int instruction_count;
+
+	/// <summary>
+	/// Blocks starting at each word of the main RAM
+	/// </summary>
+	Block** ram_blocks;
+
+	/// <summary>
+	/// Blocks starting at each word of the BIOS ROM
+	/// </summary>
+	Block** bios_blocks;
+
+	/// <summary>
+	/// One bit per word of main RAM, set if the word was decoded into a block
+	/// </summary>
+	uint32_t code_bitmap[RAM_SIZE / WORD_SIZE / 32];
+
+	/// <summary>
+	/// One bit per 4 KiB page of main RAM, set if any word of the page is in code_bitmap.
+	/// Small enough to stay in the host cache, so writes to data pages only cost one test
+	/// </summary>
+	uint32_t code_pages[CODE_PAGE_COUNT / 32];
+
+	/// <summary>
+	/// Incremented every time the cache is flushed
+	/// </summary>
+	uint32_t flush_count;
+
+	/// <summary>
+	/// Incremented every time blocks are dropped, by a flush or because their code was overwritten
+	/// </summary>
+	uint32_t invalidation_count;
+
+	/// <summary>
+	/// Set by read_io when reading a register that can change without a scheduler event (like
+	/// the timer counters), an idle loop reading it can't be skipped
+	/// </summary>
+	bool volatile_io_read;
+} BlockCache;
+
+extern PSX_THREAD_LOCAL BlockCache block_cache;
+
+/// <summary>
+/// Allocates the blocks and the lookup tables of the block cache, must be called once before running code
+/// </summary>
+/// <returns>0 if the allocation worked, -1 otherwise</returns>
+int init_block_cache();
+
+/// <summary>
+/// Releases the memory of the block cache
+/// </summary>
+void free_block_cache();
+
+/// <summary>
+/// Drops all the decoded blocks
+/// </summary>
+void flush_block_cache();
+
+/// <summary>
+/// Drops the decoded blocks containing a word of main RAM, if there are any
+/// </summary>
+/// <param name="ram_address">The offset of the written word in main RAM</param>
+void invalidate_cached_code_word(uint32_t ram_address);
+
+/// <summary>
+/// Drops the decoded blocks overlapping a range of main RAM, used when a whole buffer gets written at once
+/// </summary>
+/// <param name="ram_address">The offset of the start of the range in main RAM, the range wraps around the end of RAM</param>
+/// <param name="size">The size of the range in bytes</param>
+void invalidate_cached_code_range(uint32_t ram_address, uint32_t size);
+
+/// <summary>
+/// Must be called when a word of main RAM is written, drops the decoded blocks containing the word.
+/// Only the page bitmap is checked inline, writes to pages without code never leave this function
+/// </summary>
+/// <param name="ram_address">The offset of the written word in main RAM</param>
+static inline void invalidate_cached_code(uint32_t ram_address)
+{
+	uint32_t page_index = ram_address >> CODE_PAGE_SHIFT;
+
+	if (block_cache.code_pages[page_index / 32] & (1u << (page_index % 32)))
+		invalidate_cached_code_word(ram_address);
+}
+
+/// <summary>
+/// Checks if an instruction is a branch or jump, which means the block ends after its delay slot
+/// </summary>
+/// <param name="opcode">The 32 bit value of the opcode</param>
+/// <returns>Whether the opcode is a branch or jump</returns>
+bool is_branch_instruction(uint32_t opcode);
+
+/// <summary>
+/// Returns the decoded block starting at the address, decoding it if necessary
+/// </summary>
+/// <param name="address">The address of the first instruction of the block</param>
+/// <returns>The block, or NULL if the address is not in RAM or BIOS ROM</returns>
+Block* get_block(uint32_t address);
+
+/// <summary>
+/// Called after running a whole idle loop block: if it branched back to itself without reading volatile
+/// registers and without any event firing, nothing can change until the next scheduler event, so the
+/// cycle counter jumps straight to it instead of running the same iterations again
+/// </summary>
+/// <param name="block">The block that was executed</param>
+/// <param name="block_address">The address the block was executed at</param>
+/// <param name="deadline">The deadline of the next scheduler event when the block started</param>
+void skip_idle_loop(Block* block, uint32_t block_address, uint64_t deadline);
+
+/// <summary>
+/// Executes the block starting at the current pc using the cached decoded instructions
+/// </summary>
+/// <param name="debug_info">Whether debug information about the instructions should be printed</param>
+/// <returns>The number of instructions that were executed</returns>
+int run_cached_block(bool debug_info);
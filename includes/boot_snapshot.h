@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+
+#define BOOT_SNAPSHOT_PATH "roms/boot_snapshot.bin"
+#define BOOT_SNAPSHOT_MAGIC 0x544F4F42 // "BOOT"
+#define BOOT_SNAPSHOT_VERSION 2
+
+/// <summary>
+/// Functions for the fast boot, which skips the BIOS boot by restoring the emulator state at the shell entry point
+///
+/// The first boot that reaches the shell entry point saves a save state, behind a header identifying the BIOS.
+/// Later launches with the same BIOS restore it and sideload the EXE right away, instead of running the kernel init again
+/// </summary>
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+
+	/// <summary>
+	/// Hash of the BIOS ROM the snapshot was taken with, the snapshot is ignored with another BIOS
+	/// </summary>
+	uint32_t bios_hash;
+} BootSnapshotHeader;
+
+/// <summary>
+/// Saves the current state of the emulator as the boot snapshot, should be called when the BIOS reaches the shell entry point
+/// </summary>
+/// <param name="path">The path of the snapshot file</param>
+/// <returns>0 if the snapshot was saved, -1 otherwise</returns>
+int save_boot_snapshot(const char* path);
+
+/// <summary>
+/// Restores the boot snapshot if it was saved with the loaded BIOS, the CPU is then at the shell entry point
+/// </summary>
+/// <param name="path">The path of the snapshot file</param>
+/// <returns>0 if the snapshot was restored, -1 if it is missing or doesn't match (the state is left untouched)</returns>
+int load_boot_snapshot(const char* path);
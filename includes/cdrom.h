@@ -3,7 +3,10 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "context.h"
+
 #define CD_FIFO_SIZE 16
+#define CD_IRQ_DELAY_CYCLES 500 // How many cycles after a command the CDROM IRQ gets triggered
 
 /// <summary>
 /// Functions and state for emulating the CD-ROM drive
@@ -45,16 +48,16 @@ typedef struct
 	/// Whether a CDROM IRQ is pending
 	/// </summary>
 	bool pending_cdrom_irq;
-
-	/// <summary>
-	/// If a CDROM IRQ is pending, how many cycles are left before triggering an IRQ
-	/// </summary>
-	int cycles_until_irq;
 } CDController;
 
+extern PSX_THREAD_LOCAL CDController cd_controller;
+
 void reset_cdrom_state();
 
 uint32_t read_cdrom(uint32_t address);
 void write_cdrom(uint32_t address, uint32_t value);
 
-void tick_cdrom(int cycles);
+/// <summary>
+/// Scheduler event for a delayed CDROM IRQ
+/// </summary>
+void handle_cdrom_irq_event(uint64_t deadline);
@@ -0,0 +1,29 @@
+#pragma once
+
+/// <summary>
+/// Functions for setting up the emulator context of a thread
+///
+/// Every piece of emulator state (the state structs of each subsystem, the guest memory, the block cache and
+/// the recompiled code) is thread local, so each thread of a process runs its own independent console and
+/// the subsystems keep accessing their state directly. A thread calls init_context() before emulating anything,
+/// and free_context() once it is done. The state structs hold about 1.3 MiB in the static TLS block, carved
+/// from the stack of each thread, the bigger buffers are allocated by init_context()
+/// </summary>
+
+#if defined(_MSC_VER)
+#define PSX_THREAD_LOCAL __declspec(thread)
+#else
+#define PSX_THREAD_LOCAL _Thread_local
+#endif
+
+/// <summary>
+/// Allocates the guest memory and the block cache of the calling thread and resets its scheduler and timers, the other
+/// state starts in its power on state
+/// </summary>
+/// <returns>0 if the context is ready, -1 otherwise</returns>
+int init_context();
+
+/// <summary>
+/// Releases everything allocated for the console of the calling thread
+/// </summary>
+void free_context();
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <stdint.h>
+
+#include "context.h"
+
 #define cop0_code(value) ((((value & 0x03E00000) >> 21)))
 #define CPR0(value) _cop0_registers[value]
 
@@ -35,7 +39,7 @@ typedef enum
 	OVERFLOW = 0xC
 } ExceptionType;
 
-extern uint32_t _cop0_registers[64];
+extern PSX_THREAD_LOCAL uint32_t _cop0_registers[64];
 
 void reset_cop0_state();
 
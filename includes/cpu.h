@@ -3,9 +3,12 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "context.h"
+
 #define CPU_FREQ 33868800 // CPU Frequency in Hz
 #define NTSC_FRAME_FREQ 59.940 // Interlaced vertical refresh rate on NTSC
 #define NTSC_FRAME_CYCLE_COUNT (CPU_FREQ / NTSC_FRAME_FREQ) // How many cycles to complete one NTSC frame
+#define CYCLES_PER_INSTRUCTION 2 // Average number of cycles an instruction takes
 
 #define R(reg) cpu_state.registers[reg]
 #define rs(value) ((value & 0x03E00000) >> 21)
@@ -108,7 +111,23 @@ typedef struct
 	uint32_t fetch_reg_value;
 } cpu;
 
-extern cpu cpu_state;
+/// <summary>
+/// The ways the CPU can execute guest code
+/// </summary>
+typedef enum
+{
+	CPU_BACKEND_INTERPRETER, // Fetches and decodes every instruction
+	CPU_BACKEND_CACHED_INTERPRETER, // Replays decoded blocks of instructions
+	CPU_BACKEND_RECOMPILER, // Translates blocks of instructions into native code
+	CPU_BACKEND_THREADED_INTERPRETER, // Dispatches every instruction with computed gotos
+} CPUBackend;
+
+extern PSX_THREAD_LOCAL cpu cpu_state;
+
+/// <summary>
+/// The backend used to execute guest code, can be changed at any time between two calls to run_cpu()
+/// </summary>
+extern PSX_THREAD_LOCAL CPUBackend cpu_backend;
 
 void reset_emulator();
 
@@ -127,7 +146,7 @@ static void delay_reg_fetch(int reg_index, uint32_t value);
 /// <summary>
 /// Checks for putchar() calls to the TTY output
 /// </summary>
-static void check_tty_output();
+void check_tty_output();
 
 /// <summary>
 /// Prints debug info about the CPU state
@@ -140,12 +159,40 @@ void print_debug_info(cpu cpu_state);
 /// </summary>
 void print_tty_output();
 
+/// <summary>
+/// Looks up the function implementing an opcode in the primary/secondary opcode tables
+/// </summary>
+/// <param name="opcode">The 32 bit value of the opcode</param>
+/// <returns>The function implementing the opcode</returns>
+void* decode_instruction(uint32_t opcode);
+
+/// <summary>
+/// Executes the instruction in current_opcode, which must already be fetched from the current pc
+/// </summary>
+/// <param name="function">The function implementing the opcode</param>
+/// <param name="debug_info">Whether debug information about the instruction should be printed</param>
+void execute_instruction(void* function, bool debug_info);
+
+/// <summary>
+/// Calls the function implementing current_opcode and applies pending load delays,
+/// pc must already point to the next instruction
+/// </summary>
+/// <param name="function">The function implementing the opcode</param>
+void run_instruction_handler(void* function);
+
 /// <summary>
 /// Handles the next CPU instruction in the emulation loop
 /// </summary>
 /// <param name="debug_info">Whether debug information about the instruction should be printed</param>
 void handle_instruction(bool debug_info);
 
+/// <summary>
+/// Runs guest code using the selected CPU backend
+/// </summary>
+/// <param name="debug_info">Whether debug information about the instructions should be printed</param>
+/// <returns>The number of instructions that were executed</returns>
+int run_cpu(bool debug_info);
+
 extern const instruction primary_opcodes[0x40];
 extern const instruction secondary_opcodes[0x40];
 
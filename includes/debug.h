@@ -5,6 +5,7 @@
 #include <string.h>
 
 #include "cpu.h"
+#include "context.h"
 
 #define MAX_BREAKPOINTS 8
 #define CPU_TRACE_SIZE 40
@@ -67,7 +68,7 @@ typedef struct
 	int char_index;
 } DebugState;
 
-extern DebugState debug_state;
+extern PSX_THREAD_LOCAL DebugState debug_state;
 
 void reset_debug_state(bool reset_breakpoints);
 
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "memory.h"
+#include "context.h"
+
+#define DIRTY_PAGE_SHIFT 12 // 4 KiB pages
+#define DIRTY_PAGE_SIZE (1 << DIRTY_PAGE_SHIFT)
+#define RAM_DIRTY_PAGE_COUNT (RAM_SIZE >> DIRTY_PAGE_SHIFT)
+#define VRAM_DIRTY_PAGE_COUNT ((1024 * KIB_SIZE) >> DIRTY_PAGE_SHIFT) // 2 lines of VRAM per page
+#define VRAM_TILE_WIDTH 64 // Width of a VRAM upload tile, in halfwords
+#define VRAM_TILE_HEIGHT 16 // Height of a VRAM upload tile, in lines
+#define VRAM_TILE_ROWS (512 / VRAM_TILE_HEIGHT)
+
+/// <summary>
+/// Functions and state for tracking the pages of RAM and VRAM written since the last incremental snapshot
+///
+/// Every store to RAM (from the CPU, DMA or the EXE sideloader) and every CPU to VRAM blit sets the bit of its page.
+/// update_save_state() then only copies the dirty pages into a save state it already wrote, and clears the bits.
+/// The smaller regions like the scratchpad are always copied whole, which costs less than tracking their writes
+///
+/// VRAM writes also set the bit of their 64x16 tile, which the frontend clears once it uploaded the tile to the copy
+/// of VRAM its shaders sample. Those bits are left alone when the snapshot bits are cleared
+/// </summary>
+
+typedef struct
+{
+	uint32_t ram[RAM_DIRTY_PAGE_COUNT / 32];
+	uint32_t vram[VRAM_DIRTY_PAGE_COUNT / 32];
+
+	/// <summary>
+	/// The VRAM tiles written since the frontend last uploaded them, a mask of the 16 tiles of each tile row
+	/// </summary>
+	uint16_t vram_tiles[VRAM_TILE_ROWS];
+} DirtyPageState;
+
+extern PSX_THREAD_LOCAL DirtyPageState dirty_pages;
+
+/// <summary>
+/// Marks the page of a RAM address as written
+/// </summary>
+/// <param name="ram_address">The offset in RAM, without mirrors</param>
+static inline void mark_ram_dirty(uint32_t ram_address)
+{
+	uint32_t page = ram_address >> DIRTY_PAGE_SHIFT;
+	dirty_pages.ram[page / 32] |= 1u << (page % 32);
+}
+
+/// <summary>
+/// Marks the pages of a range of RAM as written, the range may wrap around the end of RAM
+/// </summary>
+void mark_ram_range_dirty(uint32_t ram_address, uint32_t size);
+
+/// <summary>
+/// Marks the page of a VRAM pixel as written
+/// </summary>
+/// <param name="index">The index of the pixel in VRAM</param>
+static inline void mark_vram_dirty(uint32_t index)
+{
+	uint32_t page = (index * HALF_WORD_SIZE) >> DIRTY_PAGE_SHIFT;
+	dirty_pages.vram[page / 32] |= 1u << (page % 32);
+
+	dirty_pages.vram_tiles[index / 1024 / VRAM_TILE_HEIGHT] |= 1u << ((index % 1024) / VRAM_TILE_WIDTH);
+}
+
+/// <summary>
+/// Marks the pages and tiles of a rectangle of VRAM as written
+/// </summary>
+/// <param name="left">The left column, inclusive</param>
+/// <param name="top">The top line, inclusive</param>
+/// <param name="right">The right column, inclusive</param>
+/// <param name="bottom">The bottom line, inclusive</param>
+void mark_vram_rect_dirty(uint32_t left, uint32_t top, uint32_t right, uint32_t bottom);
+
+static inline bool is_page_dirty(const uint32_t* pages, uint32_t page)
+{
+	return pages[page / 32] & (1u << (page % 32));
+}
+
+/// <summary>
+/// Marks all the pages as written, when the memory was replaced as a whole
+/// </summary>
+void mark_all_pages_dirty();
+
+/// <summary>
+/// Clears the RAM and VRAM page bits after an incremental snapshot, the VRAM tile bits are kept
+/// </summary>
+void clear_dirty_pages();
@@ -4,6 +4,10 @@
 #include <stdbool.h>
 #include <string.h>
 
+#include "context.h"
+
+#define DMA_CYCLES_PER_WORD 1 // How many cycles a DMA transfer takes for each word
+
 /// <summary>
 /// Functions and state for emulating the different transfers of the DMA controller
 /// </summary>
@@ -63,6 +67,8 @@ typedef struct
 	uint32_t dma_chcr; // DMA Channel control
 	DMATransferState transfer_state;
 	DMADevice dma_device;
+	bool transfer_running; // Whether the channel waits for its completion event
+	uint64_t completion_cycle; // The scheduler cycle at which the running transfer completes
 } DMAChannel;
 
 /// <summary>
@@ -75,12 +81,22 @@ typedef struct
 	uint32_t dicr;
 } DMA;
 
+extern PSX_THREAD_LOCAL DMA dma_regs;
+
 void reset_dma_state();
 
 uint32_t read_dma_regs(uint32_t address);
 void write_dma_regs(uint32_t address, uint32_t value);
 
-static void start_linked_list_dma(DMAChannel* channel);
-static void start_burst_dma(DMAChannel* channel);
-static void start_sliced_dma(DMAChannel* channel);
-static void handle_dma_transfer(DMAChannel* channel);
+/// <summary>
+/// Scheduler event for the completion of the running DMA transfers, clears their
+/// start/busy bit and requests the DMA IRQ if enabled
+/// </summary>
+void handle_dma_complete_event(uint64_t deadline);
+
+static int start_linked_list_dma(DMAChannel* channel);
+static int start_burst_dma(DMAChannel* channel);
+static int start_sliced_dma(DMAChannel* channel);
+static int handle_dma_transfer(DMAChannel* channel);
+static void update_dma_irq();
+static void schedule_dma_complete_event();
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "context.h"
+
+#define FASTMEM_ARENA_SIZE 0x100000000ULL // The whole 32 bit guest address space
+
+/// <summary>
+/// Functions and state for the fastmem arena, a 4 GiB range of host address space where every guest
+/// address N lives at base + N. RAM (and its mirrors) and BIOS ROM are mapped at their guest
+/// addresses in KUSEG, KSEG0 and KSEG1, the BIOS ROM being read only. Everything else, the 1 KiB
+/// scratchpad (smaller than a host page) and the lazily allocated expansion regions included, is left inaccessible, so that recompiled code can
+/// access memory with a single host instruction, and recover through the slow path when the access faults.
+/// </summary>
+
+typedef struct
+{
+	/// <summary>
+	/// Start of the reserved host address range
+	/// </summary>
+	uint8_t* base;
+
+	/// <summary>
+	/// Whether the arena is set up and can be used by the recompiler
+	/// </summary>
+	bool enabled;
+
+	/// <summary>
+	/// Host memory backing the guest memory regions, mapped both in the arena and at this writable view
+	/// </summary>
+	uint8_t* backing;
+
+	/// <summary>
+	/// The file descriptor of the backing memory, kept open to map its regions again
+	/// </summary>
+	int backing_fd;
+} FastmemState;
+
+extern PSX_THREAD_LOCAL FastmemState fastmem_state;
+
+/// <summary>
+/// Reserves the arena, maps the guest memory regions into it and installs the fault handler
+/// </summary>
+/// <returns>A writable view of the backing memory, laid out as described in memory.h, or NULL if fastmem isn't supported</returns>
+uint8_t* init_fastmem();
+
+/// <summary>
+/// Releases the arena and the backing memory of the calling thread
+/// </summary>
+void free_fastmem();
+
+/// <summary>
+/// Maps the BIOS ROM regions of the arena to a file, or back to the backing memory
+/// </summary>
+/// <param name="fd">The BIOS file, mapped from its start, or -1 for the backing memory</param>
+/// <returns>0 if the mapping worked, -1 otherwise (the arena is then unusable and fastmem gets disabled)</returns>
+int map_fastmem_bios(int fd);
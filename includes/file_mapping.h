@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/// <summary>
+/// Functions for mapping whole files read only in memory, used for the BIOS and EXE images
+///
+/// On POSIX hosts the file is mmap'd, so its pages come straight from the page cache and are shared by every
+/// process mapping the same file. Elsewhere the file is read into an allocated buffer instead
+/// </summary>
+
+typedef struct
+{
+	/// <summary>
+	/// The contents of the file, NULL if nothing is mapped
+	/// </summary>
+	const uint8_t* data;
+	size_t size;
+
+	/// <summary>
+	/// The open file, to map it again somewhere else. -1 if the contents were read into a buffer
+	/// </summary>
+	int fd;
+} FileMapping;
+
+/// <summary>
+/// Maps a whole file read only
+/// </summary>
+/// <param name="path">The path of the file</param>
+/// <param name="mapping">Receives the mapping, left empty on failure</param>
+/// <returns>0 if the file was mapped, -1 otherwise</returns>
+int map_file(const char* path, FileMapping* mapping);
+
+/// <summary>
+/// Releases a mapping made by map_file(), does nothing if it is empty
+/// </summary>
+void unmap_file(FileMapping* mapping);
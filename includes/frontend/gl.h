@@ -11,6 +11,9 @@
 #define PSX_RT frontend_state.psx_render_target
 #define VRAM_RT frontend_state.vram_render_target
 
+#define RENDER_BATCH_VERTEX_COUNT (64 * 1024) // Size of the vertex ring buffer, in vertices
+#define BATCH_VERTEX_TEXTURED (1 << 15) // Set in the texture page of the vertices of textured primitives
+
 /// <summary>
 /// Functions and state for implementing the GPU operations using the OpenGL graphics API
 /// </summary>
@@ -56,6 +59,34 @@ typedef struct
 	Vec2 uv;
 } Vertex;
 
+/// <summary>
+/// The layout of a vertex in the batch vertex buffer, all the attributes are interleaved
+/// </summary>
+typedef struct
+{
+	/// <summary>
+	/// The position in normalized device coordinates
+	/// </summary>
+	float position[2];
+
+	float color[3];
+
+	/// <summary>
+	/// The UV coordinates, in texels of the texture page
+	/// </summary>
+	float uv[2];
+
+	/// <summary>
+	/// The texture page attribute of the primitive, BATCH_VERTEX_TEXTURED is set if it is textured
+	/// </summary>
+	uint16_t texture_page;
+
+	/// <summary>
+	/// The CLUT attribute of the primitive
+	/// </summary>
+	uint16_t clut;
+} BatchVertex;
+
 /// <summary>
 /// Represents a triangle made of three vertices
 /// </summary>
@@ -120,19 +151,19 @@ typedef struct
 	bool fullscreen_mode;
 
 	/// <summary>
-	/// The OpenGL handle for the gouraud/flat shading shader
+	/// The OpenGL handle for the shader drawing the batched primitives, flat/gouraud shaded or textured
 	/// </summary>
-	GLuint color_shader;
+	GLuint batch_shader;
 
 	/// <summary>
-	/// The OpenGL handle for the textured shader
+	/// The OpenGL handle for the blit to quad shader
 	/// </summary>
-	GLuint texture_shader;
+	GLuint blit_shader;
 
 	/// <summary>
-	/// The OpenGL handle for the blit to quad shader
+	/// The OpenGL handle for the shader drawing VRAM into the VRAM view
 	/// </summary>
-	GLuint blit_shader;
+	GLuint vram_view_shader;
 
 	/// <summary>
 	/// The current render target that should be output to the screen
@@ -154,13 +185,54 @@ typedef struct
 	/// </summary>
 	Vec2 window_size;
 
-	GLuint vram_tex;
+	/// <summary>
+	/// The vertex array and ring buffer holding the batched primitives
+	/// </summary>
+	GLuint batch_vao;
+	GLuint batch_vbo;
+
+	/// <summary>
+	/// The part of the ring buffer mapped for the current batch, NULL when no batch is open
+	/// </summary>
+	BatchVertex* batch_vertices;
+
+	/// <summary>
+	/// The first vertex of the current batch in the ring buffer
+	/// </summary>
+	int batch_offset;
+
+	/// <summary>
+	/// The number of vertices in the current batch
+	/// </summary>
+	int batch_count;
+
+	/// <summary>
+	/// The texture window the textured primitives of the current batch are drawn with
+	/// </summary>
+	Vec2 batch_texture_window_mask;
+	Vec2 batch_texture_window_offset;
+
+	/// <summary>
+	/// The OpenGL handle to the copy of VRAM sampled by the textured primitives, one halfword per texel
+	/// </summary>
+	GLuint vram_sample_tex;
+
+	/// <summary>
+	/// The pixel buffer the written parts of VRAM are copied to before being uploaded to the texture
+	/// </summary>
+	GLuint vram_upload_pbo;
+
+	/// <summary>
+	/// Whether VRAM was uploaded since the VRAM view was last drawn
+	/// </summary>
+	bool vram_view_outdated;
+
 	GLuint blit_quad_vao;
 	GLuint blit_quad_vbo;
 	GLuint blit_quad_texture_bo;
 } Frontend;
 
-extern Frontend frontend_state;
+extern PSX_THREAD_LOCAL Frontend frontend_state;
 
 void start_gl_state();
 void reset_gl_state();
@@ -181,6 +253,12 @@ void draw_textured_triangle(Triangle triangle);
 void draw_quad(Quad quad);
 void draw_textured_quad(Quad quad);
 
+/// <summary>
+/// Draws the primitives batched since the last flush. Must be called before changing the state they are drawn with
+/// (drawing area, render target, VRAM contents) or reading back what they drew
+/// </summary>
+void flush_render_batch();
+
 static void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 static int setup_glfw();
@@ -214,6 +292,12 @@ static void resize_framebuffer(RenderTarget* render_target, Vec2 new_size);
 /// <returns>0 if it started successfully, or another value on failure</returns>
 int start_interface();
 
+/// <summary>
+/// Draws the display area of VRAM into the PSX framebuffer, which the software GPU backend doesn't draw to.
+/// 24 bit display modes are shown as 15 bit colors
+/// </summary>
+static void present_display_area();
+
 /// <summary>
 /// Updates the frontend (query user input, refresh etc.)
 /// </summary>
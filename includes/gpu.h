@@ -5,8 +5,10 @@
 
 #include "utils.h"
 #include "memory.h"
+#include "context.h"
 
 #define GPU_FREQ 53222400 // GPU Frequency in Hz
+#define PAL_GPU_FREQ 53203425 // GPU Frequency in Hz on PAL consoles
 #define DOT_CLK_256 5322240
 #define DOT_CLK_320 6652800
 #define DOT_CLK_368 7603200
@@ -14,7 +16,11 @@
 #define DOT_CLK_640 13305600
 
 #define NTSC_SCANLINE_CYCLES 3413 // In GPU cycles
-#define GPU_TO_CPU_CYCLES (CPU_FREQ / GPU_FREQ)
+#define PAL_SCANLINE_CYCLES 3406 // In GPU cycles
+#define NTSC_SCANLINE_COUNT 263 // Scanlines in one frame, including VBlank
+#define PAL_SCANLINE_COUNT 314 // Scanlines in one frame, including VBlank
+#define NTSC_DISPLAY_RANGE_V ((0x100 << 10) | 0x10) // Default vertical display range, the rest of the frame is VBlank
+#define PAL_DISPLAY_RANGE_V ((0x123 << 10) | 0x23) // Default vertical display range, the rest of the frame is VBlank
 
 /// <summary>
 /// Functions and state for emulating the GPU state, but not the graphics API implementation
@@ -291,16 +297,66 @@ typedef struct
 	/// </summary>
 	uint32_t display_range_vertical;
 
+	/// <summary>
+	/// The scanline the video output is currently on
+	/// </summary>
+	uint32_t scanline;
+
+	/// <summary>
+	/// Whether the video output is outside of the vertical display range
+	/// </summary>
+	bool in_vblank;
+
+	/// <summary>
+	/// The number of frames (VBlanks) since the GPU was reset
+	/// </summary>
+	uint64_t frame_count;
+
+	/// <summary>
+	/// The fraction of CPU cycle left from the previous scanlines, in units of 1/GPU frequency,
+	/// so the scanline events don't drift from the GPU clock
+	/// </summary>
+	uint64_t scanline_cycle_remainder;
+
 	/// <summary>
 	/// The VRAM contains 1024 KiB of VRAM as 16 bit words/pixels
 	/// </summary>
 	uint16_t vram[1024 * KIB_SIZE / HALF_WORD_SIZE];
 } GPU;
 
-extern GPU gpu_state;
+extern PSX_THREAD_LOCAL GPU gpu_state;
+
+/// <summary>
+/// The ways the GPU can draw the GP0 primitives
+/// </summary>
+typedef enum
+{
+	GPU_BACKEND_OPENGL, // Draws them with the frontend renderer
+	GPU_BACKEND_SOFTWARE, // Rasterizes them into VRAM on the CPU, see rasterizer.h
+} GPUBackend;
+
+/// <summary>
+/// The backend used to draw the primitives, can be changed at any time between two GP0 commands
+/// </summary>
+extern PSX_THREAD_LOCAL GPUBackend gpu_backend;
 
+/// <summary>
+/// Resets the GPU state and restarts the video timing at the first scanline
+/// </summary>
 void reset_gpu_state();
 
+/// <summary>
+/// Scheduler event for the end of a scanline, updates the video timing, requests the VBlank IRQ
+/// at the start of VBlank and ticks the timers using the HBlank clock source
+/// </summary>
+void handle_hblank_event(uint64_t deadline);
+
+/// <summary>
+/// Gets the resolution of the picture sent to the TV, set by the GP1 display mode command
+/// </summary>
+/// <returns>The size of the display area in VRAM, in pixels</returns>
+Vec2 get_display_resolution();
+
 /// <summary>
 /// Reads from a memory address located in the GPU
 /// </summary>
@@ -324,6 +380,8 @@ static void handle_gp0_command(uint32_t value);
 static inline Vec2 get_screen_resolution(DisplayMode display_mode);
 
 void update_gpustat();
+static uint64_t get_scanline_cpu_cycles();
+static void update_scanline_status();
 static void update_gpustat_display_mode(DisplayMode display_mode);
 static void gp1_display_mode(uint32_t value);
 static void handle_gp1_command(uint32_t value);
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "context.h"
+
+#define HLE_OPCODE 0xFC000000 // Unused primary opcode 3Fh, the low bits select the trap
+#define HLE_FILE_DIRECTORY "roms/files/" // Local directory standing in for the devices opened by the file functions
+#define HLE_MAX_FILES 16
+#define HLE_MAX_EVENTS 32
+#define HLE_MAX_THREADS 4
+#define HLE_MAX_HEAP_CHUNKS 256
+#define HLE_MAX_CALLBACKS 8
+#define HLE_CALLBACK_RETURN_ADDRESS 0x800000D0 // Unused kernel RAM after the C0h vector, holds the trap ending a callback
+
+/// <summary>
+/// Functions and state for the high level emulation of the BIOS, used to boot EXEs without a BIOS ROM
+///
+/// Trap opcodes are placed at the reset vector, at the A0h/B0h/C0h kernel call vectors and at the exception
+/// vectors. The kernel functions are then implemented natively: the C library functions (strings, memory,
+/// heap, printf), file I/O over HLE_FILE_DIRECTORY, events, threads and the interrupt/syscall handling.
+/// Event callbacks and the custom exit set by HookEntryInt() are run as guest code, returning through a trap.
+/// </summary>
+
+/// <summary>
+/// The traps of the HLE BIOS, stored in the low bits of HLE_OPCODE
+/// </summary>
+typedef enum
+{
+	HLE_TRAP_RESET, // Initializes the kernel and jumps to the shell entry point
+	HLE_TRAP_A0,
+	HLE_TRAP_B0,
+	HLE_TRAP_C0,
+	HLE_TRAP_EXCEPTION,
+	HLE_TRAP_CALLBACK_RETURN, // Return address of the event callbacks run during an exception
+} HLETrap;
+
+/// <summary>
+/// A kernel event, opened with OpenEvent()
+/// </summary>
+typedef struct
+{
+	uint32_t event_class;
+	uint32_t spec;
+
+	/// <summary>
+	/// 0x1000 to call the function when delivered, 0x2000 to mark the event as ready
+	/// </summary>
+	uint32_t mode;
+
+	/// <summary>
+	/// 0 when free, 0x1000 when disabled, 0x2000 when enabled, 0x4000 when ready
+	/// </summary>
+	uint32_t status;
+
+	uint32_t function;
+} HLEEvent;
+
+/// <summary>
+/// The saved registers of a thread, or of the code interrupted by an exception
+/// </summary>
+typedef struct
+{
+	uint32_t registers[32];
+	uint32_t pc;
+	uint32_t hi;
+	uint32_t lo;
+	uint32_t sr;
+} HLEContext;
+
+/// <summary>
+/// A range of the heap set with InitHeap()
+/// </summary>
+typedef struct
+{
+	uint32_t address;
+	uint32_t size;
+	bool used;
+} HLEHeapChunk;
+
+typedef struct
+{
+	/// <summary>
+	/// Whether the BIOS is emulated, the traps are only recognized when it is
+	/// </summary>
+	bool enabled;
+
+	/// <summary>
+	/// Host files opened by the guest, NULL when free. Descriptors 0 and 1 are the TTY
+	/// </summary>
+	FILE* files[HLE_MAX_FILES];
+
+	HLEEvent events[HLE_MAX_EVENTS];
+
+	/// <summary>
+	/// Saved contexts of the threads, the context of the current one is in the CPU
+	/// </summary>
+	HLEContext threads[HLE_MAX_THREADS];
+	bool thread_used[HLE_MAX_THREADS];
+	int current_thread;
+
+	/// <summary>
+	/// The context interrupted by the exception being handled, restored by ReturnFromException()
+	/// </summary>
+	HLEContext exception_context;
+
+	/// <summary>
+	/// Callbacks of the delivered events, not run yet
+	/// </summary>
+	uint32_t pending_callbacks[HLE_MAX_CALLBACKS];
+	int pending_callback_count;
+
+	/// <summary>
+	/// The context restored once all the callbacks returned
+	/// </summary>
+	HLEContext callback_context;
+
+	/// <summary>
+	/// Whether the callbacks were delivered by an interrupt, which then leaves through the custom exit if there is one
+	/// </summary>
+	bool callbacks_from_exception;
+
+	/// <summary>
+	/// Address of the jmp_buf set with HookEntryInt(), jumped to at the end of interrupts, 0 if none
+	/// </summary>
+	uint32_t custom_exit;
+
+	HLEHeapChunk heap[HLE_MAX_HEAP_CHUNKS];
+	int heap_chunk_count;
+
+	uint32_t random_seed;
+
+	/// <summary>
+	/// One bit per function of each table, set once an unimplemented function was reported
+	/// </summary>
+	uint32_t reported_functions[3][0x100 / 32];
+} HLEState;
+
+extern PSX_THREAD_LOCAL HLEState hle_state;
+
+/// <summary>
+/// Enables the HLE BIOS and writes its reset trap in the BIOS ROM, the kernel is initialized once the CPU runs it
+/// </summary>
+void init_hle_bios();
+
+/// <summary>
+/// Instruction function of HLE_OPCODE, runs the selected trap or raises a reserved instruction error when the BIOS isn't emulated
+/// </summary>
+void hle_bios_trap();
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "memory.h"
+#include "context.h"
+
+#define ICACHE_SIZE (4 * KIB_SIZE)
+#define ICACHE_LINE_SIZE 16 // 4 words per line
+#define ICACHE_LINE_COUNT (ICACHE_SIZE / ICACHE_LINE_SIZE)
+#define ICACHE_TAG_MASK 0x1FFFF000 // Physical address bits above the 4 KiB covered by the cache
+
+#define CACHE_CONTROL_INDEX (0x130 / WORD_SIZE) // Cache control register at 0xFFFE0130
+#define CACHE_CONTROL_TAG_TEST (1 << 2) // Isolated writes set the tag of the line and invalidate it
+#define CACHE_CONTROL_ICACHE_ENABLE (1 << 11)
+
+#define RAM_FETCH_CYCLES 6 // Extra cycles to fetch the first word of an access from main RAM
+#define BIOS_FETCH_CYCLES 24 // Extra cycles to fetch a word through the 8 bit bus of the BIOS ROM
+#define BURST_FETCH_CYCLES 1 // Extra cycles for each following word of a cache line fill
+
+/// <summary>
+/// Functions and state for the instruction cache of the R3000A, 4 KiB direct mapped in lines of 4 words
+///
+/// Only the timing of instruction fetches and the isolated cache accesses are emulated, the code itself
+/// is always executed from memory since the block cache already drops code when it is overwritten.
+/// Fetches from KUSEG/KSEG0 with the cache enabled only compare the tag of their line, misses fill the line
+/// from the missed word to its end, and KSEG1 fetches always pay the cost of the bus
+/// </summary>
+
+typedef struct
+{
+	/// <summary>
+	/// The physical address bits of the words in each line
+	/// </summary>
+	uint32_t tags[ICACHE_LINE_COUNT];
+
+	/// <summary>
+	/// One bit per word of each line, set if the word is in the cache
+	/// </summary>
+	uint8_t valid[ICACHE_LINE_COUNT];
+
+	/// <summary>
+	/// The words of the cache, only read and written while the cache is isolated
+	/// </summary>
+	uint32_t data[ICACHE_SIZE / WORD_SIZE];
+} ICacheState;
+
+extern PSX_THREAD_LOCAL ICacheState icache_state;
+
+/// <summary>
+/// Invalidates all the lines of the cache
+/// </summary>
+void reset_icache_state();
+
+/// <summary>
+/// Gets the extra cycles of an uncached instruction fetch, depending on the memory it reads
+/// </summary>
+/// <param name="address">The address of the instruction</param>
+static inline int get_uncached_fetch_cycles(uint32_t address)
+{
+	return (address & 0x1FFFFFFF) >= 0x1FC00000 ? BIOS_FETCH_CYCLES : RAM_FETCH_CYCLES;
+}
+
+/// <summary>
+/// Fills the line of an instruction that missed the cache
+/// </summary>
+/// <param name="address">The address of the instruction</param>
+/// <returns>The extra cycles of the line fill</returns>
+int fill_icache_line(uint32_t address);
+
+/// <summary>
+/// Goes through the instruction cache for an instruction fetch
+/// </summary>
+/// <param name="address">The address of the instruction</param>
+/// <returns>The extra cycles of the fetch, 0 on a cache hit</returns>
+static inline int fetch_icache(uint32_t address)
+{
+	// KSEG1 is never cached
+	if ((address >> 29) == 5 || !(cpu_cache_control[CACHE_CONTROL_INDEX] & CACHE_CONTROL_ICACHE_ENABLE))
+		return get_uncached_fetch_cycles(address);
+
+	uint32_t line = (address / ICACHE_LINE_SIZE) % ICACHE_LINE_COUNT;
+	uint32_t word = (address / WORD_SIZE) % (ICACHE_LINE_SIZE / WORD_SIZE);
+
+	if (icache_state.tags[line] == (address & ICACHE_TAG_MASK) && (icache_state.valid[line] & (1 << word)))
+		return 0;
+
+	return fill_icache_line(address);
+}
+
+/// <summary>
+/// Goes through the instruction cache for a run of sequential instructions, used when a whole block is executed at once
+/// </summary>
+/// <param name="address">The address of the first instruction</param>
+/// <param name="count">The number of instructions</param>
+/// <returns>The extra cycles of the fetches</returns>
+int fetch_icache_range(uint32_t address, int count);
+
+/// <summary>
+/// Reads a word of the cache while it is isolated
+/// </summary>
+/// <param name="address">The address selecting the word</param>
+/// <returns>The word in the cache</returns>
+uint32_t read_isolated_icache(uint32_t address);
+
+/// <summary>
+/// Writes a word to the cache while it is isolated, or invalidates its line in tag test mode (used by the BIOS to flush the cache)
+/// </summary>
+/// <param name="address">The address selecting the word</param>
+/// <param name="value">The value to be written</param>
+void write_isolated_icache(uint32_t address, uint32_t value);
@@ -2,6 +2,8 @@
 
 #include <stdint.h>
 
+#include "context.h"
+
 typedef enum
 {
 	IRQ_VBLANK = 0,
@@ -21,8 +23,15 @@ typedef struct
 {
 	uint32_t I_STAT;
 	uint32_t I_MASK;
+
+	/// <summary>
+	/// The IRQs serviced since the last read by the HLE BIOS, which can't read them back from I_STAT
+	/// </summary>
+	uint32_t serviced_irqs;
 } InterruptState;
 
+extern PSX_THREAD_LOCAL InterruptState interrupt_regs;
+
 /// <summary>
 /// Functions and state for emulating the PSX interrupt behavior
 /// </summary>
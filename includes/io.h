@@ -47,3 +47,33 @@
 
 uint32_t read_io(uint32_t address);
 void write_io(uint32_t address, uint32_t value);
+
+/// <summary>
+/// Reads a byte from an IO port. The 8/16 bit registers (CDROM, SPU) are read at their exact address,
+/// the others are read as the containing word
+/// </summary>
+/// <param name="address">The IO port address to be read</param>
+/// <returns>The byte at the IO port address</returns>
+uint8_t read_io_byte(uint32_t address);
+
+/// <summary>
+/// Reads a half word from an IO port, see read_io_byte()
+/// </summary>
+/// <param name="address">The IO port address to be read</param>
+/// <returns>The half word at the IO port address</returns>
+uint16_t read_io_half(uint32_t address);
+
+/// <summary>
+/// Writes a byte to an IO port. The 8/16 bit registers (CDROM, SPU) are written at their exact address,
+/// the others receive the byte on its lane of the containing word, without reading the register first
+/// </summary>
+/// <param name="address">The IO port address to write to</param>
+/// <param name="value">The value to be written</param>
+void write_io_byte(uint32_t address, uint8_t value);
+
+/// <summary>
+/// Writes a half word to an IO port, see write_io_byte()
+/// </summary>
+/// <param name="address">The IO port address to write to</param>
+/// <param name="value">The value to be written</param>
+void write_io_half(uint32_t address, uint16_t value);
@@ -3,6 +3,12 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "file_mapping.h"
+#include "context.h"
+
+#define SPEED_MEASURE_INTERVAL 1.0 // How often the emulation speed is measured, in seconds
+#define SHELL_ENTRY_POINT 0x80030000 // Where the BIOS jumps to the shell once the kernel is initialized, EXEs are sideloaded there
+
 /// <summary>
 /// A struct used to contain the header data for a PSX EXE file 
 /// </summary>
@@ -27,7 +33,44 @@ typedef struct
 {
 	bool finished_bios_boot;
 	EXEHeader file_header;
-	uint32_t* exe_contents;
+
+	/// <summary>
+	/// The EXE file mapped read only, exe_contents points to its data after the header
+	/// </summary>
+	FileMapping exe_file;
+	const uint32_t* exe_contents;
+
+	/// <summary>
+	/// Whether the BIOS boot is skipped by restoring the boot snapshot
+	/// </summary>
+	bool fast_boot;
+
+	/// <summary>
+	/// Whether the boot snapshot is saved the next time the BIOS reaches the shell entry point, set when fast boot couldn't restore it
+	/// </summary>
+	bool boot_snapshot_pending;
+
+	/// <summary>
+	/// Whether the emulation is slowed down to the speed of a real console
+	/// </summary>
+	bool limit_speed;
+
+	/// <summary>
+	/// The emulation speed relative to a real console (1.0 is full speed)
+	/// </summary>
+	double emulation_speed;
+
+	/// <summary>
+	/// The cycle count at the start of the current speed measurement
+	/// </summary>
+	uint64_t speed_measure_cycles;
+
+	/// <summary>
+	/// The host time in seconds at the start of the current speed measurement
+	/// </summary>
+	double speed_measure_time;
 } MainState;
 
+extern PSX_THREAD_LOCAL MainState main_state;
+
 int load_exe(const char* exe_path);
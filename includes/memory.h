@@ -4,6 +4,7 @@
 #include <stdio.h>
 
 #include "main.h"
+#include "context.h"
 
 #define WORD_SIZE 4
 #define HALF_WORD_SIZE 2
@@ -11,6 +12,7 @@
 #define KIB_TO_WORD_SIZE (KIB_SIZE / WORD_SIZE)
 
 #define RAM_SIZE (2048 * KIB_SIZE)
+#define RAM_MIRROR_SIZE (4 * RAM_SIZE) // The main RAM repeats over the first 8 MiB of each segment
 #define EXPANSION_1_SIZE (8192 * KIB_SIZE)
 #define SCRATCHPAD_SIZE (1 * KIB_SIZE)
 #define IO_PORTS_SIZE (4 * KIB_SIZE)
@@ -19,10 +21,52 @@
 #define BIOS_ROM_SIZE (512 * KIB_SIZE)
 #define CONTROL_REGISTERS_SIZE 512
 
+#define MEMORY_PAGE_SHIFT 16 // 64 KiB pages
+#define MEMORY_PAGE_SIZE (1 << MEMORY_PAGE_SHIFT)
+#define MEMORY_PAGE_COUNT (1 << (32 - MEMORY_PAGE_SHIFT))
+
+// Layout of the host memory backing the guest memory regions, offsets are aligned to host pages for fastmem.
+// Expansion regions 1 and 3 aren't part of it, they are only allocated once written
+#define RAM_OFFSET 0
+#define BIOS_ROM_OFFSET (RAM_OFFSET + RAM_SIZE)
+#define SCRATCHPAD_OFFSET (BIOS_ROM_OFFSET + BIOS_ROM_SIZE)
+#define MEMORY_BACKING_SIZE (SCRATCHPAD_OFFSET + 4 * KIB_SIZE)
+
 /// <summary>
 /// Functions and state for emulating the various memory related operations
 /// </summary>
 
+extern PSX_THREAD_LOCAL uint32_t* ram;
+extern PSX_THREAD_LOCAL uint32_t* bios_rom;
+extern PSX_THREAD_LOCAL uint32_t* scratchpad;
+extern PSX_THREAD_LOCAL uint32_t io_ports[IO_PORTS_SIZE / WORD_SIZE];
+extern PSX_THREAD_LOCAL uint32_t expansion_2[EXPANSION_2_SIZE / WORD_SIZE];
+extern PSX_THREAD_LOCAL uint32_t cpu_cache_control[CONTROL_REGISTERS_SIZE / WORD_SIZE];
+
+/// <summary>
+/// Host memory backing each 64 KiB page of the address space for reads, MEMORY_PAGE_COUNT entries allocated by init_memory().
+/// An entry is NULL if the page needs to go through the segment handlers (IO ports, scratchpad, cache control, unmapped)
+/// </summary>
+extern PSX_THREAD_LOCAL uint32_t** read_page_table;
+
+/// <summary>
+/// Host memory backing each 64 KiB page of the address space for writes,
+/// NULL if the page needs to go through the segment handlers (same as reads, plus the BIOS ROM)
+/// </summary>
+extern PSX_THREAD_LOCAL uint32_t** write_page_table;
+
+/// <summary>
+/// Allocates the guest memory, in the fastmem arena if possible, and fills the page tables.
+/// Must be called once before accessing memory
+/// </summary>
+/// <returns>0 if the memory was allocated, -1 otherwise</returns>
+int init_memory();
+
+/// <summary>
+/// Releases the guest memory, init_memory() must be called again before accessing memory
+/// </summary>
+void free_memory();
+
 /// <summary>
 /// Clears all the system's memory
 /// </summary>
@@ -60,15 +104,52 @@ static void write_word_kseg2(uint32_t address, uint32_t value);
 void write_word(uint32_t address, uint32_t value);
 
 /// <summary>
-/// Loads the content of a file stream into the memory of the BIOS ROM
+/// Reads a byte at the address, IO ports are accessed with a byte wide read
+/// </summary>
+/// <param name="address">The address to be read</param>
+/// <returns>The byte at the address</returns>
+uint8_t read_byte(uint32_t address);
+
+/// <summary>
+/// Reads a half word at the address, IO ports are accessed with a half word wide read
+/// </summary>
+/// <param name="address">The address to be read, must be half word aligned</param>
+/// <returns>The half word at the address</returns>
+uint16_t read_half(uint32_t address);
+
+/// <summary>
+/// Writes a byte at the address, IO ports are accessed with a byte wide write
+/// </summary>
+/// <param name="address">The address to write to</param>
+/// <param name="value">The value to be written</param>
+void write_byte(uint32_t address, uint8_t value);
+
+/// <summary>
+/// Writes a half word at the address, IO ports are accessed with a half word wide write
+/// </summary>
+/// <param name="address">The address to write to, must be half word aligned</param>
+/// <param name="value">The value to be written</param>
+void write_half(uint32_t address, uint16_t value);
+
+/// <summary>
+/// Maps a BIOS file read only as the memory of the BIOS ROM, so that every process running the same BIOS shares
+/// its pages. The first write to the BIOS ROM moves it to private memory, the file is never modified
+/// </summary>
+/// <param name="path">The path of the BIOS file, it should contain 512 KiB of binary data</param>
+/// <returns>0 if the BIOS was loaded, -1 if the file couldn't be opened</returns>
+int map_bios_into_mem(const char* path);
+
+/// <summary>
+/// Drops the loaded BIOS, the BIOS ROM is then all zeroes and writable
 /// </summary>
-/// <param name="bios_file">The file stream to be loaded, it should contain 512 KiB of binary data</param>
-void load_bios_into_mem(FILE* bios_file);
+void clear_bios_rom();
 
 /// <summary>
 /// Sideloads an EXE file into the RAM. May be called after BIOS finishes execution (when PC = 0x80030000)
 /// to run a program without loading a full ISO disk image
 ///</summary>
-/// <param name="exe_file">The file stream to be loaded</param>
-/// <param name="exe_size">The size of the EXE to be loaded</param>
-void sideload_exe_into_mem(EXEHeader file_header, uint32_t* exe_file);
\ No newline at end of file
+/// <param name="file_header">The header of the EXE</param>
+/// <param name="exe_file">The data of the EXE, following its header</param>
+/// <param name="exe_size">The number of bytes available at exe_file</param>
+/// <returns>0 if the EXE was loaded, -1 if its data doesn't fit in the file or in RAM (nothing is changed then)</returns>
+int sideload_exe_into_mem(EXEHeader file_header, const uint32_t* exe_file, size_t exe_size);
\ No newline at end of file
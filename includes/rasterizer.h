@@ -0,0 +1,165 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "context.h"
+
+#define RASTERIZER_QUEUE_SIZE 4096 // Primitives queued before they have to be drawn
+#define RASTERIZER_MAX_THREADS 8 // Threads drawing the primitives, the emulator thread included
+#define RASTERIZER_BAND_HEIGHT 8 // Height of the bands of VRAM lines handed to the threads in turn
+
+#define RASTER_GOURAUD (1 << 0) // The vertex colors are interpolated instead of using the first one
+#define RASTER_TEXTURED (1 << 1)
+#define RASTER_SEMI_TRANSPARENT (1 << 2)
+#define RASTER_RAW_TEXTURE (1 << 3) // The texels are drawn as they are instead of being modulated by the color
+
+/// <summary>
+/// Functions and state for the software GPU backend, drawing the GP0 primitives directly into VRAM
+///
+/// The primitives are queued with a copy of the drawing environment they were sent with (drawing area and offset,
+/// texture window, mask and dither settings), so the environment can change without drawing them. The queue is
+/// drawn by flush_rasterizer(), before VRAM is accessed by anything else: CPU blits, save states, the end of a
+/// frame, a textured primitive reading VRAM that a queued primitive writes, or a primitive writing VRAM that a queued
+/// one reads. A textured primitive reading its own pixels is drawn right away by the emulator thread alone.
+///
+/// VRAM lines are split into bands of RASTERIZER_BAND_HEIGHT lines, handed to the threads in turn. Each thread draws
+/// every queued primitive in order on its own lines, so the pixels are written in the same order as with one thread.
+/// The worker threads only get pointers to the queue and to VRAM, they never touch the thread local emulator state
+/// </summary>
+
+/// <summary>
+/// A vertex of a primitive, as sent to GP0 (before the drawing offset is applied)
+/// </summary>
+typedef struct
+{
+	int16_t x;
+	int16_t y;
+
+	uint8_t r;
+	uint8_t g;
+	uint8_t b;
+
+	uint8_t u;
+	uint8_t v;
+} RasterVertex;
+
+typedef enum
+{
+	RASTER_TRIANGLE,
+	RASTER_RECTANGLE,
+} RasterPrimitiveType;
+
+/// <summary>
+/// A queued primitive, with the drawing environment it is drawn with
+/// </summary>
+typedef struct
+{
+	RasterPrimitiveType type;
+
+	/// <summary>
+	/// The vertices, with the drawing offset applied. A rectangle uses the first one as its top left corner and its color
+	/// </summary>
+	RasterVertex vertices[3];
+
+	/// <summary>
+	/// The size of a rectangle
+	/// </summary>
+	uint16_t width;
+	uint16_t height;
+
+	/// <summary>
+	/// The RASTER_* flags
+	/// </summary>
+	uint32_t flags;
+
+	/// <summary>
+	/// The texture page attribute (only the semi transparency mode is used by untextured primitives)
+	/// </summary>
+	uint16_t texture_page;
+	uint16_t clut;
+
+	/// <summary>
+	/// The pixels of the drawing area the primitive can cover, inclusive
+	/// </summary>
+	int16_t min_x;
+	int16_t min_y;
+	int16_t max_x;
+	int16_t max_y;
+
+	uint8_t texture_window_mask_x;
+	uint8_t texture_window_mask_y;
+	uint8_t texture_window_offset_x;
+	uint8_t texture_window_offset_y;
+
+	bool dither;
+	bool set_mask;
+	bool check_mask;
+} RasterPrimitive;
+
+/// <summary>
+/// A rectangle of VRAM, inclusive. It is empty when left > right
+/// </summary>
+typedef struct
+{
+	int16_t left;
+	int16_t top;
+	int16_t right;
+	int16_t bottom;
+} RasterRect;
+
+typedef struct RasterizerPool RasterizerPool;
+
+typedef struct
+{
+	/// <summary>
+	/// The primitives waiting to be drawn, NULL until the first primitive is queued
+	/// </summary>
+	RasterPrimitive* queue;
+	int queue_count;
+
+	/// <summary>
+	/// The bounding boxes of the pixels the queued primitives can write, and of the texels they can sample
+	/// </summary>
+	RasterRect queued_writes;
+	RasterRect queued_reads;
+
+	/// <summary>
+	/// The worker threads, NULL until the first flush
+	/// </summary>
+	RasterizerPool* pool;
+
+	/// <summary>
+	/// The number of threads drawing, 1 if no worker thread could be started
+	/// </summary>
+	int thread_count;
+} RasterizerState;
+
+extern PSX_THREAD_LOCAL RasterizerState rasterizer_state;
+
+/// <summary>
+/// Queues a triangle or a quad, a quad being drawn as the triangles (v1, v2, v3) and (v2, v3, v4)
+/// </summary>
+/// <param name="vertices">The vertices, as sent to GP0</param>
+/// <param name="vertex_count">3 for a triangle, 4 for a quad</param>
+/// <param name="texture_page">The texture page attribute of a textured polygon</param>
+/// <param name="clut">The CLUT attribute of a textured polygon</param>
+/// <param name="flags">The RASTER_* flags of the polygon</param>
+void rasterize_polygon(const RasterVertex* vertices, int vertex_count, uint16_t texture_page, uint16_t clut, uint32_t flags);
+
+/// <summary>
+/// Queues a rectangle filled with one color
+/// </summary>
+/// <param name="x">The x coordinate of the top left corner, before the drawing offset is applied</param>
+/// <param name="y">The y coordinate of the top left corner, before the drawing offset is applied</param>
+void rasterize_rectangle(int16_t x, int16_t y, uint16_t width, uint16_t height, uint8_t red, uint8_t green, uint8_t blue);
+
+/// <summary>
+/// Draws the queued primitives into VRAM, and marks the pages they wrote as dirty
+/// </summary>
+void flush_rasterizer();
+
+/// <summary>
+/// Stops the worker threads and drops the queued primitives
+/// </summary>
+void free_rasterizer();
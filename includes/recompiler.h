@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "block_cache.h"
+#include "context.h"
+
+#define RECOMPILER_CODE_BUFFER_SIZE (16 * 1024 * 1024) // Size of the executable memory for translated blocks
+#define RECOMPILER_MAX_BLOCK_SIZE (BLOCK_MAX_INSTRUCTIONS * 512 + 256) // Upper bound of the native code emitted for one block
+#define RECOMPILER_MAX_FASTMEM_SITES (1 << 16) // How many fastmem accesses can be translated before starting over
+#define RECOMPILER_CACHED_REGISTERS 4 // How many guest registers can be kept in host registers inside a block
+
+/// <summary>
+/// Functions and state for the x86-64 dynamic recompiler, which translates the decoded blocks
+/// of the block cache into native code
+///
+/// Simple ALU instructions are translated into native instructions, with the most used guest
+/// registers of the block kept in host registers. All the other instructions call back into
+/// their interpreter functions, so both backends share the cpu struct and behave the same.
+/// </summary>
+
+/// <summary>
+/// A memory access of the native code going through the fastmem arena
+/// </summary>
+typedef struct
+{
+	/// <summary>
+	/// The host instruction doing the access, which faults if the guest page isn't mapped
+	/// </summary>
+	uint8_t* access;
+
+	/// <summary>
+	/// Where to continue when the access faults
+	/// </summary>
+	uint8_t* slow_path;
+} FastmemSite;
+
+typedef struct
+{
+	/// <summary>
+	/// Executable memory holding the native code of the translated blocks
+	/// </summary>
+	uint8_t* code_buffer;
+
+	/// <summary>
+	/// The number of bytes of the code buffer in use
+	/// </summary>
+	size_t code_used;
+
+	/// <summary>
+	/// The fastmem accesses of the translated blocks, sorted by host address. RECOMPILER_MAX_FASTMEM_SITES of them
+	/// are allocated along with the code buffer
+	/// </summary>
+	FastmemSite* fastmem_sites;
+
+	/// <summary>
+	/// The number of fastmem accesses in use
+	/// </summary>
+	int fastmem_site_count;
+
+	/// <summary>
+	/// The flush count of the block cache the translated blocks belong to
+	/// </summary>
+	uint32_t flush_count;
+
+	/// <summary>
+	/// Whether the recompiler can't run on this host, in which case the cached interpreter is used instead
+	/// </summary>
+	bool unavailable;
+} RecompilerState;
+
+extern PSX_THREAD_LOCAL RecompilerState recompiler_state;
+
+/// <summary>
+/// Executes the block starting at the current pc using its translated native code,
+/// falls back to the cached interpreter when debugging features are in use
+/// </summary>
+/// <param name="debug_info">Whether debug information about the instructions should be printed</param>
+/// <returns>The number of instructions that were executed</returns>
+int run_recompiled_block(bool debug_info);
+
+/// <summary>
+/// Called by the fault handler when a host memory access faults inside the fastmem arena
+/// </summary>
+/// <param name="host_pc">The address of the faulting host instruction</param>
+/// <returns>Where the native code should continue, or NULL if the fault doesn't come from a fastmem access</returns>
+uint8_t* handle_fastmem_fault(uint8_t* host_pc);
+
+/// <summary>
+/// Releases the code buffer, it is allocated again the next time a block is translated
+/// </summary>
+void free_recompiler();
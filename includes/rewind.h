@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "context.h"
+
+#define REWIND_INTERVAL_FRAMES 10 // How many frames between two snapshots
+#define REWIND_MAX_SNAPSHOTS 4096
+#define REWIND_MEMORY_BUDGET (64 * 1024 * 1024) // Memory used by the compressed snapshots before the oldest ones are dropped
+
+/// <summary>
+/// Functions and state for rewinding the emulation to a previous frame
+///
+/// A save state is taken every REWIND_INTERVAL_FRAMES frames. Only the newest one is kept as it is, each older snapshot
+/// is stored as the XOR of itself with the next newer one. Most of the state doesn't change between two snapshots so
+/// the XOR is mostly zero, and it is compressed by encoding the runs of zero words. The new state is an incremental
+/// update of the previous one, so only the pages written in between are copied and compared. Rewinding walks the
+/// snapshots from the newest one, undoing one delta at a time
+/// </summary>
+
+/// <summary>
+/// A snapshot older than the newest one
+/// </summary>
+typedef struct
+{
+	uint64_t frame;
+
+	/// <summary>
+	/// The compressed XOR of this snapshot with the next newer one
+	/// </summary>
+	uint8_t* delta;
+	size_t delta_size;
+} RewindSnapshot;
+
+typedef struct
+{
+	bool enabled;
+
+	/// <summary>
+	/// The size of the save states, rounded up to whole 64 bit words for the delta encoding
+	/// </summary>
+	size_t state_size;
+
+	/// <summary>
+	/// The newest snapshot, not compressed. NULL until init_rewind() is called
+	/// </summary>
+	uint8_t* latest_state;
+	uint64_t latest_frame;
+	bool has_latest_state;
+
+	/// <summary>
+	/// Holds the state being recorded or rewound to, kept equal to the newest snapshot in between
+	/// </summary>
+	uint8_t* work_state;
+
+	/// <summary>
+	/// The blocks of work_state written by the last update, only those can differ from the newest snapshot
+	/// </summary>
+	uint32_t* written_blocks;
+
+	/// <summary>
+	/// Holds a delta while it is compressed, before it is copied to a buffer of the right size
+	/// </summary>
+	uint8_t* encode_buffer;
+
+	/// <summary>
+	/// Ring of the older snapshots, from the oldest at first_snapshot to the newest
+	/// </summary>
+	RewindSnapshot snapshots[REWIND_MAX_SNAPSHOTS];
+	int first_snapshot;
+	int snapshot_count;
+
+	/// <summary>
+	/// The memory used by the compressed deltas
+	/// </summary>
+	size_t memory_used;
+} RewindState;
+
+extern PSX_THREAD_LOCAL RewindState rewind_state;
+
+/// <summary>
+/// Allocates the rewind buffers and enables rewinding
+/// </summary>
+/// <returns>0 if the buffers were allocated, -1 otherwise</returns>
+int init_rewind();
+
+/// <summary>
+/// Drops all the snapshots and releases the rewind buffers, disabling rewinding
+/// </summary>
+void free_rewind();
+
+/// <summary>
+/// Drops all the snapshots
+/// </summary>
+void reset_rewind();
+
+/// <summary>
+/// Takes a snapshot if enough frames elapsed since the last one, should be called once per frame
+/// </summary>
+void record_rewind_frame();
+
+/// <summary>
+/// Gets the number of frames that can be rewound to, the newest snapshot included
+/// </summary>
+int get_rewind_snapshot_count();
+
+/// <summary>
+/// Gets the frame of a snapshot
+/// </summary>
+/// <param name="index">The index of the snapshot, from 0 for the oldest to get_rewind_snapshot_count() - 1 for the newest</param>
+uint64_t get_rewind_snapshot_frame(int index);
+
+/// <summary>
+/// Restores the emulator to the state it had at a frame, the snapshots after it are dropped
+/// </summary>
+/// <param name="frame">The frame to go back to, must be the frame of a snapshot</param>
+/// <returns>0 if the state was restored, -1 if there is no snapshot of the frame</returns>
+int rewind_to_frame(uint64_t frame);
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SAVE_STATE_PATH "roms/save_state.bin"
+#define SAVE_STATE_MAGIC 0x53585350 // "PSXS"
+#define SAVE_STATE_VERSION 1
+#define SAVE_STATE_BLOCK_SHIFT 12 // update_save_state() reports the written parts of the buffer in 4 KiB blocks
+
+/// <summary>
+/// Builds the tag of a section from 4 characters, stored in file order
+/// </summary>
+#define SAVE_STATE_TAG(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+/// <summary>
+/// Functions for saving and restoring the whole emulator state
+///
+/// A save state is a header followed by sections, each one holding the raw contents of a state struct or memory region
+/// behind a tag, a version and a size. Saving and loading are plain copies into a buffer allocated once by the caller.
+/// Sections with an unknown tag are skipped so newer states can add sections; a known section whose version or size
+/// doesn't match makes the whole state invalid, and nothing is restored then.
+///
+/// Not everything is part of a state: the expansion regions 1 and 3 only hold what was written to their unconnected
+/// bus space and keep their current contents on load, and the host files opened through the HLE BIOS stay open
+/// </summary>
+
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t section_count;
+
+	/// <summary>
+	/// The size of the whole state, this header included
+	/// </summary>
+	uint32_t size;
+} SaveStateHeader;
+
+typedef struct
+{
+	uint32_t tag;
+
+	/// <summary>
+	/// Increased whenever the layout of the saved data changes
+	/// </summary>
+	uint16_t version;
+	uint16_t reserved;
+
+	/// <summary>
+	/// The size of the data following the header
+	/// </summary>
+	uint32_t size;
+} SaveStateSectionHeader;
+
+/// <summary>
+/// Gets the size of a save state of the current emulator state, to allocate the buffer given to save_state()
+/// </summary>
+size_t get_save_state_size();
+
+/// <summary>
+/// Writes the emulator state to a buffer
+/// </summary>
+/// <param name="buffer">The buffer to write to</param>
+/// <param name="capacity">The size of the buffer</param>
+/// <returns>The size of the state, 0 if the buffer is too small</returns>
+size_t save_state(uint8_t* buffer, size_t capacity);
+
+/// <summary>
+/// Updates a save state with the current emulator state, only copying the RAM and VRAM pages written since the last
+/// update. The buffer must hold a state written by save_state() with the dirty pages cleared right after, or by this function
+/// </summary>
+/// <param name="buffer">The buffer holding the previous state</param>
+/// <param name="capacity">The size of the buffer</param>
+/// <param name="written_blocks">Bitmap receiving a bit for each 4 KiB block of the buffer that was copied, may be NULL</param>
+/// <returns>The size of the state, 0 if the buffer is too small</returns>
+size_t update_save_state(uint8_t* buffer, size_t capacity, uint32_t* written_blocks);
+
+/// <summary>
+/// Restores the emulator state from a buffer written by save_state()
+/// </summary>
+/// <param name="buffer">The buffer to read from</param>
+/// <param name="size">The size of the buffer</param>
+/// <returns>0 if the state was restored, -1 if it isn't valid (the emulator state is then left untouched)</returns>
+int load_state(const uint8_t* buffer, size_t size);
+
+/// <summary>
+/// Saves the emulator state to a file
+/// </summary>
+/// <returns>0 if the state was saved, -1 otherwise</returns>
+int save_state_to_file(const char* path);
+
+/// <summary>
+/// Restores the emulator state from a file written by save_state_to_file()
+/// </summary>
+/// <returns>0 if the state was restored, -1 otherwise</returns>
+int load_state_from_file(const char* path);
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "context.h"
+
+#define SCHEDULER_NO_EVENT UINT64_MAX // Deadline used when no event is scheduled
+
+/// <summary>
+/// Functions and state for the event scheduler
+///
+/// Instead of ticking every device after each instruction, devices schedule events at the
+/// absolute cycle where something happens (an IRQ, the end of a scanline etc.).
+/// The events are kept in a min-heap sorted by deadline, so the CPU only has to compare the
+/// cycle counter with the earliest deadline and can run straight up to it.
+/// </summary>
+
+/// <summary>
+/// The events that can be scheduled, each type can only be scheduled once at a time
+/// </summary>
+typedef enum
+{
+	EVENT_HBLANK,
+	EVENT_TIMERS,
+	EVENT_CDROM_IRQ,
+	EVENT_DMA_COMPLETE, // Fires when the earliest running DMA transfer completes
+	EVENT_COUNT,
+} EventType;
+
+/// <summary>
+/// An event waiting in the scheduler heap
+/// </summary>
+typedef struct
+{
+	/// <summary>
+	/// The absolute cycle at which the event fires
+	/// </summary>
+	uint64_t deadline;
+
+	EventType type;
+} ScheduledEvent;
+
+/// <summary>
+/// Called when an event reaches its deadline, the deadline is given so periodic events
+/// can reschedule themselves without drifting
+/// </summary>
+typedef void (*EventHandler)(uint64_t deadline);
+
+typedef struct
+{
+	/// <summary>
+	/// The number of CPU cycles elapsed since the emulator started
+	/// </summary>
+	uint64_t cycles;
+
+	/// <summary>
+	/// The deadline of the earliest scheduled event, SCHEDULER_NO_EVENT if there is none
+	/// </summary>
+	uint64_t next_deadline;
+
+	/// <summary>
+	/// Min-heap of the scheduled events, sorted by deadline
+	/// </summary>
+	ScheduledEvent heap[EVENT_COUNT];
+
+	/// <summary>
+	/// The number of events in the heap
+	/// </summary>
+	int heap_size;
+
+	/// <summary>
+	/// The position of each event type in the heap, -1 if it isn't scheduled
+	/// </summary>
+	int heap_index[EVENT_COUNT];
+} SchedulerState;
+
+extern PSX_THREAD_LOCAL SchedulerState scheduler_state;
+
+void reset_scheduler_state();
+
+/// <summary>
+/// Schedules an event a number of cycles from now, replacing its previous deadline if it was already scheduled
+/// </summary>
+/// <param name="type">The event to schedule</param>
+/// <param name="cycles">In how many cycles the event should fire</param>
+void schedule_event(EventType type, uint64_t cycles);
+
+/// <summary>
+/// Schedules an event at an absolute cycle, replacing its previous deadline if it was already scheduled
+/// </summary>
+/// <param name="type">The event to schedule</param>
+/// <param name="deadline">The cycle at which the event should fire</param>
+void schedule_event_at(EventType type, uint64_t deadline);
+
+/// <summary>
+/// Removes an event from the scheduler, does nothing if it isn't scheduled
+/// </summary>
+void cancel_event(EventType type);
+
+bool is_event_scheduled(EventType type);
+
+/// <summary>
+/// Runs the handlers of all the events whose deadline has been reached, in deadline order
+/// </summary>
+void run_scheduled_events();
+
+/// <summary>
+/// Advances the cycle counter and runs the events that became due
+/// </summary>
+/// <param name="cycles">The number of cycles that elapsed</param>
+static inline void scheduler_tick(int cycles)
+{
+	scheduler_state.cycles += cycles;
+
+	if (scheduler_state.cycles >= scheduler_state.next_deadline)
+		run_scheduled_events();
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#define BENCHMARK_ITERATIONS 2000000 // Loop iterations run by each CPU backend in the benchmark
+#define TEST_CONSOLE_THREADS 16 // Consoles run at once by the thread test, four per CPU backend
+
 /// <summary>
 /// Functions to do some simple tests on the emulator behavior
 /// </summary>
@@ -12,4 +15,9 @@ void test_instructions();
 /// <summary>
 /// Starts some very basic tests to check that RAM R/W operations work corretly
 /// </summary>
-void test_memory();
\ No newline at end of file
+void test_memory();
+
+/// <summary>
+/// Runs the same guest loop with every CPU backend, and logs how long each one took
+/// </summary>
+void benchmark_cpu_backends();
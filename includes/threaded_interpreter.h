@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+
+#define THREADED_INTERPRETER_MAX_CYCLES 65536 // Cycles to run at most before returning to the caller
+
+/// <summary>
+/// Functions for the threaded interpreter, which runs instructions in a single function
+/// dispatching to one label per opcode with computed gotos
+///
+/// Every opcode ends with its own copy of the fetch and dispatch code, so the host branch predictor
+/// learns the transitions between opcodes instead of sharing a single indirect call site. The pc and
+/// the current opcode are kept in local variables and only written back to cpu_state when an
+/// instruction function needs them, simple ALU instructions and branches are implemented inline.
+///
+/// Computed gotos are a GCC/Clang extension, other compilers use the regular interpreter instead.
+/// </summary>
+
+/// <summary>
+/// Executes instructions until the next scheduler event, until a register jump lands,
+/// or until the debugger takes over
+/// </summary>
+/// <param name="debug_info">Whether debug information about the instructions should be printed</param>
+/// <returns>The number of instructions that were executed</returns>
+int run_threaded_interpreter(bool debug_info);
@@ -3,6 +3,9 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "scheduler.h"
+#include "context.h"
+
 #define DOT_CLOCK_CYCLES 
 #define SYS_CLOCK_8_CYCLES 8
 
@@ -34,9 +37,32 @@ typedef enum
 	DOT_CLOCK
 } ClockSourceType;
 
+/// <summary>
+/// A timer counter isn't incremented, it is computed on demand from the value it had at
+/// a base time and the rate of its clock source
+/// </summary>
 typedef struct
 {
+	/// <summary>
+	/// The counter value at the base time, use get_counter_value to get the current value
+	/// </summary>
 	uint32_t counter_value;
+
+	/// <summary>
+	/// The time at which the counter had counter_value, in cycles or in scanlines for the HBlank clock source
+	/// </summary>
+	uint64_t base_time;
+
+	/// <summary>
+	/// How many units of base_time one increment of the counter takes
+	/// </summary>
+	uint32_t time_per_tick;
+
+	/// <summary>
+	/// The cycle at which the timer requests its next IRQ, SCHEDULER_NO_EVENT if it doesn't
+	/// </summary>
+	uint64_t irq_deadline;
+
 	uint16_t counter_target;
 	uint32_t counter_mode;
 
@@ -61,24 +87,39 @@ typedef struct
 	Timer timers[3];
 
 	/// <summary>
-	/// An internal counter to keep track of the HBlank clock source
-	/// </summary>
-	int hblank_clock_internal;
-
-	/// <summary>
-	/// An internal counter to keep track of the dot clock counter
+	/// The number of scanlines elapsed, which is the time of the HBlank clock source
 	/// </summary>
-	int dot_clock_internal;
-
-	/// <summary>
-	/// An internal counter to keep track of the 1/8th system clock clock source
-	/// </summary>
-	int sys_clock_8_internal;
+	uint64_t hblank_count;
 } TimerState;
 
+extern PSX_THREAD_LOCAL TimerState timer_state;
+
 void reset_timer_state();
 
 uint32_t read_timer(uint32_t address);
 void write_timer(uint32_t address, uint32_t value);
 
-void system_clock_tick(int cycles);
+/// <summary>
+/// Computes the current counter value of a timer
+/// </summary>
+/// <param name="index">The timer index (0-2)</param>
+uint32_t get_counter_value(int index);
+
+/// <summary>
+/// Called when the rate of a clock source changes (the dot clock depends on the horizontal resolution),
+/// so the timers keep their current value but count at the new rate from now on
+/// </summary>
+void update_timer_rates();
+
+/// <summary>
+/// Called by the GPU at the HBlank of each scanline, ticks the timers using the HBlank clock source
+/// </summary>
+void tick_hblank_timers();
+
+/// <summary>
+/// Scheduler event for the earliest timer IRQ deadline
+/// </summary>
+void handle_timer_event(uint64_t deadline);
+
+static void rebase_timer(int index);
+static void update_irq_deadline(int index);
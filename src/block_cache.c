@@ -0,0 +1,661 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "block_cache.h"
+#include "cpu.h"
+#include "memory.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "logging.h"
+#include "scheduler.h"
+#include "icache.h"
+
+PSX_THREAD_LOCAL BlockCache block_cache = {0};
+
+int init_block_cache()
+{
+	block_cache.blocks = malloc(BLOCK_CACHE_MAX_BLOCKS * sizeof(Block));
+	block_cache.instructions = malloc(BLOCK_CACHE_MAX_INSTRUCTIONS * sizeof(DecodedInstruction));
+	block_cache.ram_blocks = malloc(RAM_SIZE / WORD_SIZE * sizeof(Block*));
+	block_cache.bios_blocks = malloc(BIOS_ROM_SIZE / WORD_SIZE * sizeof(Block*));
+
+	if (block_cache.blocks == NULL || block_cache.instructions == NULL || block_cache.ram_blocks == NULL || block_cache.bios_blocks == NULL)
+	{
+		log_error("Error while trying to allocate memory for the block cache!\n");
+		free_block_cache();
+		return -1;
+	}
+
+	flush_block_cache();
+
+	return 0;
+}
+
+void free_block_cache()
+{
+	free(block_cache.blocks);
+	free(block_cache.instructions);
+	free(block_cache.ram_blocks);
+	free(block_cache.bios_blocks);
+
+	block_cache.blocks = NULL;
+	block_cache.instructions = NULL;
+	block_cache.ram_blocks = NULL;
+	block_cache.bios_blocks = NULL;
+}
+
+void flush_block_cache()
+{
+	memset(block_cache.ram_blocks, 0, RAM_SIZE / WORD_SIZE * sizeof(Block*));
+	memset(block_cache.bios_blocks, 0, BIOS_ROM_SIZE / WORD_SIZE * sizeof(Block*));
+	memset(block_cache.code_bitmap, 0, sizeof(block_cache.code_bitmap));
+	memset(block_cache.code_pages, 0, sizeof(block_cache.code_pages));
+
+	block_cache.block_count = 0;
+	block_cache.instruction_count = 0;
+	block_cache.flush_count++;
+	block_cache.invalidation_count++;
+}
+
+/// <summary>
+/// Clears the bit of a page in the page bitmap if none of its words contain code anymore
+/// </summary>
+/// <param name="page_index">The index of the 4 KiB page in main RAM</param>
+static void update_code_page(uint32_t page_index)
+{
+	const int bitmap_words = CODE_PAGE_SIZE / WORD_SIZE / 32;
+	uint32_t* page_bitmap = &block_cache.code_bitmap[page_index * bitmap_words];
+
+	for (int i = 0; i < bitmap_words; i++)
+	{
+		if (page_bitmap[i] != 0)
+			return;
+	}
+
+	block_cache.code_pages[page_index / 32] &= ~(1u << (page_index % 32));
+}
+
+/// <summary>
+/// Drops the RAM blocks overlapping a range of words, and clears the range in the code bitmaps
+/// </summary>
+/// <param name="first_word">The index of the first word of the range in main RAM</param>
+/// <param name="last_word">The index of the last word of the range in main RAM</param>
+static void drop_ram_blocks(uint32_t first_word, uint32_t last_word)
+{
+	// Blocks starting up to BLOCK_MAX_INSTRUCTIONS - 1 words earlier can run into the range
+	uint32_t start = first_word >= BLOCK_MAX_INSTRUCTIONS - 1 ? first_word - (BLOCK_MAX_INSTRUCTIONS - 1) : 0;
+	bool dropped = false;
+
+	for (uint32_t i = start; i <= last_word; i++)
+	{
+		Block* block = block_cache.ram_blocks[i];
+
+		if (block != NULL && i + block->length > first_word)
+		{
+			block_cache.ram_blocks[i] = NULL;
+			dropped = true;
+		}
+	}
+
+	// The blocks left around the range all end before it, so no code remains in the range.
+	// Words before the range may keep their bit when their block was dropped, which only costs a useless check later
+	for (uint32_t i = first_word; i <= last_word; i++)
+		block_cache.code_bitmap[i / 32] &= ~(1u << (i % 32));
+
+	for (uint32_t page = first_word * WORD_SIZE >> CODE_PAGE_SHIFT; page <= last_word * WORD_SIZE >> CODE_PAGE_SHIFT; page++)
+		update_code_page(page);
+
+	// The running block may have been dropped
+	if (dropped)
+		block_cache.invalidation_count++;
+}
+
+void invalidate_cached_code_word(uint32_t ram_address)
+{
+	uint32_t word_index = ram_address / WORD_SIZE;
+
+	if (block_cache.code_bitmap[word_index / 32] & (1u << (word_index % 32)))
+		drop_ram_blocks(word_index, word_index);
+}
+
+void invalidate_cached_code_range(uint32_t ram_address, uint32_t size)
+{
+	if (size == 0)
+		return;
+
+	if (size > RAM_SIZE)
+		size = RAM_SIZE;
+
+	ram_address &= RAM_SIZE - 1;
+
+	// Split the ranges wrapping around the end of RAM
+	if (ram_address + size > RAM_SIZE)
+	{
+		invalidate_cached_code_range(0, ram_address + size - RAM_SIZE);
+		size = RAM_SIZE - ram_address;
+	}
+
+	uint32_t first_word = ram_address / WORD_SIZE;
+	uint32_t last_word = (ram_address + size - 1) / WORD_SIZE;
+
+	// Only look at the pages that contain code
+	for (uint32_t page = first_word * WORD_SIZE >> CODE_PAGE_SHIFT; page <= last_word * WORD_SIZE >> CODE_PAGE_SHIFT; page++)
+	{
+		if ((block_cache.code_pages[page / 32] & (1u << (page % 32))) == 0)
+			continue;
+
+		uint32_t page_first_word = page * (CODE_PAGE_SIZE / WORD_SIZE);
+		uint32_t page_last_word = page_first_word + CODE_PAGE_SIZE / WORD_SIZE - 1;
+
+		drop_ram_blocks(first_word > page_first_word ? first_word : page_first_word,
+			last_word < page_last_word ? last_word : page_last_word);
+	}
+}
+
+bool is_branch_instruction(uint32_t opcode)
+{
+	uint8_t primary_opcode = (opcode & 0xFC000000) >> 26;
+	uint8_t secondary_opcode = opcode & 0x3F;
+
+	// BCONDZ, J, JAL, BEQ, BNE, BLEZ, BGTZ
+	if (primary_opcode >= 0x01 && primary_opcode <= 0x07)
+		return true;
+
+	// JR, JALR
+	return primary_opcode == 0x00 && (secondary_opcode == 0x08 || secondary_opcode == 0x09);
+}
+
+/// <summary>
+/// Gets the registers read and written by an instruction allowed in an idle loop
+/// </summary>
+/// <param name="opcode">The 32 bit value of the opcode</param>
+/// <param name="reads">Mask of the registers read by the instruction</param>
+/// <param name="writes">Mask of the registers written by the instruction</param>
+/// <returns>False if the instruction has side effects, or depends on state other than registers and memory</returns>
+static bool get_idle_loop_registers(uint32_t opcode, uint32_t* reads, uint32_t* writes)
+{
+	uint8_t primary_opcode = (opcode & 0xFC000000) >> 26;
+	uint8_t secondary_opcode = opcode & 0x3F;
+
+	*reads = 0;
+	*writes = 0;
+
+	switch (primary_opcode)
+	{
+		case 0x00:
+			switch (secondary_opcode)
+			{
+				case 0x00: case 0x02: case 0x03: // SLL, SRL, SRA
+					*reads = 1u << rt(opcode);
+					*writes = 1u << rd(opcode);
+					return true;
+
+				case 0x04: case 0x06: case 0x07: // SLLV, SRLV, SRAV
+				case 0x21: case 0x23: case 0x24: case 0x25: // ADDU, SUBU, AND, OR
+				case 0x26: case 0x27: case 0x2A: case 0x2B: // XOR, NOR, SLT, SLTU
+					*reads = (1u << rs(opcode)) | (1u << rt(opcode));
+					*writes = 1u << rd(opcode);
+					return true;
+
+				default:
+					return false;
+			}
+
+		case 0x01: // BLTZ, BGEZ but not the linking variants
+			*reads = 1u << rs(opcode);
+			return (rt(opcode) & 0x10) == 0;
+
+		case 0x04: case 0x05: // BEQ, BNE
+			*reads = (1u << rs(opcode)) | (1u << rt(opcode));
+			return true;
+
+		case 0x06: case 0x07: // BLEZ, BGTZ
+			*reads = 1u << rs(opcode);
+			return true;
+
+		case 0x09: case 0x0A: case 0x0B: case 0x0C: // ADDIU, SLTI, SLTIU, ANDI
+		case 0x0D: case 0x0E: // ORI, XORI
+		case 0x20: case 0x21: case 0x23: case 0x24: case 0x25: // LB, LH, LW, LBU, LHU
+			*reads = 1u << rs(opcode);
+			*writes = 1u << rt(opcode);
+			return true;
+
+		case 0x0F: // LUI
+			*writes = 1u << rt(opcode);
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+/// <summary>
+/// Checks if a block is an idle loop, a short loop branching back to its start that only reads memory,
+/// and whose registers read before being written are never written by the loop.
+/// Running it again with the same memory then always gives the same result
+/// </summary>
+static bool is_idle_loop(Block* block)
+{
+	if (block->length < 2 || block->length > IDLE_LOOP_MAX_INSTRUCTIONS)
+		return false;
+
+	// The branch must target the start of the block
+	uint32_t branch_address = block->address + (block->length - 2) * WORD_SIZE;
+	uint32_t branch_opcode = block->instructions[block->length - 2].opcode;
+	uint8_t primary_opcode = (branch_opcode & 0xFC000000) >> 26;
+
+	uint32_t target;
+
+	if (primary_opcode == 0x02) // J
+		target = ((branch_address + WORD_SIZE) & 0xF0000000) | ((branch_opcode & 0x03FFFFFF) << 2);
+	else if (primary_opcode == 0x01 || (primary_opcode >= 0x04 && primary_opcode <= 0x07))
+		target = branch_address + WORD_SIZE + ((int32_t)(int16_t)(branch_opcode & 0xFFFF) << 2);
+	else
+		return false;
+
+	if (target != block->address)
+		return false;
+
+	uint32_t all_writes = 0;
+
+	for (int i = 0; i < block->length; i++)
+	{
+		uint32_t reads, writes;
+
+		if (!get_idle_loop_registers(block->instructions[i].opcode, &reads, &writes))
+			return false;
+
+		all_writes |= writes;
+	}
+
+	uint32_t written = 1;
+
+	for (int i = 0; i < block->length; i++)
+	{
+		uint32_t reads, writes;
+		get_idle_loop_registers(block->instructions[i].opcode, &reads, &writes);
+
+		// A register carried over from the previous iteration would make each iteration different
+		if (reads & ~written & all_writes)
+			return false;
+
+		written |= writes;
+	}
+
+	return true;
+}
+
+/// <summary>
+/// Extracts the fields of an instruction and picks how run_cached_block() runs it
+/// </summary>
+/// <param name="instruction">The instruction to fill</param>
+/// <param name="opcode">The 32 bit value of the opcode</param>
+static void decode_cached_instruction(DecodedInstruction* instruction, uint32_t opcode)
+{
+	uint32_t primary = opcode >> 26;
+	uint32_t secondary = opcode & 0x3F;
+	uint32_t signed_immediate = (uint32_t)(int32_t)(int16_t)(opcode & 0xFFFF);
+
+	instruction->opcode = opcode;
+	instruction->function = decode_instruction(opcode);
+	instruction->rs = rs(opcode);
+	instruction->rt = rt(opcode);
+	instruction->rd = rd(opcode);
+	instruction->shamt = imm5(opcode);
+	instruction->immediate = signed_immediate;
+	instruction->operation = CACHED_OP_HANDLER;
+
+	static const uint8_t primary_operations[0x10] = {
+		[0x02] = CACHED_OP_J,
+		[0x03] = CACHED_OP_JAL,
+		[0x04] = CACHED_OP_BEQ,
+		[0x05] = CACHED_OP_BNE,
+		[0x06] = CACHED_OP_BLEZ,
+		[0x07] = CACHED_OP_BGTZ,
+		[0x09] = CACHED_OP_ADDIU,
+		[0x0A] = CACHED_OP_SLTI,
+		[0x0B] = CACHED_OP_SLTIU,
+		[0x0C] = CACHED_OP_ANDI,
+		[0x0D] = CACHED_OP_ORI,
+		[0x0E] = CACHED_OP_XORI,
+		[0x0F] = CACHED_OP_LUI,
+	};
+
+	static const uint8_t secondary_operations[0x30] = {
+		[0x00] = CACHED_OP_SLL,
+		[0x02] = CACHED_OP_SRL,
+		[0x03] = CACHED_OP_SRA,
+		[0x04] = CACHED_OP_SLLV,
+		[0x06] = CACHED_OP_SRLV,
+		[0x07] = CACHED_OP_SRAV,
+		[0x08] = CACHED_OP_JR,
+		[0x09] = CACHED_OP_JALR,
+		[0x10] = CACHED_OP_MFHI,
+		[0x11] = CACHED_OP_MTHI,
+		[0x12] = CACHED_OP_MFLO,
+		[0x13] = CACHED_OP_MTLO,
+		[0x21] = CACHED_OP_ADDU,
+		[0x23] = CACHED_OP_SUBU,
+		[0x24] = CACHED_OP_AND,
+		[0x25] = CACHED_OP_OR,
+		[0x26] = CACHED_OP_XOR,
+		[0x27] = CACHED_OP_NOR,
+		[0x2A] = CACHED_OP_SLT,
+		[0x2B] = CACHED_OP_SLTU,
+	};
+
+	if (primary == 0x00 && secondary < 0x30)
+		instruction->operation = secondary_operations[secondary];
+	else if (primary < 0x10)
+		instruction->operation = primary_operations[primary];
+
+	switch (instruction->operation)
+	{
+		case CACHED_OP_ANDI:
+		case CACHED_OP_ORI:
+		case CACHED_OP_XORI:
+			instruction->immediate = opcode & 0xFFFF;
+			break;
+		case CACHED_OP_LUI:
+			instruction->immediate = (opcode & 0xFFFF) << 16;
+			break;
+		case CACHED_OP_BEQ:
+		case CACHED_OP_BNE:
+		case CACHED_OP_BLEZ:
+		case CACHED_OP_BGTZ:
+			instruction->immediate = signed_immediate << 2;
+			break;
+		case CACHED_OP_J:
+		case CACHED_OP_JAL:
+			instruction->immediate = (opcode & 0x03FFFFFF) << 2;
+			break;
+	}
+
+	// Loads, bcond and the multiplications/divisions can't change the interrupt state either
+	bool is_load = primary >= 0x20 && primary <= 0x26;
+	bool is_mult_div = primary == 0x00 && secondary >= 0x18 && secondary <= 0x1B;
+
+	instruction->sync = instruction->operation == CACHED_OP_HANDLER && !is_load && !is_mult_div && primary != 0x01;
+}
+
+/// <summary>
+/// Decodes a new block from memory and registers it in the cache
+/// </summary>
+/// <param name="address">The address of the first instruction of the block</param>
+/// <param name="code">A pointer to the memory containing the first instruction</param>
+/// <param name="words_left">How many words of code are left in the memory region</param>
+/// <returns>The new block</returns>
+static Block* compile_block(uint32_t address, uint32_t* code, uint32_t words_left)
+{
+	// Start over when running out of space, the blocks will get decoded again when needed
+	if (block_cache.block_count == BLOCK_CACHE_MAX_BLOCKS
+		|| block_cache.instruction_count + BLOCK_MAX_INSTRUCTIONS > BLOCK_CACHE_MAX_INSTRUCTIONS)
+		flush_block_cache();
+
+	Block* block = &block_cache.blocks[block_cache.block_count++];
+	block->address = address;
+	block->length = 0;
+	block->instructions = &block_cache.instructions[block_cache.instruction_count];
+	block->recompiled = NULL;
+
+	bool in_delay_slot = false;
+
+	while (block->length < BLOCK_MAX_INSTRUCTIONS && (uint32_t)block->length < words_left)
+	{
+		uint32_t opcode = code[block->length];
+
+		decode_cached_instruction(&block->instructions[block->length++], opcode);
+
+		// The block ends after the delay slot of a branch
+		if (in_delay_slot)
+			break;
+
+		in_delay_slot = is_branch_instruction(opcode);
+	}
+
+	block_cache.instruction_count += block->length;
+
+	block->idle_loop = is_idle_loop(block);
+
+	return block;
+}
+
+Block* get_block(uint32_t address)
+{
+	// Code is only cached in KUSEG, KSEG0 and KSEG1, which all map the same physical memory
+	uint32_t segment = address >> 29;
+	if (segment != 0 && segment != 4 && segment != 5)
+		return NULL;
+
+	uint32_t physical_address = address & 0x1FFFFFFF;
+
+	if (physical_address < RAM_MIRROR_SIZE) // Main RAM
+	{
+		uint32_t word_index = (physical_address & (RAM_SIZE - 1)) / WORD_SIZE;
+		Block* block = block_cache.ram_blocks[word_index];
+
+		if (block == NULL)
+		{
+			block = compile_block(address, &ram[word_index], RAM_SIZE / WORD_SIZE - word_index);
+			block_cache.ram_blocks[word_index] = block;
+
+			// Mark the words and pages of the block so that writing to them drops it
+			for (int i = 0; i < block->length; i++)
+			{
+				uint32_t code_word = word_index + i;
+				uint32_t page_index = code_word * WORD_SIZE >> CODE_PAGE_SHIFT;
+
+				block_cache.code_bitmap[code_word / 32] |= 1u << (code_word % 32);
+				block_cache.code_pages[page_index / 32] |= 1u << (page_index % 32);
+			}
+		}
+
+		return block;
+	}
+
+	if (physical_address >= 0x1FC00000 && physical_address < 0x1FC00000 + BIOS_ROM_SIZE) // BIOS ROM
+	{
+		uint32_t word_index = (physical_address - 0x1FC00000) / WORD_SIZE;
+		Block* block = block_cache.bios_blocks[word_index];
+
+		if (block == NULL)
+		{
+			block = compile_block(address, &bios_rom[word_index], BIOS_ROM_SIZE / WORD_SIZE - word_index);
+			block_cache.bios_blocks[word_index] = block;
+		}
+
+		return block;
+	}
+
+	return NULL;
+}
+
+void skip_idle_loop(Block* block, uint32_t block_address, uint64_t deadline)
+{
+	// Only skip once the loop branched back, and if no event could have changed memory during the iteration
+	if (!block->idle_loop || cpu_state.pc != block_address || block_cache.volatile_io_read
+		|| scheduler_state.cycles >= deadline || deadline == SCHEDULER_NO_EVENT)
+		return;
+
+	scheduler_state.cycles = deadline;
+	run_scheduled_events();
+}
+
+/// <summary>
+/// Runs a decoded instruction like execute_instruction() does, without the debugger checks, and with
+/// the common instructions done inline from their pre-decoded operands instead of calling their function
+/// </summary>
+/// <param name="instruction">The instruction to run</param>
+/// <returns>Whether the interrupts must be serviced before the next instruction</returns>
+static inline bool run_decoded_instruction(const DecodedInstruction* instruction)
+{
+	uint32_t pc = cpu_state.pc;
+
+	if (pc == 0xA0 || pc == 0xB0)
+		check_tty_output();
+
+	int fetch_cycles = fetch_icache(pc);
+
+	if (cpu_state.delay_jump)
+	{
+		cpu_state.delay_jump = false;
+		cpu_state.pc = cpu_state.jmp_address;
+	}
+	else
+		cpu_state.pc += 0x4;
+
+	cpu_state.current_opcode = instruction->opcode;
+
+	uint32_t* registers = cpu_state.registers;
+
+	switch (instruction->operation)
+	{
+		case CACHED_OP_ADDIU: registers[instruction->rt] = registers[instruction->rs] + instruction->immediate; break;
+		case CACHED_OP_SLTI: registers[instruction->rt] = (int32_t)registers[instruction->rs] < (int32_t)instruction->immediate; break;
+		case CACHED_OP_SLTIU: registers[instruction->rt] = registers[instruction->rs] < instruction->immediate; break;
+		case CACHED_OP_ANDI: registers[instruction->rt] = registers[instruction->rs] & instruction->immediate; break;
+		case CACHED_OP_ORI: registers[instruction->rt] = registers[instruction->rs] | instruction->immediate; break;
+		case CACHED_OP_XORI: registers[instruction->rt] = registers[instruction->rs] ^ instruction->immediate; break;
+		case CACHED_OP_LUI: registers[instruction->rt] = instruction->immediate; break;
+		case CACHED_OP_SLL: registers[instruction->rd] = registers[instruction->rt] << instruction->shamt; break;
+		case CACHED_OP_SRL: registers[instruction->rd] = registers[instruction->rt] >> instruction->shamt; break;
+		case CACHED_OP_SRA: registers[instruction->rd] = (int32_t)registers[instruction->rt] >> instruction->shamt; break;
+		case CACHED_OP_SLLV: registers[instruction->rd] = registers[instruction->rt] << (registers[instruction->rs] & 0x1F); break;
+		case CACHED_OP_SRLV: registers[instruction->rd] = registers[instruction->rt] >> (registers[instruction->rs] & 0x1F); break;
+		case CACHED_OP_SRAV: registers[instruction->rd] = (int32_t)registers[instruction->rt] >> (registers[instruction->rs] & 0x1F); break;
+		case CACHED_OP_ADDU: registers[instruction->rd] = registers[instruction->rs] + registers[instruction->rt]; break;
+		case CACHED_OP_SUBU: registers[instruction->rd] = registers[instruction->rs] - registers[instruction->rt]; break;
+		case CACHED_OP_AND: registers[instruction->rd] = registers[instruction->rs] & registers[instruction->rt]; break;
+		case CACHED_OP_OR: registers[instruction->rd] = registers[instruction->rs] | registers[instruction->rt]; break;
+		case CACHED_OP_XOR: registers[instruction->rd] = registers[instruction->rs] ^ registers[instruction->rt]; break;
+		case CACHED_OP_NOR: registers[instruction->rd] = ~(registers[instruction->rs] | registers[instruction->rt]); break;
+		case CACHED_OP_SLT: registers[instruction->rd] = (int32_t)registers[instruction->rs] < (int32_t)registers[instruction->rt]; break;
+		case CACHED_OP_SLTU: registers[instruction->rd] = registers[instruction->rs] < registers[instruction->rt]; break;
+		case CACHED_OP_MFHI: registers[instruction->rd] = cpu_state.hi; break;
+		case CACHED_OP_MTHI: cpu_state.hi = registers[instruction->rs]; break;
+		case CACHED_OP_MFLO: registers[instruction->rd] = cpu_state.lo; break;
+		case CACHED_OP_MTLO: cpu_state.lo = registers[instruction->rs]; break;
+
+		case CACHED_OP_BEQ:
+		case CACHED_OP_BNE:
+		case CACHED_OP_BLEZ:
+		case CACHED_OP_BGTZ:
+		{
+			uint32_t rs_value = registers[instruction->rs];
+			bool taken;
+
+			if (instruction->operation == CACHED_OP_BEQ)
+				taken = rs_value == registers[instruction->rt];
+			else if (instruction->operation == CACHED_OP_BNE)
+				taken = rs_value != registers[instruction->rt];
+			else if (instruction->operation == CACHED_OP_BLEZ)
+				taken = (int32_t)rs_value <= 0;
+			else
+				taken = (int32_t)rs_value > 0;
+
+			if (taken)
+			{
+				cpu_state.delay_jump = true;
+				cpu_state.jmp_address = cpu_state.pc + instruction->immediate;
+			}
+			break;
+		}
+
+		case CACHED_OP_JAL:
+			R31 = cpu_state.pc + 0x4;
+			// Fall through
+		case CACHED_OP_J:
+			// The upper bits come from pc, blocks are shared between the mirrors of the memory
+			cpu_state.jmp_address = ((cpu_state.pc + 0x4) & 0xF0000000) | instruction->immediate;
+			cpu_state.delay_jump = true;
+			break;
+
+		case CACHED_OP_JR:
+		case CACHED_OP_JALR:
+			cpu_state.jmp_address = registers[instruction->rs];
+			cpu_state.delay_jump = true;
+
+			if (instruction->operation == CACHED_OP_JALR)
+				registers[instruction->rd] = cpu_state.pc + 0x4;
+			break;
+
+		default:
+			run_instruction_handler(instruction->function);
+			break;
+	}
+
+	scheduler_state.cycles += CYCLES_PER_INSTRUCTION + fetch_cycles;
+
+	// Events can raise interrupts
+	if (scheduler_state.cycles >= scheduler_state.next_deadline)
+	{
+		run_scheduled_events();
+		return true;
+	}
+
+	return instruction->sync;
+}
+
+int run_cached_block(bool debug_info)
+{
+	R0 = 0;
+
+	service_interrupts();
+
+	Block* block = get_block(cpu_state.pc);
+
+	// Code outside of RAM/BIOS is never cached, fall back to the regular interpreter
+	if (block == NULL)
+	{
+		cpu_state.current_opcode = read_word_internal(cpu_state.pc);
+		execute_instruction(decode_instruction(cpu_state.current_opcode), debug_info);
+
+		return 1;
+	}
+
+	// The address of the block is stored as given by pc, but the cache is shared between mirrors
+	uint32_t block_address = cpu_state.pc;
+	uint32_t invalidation_count = block_cache.invalidation_count;
+	uint64_t deadline = scheduler_state.next_deadline;
+
+	block_cache.volatile_io_read = false;
+
+	// Printing instructions and code breakpoints need every instruction to go through execute_instruction()
+	bool checked = debug_info || debug_state.breakpoint_count > 0;
+
+	int index = 0;
+
+	while (true)
+	{
+		DecodedInstruction* instruction = &block->instructions[index++];
+		bool service = true;
+
+		if (checked)
+		{
+			cpu_state.current_opcode = instruction->opcode;
+			execute_instruction(instruction->function, debug_info);
+		}
+		else
+			service = run_decoded_instruction(instruction);
+
+		// Stop at the end of the block, when the debugger needs to take over, or if the block was overwritten
+		if (index == block->length || debug_state.in_debug || invalidation_count != block_cache.invalidation_count)
+		{
+			if (index == block->length && !debug_info && !debug_state.in_debug)
+				skip_idle_loop(block, block_address, deadline);
+
+			return index;
+		}
+
+		R0 = 0;
+
+		if (service)
+			service_interrupts();
+
+		// An exception, an interrupt or a taken branch moved pc out of the block
+		if (cpu_state.pc != block_address + index * WORD_SIZE)
+			return index;
+	}
+}
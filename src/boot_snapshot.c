@@ -0,0 +1,184 @@
+#if defined(__unix__) || defined(__APPLE__)
+#define MKSTEMP_SUPPORTED
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef MKSTEMP_SUPPORTED
+#include <unistd.h>
+#else
+#include <stdatomic.h>
+#include <time.h>
+#endif
+
+#include "boot_snapshot.h"
+#include "save_state.h"
+#include "memory.h"
+#include "logging.h"
+
+#define BOOT_SNAPSHOT_PATH_SIZE 4096 // Room for the path of the temporary file written before replacing the snapshot
+
+/// <summary>
+/// Gets the FNV-1a hash of the BIOS ROM
+/// </summary>
+static uint32_t get_bios_hash()
+{
+	const uint8_t* bytes = (const uint8_t*)bios_rom;
+	uint32_t hash = 0x811C9DC5;
+
+	for (uint32_t i = 0; i < BIOS_ROM_SIZE; i++)
+		hash = (hash ^ bytes[i]) * 0x01000193;
+
+	return hash;
+}
+
+/// <summary>
+/// Creates a new file with a unique name next to the snapshot, so that the snapshot is only ever replaced by a
+/// complete one, and consoles saving at the same time don't write to the same file
+/// </summary>
+/// <param name="path">The path of the snapshot file</param>
+/// <param name="temporary_path">Receives the path of the new file</param>
+/// <param name="size">The size of the temporary_path buffer</param>
+/// <returns>The file open for writing, NULL if it couldn't be created</returns>
+static FILE* create_temporary_file(const char* path, char* temporary_path, size_t size)
+{
+#ifdef MKSTEMP_SUPPORTED
+	int length = snprintf(temporary_path, size, "%s.XXXXXX", path);
+
+	if (length < 0 || (size_t)length >= size)
+		return NULL;
+
+	int fd = mkstemp(temporary_path);
+	if (fd == -1)
+		return NULL;
+
+	FILE* file = fdopen(fd, "wb");
+
+	if (file == NULL)
+	{
+		close(fd);
+		remove(temporary_path);
+	}
+
+	return file;
+#else
+	static atomic_uint counter = 0;
+	int length = snprintf(temporary_path, size, "%s.%lld.%u.tmp", path, (long long)time(NULL), atomic_fetch_add(&counter, 1));
+
+	if (length < 0 || (size_t)length >= size)
+		return NULL;
+
+	return fopen(temporary_path, "wb");
+#endif
+}
+
+int save_boot_snapshot(const char* path)
+{
+	BootSnapshotHeader header = {
+		.magic = BOOT_SNAPSHOT_MAGIC,
+		.version = BOOT_SNAPSHOT_VERSION,
+		.bios_hash = get_bios_hash(),
+	};
+
+	size_t size = get_save_state_size();
+	uint8_t* state = malloc(size);
+
+	if (state == NULL)
+	{
+		log_error("Error while trying to allocate memory for the boot snapshot!\n");
+		return -1;
+	}
+
+	save_state(state, size);
+
+	char temporary_path[BOOT_SNAPSHOT_PATH_SIZE];
+	FILE* file = create_temporary_file(path, temporary_path, sizeof(temporary_path));
+	int result = -1;
+
+	if (file != NULL)
+	{
+		result = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(state, 1, size, file) == size ? 0 : -1;
+
+		if (fclose(file) != 0)
+			result = -1;
+
+#ifndef MKSTEMP_SUPPORTED
+		// rename() doesn't replace an existing file there
+		if (result == 0)
+			remove(path);
+#endif
+
+		// The snapshot is replaced at once, a crash or a full disk leaves either the old one or the new one
+		if (result == 0 && rename(temporary_path, path) != 0)
+			result = -1;
+
+		if (result != 0)
+			remove(temporary_path);
+	}
+
+	if (result != 0)
+		log_warning("Couldn't write the boot snapshot at %s\n", path);
+
+	free(state);
+
+	return result;
+}
+
+int load_boot_snapshot(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return -1;
+
+	BootSnapshotHeader header = {0};
+
+	if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != BOOT_SNAPSHOT_MAGIC || header.version != BOOT_SNAPSHOT_VERSION)
+	{
+		log_warning("Ignoring the boot snapshot at %s, it was saved by another version\n", path);
+		fclose(file);
+		return -1;
+	}
+
+	if (header.bios_hash != get_bios_hash())
+	{
+		log_info("Ignoring the boot snapshot at %s, it was saved with another BIOS\n", path);
+		fclose(file);
+		return -1;
+	}
+
+	long start = ftell(file);
+	fseek(file, 0, SEEK_END);
+	long end = ftell(file);
+	fseek(file, start, SEEK_SET);
+
+	if (start < 0 || end < start + (long)sizeof(SaveStateHeader))
+	{
+		log_warning("Ignoring the boot snapshot at %s, it is truncated\n", path);
+		fclose(file);
+		return -1;
+	}
+
+	size_t size = end - start;
+	uint8_t* state = malloc(size);
+	int result = -1;
+
+	if (state != NULL && fread(state, 1, size, file) == size)
+	{
+		SaveStateHeader state_header;
+		memcpy(&state_header, state, sizeof(state_header));
+
+		// The save state checks its own version and leaves the emulator untouched if it doesn't match
+		if (state_header.size != size)
+			log_warning("Ignoring the boot snapshot at %s, its size doesn't match its header\n", path);
+		else
+			result = load_state(state, size);
+	}
+
+	fclose(file);
+	free(state);
+
+	return result;
+}
@@ -4,8 +4,9 @@
 #include "logging.h"
 #include "debug.h"
 #include "interrupt.h"
+#include "scheduler.h"
 
-CDController cd_controller = {
+PSX_THREAD_LOCAL CDController cd_controller = {
 	.status_register = 0b00011000,
 	.current_index = 0,
 	.interrupt_enable = 0,
@@ -14,12 +15,12 @@ CDController cd_controller = {
 	.response_fifo = {0},
 	.data_fifo = {0},
 	.pending_cdrom_irq = false,
-	.cycles_until_irq = 0,
 };
 
 void reset_cdrom_state()
 {
 	memset(&cd_controller, 0, sizeof(cd_controller));
+	cancel_event(EVENT_CDROM_IRQ);
 }
 
 uint32_t read_cdrom(uint32_t address)
@@ -108,7 +109,7 @@ void write_cdrom(uint32_t address, uint32_t value)
 		{
 			log_warning("Unhandled CDROM command with value %x\n", value & 0xFF);
 			cd_controller.pending_cdrom_irq = true;
-			cd_controller.cycles_until_irq = 500;
+			schedule_event(EVENT_CDROM_IRQ, CD_IRQ_DELAY_CYCLES);
 		}
 		else if (cd_controller.current_index == 1)
 		{
@@ -166,16 +167,11 @@ void write_cdrom(uint32_t address, uint32_t value)
 		log_warning("Unhandled CDROM write at address %x\n", address);
 }
 
-void tick_cdrom(int cycles)
+void handle_cdrom_irq_event(uint64_t deadline)
 {
-	if (cd_controller.pending_cdrom_irq && cd_controller.cycles_until_irq > 0)
+	if (cd_controller.pending_cdrom_irq)
 	{
-		cd_controller.cycles_until_irq -= cycles;
-
-		if (cd_controller.cycles_until_irq <= 0)
-		{
-			request_interrupt(IRQ_CDROM);
-			cd_controller.pending_cdrom_irq = false;
-		}
+		request_interrupt(IRQ_CDROM);
+		cd_controller.pending_cdrom_irq = false;
 	}
 }
@@ -0,0 +1,36 @@
+#include "context.h"
+#include "memory.h"
+#include "block_cache.h"
+#include "recompiler.h"
+#include "rewind.h"
+#include "rasterizer.h"
+#include "scheduler.h"
+#include "timer.h"
+
+int init_context()
+{
+	// Loading a BIOS or clearing the memory flushes the block cache, so it comes first
+	if (init_block_cache() != 0)
+		return -1;
+
+	if (init_memory() != 0)
+	{
+		free_block_cache();
+		return -1;
+	}
+
+	// The scheduler tables can't be filled by a portable static initializer
+	reset_scheduler_state();
+	reset_timer_state();
+
+	return 0;
+}
+
+void free_context()
+{
+	free_rewind();
+	free_rasterizer();
+	free_recompiler();
+	free_memory();
+	free_block_cache();
+}
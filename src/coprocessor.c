@@ -6,7 +6,7 @@
 #include "logging.h"
 #include "debug.h"
 
-uint32_t _cop0_registers[64] = { 0 };
+PSX_THREAD_LOCAL uint32_t _cop0_registers[64] = { 0 };
 
 void reset_cop0_state()
 {
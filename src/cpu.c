@@ -12,8 +12,14 @@
 #include "cdrom.h"
 #include "gpu.h"
 #include "frontend/gl.h"
-
-cpu cpu_state = {
+#include "block_cache.h"
+#include "recompiler.h"
+#include "threaded_interpreter.h"
+#include "scheduler.h"
+#include "icache.h"
+#include "hle_bios.h"
+
+PSX_THREAD_LOCAL cpu cpu_state = {
     .registers = {0},
     .current_opcode = 0x00,
     .pc = 0xBFC00000,
@@ -23,10 +29,15 @@ cpu cpu_state = {
     .jmp_address = 0x00
 };
 
+PSX_THREAD_LOCAL CPUBackend cpu_backend = CPU_BACKEND_CACHED_INTERPRETER;
+
 void reset_emulator()
 {
     reset_cpu_state();
+    flush_block_cache();
     reset_debug_state(false);
+    reset_scheduler_state();
+    reset_timer_state();
     reset_dma_state();
     reset_interrupt_state();
     reset_cdrom_state();
@@ -60,9 +71,13 @@ static void delay_reg_fetch(int reg_index, uint32_t value)
     cpu_state.fetch_reg_value = value;
 }
 
-static void check_tty_output()
+void check_tty_output()
 {
     // Check for a putchar() call
+    // The HLE BIOS prints the characters itself
+    if (hle_state.enabled)
+        return;
+
     if ((cpu_state.pc == 0xA0 && R9 == 0x3C) || (cpu_state.pc == 0xB0 && R9 == 0x3D))
     {
         debug_state.tty[debug_state.char_index] = (char)(uint8_t)R4;
@@ -94,20 +109,21 @@ void print_tty_output()
     printf("--- TTY DEBUG OUTPUT ---\n%s\n--- END TTY DEBUG OUTPUT\n\n", debug_state.tty);
 }
 
-void handle_instruction(bool debug_info)
+void* decode_instruction(uint32_t opcode)
 {
-    R0 = 0;
-
-    service_interrupts();
-
-    // Decode next instruction
-    cpu_state.current_opcode = read_word_internal(cpu_state.pc);
-
     // Get primary opcode from 6 highest bits
-    uint8_t primary_opcode = (cpu_state.current_opcode & 0xFC000000) >> 26;
+    uint8_t primary_opcode = (opcode & 0xFC000000) >> 26;
     // Get secondary opcode from 6 lowest bits
-    uint8_t secondary_opcode = cpu_state.current_opcode & 0x3F;
+    uint8_t secondary_opcode = opcode & 0x3F;
 
+    if (primary_opcode == 0x00)
+        return secondary_opcodes[secondary_opcode].function;
+
+    return primary_opcodes[primary_opcode].function;
+}
+
+void execute_instruction(void* function, bool debug_info)
+{
     if (debug_info)
         print_debug_info(cpu_state);
 
@@ -116,6 +132,8 @@ void handle_instruction(bool debug_info)
     //add_cpu_trace(cpu_state);
     check_code_breakpoints(cpu_state.pc);
 
+    int fetch_cycles = fetch_icache(cpu_state.pc);
+
     // Jump if we have a jump in delay slot, otherwise increment pc normally
     if (cpu_state.delay_jump)
     {
@@ -125,11 +143,15 @@ void handle_instruction(bool debug_info)
     else
         cpu_state.pc += 0x4;
 
-    // Decode and execute
-    if (primary_opcode == 0x00)
-        ((void (*)(void))secondary_opcodes[secondary_opcode].function)();
-    else
-        ((void (*)(void))primary_opcodes[primary_opcode].function)();
+    run_instruction_handler(function);
+
+    scheduler_tick(CYCLES_PER_INSTRUCTION + fetch_cycles);
+}
+
+void run_instruction_handler(void* function)
+{
+    // Execute
+    ((void (*)(void))function)();
 
     // TODO : Fix this because it doesn't work
     // Ugly, used so that a memory load into register gets done at the end of the next instruction
@@ -138,8 +160,39 @@ void handle_instruction(bool debug_info)
         R(cpu_state.fetch_reg_index) = cpu_state.fetch_reg_value;
         cpu_state.delay_fetch = false;
     }
+}
+
+void handle_instruction(bool debug_info)
+{
+    R0 = 0;
+
+    service_interrupts();
+
+    // Fetch and decode next instruction
+    cpu_state.current_opcode = read_word_internal(cpu_state.pc);
+
+    execute_instruction(decode_instruction(cpu_state.current_opcode), debug_info);
+}
+
+int run_cpu(bool debug_info)
+{
+    switch (cpu_backend)
+    {
+        case CPU_BACKEND_INTERPRETER:
+            handle_instruction(debug_info);
+            return 1;
+
+        case CPU_BACKEND_CACHED_INTERPRETER:
+            return run_cached_block(debug_info);
+
+        case CPU_BACKEND_RECOMPILER:
+            return run_recompiled_block(debug_info);
+
+        case CPU_BACKEND_THREADED_INTERPRETER:
+            return run_threaded_interpreter(debug_info);
+    }
 
-    system_clock_tick(2);
+    return 0;
 }
 
 /// <summary>
@@ -210,7 +263,7 @@ const instruction primary_opcodes[0x40] = {
     { "N/A", undefined },         // 3Ch
     { "N/A", undefined },         // 3Dh
     { "N/A", undefined },         // 3Eh
-    { "N/A", undefined }          // 3Fh
+    { "HLE", hle_bios_trap }      // 3Fh
 };
 
 const instruction secondary_opcodes[0x40] = {
@@ -516,17 +569,9 @@ void lb()
     // Get signed offset from 16 lower bits
     int16_t offset = (int16_t)(cpu_state.current_opcode & 0x0000FFFF);
 
-    int address = base_addr + offset;
-
-    // Get the word that contains the byte
-    uint8_t byte_index = address & 0b11;
-    uint32_t word = (uint32_t)read_word(address - byte_index);
-
-    // First byte in first 8 bits, second in the next 8 and so on
-    uint32_t mask = 0xFF << (byte_index * 8);
-    // Shift the value to bring it to an 8 bit value
-    int8_t byte = (word & mask) >> (byte_index * 8);
+    uint32_t address = base_addr + offset;
 
+    int8_t byte = (int8_t)read_byte(address);
     int32_t sign_extended = (int32_t)byte;
 
     delay_reg_fetch(rt(cpu_state.current_opcode), sign_extended);
@@ -540,7 +585,7 @@ void lh()
     // Get signed offset from 16 lower bits
     int16_t offset = (int16_t)(cpu_state.current_opcode & 0xFFFF);
 
-    int address = base_addr + offset;
+    uint32_t address = base_addr + offset;
 
     if ((address & 0b1) != 0)
     {
@@ -549,15 +594,7 @@ void lh()
         return;
     }
 
-    // Get the word that contains the byte
-    uint16_t half_word_index = (address & 0b10) >> 1;
-    uint32_t word = read_word(address - half_word_index * 2);
-
-    // First byte in first 8 bits, second in the next 8 and so on
-    uint32_t mask = 0xFFFF << (half_word_index * 16);
-    // Shift the value to bring it to a 16 bit value
-    int16_t half_word = (word & mask) >> (half_word_index * 16);
-
+    int16_t half_word = (int16_t)read_half(address);
     int32_t sign_extended = (int32_t)half_word;
 
     delay_reg_fetch(rt(cpu_state.current_opcode), sign_extended);
@@ -610,16 +647,9 @@ void lbu()
     // Get signed offset from 16 lower bits
     int16_t offset = (int16_t)(cpu_state.current_opcode & 0x0000FFFF);
 
-    int address = base_addr + offset;
-
-    // Get the word that contains the byte
-    uint8_t byte_index = address & 0b11;
-    uint32_t word = (uint32_t)read_word(address - byte_index);
+    uint32_t address = base_addr + offset;
 
-    // First byte in first 8 bits, second in the next 8 and so on
-    uint32_t mask = 0xFF << (byte_index * 8);
-    // Shift the value to bring it to an 8 bit value
-    uint32_t byte = (word & mask) >> (byte_index * 8);
+    uint32_t byte = read_byte(address);
 
     delay_reg_fetch(rt(cpu_state.current_opcode), byte);
 }
@@ -632,7 +662,7 @@ void lhu()
     // Get signed offset from 16 lower bits
     int16_t offset = (int16_t)(cpu_state.current_opcode & 0x0000FFFF);
 
-    int address = base_addr + offset;
+    uint32_t address = base_addr + offset;
 
     if ((address & 0b1) != 0)
     {
@@ -641,14 +671,7 @@ void lhu()
         return;
     }
 
-    // Get the word that contains the byte
-    uint16_t half_word_index = (address & 0b10) >> 1;
-    uint32_t word = (uint32_t)read_word(address - half_word_index * 2);
-
-    // First byte in first 8 bits, second in the next 8 and so on
-    uint32_t mask = 0xFFFF << (half_word_index * 16);
-    // Shift the value to bring it to an 8 bit value
-    uint16_t half_word = (word & mask) >> (half_word_index * 16);
+    uint32_t half_word = read_half(address);
 
     delay_reg_fetch(rt(cpu_state.current_opcode), half_word);
 }
@@ -678,34 +701,11 @@ void sb()
     // Get signed offset from 16 lower bits
     int16_t offset = (int16_t)(cpu_state.current_opcode & 0x0000FFFF);
 
-    int address = base_addr + offset;
+    uint32_t address = base_addr + offset;
 
     uint8_t value = R(rt(cpu_state.current_opcode)) & 0xFF;
 
-    // Where the byte is located in the word
-    int byte_index = address & 0b11;
-    // The address of the aligned word where the byte will be stored
-    int word_index = address - byte_index;
-
-    // A mask to keep all the original bits except the ones we're replacing
-    uint32_t original_value_mask = ~(0xFF << (byte_index * 8));
-    // The bits of the new value shifted to the right position
-    uint32_t indexed_value = value << (byte_index * 8);
-
-    // Original value in memory
-    uint32_t word_value;
-    if (address >= 0x1F801800 && address <= 0x1F801803)
-        word_value = read_word(address);
-    else
-        word_value = read_word(word_index);
-    uint32_t new_value = (word_value & original_value_mask) | indexed_value;
-
-    // TODO : Ugly hack to get correct addresses on CDROM R/W
-    // Need to make a dedicated 8 bit write function!
-    if (address >= 0x1F801800 && address <= 0x1F801803)
-        write_word(address, new_value);
-    else
-        write_word(word_index, new_value);
+    write_byte(address, value);
 }
 
 void sh()
@@ -716,7 +716,7 @@ void sh()
     // Get signed offset from 16 lower bits
     int16_t offset = (int16_t)(cpu_state.current_opcode & 0x0000FFFF);
 
-    int address = base_addr + offset;
+    uint32_t address = base_addr + offset;
 
     if ((address & 0b1) != 0)
     {
@@ -727,21 +727,7 @@ void sh()
 
     uint16_t value = R(rt(cpu_state.current_opcode)) & 0xFFFF;
 
-    // Where the half word is located in the word
-    int half_word_index = (address & 0b10) >> 1;
-    // The address of the aligned word where the half word will be stored
-    int word_index = address - half_word_index * 2;
-
-    // A mask to keep all the original bits except the ones we're replacing
-    uint32_t original_value_mask = ~(0xFFFF << (half_word_index * 16));
-    // The bits of the new value shifted to the right position
-    uint32_t indexed_value = value << (half_word_index * 16);
-
-    // Original value in memory
-    uint32_t word_value = read_word(word_index);
-    uint32_t new_value = (word_value & original_value_mask) | indexed_value;
-    
-    write_word(word_index, new_value);
+    write_half(address, value);
 }
 
 void swl()
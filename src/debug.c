@@ -8,7 +8,7 @@
 #include "logging.h"
 #include "cpu.h"
 
-DebugState debug_state = {
+PSX_THREAD_LOCAL DebugState debug_state = {
 	.code_breakpoints = {0},
 	.breakpoint_count = 0,
 	.in_debug = false,
@@ -17,7 +17,7 @@ DebugState debug_state = {
 	.char_index = 0,
 };
 
-char input[256] = {0};
+PSX_THREAD_LOCAL char input[256] = {0};
 
 char* menu_string = {
 	"Use the following commands to interact with the debugger:\n\t"
@@ -0,0 +1,55 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "dirty_pages.h"
+
+PSX_THREAD_LOCAL DirtyPageState dirty_pages = {0};
+
+void mark_ram_range_dirty(uint32_t ram_address, uint32_t size)
+{
+	if (size == 0)
+		return;
+
+	// Close to the size of RAM, the last page could also be the first one
+	if (size > RAM_SIZE - DIRTY_PAGE_SIZE)
+	{
+		memset(dirty_pages.ram, 0xFF, sizeof(dirty_pages.ram));
+		return;
+	}
+
+	uint32_t first_page = ram_address >> DIRTY_PAGE_SHIFT;
+	uint32_t last_page = ((ram_address + size - 1) & (RAM_SIZE - 1)) >> DIRTY_PAGE_SHIFT;
+
+	for (uint32_t page = first_page; ; page = (page + 1) % RAM_DIRTY_PAGE_COUNT)
+	{
+		dirty_pages.ram[page / 32] |= 1u << (page % 32);
+
+		if (page == last_page)
+			break;
+	}
+}
+
+void mark_vram_rect_dirty(uint32_t left, uint32_t top, uint32_t right, uint32_t bottom)
+{
+	// A page holds whole lines, so only the lines matter
+	uint32_t last_page = (bottom * 1024 * HALF_WORD_SIZE) >> DIRTY_PAGE_SHIFT;
+
+	for (uint32_t page = (top * 1024 * HALF_WORD_SIZE) >> DIRTY_PAGE_SHIFT; page <= last_page; page++)
+		dirty_pages.vram[page / 32] |= 1u << (page % 32);
+
+	uint32_t tiles = (2u << (right / VRAM_TILE_WIDTH)) - (1u << (left / VRAM_TILE_WIDTH));
+
+	for (uint32_t row = top / VRAM_TILE_HEIGHT; row <= bottom / VRAM_TILE_HEIGHT; row++)
+		dirty_pages.vram_tiles[row] |= tiles;
+}
+
+void mark_all_pages_dirty()
+{
+	memset(&dirty_pages, 0xFF, sizeof(dirty_pages));
+}
+
+void clear_dirty_pages()
+{
+	memset(dirty_pages.ram, 0, sizeof(dirty_pages.ram));
+	memset(dirty_pages.vram, 0, sizeof(dirty_pages.vram));
+}
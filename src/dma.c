@@ -1,14 +1,19 @@
 #include <stdint.h>
+#include <string.h>
 
 #include "dma.h"
 #include "logging.h"
 #include "memory.h"
 #include "cpu.h"
+#include "interrupt.h"
+#include "scheduler.h"
+#include "block_cache.h"
+#include "dirty_pages.h"
 
 #define DMA_CHANNELS_START 0x1F801080
 #define DMA_CHANNELS_END (0x1F8010E0 + 0x10)
 
-DMA dma_regs = {
+PSX_THREAD_LOCAL DMA dma_regs = {
 	.channels = {
 		{ .dma_madr = 0, .dma_bcr = 0, .dma_chcr = 0, .transfer_state = {0}, .dma_device = DMA_DEVICE_MDEC_IN },
 		{ .dma_madr = 0, .dma_bcr = 0, .dma_chcr = 0, .transfer_state = {0}, .dma_device = DMA_DEVICE_MDEC_OUT },
@@ -36,7 +41,13 @@ const char dma_direction_str[][20] = {
 
 void reset_dma_state()
 {
-	memset(&dma_regs, 0, sizeof(&dma_regs));
+	memset(&dma_regs, 0, sizeof(dma_regs));
+
+	// The device of each channel is fixed, and matches its index
+	for (int i = 0; i < 7; i++)
+		dma_regs.channels[i].dma_device = (DMADevice)i;
+
+	cancel_event(EVENT_DMA_COMPLETE);
 }
 
 uint32_t read_dma_regs(uint32_t address)
@@ -106,9 +117,12 @@ void write_dma_regs(uint32_t address, uint32_t value)
 
 			if (state->start_transfer)
 			{
-				handle_dma_transfer(channel);
-				// Clear bit 24 to indicate that the transfer has been completed
-				channel->dma_chcr &= ~(1 << 24);
+				// The data is moved right away, but the channel stays busy until the completion event
+				int words_transferred = handle_dma_transfer(channel);
+
+				channel->transfer_running = true;
+				channel->completion_cycle = scheduler_state.cycles + words_transferred * DMA_CYCLES_PER_WORD + 1;
+				schedule_dma_complete_event();
 			}
 			/*else
 				log_debug("No DMA started...\n");*/
@@ -121,26 +135,31 @@ void write_dma_regs(uint32_t address, uint32_t value)
 		dma_regs.dpcr = value;
 
 	else if (address == 0x1F8010F4)
-		dma_regs.dicr = value;
+	{
+		// Writing 1 to the IRQ flags acknowledges them, the master flag is read only
+		uint32_t flags = dma_regs.dicr & ~value & 0x7F000000;
+		dma_regs.dicr = (value & 0x00FFFFFF) | flags | (dma_regs.dicr & (1u << 31));
+		update_dma_irq();
+	}
 
 	else
 		log_warning("Unhandled DMA registers write at address %x\n", address);
 }
 
-static void start_linked_list_dma(DMAChannel* channel)
+static int start_linked_list_dma(DMAChannel* channel)
 {
 	DMATransferState* state = &channel->transfer_state;
 
 	if (state->dma_direction != DMA_RAM_TO_DEVICE)
 	{
 		log_warning("Unhandled DMA transfer -- Linked list in device to ram direction\n");
-		return;
+		return 0;
 	}
 
 	if (channel->dma_device != DMA_DEVICE_GPU)
 	{
 		log_warning("Unhandled DMA transfer -- Linked list with a device that is NOT the GPU\n");
-		return;
+		return 0;
 	}
 
 	// Channel 2 linked list transfer
@@ -150,6 +169,7 @@ static void start_linked_list_dma(DMAChannel* channel)
 
 	// Get the first linked list node
 	uint32_t ll_start = 0;
+	int words_transferred = 0;
 
 	while ((address & 0xFFFFFF) != 0xFFFFFF)
 	{
@@ -157,6 +177,7 @@ static void start_linked_list_dma(DMAChannel* channel)
 
 		// Get number of words from the 8 highest bits
 		uint32_t words_to_transfer = (ll_start & 0xFF000000) >> 24;
+		words_transferred += words_to_transfer + 1;
 
 		while (words_to_transfer--)
 		{
@@ -175,65 +196,78 @@ static void start_linked_list_dma(DMAChannel* channel)
 		// The address is mapped into RAM
 		ll_start = read_word(address);
 	}
+
+	return words_transferred;
 }
 
-static void start_burst_dma(DMAChannel* channel)
+static int start_burst_dma(DMAChannel* channel)
 {
 	DMATransferState* state = &channel->transfer_state;
 
 	if (state->dma_direction != DMA_DEVICE_TO_RAM)
 	{
 		log_warning("Unhandled DMA transfer -- Burst in ram to device direction\n");
-		return;
+		return 0;
 	}
 
 	if (channel->dma_device != DMA_DEVICE_OTC)
 	{
 		log_warning("Unhandled DMA transfer -- Burst with a device that is NOT the OT\n");
-		return;
+		return 0;
 	}
 
 	if (channel->dma_bcr <= 0)
-		return;
+		return 0;
+
+	int words_transferred = channel->dma_bcr;
 
-	uint32_t address = channel->dma_madr & 0xFFFFFF;
+	uint32_t address = channel->dma_madr & (RAM_SIZE - 1) & ~3;
 	int increment = state->madr_increment ? -4 : 4;
 
+	// Drop the decoded code in the whole table once, then write RAM directly
+	uint32_t table_size = words_transferred * WORD_SIZE;
+	uint32_t table_start = increment < 0 ? address + WORD_SIZE - table_size : address;
+	mark_ram_range_dirty(table_start & (RAM_SIZE - 1), table_size);
+	invalidate_cached_code_range(table_start, table_size);
+
 	// Then for all the other addresses, create pointer to the previous entry
 	for (int i = 0; i < channel->dma_bcr - 1; i++)
 	{
 		uint32_t previous_address = address;
-		address += increment;
+		address = (address + increment) & (RAM_SIZE - 1);
 
-		write_word(previous_address, address & 0xFFFFFF);
+		ram[previous_address / WORD_SIZE] = address;
 	}
 
 	// Write end node at the first address
-	write_word(address, 0x00FFFFFF);
+	ram[address / WORD_SIZE] = 0x00FFFFFF;
 
 	channel->dma_bcr = 0;
+
+	return words_transferred;
 }
 
-static void start_sliced_dma(DMAChannel* channel)
+static int start_sliced_dma(DMAChannel* channel)
 {
 	DMATransferState* state = &channel->transfer_state;
 
 	if (state->dma_direction != DMA_RAM_TO_DEVICE)
 	{
 		log_warning("Unhandled DMA transfer -- Linked list in device to ram direction\n");
-		return;
+		return 0;
 	}
 
 	if (channel->dma_device != DMA_DEVICE_GPU)
 	{
 		log_warning("Unhandled DMA transfer -- Linked list with a device that is NOT the GPU\n");
-		return;
+		return 0;
 	}
 
 	uint16_t block_size = channel->dma_bcr & 0xFFFF;
 	uint16_t block_count = (channel->dma_bcr & 0xFFFF0000) >> 16;
 
 	int total_size = block_count * block_size;
+	int words_transferred = total_size;
 	int increment = channel->transfer_state.madr_increment ? -4 : 4;
 
 	log_info("Doing sliced DMA -- Block count is %x with a block size of %x words (total size is %d)\n", block_count, block_size, total_size);
@@ -246,18 +280,87 @@ static void start_sliced_dma(DMAChannel* channel)
 
 	// Clear block count to 0 since we finished the transfer
 	channel->dma_bcr &= 0xFFFF;
+
+	return words_transferred;
 }
 
-static void handle_dma_transfer(DMAChannel* channel)
+static int handle_dma_transfer(DMAChannel* channel)
 {
 	DMATransferState* state = &channel->transfer_state;
 
 	if (state->transfer_mode == DMA_TRANSFER_LINKED_LIST)
-		start_linked_list_dma(channel);
+		return start_linked_list_dma(channel);
 	else if (state->transfer_mode == DMA_TRANSFER_BURST) // Empty OT table
-		start_burst_dma(channel);
+		return start_burst_dma(channel);
 	else if (state->transfer_mode == DMA_TRANSFER_SLICE)
-		start_sliced_dma(channel);
+		return start_sliced_dma(channel);
+
+	log_info("UNHANDLED DMA TRANSFER\n");
+	return 0;
+}
+
+/// <summary>
+/// Updates the master IRQ flag of DICR, and requests the DMA IRQ when it gets set
+/// </summary>
+static void update_dma_irq()
+{
+	bool previous_flag = dma_regs.dicr & (1u << 31);
+
+	bool force_irq = dma_regs.dicr & (1 << 15);
+	bool master_enable = dma_regs.dicr & (1 << 23);
+	uint32_t enabled_flags = (dma_regs.dicr >> 24) & (dma_regs.dicr >> 16) & 0x7F;
+
+	bool flag = force_irq || (master_enable && enabled_flags != 0);
+
+	if (flag)
+		dma_regs.dicr |= 1u << 31;
 	else
-		log_info("UNHANDLED DMA TRANSFER\n");
+		dma_regs.dicr &= ~(1u << 31);
+
+	if (flag && !previous_flag)
+		request_interrupt(IRQ_DMA);
+}
+
+/// <summary>
+/// Schedules the completion event at the end of the earliest running transfer
+/// </summary>
+static void schedule_dma_complete_event()
+{
+	uint64_t deadline = SCHEDULER_NO_EVENT;
+
+	for (int i = 0; i < 7; i++)
+	{
+		DMAChannel* channel = &dma_regs.channels[i];
+
+		if (channel->transfer_running && channel->completion_cycle < deadline)
+			deadline = channel->completion_cycle;
+	}
+
+	if (deadline == SCHEDULER_NO_EVENT)
+		cancel_event(EVENT_DMA_COMPLETE);
+	else
+		schedule_event_at(EVENT_DMA_COMPLETE, deadline);
+}
+
+void handle_dma_complete_event(uint64_t deadline)
+{
+	for (int i = 0; i < 7; i++)
+	{
+		DMAChannel* channel = &dma_regs.channels[i];
+
+		if (!channel->transfer_running || channel->completion_cycle > scheduler_state.cycles)
+			continue;
+
+		channel->transfer_running = false;
+
+		// Clear bit 24 to indicate that the transfer has been completed
+		channel->dma_chcr &= ~(1 << 24);
+
+		// Set the IRQ flag of the channel if its IRQ is enabled
+		if (dma_regs.dicr & (1 << (16 + i)))
+			dma_regs.dicr |= 1 << (24 + i);
+	}
+
+	update_dma_irq();
+	schedule_dma_complete_event();
 }
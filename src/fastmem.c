@@ -0,0 +1,227 @@
+#if defined(__linux__) && defined(__x86_64__)
+#define _GNU_SOURCE
+#define FASTMEM_SUPPORTED
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#ifdef FASTMEM_SUPPORTED
+#include <signal.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "fastmem.h"
+#include "memory.h"
+#include "recompiler.h"
+#include "logging.h"
+
+PSX_THREAD_LOCAL FastmemState fastmem_state = {
+	.base = NULL,
+	.enabled = false,
+	.backing = NULL,
+	.backing_fd = -1,
+};
+
+#ifdef FASTMEM_SUPPORTED
+
+/// <summary>
+/// The signal handler that was installed before ours, used for faults that don't come from recompiled code.
+/// The handler is shared by the threads of the process, it finds the arena of the faulting thread in its fastmem_state
+/// </summary>
+static struct sigaction previous_action;
+
+/// <summary>
+/// 0 until the first thread starts installing the signal handler, 1 while it does, 2 once it is installed
+/// </summary>
+static atomic_int handler_state = 0;
+
+/// <summary>
+/// Redirects faulting memory accesses of recompiled code to their slow path
+/// </summary>
+static void handle_fault(int signal, siginfo_t* info, void* context)
+{
+	ucontext_t* user_context = context;
+	uint8_t* fault_address = info->si_addr;
+
+	if (fault_address >= fastmem_state.base && fault_address < fastmem_state.base + FASTMEM_ARENA_SIZE)
+	{
+		uint8_t* host_pc = (uint8_t*)user_context->uc_mcontext.gregs[REG_RIP];
+		uint8_t* slow_path = handle_fastmem_fault(host_pc);
+
+		if (slow_path != NULL)
+		{
+			user_context->uc_mcontext.gregs[REG_RIP] = (greg_t)slow_path;
+			return;
+		}
+	}
+
+	// A genuine crash, let it be handled as if we weren't there
+	sigaction(SIGSEGV, &previous_action, NULL);
+}
+
+/// <summary>
+/// Maps a region of the backing memory at a guest address of the arena
+/// </summary>
+/// <returns>0 if the mapping worked, -1 otherwise</returns>
+static int map_region(int fd, uint32_t guest_address, size_t offset, size_t size, bool writable)
+{
+	int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+	void* address = fastmem_state.base + guest_address;
+
+	if (mmap(address, size, protection, MAP_SHARED | MAP_FIXED, fd, offset) == MAP_FAILED)
+	{
+		log_error("Couldn't map fastmem region at %x\n", guest_address);
+		return -1;
+	}
+
+	return 0;
+}
+
+/// <summary>
+/// Maps all the guest memory regions in the arena
+/// </summary>
+/// <returns>0 if the mappings worked, -1 otherwise</returns>
+static int map_regions(int fd)
+{
+	static const uint32_t segments[] = { 0x00000000, 0x80000000, 0xA0000000 }; // KUSEG, KSEG0, KSEG1
+
+	for (int i = 0; i < 3; i++)
+	{
+		for (uint32_t mirror = 0; mirror < RAM_MIRROR_SIZE; mirror += RAM_SIZE)
+			if (map_region(fd, segments[i] + mirror, RAM_OFFSET, RAM_SIZE, true) != 0)
+				return -1;
+
+		if (map_region(fd, segments[i] + 0x1FC00000, BIOS_ROM_OFFSET, BIOS_ROM_SIZE, false) != 0)
+			return -1;
+	}
+
+	// The scratchpad is left out: it is only 1 KiB, mapping its host page would let 0x1F800400-0x1F800FFF
+	// succeed instead of going through the slow path. Its accesses fault once and their sites get patched
+	return 0;
+}
+
+uint8_t* init_fastmem()
+{
+	if (sysconf(_SC_PAGESIZE) != 4 * KIB_SIZE)
+	{
+		log_warning("Fastmem needs 4 KiB host pages, using the page tables only\n");
+		return NULL;
+	}
+
+	int fd = memfd_create("psx-memory", MFD_CLOEXEC);
+	if (fd == -1)
+	{
+		log_warning("Couldn't create the fastmem backing memory, using the page tables only\n");
+		return NULL;
+	}
+
+	if (ftruncate(fd, MEMORY_BACKING_SIZE) != 0)
+	{
+		log_warning("Couldn't size the fastmem backing memory, using the page tables only\n");
+		close(fd);
+		return NULL;
+	}
+
+	fastmem_state.base = mmap(NULL, FASTMEM_ARENA_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	fastmem_state.backing = mmap(NULL, MEMORY_BACKING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if (fastmem_state.base == MAP_FAILED || fastmem_state.backing == MAP_FAILED || map_regions(fd) != 0)
+	{
+		log_warning("Couldn't reserve the fastmem arena, using the page tables only\n");
+
+		if (fastmem_state.base != MAP_FAILED)
+			munmap(fastmem_state.base, FASTMEM_ARENA_SIZE);
+		if (fastmem_state.backing != MAP_FAILED)
+			munmap(fastmem_state.backing, MEMORY_BACKING_SIZE);
+
+		fastmem_state.base = NULL;
+		fastmem_state.backing = NULL;
+		close(fd);
+
+		return NULL;
+	}
+
+	fastmem_state.backing_fd = fd;
+
+	int expected_state = 0;
+
+	if (atomic_compare_exchange_strong(&handler_state, &expected_state, 1))
+	{
+		struct sigaction action = {0};
+		action.sa_sigaction = handle_fault;
+		action.sa_flags = SA_SIGINFO;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGSEGV, &action, &previous_action);
+
+		atomic_store(&handler_state, 2);
+	}
+
+	// Another thread may still be installing it
+	while (atomic_load(&handler_state) != 2)
+		;
+
+	fastmem_state.enabled = true;
+
+	return fastmem_state.backing;
+}
+
+void free_fastmem()
+{
+	if (fastmem_state.base != NULL)
+	{
+		munmap(fastmem_state.base, FASTMEM_ARENA_SIZE);
+		munmap(fastmem_state.backing, MEMORY_BACKING_SIZE);
+		close(fastmem_state.backing_fd);
+	}
+
+	fastmem_state.base = NULL;
+	fastmem_state.backing = NULL;
+	fastmem_state.backing_fd = -1;
+	fastmem_state.enabled = false;
+}
+
+int map_fastmem_bios(int fd)
+{
+	static const uint32_t segments[] = { 0x00000000, 0x80000000, 0xA0000000 }; // KUSEG, KSEG0, KSEG1
+
+	if (!fastmem_state.enabled)
+		return 0;
+
+	int source_fd = fd != -1 ? fd : fastmem_state.backing_fd;
+	size_t offset = fd != -1 ? 0 : BIOS_ROM_OFFSET;
+
+	for (int i = 0; i < 3; i++)
+	{
+		if (map_region(source_fd, segments[i] + 0x1FC00000, offset, BIOS_ROM_SIZE, false) != 0)
+		{
+			// A failed MAP_FIXED leaves the range in an unknown state, recompiled code can't rely on it anymore
+			fastmem_state.enabled = false;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+#else
+
+uint8_t* init_fastmem()
+{
+	return NULL;
+}
+
+void free_fastmem()
+{
+}
+
+int map_fastmem_bios(int fd)
+{
+	return 0;
+}
+
+#endif
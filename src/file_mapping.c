@@ -0,0 +1,106 @@
+#if defined(__unix__) || defined(__APPLE__)
+#define FILE_MAPPING_SUPPORTED
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef FILE_MAPPING_SUPPORTED
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "file_mapping.h"
+
+static const FileMapping empty_mapping = {
+	.data = NULL,
+	.size = 0,
+	.fd = -1,
+};
+
+#ifdef FILE_MAPPING_SUPPORTED
+
+int map_file(const char* path, FileMapping* mapping)
+{
+	*mapping = empty_mapping;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	struct stat file_stat;
+
+	if (fd == -1)
+		return -1;
+
+	if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	void* data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+	if (data == MAP_FAILED)
+	{
+		close(fd);
+		return -1;
+	}
+
+	mapping->data = data;
+	mapping->size = file_stat.st_size;
+	mapping->fd = fd;
+
+	return 0;
+}
+
+void unmap_file(FileMapping* mapping)
+{
+	if (mapping->data != NULL)
+	{
+		munmap((void*)mapping->data, mapping->size);
+		close(mapping->fd);
+	}
+
+	*mapping = empty_mapping;
+}
+
+#else
+
+int map_file(const char* path, FileMapping* mapping)
+{
+	*mapping = empty_mapping;
+
+	FILE* file = fopen(path, "rb");
+
+	if (file == NULL)
+		return -1;
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	rewind(file);
+
+	uint8_t* data = size > 0 ? malloc(size) : NULL;
+
+	if (data == NULL || fread(data, 1, size, file) != (size_t)size)
+	{
+		free(data);
+		fclose(file);
+		return -1;
+	}
+
+	fclose(file);
+
+	mapping->data = data;
+	mapping->size = size;
+
+	return 0;
+}
+
+void unmap_file(FileMapping* mapping)
+{
+	free((void*)mapping->data);
+	*mapping = empty_mapping;
+}
+
+#endif
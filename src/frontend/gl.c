@@ -1,4 +1,5 @@
 #include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 
 #include <glad/glad.h>
@@ -9,6 +10,7 @@
 #include "logging.h"
 #include "debug.h"
 #include "gpu.h"
+#include "dirty_pages.h"
 
 #define WINDOW_WIDTH 1280
 #define WINDOW_HEIGHT 800
@@ -16,29 +18,77 @@
 #define VRAM_WIDTH 1024
 #define VRAM_HEIGHT 512
 
-// Flat/Gouraud polygon shader
-const char* color_v_shader =
+// Batched polygon shader, flat/gouraud shaded or textured depending on the texture page attribute
+// Textured primitives read their texels and CLUT entries straight from VRAM
+const char* batch_v_shader =
     "#version 410 core\n"
-    "layout(location = 0) in vec3 aPos;"
+    "layout(location = 0) in vec2 aPos;"
     "layout(location = 1) in vec3 aColor;"
+    "layout(location = 2) in vec2 aTexCoord;"
+    "layout(location = 3) in uint aTexPage;"
+    "layout(location = 4) in uint aClut;"
     "out vec3 color;"
+    "out vec2 texCoord;"
+    "flat out uint texPage;"
+    "flat out uint clut;"
     "void main()"
     "{"
-    "   gl_Position = vec4(aPos, 1.0);"
+    "   gl_Position = vec4(aPos, 0.0, 1.0);"
     "   color = aColor;"
+    "   texCoord = aTexCoord;"
+    "   texPage = aTexPage;"
+    "   clut = aClut;"
     "}";
 
-const char* color_f_shader =
+const char* batch_f_shader =
     "#version 410 core\n"
     "in vec3 color;"
+    "in vec2 texCoord;"
+    "flat in uint texPage;"
+    "flat in uint clut;"
     "out vec4 FragColor;"
+    "uniform usampler2D vramSampler;"
+    "uniform uvec2 textureWindowMask;"
+    "uniform uvec2 textureWindowOffset;"
+    "uint readVram(uvec2 position)"
+    "{"
+    "   return texelFetch(vramSampler, ivec2(position.x & 1023u, position.y & 511u), 0).r;"
+    "}"
     "void main()"
     "{"
-    "   FragColor = vec4(color, 1.0);"
+    "   if ((texPage & 0x8000u) == 0u)"
+    "   {"
+    "       FragColor = vec4(color, 1.0);"
+    "       return;"
+    "   }"
+    // The texture window replaces the masked UV bits with the offset ones, both are in 8 pixel steps
+    "   uvec2 uv = uvec2(texCoord) & 255u;"
+    "   uv = (uv & ~(textureWindowMask * 8u)) | ((textureWindowOffset & textureWindowMask) * 8u);"
+    "   uvec2 pageBase = uvec2((texPage & 0xFu) * 64u, ((texPage >> 4) & 1u) * 256u);"
+    "   uvec2 clutBase = uvec2((clut & 0x3Fu) * 16u, (clut >> 6) & 0x1FFu);"
+    "   uint colors = (texPage >> 7) & 3u;"
+    "   uint texel;"
+    // 4 and 8 bit pages pack 4 and 2 CLUT indices in each halfword, from the lowest bits
+    "   if (colors == 0u)"
+    "   {"
+    "       uint index = (readVram(pageBase + uvec2(uv.x / 4u, uv.y)) >> ((uv.x & 3u) * 4u)) & 0xFu;"
+    "       texel = readVram(clutBase + uvec2(index, 0u));"
+    "   }"
+    "   else if (colors == 1u)"
+    "   {"
+    "       uint index = (readVram(pageBase + uvec2(uv.x / 2u, uv.y)) >> ((uv.x & 1u) * 8u)) & 0xFFu;"
+    "       texel = readVram(clutBase + uvec2(index, 0u));"
+    "   }"
+    "   else"
+    "       texel = readVram(pageBase + uv);"
+    // A texel of 0 is fully transparent
+    "   if (texel == 0u)"
+    "       discard;"
+    "   FragColor = vec4(vec3(texel & 0x1Fu, (texel >> 5) & 0x1Fu, (texel >> 10) & 0x1Fu) / 31.0, 1.0);"
     "}";
 
-// Textured polygon shader
-const char* texture_v_shader =
+// Blit to quad shader
+const char* blit_v_shader =
     "#version 410 core\n"
     "layout(location = 0) in vec3 aPos;"
     "layout(location = 1) in vec2 aTexCoord;"
@@ -49,38 +99,19 @@ const char* texture_v_shader =
     "   texCoord = aTexCoord;"
     "}";
 
-const char* texture_f_shader =
+// VRAM view shader, shows the raw VRAM halfwords as 15 bit colors
+// The area uniforms pick the part of VRAM shown, the coordinates wrap around like the VRAM addresses do
+const char* vram_view_f_shader =
     "#version 410 core\n"
     "in vec2 texCoord;"
     "out vec4 FragColor;"
-    "uniform sampler2D textureSampler;"
-    "uniform sampler1D clutSampler;"
-    "uniform int clutSize;"
+    "uniform usampler2D vramSampler;"
+    "uniform vec2 areaOffset;"
+    "uniform vec2 areaScale;"
     "void main()"
     "{"
-    "   if (clutSize == 0)"
-    "       FragColor = texture(textureSampler, texCoord);"
-    "   else"
-    "   {"
-    "       float clutIndex = texture(textureSampler, texCoord).r;"
-    "       vec3 pixelColor = texture(clutSampler, clutIndex).rgb;"
-    "       float opacity = 1.0f;"
-    "       if (pixelColor.r == 0.0f && pixelColor.g == 0.0f && pixelColor.b == 0.0f)"
-    "           opacity = 0.0f;"
-    "       FragColor = vec4(pixelColor, opacity);"
-    "   }"
-    "}";
-
-// Blit to quad shader
-const char* blit_v_shader =
-    "#version 410 core\n"
-    "layout(location = 0) in vec3 aPos;"
-    "layout(location = 1) in vec2 aTexCoord;"
-    "out vec2 texCoord;"
-    "void main()"
-    "{"
-    "   gl_Position = vec4(aPos, 1.0);"
-    "   texCoord = aTexCoord;"
+    "   uint texel = texture(vramSampler, areaOffset + texCoord * areaScale).r;"
+    "   FragColor = vec4(vec3(texel & 0x1Fu, (texel >> 5) & 0x1Fu, (texel >> 10) & 0x1Fu) / 31.0, 1.0);"
     "}";
 
 const char* blit_f_shader =
@@ -113,12 +144,14 @@ const float quad_tex_coords[] = {
     0.0f, 1.0f, // Bottom left
 };
 
-Frontend frontend_state = {
+PSX_THREAD_LOCAL Frontend frontend_state = {
 	.window = NULL,
     .fullscreen_mode = false,
-    .color_shader = 0,
+    .batch_shader = 0,
     .blit_shader = 0,
-    .current_render_target = &frontend_state.psx_render_target,
+    .batch_vertices = NULL,
+    .current_render_target = NULL,
+    .vram_view_outdated = true,
     .psx_render_target = {
         .framebuffer = 0,
         .depth_stencil_buffer = 0,
@@ -166,390 +199,407 @@ static void setup_blit_quad()
     glEnableVertexAttribArray(1);
 }
 
+static void setup_batch_buffer()
+{
+    glGenVertexArrays(1, &frontend_state.batch_vao);
+    glGenBuffers(1, &frontend_state.batch_vbo);
+
+    glBindVertexArray(frontend_state.batch_vao);
+
+    // The storage is orphaned and mapped again each time the ring wraps around
+    glBindBuffer(GL_ARRAY_BUFFER, frontend_state.batch_vbo);
+    glBufferData(GL_ARRAY_BUFFER, RENDER_BATCH_VERTEX_COUNT * sizeof(BatchVertex), NULL, GL_STREAM_DRAW);
+
+    // Interleaved position, color, UV, texture page and CLUT
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(BatchVertex), (void*)offsetof(BatchVertex, position));
+    glEnableVertexAttribArray(0);
+
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(BatchVertex), (void*)offsetof(BatchVertex, color));
+    glEnableVertexAttribArray(1);
+
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(BatchVertex), (void*)offsetof(BatchVertex, uv));
+    glEnableVertexAttribArray(2);
+
+    glVertexAttribIPointer(3, 1, GL_UNSIGNED_SHORT, sizeof(BatchVertex), (void*)offsetof(BatchVertex, texture_page));
+    glEnableVertexAttribArray(3);
+
+    glVertexAttribIPointer(4, 1, GL_UNSIGNED_SHORT, sizeof(BatchVertex), (void*)offsetof(BatchVertex, clut));
+    glEnableVertexAttribArray(4);
+
+    glBindVertexArray(0);
+
+    frontend_state.batch_vertices = NULL;
+    frontend_state.batch_offset = 0;
+    frontend_state.batch_count = 0;
+}
+
+static void setup_vram_sample_texture()
+{
+    // Integer texture holding the raw VRAM halfwords, the shader decodes them
+    glGenTextures(1, &frontend_state.vram_sample_tex);
+    glBindTexture(GL_TEXTURE_2D, frontend_state.vram_sample_tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, VRAM_WIDTH, VRAM_HEIGHT, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, gpu_state.vram);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // The whole VRAM was just uploaded, the next uploads go through the pixel buffer
+    memset(dirty_pages.vram_tiles, 0, sizeof(dirty_pages.vram_tiles));
+    frontend_state.vram_view_outdated = true;
+
+    glGenBuffers(1, &frontend_state.vram_upload_pbo);
+
+    frontend_state.batch_texture_window_mask = gpu_state.texture_window_mask;
+    frontend_state.batch_texture_window_offset = gpu_state.texture_window_offset;
+
+    glUseProgram(frontend_state.batch_shader);
+    glUniform1i(glGetUniformLocation(frontend_state.batch_shader, "vramSampler"), 0);
+    glUseProgram(0);
+}
+
 void start_gl_state()
 {
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    frontend_state.color_shader = compile_shader(color_v_shader, color_f_shader);
-    frontend_state.texture_shader = compile_shader(texture_v_shader, texture_f_shader);
+    frontend_state.batch_shader = compile_shader(batch_v_shader, batch_f_shader);
     frontend_state.blit_shader = compile_shader(blit_v_shader, blit_f_shader);
+    frontend_state.vram_view_shader = compile_shader(blit_v_shader, vram_view_f_shader);
+
+    // The address of the thread local state isn't a constant, so the initializer can't point at it
+    frontend_state.current_render_target = &PSX_RT;
 
     create_framebuffer(&PSX_RT);
     create_framebuffer(&VRAM_RT);
 
     setup_blit_quad();
-
-    // Render texture for the VRAM
-    glGenTextures(1, &frontend_state.vram_tex);
-    glBindTexture(GL_TEXTURE_2D, frontend_state.vram_tex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, VRAM_WIDTH, VRAM_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, 0);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    setup_batch_buffer();
+    setup_vram_sample_texture();
 }
 
 void reset_gl_state()
 {
-    glDeleteProgram(frontend_state.color_shader);
-    glDeleteProgram(frontend_state.texture_shader);
+    flush_render_batch();
+
+    glDeleteProgram(frontend_state.batch_shader);
     glDeleteProgram(frontend_state.blit_shader);
+    glDeleteProgram(frontend_state.vram_view_shader);
 
-    glDeleteTextures(1, &frontend_state.vram_tex);
+    glDeleteTextures(1, &frontend_state.vram_sample_tex);
+    glDeleteBuffers(1, &frontend_state.vram_upload_pbo);
 
     glDeleteVertexArrays(1, &frontend_state.blit_quad_vao);
     glDeleteBuffers(1, &frontend_state.blit_quad_vbo);
     glDeleteBuffers(1, &frontend_state.blit_quad_texture_bo);
 
+    glDeleteVertexArrays(1, &frontend_state.batch_vao);
+    glDeleteBuffers(1, &frontend_state.batch_vbo);
+
     delete_framebuffer(&PSX_RT);
     delete_framebuffer(&VRAM_RT);
 }
 
-void draw_pixel(uint16_t x_coord, uint16_t y_coord, uint8_t red, uint8_t green, uint8_t blue)
+/// <summary>
+/// Uploads the tiles of VRAM written since the last upload to the texture sampled by the shaders, through the
+/// pixel buffer so the copy to the texture doesn't stall the emulation
+/// </summary>
+/// <returns>true if something was uploaded</returns>
+static bool upload_written_vram()
 {
-    glBindFramebuffer(GL_FRAMEBUFFER, PSX_RT.framebuffer);
-    glViewport(0, 0, frontend_state.psx_render_target.size.x, frontend_state.psx_render_target.size.y);
-    glEnable(GL_SCISSOR_TEST);
+    bool written = false;
 
-    y_coord = PSX_RT.size.y - y_coord;
+    for (int row = 0; row < VRAM_TILE_ROWS; row++)
+        written |= dirty_pages.vram_tiles[row] != 0;
 
-    glScissor(x_coord, y_coord, 1, 1);
-    glClearColor(red / 255.0f, green / 255.0f, blue / 255.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT);
-    glDisable(GL_SCISSOR_TEST);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
+    if (!written)
+        return false;
 
-void draw_triangle(Triangle triangle)
-{
-    // Prepare vertices for OpenGL
-    float vertices[9] = {
-        (triangle.v1.position.x / PSX_RT.size.x) * 2.0f - 1.0f,
-        1.0f - (triangle.v1.position.y / PSX_RT.size.y) * 2.0f,
-        0.0f,
-        (triangle.v2.position.x / PSX_RT.size.x) * 2.0f - 1.0f,
-        1.0f - (triangle.v2.position.y / PSX_RT.size.y) * 2.0f,
-        0.0f,
-        (triangle.v3.position.x / PSX_RT.size.x) * 2.0f - 1.0f,
-        1.0f - (triangle.v3.position.y / PSX_RT.size.y) * 2.0f,
-        0.0f
-    };
-
-    float colors[9] = {
-        triangle.v1.color.r / 255.0f,
-        triangle.v1.color.g / 255.0f,
-        triangle.v1.color.b / 255.0f,
-        triangle.v2.color.r / 255.0f,
-        triangle.v2.color.g / 255.0f,
-        triangle.v2.color.b / 255.0f,
-        triangle.v3.color.r / 255.0f,
-        triangle.v3.color.g / 255.0f,
-        triangle.v3.color.b / 255.0f,
-    };
+    // Orphan the buffer, the previous upload may still be reading from it
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, frontend_state.vram_upload_pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, sizeof(gpu_state.vram), NULL, GL_STREAM_DRAW);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, PSX_RT.framebuffer);
-    glViewport(0, 0, frontend_state.psx_render_target.size.x, frontend_state.psx_render_target.size.y);
-    glUseProgram(frontend_state.color_shader);
+    uint16_t* staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, sizeof(gpu_state.vram),
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
 
-    GLuint vao = 0;
-    GLuint vbo = 0;
-    GLuint color_bo = 0;
+    if (staging == NULL)
+    {
+        log_error("Couldn't map the VRAM upload buffer!\n");
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return false;
+    }
 
-    glGenVertexArrays(1, &vao);
-    glGenBuffers(1, &vbo);
-    glGenBuffers(1, &color_bo);
+    // The buffer has the layout of VRAM, only the written tiles are copied into it
+    for (int row = 0; row < VRAM_TILE_ROWS; row++)
+    {
+        uint16_t tiles = dirty_pages.vram_tiles[row];
 
-    glBindVertexArray(vao);
+        for (int tile = 0; tile < 16; tile++)
+        {
+            if (!(tiles & (1 << tile)))
+                continue;
 
-    // Send vertices
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+            for (int line = row * VRAM_TILE_HEIGHT; line < (row + 1) * VRAM_TILE_HEIGHT; line++)
+            {
+                uint32_t offset = line * VRAM_WIDTH + tile * VRAM_TILE_WIDTH;
+                memcpy(&staging[offset], &gpu_state.vram[offset], VRAM_TILE_WIDTH * sizeof(uint16_t));
+            }
+        }
+    }
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
+    if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_FALSE)
+    {
+        // The tiles stay dirty, they are uploaded again next time
+        log_warning("The VRAM upload buffer was corrupted, retrying the upload later\n");
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return false;
+    }
 
-    // Send colors
-    glBindBuffer(GL_ARRAY_BUFFER, color_bo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(colors), colors, GL_STATIC_DRAW);
+    glBindTexture(GL_TEXTURE_2D, frontend_state.vram_sample_tex);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, VRAM_WIDTH);
 
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(1);
+    // Upload a rectangle for each run of written tiles, spanning the following tile rows written the same way
+    int row = 0;
 
-    glDrawArrays(GL_TRIANGLES, 0, 3);
+    while (row < VRAM_TILE_ROWS)
+    {
+        uint16_t tiles = dirty_pages.vram_tiles[row];
+        int row_count = 1;
 
-    glDeleteVertexArrays(1, &vao);
-    glDeleteBuffers(1, &vbo);
-    glDeleteBuffers(1, &color_bo);
+        while (row + row_count < VRAM_TILE_ROWS && dirty_pages.vram_tiles[row + row_count] == tiles)
+            row_count++;
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
+        int tile = 0;
 
-void draw_textured_triangle(Triangle triangle)
-{
-    log_warning("Unhandled OpenGL function -- draw_textured_triangle !\n");
+        while (tile < 16)
+        {
+            if (!(tiles & (1 << tile)))
+            {
+                tile++;
+                continue;
+            }
+
+            int tile_count = 1;
+
+            while (tile + tile_count < 16 && (tiles & (1 << (tile + tile_count))))
+                tile_count++;
+
+            int x = tile * VRAM_TILE_WIDTH;
+            int y = row * VRAM_TILE_HEIGHT;
+
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, tile_count * VRAM_TILE_WIDTH, row_count * VRAM_TILE_HEIGHT,
+                GL_RED_INTEGER, GL_UNSIGNED_SHORT, (void*)((y * VRAM_WIDTH + x) * sizeof(uint16_t)));
+
+            tile += tile_count;
+        }
+
+        row += row_count;
+    }
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    memset(dirty_pages.vram_tiles, 0, sizeof(dirty_pages.vram_tiles));
+    frontend_state.vram_view_outdated = true;
+
+    return true;
 }
 
-void draw_quad(Quad quad)
+void flush_render_batch()
 {
-    // Prepare vertices for OpenGL
-    float vertices[18] = {
-        (quad.v1.position.x / PSX_RT.size.x) * 2.0f - 1.0f,
-        1.0f - (quad.v1.position.y / PSX_RT.size.y) * 2.0f,
-        0.0f,
-        (quad.v2.position.x / PSX_RT.size.x) * 2.0f - 1.0f,
-        1.0f - (quad.v2.position.y / PSX_RT.size.y) * 2.0f,
-        0.0f,
-        (quad.v3.position.x / PSX_RT.size.x) * 2.0f - 1.0f,
-        1.0f - (quad.v3.position.y / PSX_RT.size.y) * 2.0f,
-        0.0f,
-        (quad.v2.position.x / PSX_RT.size.x) * 2.0f - 1.0f,
-        1.0f - (quad.v2.position.y / PSX_RT.size.y) * 2.0f,
-        0.0f,
-        (quad.v3.position.x / PSX_RT.size.x) * 2.0f - 1.0f,
-        1.0f - (quad.v3.position.y / PSX_RT.size.y) * 2.0f,
-        0.0f,
-        (quad.v4.position.x / PSX_RT.size.x) * 2.0f - 1.0f,
-        1.0f - (quad.v4.position.y / PSX_RT.size.y) * 2.0f,
-        0.0f
-    };
-
-    float colors[18] = {
-        quad.v1.color.r / 255.0f,
-        quad.v1.color.g / 255.0f,
-        quad.v1.color.b / 255.0f,
-        quad.v2.color.r / 255.0f,
-        quad.v2.color.g / 255.0f,
-        quad.v2.color.b / 255.0f,
-        quad.v3.color.r / 255.0f,
-        quad.v3.color.g / 255.0f,
-        quad.v3.color.b / 255.0f,
-        quad.v2.color.r / 255.0f,
-        quad.v2.color.g / 255.0f,
-        quad.v2.color.b / 255.0f,
-        quad.v3.color.r / 255.0f,
-        quad.v3.color.g / 255.0f,
-        quad.v3.color.b / 255.0f,
-        quad.v4.color.r / 255.0f,
-        quad.v4.color.g / 255.0f,
-        quad.v4.color.b / 255.0f,
-    };
+    if (frontend_state.batch_vertices == NULL)
+        return;
 
-    glBindFramebuffer(GL_FRAMEBUFFER, PSX_RT.framebuffer);
-    glViewport(0, 0, frontend_state.psx_render_target.size.x, frontend_state.psx_render_target.size.y);
-    glUseProgram(frontend_state.color_shader);
+    int count = frontend_state.batch_count;
 
-    GLuint vao = 0;
-    GLuint vbo = 0;
-    GLuint color_bo = 0;
+    glBindBuffer(GL_ARRAY_BUFFER, frontend_state.batch_vbo);
 
-    glGenVertexArrays(1, &vao);
-    glGenBuffers(1, &vbo);
-    glGenBuffers(1, &color_bo);
+    if (count != 0)
+        glFlushMappedBufferRange(GL_ARRAY_BUFFER, 0, count * sizeof(BatchVertex));
 
-    glBindVertexArray(vao);
+    frontend_state.batch_vertices = NULL;
+    frontend_state.batch_count = 0;
 
-    // Send vertices
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    // The contents of the buffer are lost if it was corrupted while mapped
+    if (glUnmapBuffer(GL_ARRAY_BUFFER) == GL_FALSE)
+    {
+        log_warning("The batch vertex buffer was corrupted, dropping %d vertices\n", count);
+        return;
+    }
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
+    if (count == 0)
+        return;
 
-    // Send colors
-    glBindBuffer(GL_ARRAY_BUFFER, color_bo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(colors), colors, GL_STATIC_DRAW);
+    glBindFramebuffer(GL_FRAMEBUFFER, PSX_RT.framebuffer);
+    glViewport(0, 0, frontend_state.psx_render_target.size.x, frontend_state.psx_render_target.size.y);
+    glUseProgram(frontend_state.batch_shader);
 
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(1);
+    // The primitives are drawn before VRAM is written again, so they see what is written up to now
+    upload_written_vram();
 
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, frontend_state.vram_sample_tex);
 
-    glDeleteVertexArrays(1, &vao);
-    glDeleteBuffers(1, &vbo);
-    glDeleteBuffers(1, &color_bo);
+    Vec2 mask = frontend_state.batch_texture_window_mask;
+    Vec2 offset = frontend_state.batch_texture_window_offset;
+    glUniform2ui(glGetUniformLocation(frontend_state.batch_shader, "textureWindowMask"), mask.x, mask.y);
+    glUniform2ui(glGetUniformLocation(frontend_state.batch_shader, "textureWindowOffset"), offset.x, offset.y);
 
+    glBindVertexArray(frontend_state.batch_vao);
+    glDrawArrays(GL_TRIANGLES, frontend_state.batch_offset, count);
+
+    glBindVertexArray(0);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    frontend_state.batch_offset += count;
 }
 
-void draw_textured_quad(Quad quad)
+/// <summary>
+/// Makes sure the current batch has room for more vertices, mapping the next part of the ring buffer if needed
+/// </summary>
+/// <param name="vertex_count">The number of vertices that will be added</param>
+static void reserve_batch_vertices(int vertex_count)
 {
-    // Prepare vertices for OpenGL
-    // Invert y coordinate to match with OpenGL coordinate system
-    // And convert values from pixel positions to NDC range
-    float vertices[18] = {
-        (quad.v1.position.x / PSX_RT.size.x) * 2.0f - 1.0f,
-        1.0f - (quad.v1.position.y / PSX_RT.size.y) * 2.0f,
-        0.0f,
-        (quad.v2.position.x / PSX_RT.size.x) * 2.0f - 1.0f,
-        1.0f - (quad.v2.position.y / PSX_RT.size.y) * 2.0f,
-        0.0f,
-        (quad.v3.position.x / PSX_RT.size.x) * 2.0f - 1.0f,
-        1.0f - (quad.v3.position.y / PSX_RT.size.y) * 2.0f,
-        0.0f,
-        (quad.v2.position.x / PSX_RT.size.x) * 2.0f - 1.0f,
-        1.0f - (quad.v2.position.y / PSX_RT.size.y) * 2.0f,
-        0.0f,
-        (quad.v3.position.x / PSX_RT.size.x) * 2.0f - 1.0f,
-        1.0f - (quad.v3.position.y / PSX_RT.size.y) * 2.0f,
-        0.0f,
-        (quad.v4.position.x / PSX_RT.size.x) * 2.0f - 1.0f,
-        1.0f - (quad.v4.position.y / PSX_RT.size.y) * 2.0f,
-        0.0f
-    };
-    
-    // Convert UV coordinates from 0-255 to 0.0-1.0
-    float uv[12] = {
-        quad.v1.uv.x / 255.0f,
-        quad.v1.uv.y / 255.0f,
-        quad.v2.uv.x / 255.0f,
-        quad.v2.uv.y / 255.0f,
-        quad.v3.uv.x / 255.0f,
-        quad.v3.uv.y / 255.0f,
-        quad.v2.uv.x / 255.0f,
-        quad.v2.uv.y / 255.0f,
-        quad.v3.uv.x / 255.0f,
-        quad.v3.uv.y / 255.0f,
-        quad.v4.uv.x / 255.0f,
-        quad.v4.uv.y / 255.0f,
-    };
-
-    uint8_t texture_data[256 * 256 * 3] = {0};
-
-    uint32_t x_start = quad.uv_data.texture_page_x_base * 64;
-    uint32_t y_start = quad.uv_data.texture_page_y_base * 256;
-
-    TexturePageColors colors = quad.uv_data.texture_page_colors;
-
-    // Generate the 256*256 texture page to send to the GPU
-    if (colors == PAGE_4_BIT)
-    {
-        for (int y = 0; y < 256; y++) // For each line
-        {
-            for (int x = 0; x < 256; x++) // For each pixel on the line
-            {
-                // Get the address of the current pixel
-                uint32_t pixel_address = (y_start + y) * 1024 + (x_start + x / 4);
-                uint16_t pixel = gpu_state.vram[pixel_address];
-
-                // In 4 bit mode, a half word contains 4 pixel
-                int pixel_index = x % 4;
-                // Mask to select onl the current pixel
-                uint16_t mask = 0xF000 >> (3 - x % 4) * 4;
-
-                // Mask the value, bring it down to a 4 bit value, then left shift by 4 to get an 8 bit color
-                texture_data[3 * 256 * y + 3 * x] = (pixel & mask) >> (pixel_index * 4) << 4;
-                texture_data[3 * 256 * y + 3 * x + 1] = (pixel & mask) >> (pixel_index * 4) << 4;
-                texture_data[3 * 256 * y + 3 * x + 2] = (pixel & mask) >> (pixel_index * 4) << 4;
-            }
-        }
-    }
-    else if (colors == PAGE_8_BIT)
-    {
-        log_warning("Unhandled 8 bit texture page rendering!\n");
-    }
-    else if (colors == PAGE_15_BIT)
+    if (frontend_state.batch_vertices != NULL &&
+        frontend_state.batch_offset + frontend_state.batch_count + vertex_count <= RENDER_BATCH_VERTEX_COUNT)
+        return;
+
+    flush_render_batch();
+
+    // Nothing already written is overwritten until the storage is orphaned, so the driver doesn't have to sync
+    GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_FLUSH_EXPLICIT_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+
+    glBindBuffer(GL_ARRAY_BUFFER, frontend_state.batch_vbo);
+
+    if (frontend_state.batch_offset + vertex_count > RENDER_BATCH_VERTEX_COUNT)
     {
-        log_warning("Unhandled 15 bit texture page rendering!\n");
+        // Start over in new storage, the driver keeps the old one until the draws reading it are done
+        glBufferData(GL_ARRAY_BUFFER, RENDER_BATCH_VERTEX_COUNT * sizeof(BatchVertex), NULL, GL_STREAM_DRAW);
+        frontend_state.batch_offset = 0;
+        access |= GL_MAP_INVALIDATE_BUFFER_BIT;
     }
+    else
+        access |= GL_MAP_INVALIDATE_RANGE_BIT;
 
-    // x in 16 halfword steps, y in 1 line steps
-    // Get CLUT address in VRAM
-    uint32_t clut_start = quad.uv_data.clut_position.y * 1024 + quad.uv_data.clut_position.x * 16;
+    frontend_state.batch_vertices = glMapBufferRange(GL_ARRAY_BUFFER,
+        frontend_state.batch_offset * sizeof(BatchVertex),
+        (RENDER_BATCH_VERTEX_COUNT - frontend_state.batch_offset) * sizeof(BatchVertex),
+        access);
 
-    // CLUT is 256x1 or 16x1 depending on color mode
-    uint8_t clut_data[256 * 1 * 3] = {0};
-    int clut_size = 0;
+    if (frontend_state.batch_vertices == NULL)
+        log_error("Couldn't map the batch vertex buffer!\n");
+}
 
-    if (colors == PAGE_4_BIT)
-        clut_size = 16;
-    else if (colors == PAGE_8_BIT)
-        clut_size = 256;
+static void push_batch_vertex(const Vertex* vertex, uint16_t texture_page, uint16_t clut)
+{
+    BatchVertex* batch_vertex = &frontend_state.batch_vertices[frontend_state.batch_count++];
 
-    // If we have a CLUT, we need to construct the array for it
-    if (clut_size != 0)
-    {
-        for (int i = 0; i < clut_size; i++)
-        {
-            uint32_t clut_color = gpu_state.vram[clut_start + i];
+    // Invert y coordinate to match with OpenGL coordinate system
+    // And convert values from pixel positions to NDC range
+    batch_vertex->position[0] = (vertex->position.x / PSX_RT.size.x) * 2.0f - 1.0f;
+    batch_vertex->position[1] = 1.0f - (vertex->position.y / PSX_RT.size.y) * 2.0f;
 
-            clut_data[i * 3] = clut_color & 0b11111;
-            clut_data[i * 3 + 1] = (clut_color & (0b11111 << 5)) >> 5;
-            clut_data[i * 3 + 2] = (clut_color & (0b11111 << 10)) >> 10;
+    batch_vertex->color[0] = vertex->color.r / 255.0f;
+    batch_vertex->color[1] = vertex->color.g / 255.0f;
+    batch_vertex->color[2] = vertex->color.b / 255.0f;
 
-            // Convert from 5 to 8 bit color
-            clut_data[i * 3] <<= 3;
-            clut_data[i * 3 + 1] <<= 3;
-            clut_data[i * 3 + 2] <<= 3;
-        }
-    }
+    batch_vertex->uv[0] = vertex->uv.x;
+    batch_vertex->uv[1] = vertex->uv.y;
 
-    GLuint texture = 0;
-    GLuint clut_texture = 0;
+    batch_vertex->texture_page = texture_page;
+    batch_vertex->clut = clut;
+}
 
-    // Create a texture with the texture page data
-    glGenTextures(1, &texture);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 256, 256, 0, GL_RGB, GL_UNSIGNED_BYTE, texture_data);
+/// <summary>
+/// Adds a triangle to the current batch
+/// </summary>
+static void push_batch_triangle(const Vertex* v1, const Vertex* v2, const Vertex* v3, uint16_t texture_page, uint16_t clut)
+{
+    reserve_batch_vertices(3);
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    if (frontend_state.batch_vertices == NULL)
+        return;
 
-    // If we need a CLUT, create a 1D texture for it
-    if (clut_size != 0)
-    {
-        glGenTextures(1, &clut_texture);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_1D, clut_texture);
-        glTexImage1D(GL_TEXTURE_1D, 0, GL_RGB, clut_size, 0, GL_RGB, GL_UNSIGNED_BYTE, clut_data);
+    push_batch_vertex(v1, texture_page, clut);
+    push_batch_vertex(v2, texture_page, clut);
+    push_batch_vertex(v3, texture_page, clut);
+}
 
-        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    }
+static uint16_t get_texture_page_attribute(UVData uv_data)
+{
+    return BATCH_VERTEX_TEXTURED |
+        uv_data.texture_page_x_base |
+        uv_data.texture_page_y_base << 4 |
+        uv_data.semi_transparency << 5 |
+        uv_data.texture_page_colors << 7;
+}
 
-    glBindFramebuffer(GL_FRAMEBUFFER, PSX_RT.framebuffer);
-    glViewport(0, 0, frontend_state.psx_render_target.size.x, frontend_state.psx_render_target.size.y);
-    glUseProgram(frontend_state.texture_shader);
+static uint16_t get_clut_attribute(UVData uv_data)
+{
+    return (uint16_t)uv_data.clut_position.x | (uint16_t)uv_data.clut_position.y << 6;
+}
+
+/// <summary>
+/// Sets the texture window used by the textured primitives of the batch, flushing it if the window changed
+/// </summary>
+static void set_batch_texture_window(Vec2 mask, Vec2 offset)
+{
+    if (mask.x == frontend_state.batch_texture_window_mask.x && mask.y == frontend_state.batch_texture_window_mask.y &&
+        offset.x == frontend_state.batch_texture_window_offset.x && offset.y == frontend_state.batch_texture_window_offset.y)
+        return;
 
-    // Set the sampler on texture unit 0
-    glUniform1i(glGetUniformLocation(frontend_state.texture_shader, "textureSampler"), 0);
-    glUniform1i(glGetUniformLocation(frontend_state.texture_shader, "clutSampler"), 1);
-    glUniform1i(glGetUniformLocation(frontend_state.texture_shader, "clutSize"), clut_size);
+    flush_render_batch();
 
-    GLuint vao = 0;
-    GLuint vbo = 0;
-    GLuint texture_bo = 0;
+    frontend_state.batch_texture_window_mask = mask;
+    frontend_state.batch_texture_window_offset = offset;
+}
 
-    glGenVertexArrays(1, &vao);
-    glGenBuffers(1, &vbo);
-    glGenBuffers(1, &texture_bo);
+void draw_pixel(uint16_t x_coord, uint16_t y_coord, uint8_t red, uint8_t green, uint8_t blue)
+{
+    // The pixel must land over the primitives drawn before it
+    flush_render_batch();
 
-    glBindVertexArray(vao);
+    glBindFramebuffer(GL_FRAMEBUFFER, PSX_RT.framebuffer);
+    glViewport(0, 0, frontend_state.psx_render_target.size.x, frontend_state.psx_render_target.size.y);
+    glEnable(GL_SCISSOR_TEST);
 
-    // Send vertices
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    y_coord = PSX_RT.size.y - y_coord;
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
+    glScissor(x_coord, y_coord, 1, 1);
+    glClearColor(red / 255.0f, green / 255.0f, blue / 255.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glDisable(GL_SCISSOR_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-    // Send UV coordinates
-    glBindBuffer(GL_ARRAY_BUFFER, texture_bo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(uv), uv, GL_STATIC_DRAW);
+void draw_triangle(Triangle triangle)
+{
+    push_batch_triangle(&triangle.v1, &triangle.v2, &triangle.v3, 0, 0);
+}
 
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(1);
+void draw_textured_triangle(Triangle triangle)
+{
+    log_warning("Unhandled OpenGL function -- draw_textured_triangle !\n");
+}
 
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+void draw_quad(Quad quad)
+{
+    push_batch_triangle(&quad.v1, &quad.v2, &quad.v3, 0, 0);
+    push_batch_triangle(&quad.v2, &quad.v3, &quad.v4, 0, 0);
+}
 
-    glDeleteVertexArrays(1, &vao);
-    glDeleteBuffers(1, &vbo);
-    glDeleteBuffers(1, &texture_bo);
+void draw_textured_quad(Quad quad)
+{
+    set_batch_texture_window(gpu_state.texture_window_mask, gpu_state.texture_window_offset);
 
-    glDeleteTextures(1, &texture);
-    glDeleteTextures(1, &clut_texture);
+    uint16_t texture_page = get_texture_page_attribute(quad.uv_data);
+    uint16_t clut = get_clut_attribute(quad.uv_data);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    push_batch_triangle(&quad.v1, &quad.v2, &quad.v3, texture_page, clut);
+    push_batch_triangle(&quad.v2, &quad.v3, &quad.v4, texture_page, clut);
 }
 
 static void framebuffer_size_callback(GLFWwindow* window, int width, int height)
@@ -716,6 +766,9 @@ static void delete_framebuffer(RenderTarget* render_target)
 
 void resize_psx_framebuffer(Vec2 new_size)
 {
+    // The batched primitives are drawn with the old size
+    flush_render_batch();
+
     resize_framebuffer(&PSX_RT, new_size);
 }
 
@@ -740,10 +793,11 @@ int start_interface()
 
 static void update_vram()
 {
-    // Send VRAM data to the texture
-    glBindTexture(GL_TEXTURE_2D, frontend_state.vram_tex);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, VRAM_WIDTH, VRAM_HEIGHT, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, gpu_state.vram);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    upload_written_vram();
+
+    // The view only changes when VRAM was written
+    if (!frontend_state.vram_view_outdated)
+        return;
 
     // Render to the framebuffer with a quad
     glBindFramebuffer(GL_FRAMEBUFFER, VRAM_RT.framebuffer);
@@ -751,11 +805,47 @@ static void update_vram()
 
     glBindVertexArray(frontend_state.blit_quad_vao);
 
-    glUseProgram(frontend_state.blit_shader);
+    glUseProgram(frontend_state.vram_view_shader);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, frontend_state.vram_sample_tex);
+    glUniform1i(glGetUniformLocation(frontend_state.vram_view_shader, "vramSampler"), 0);
+    glUniform2f(glGetUniformLocation(frontend_state.vram_view_shader, "areaOffset"), 0.0f, 0.0f);
+    glUniform2f(glGetUniformLocation(frontend_state.vram_view_shader, "areaScale"), 1.0f, 1.0f);
+
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    frontend_state.vram_view_outdated = false;
+}
+
+static void present_display_area()
+{
+    Vec2 size = get_display_resolution();
+
+    if (size.x == 0 || size.y == 0)
+        return;
+
+    if (size.x != PSX_RT.size.x || size.y != PSX_RT.size.y)
+        resize_framebuffer(&PSX_RT, size);
+
+    // The display area starts at a halfword position in VRAM
+    float start_x = gpu_state.display_area_start & 0x3FF;
+    float start_y = (gpu_state.display_area_start >> 10) & 0x1FF;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, PSX_RT.framebuffer);
+    glViewport(0, 0, size.x, size.y);
+
+    glBindVertexArray(frontend_state.blit_quad_vao);
+
+    glUseProgram(frontend_state.vram_view_shader);
 
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, frontend_state.vram_tex);
-    glUniform1i(glGetUniformLocation(frontend_state.blit_shader, "textureSampler"), 0);
+    glBindTexture(GL_TEXTURE_2D, frontend_state.vram_sample_tex);
+    glUniform1i(glGetUniformLocation(frontend_state.vram_view_shader, "vramSampler"), 0);
+    glUniform2f(glGetUniformLocation(frontend_state.vram_view_shader, "areaOffset"), start_x / VRAM_WIDTH, start_y / VRAM_HEIGHT);
+    glUniform2f(glGetUniformLocation(frontend_state.vram_view_shader, "areaScale"), size.x / VRAM_WIDTH, size.y / VRAM_HEIGHT);
 
     glDrawArrays(GL_TRIANGLES, 0, 6);
 
@@ -778,8 +868,14 @@ static void blit_to_screen()
 
 int update_interface()
 {
+    // End of the frame, draw what is left in the batch
+    flush_render_batch();
+
     update_vram();
 
+    if (gpu_backend == GPU_BACKEND_SOFTWARE)
+        present_display_area();
+
     if (frontend_state.fullscreen_mode)
         blit_to_screen();
     else
@@ -810,4 +906,6 @@ void stop_interface()
 
 	glfwDestroyWindow(frontend_state.window);
 	glfwTerminate();
+
+	frontend_state.window = NULL;
 }
@@ -7,6 +7,10 @@
 #include "cpu.h"
 #include "memory.h"
 #include "debug.h"
+#include "main.h"
+#include "save_state.h"
+#include "rewind.h"
+#include "rasterizer.h"
 
 UIState ui_state = {
     .ctx = NULL,
@@ -55,6 +59,12 @@ void gui_update()
     {
         igMenuItemEx("Load file", NULL, NULL, false, true);
 
+        if (igMenuItemEx("Save state", NULL, NULL, false, true))
+            save_state_to_file(SAVE_STATE_PATH);
+
+        if (igMenuItemEx("Load state", NULL, NULL, false, true))
+            load_state_from_file(SAVE_STATE_PATH);
+
         igEndMenu();
     }
 
@@ -63,9 +73,54 @@ void gui_update()
         if (igMenuItemEx("Reset", NULL, NULL, false, true))
             reset_emulator();
 
+        if (igBeginMenu("CPU backend", true))
+        {
+            if (igMenuItemEx("Interpreter", NULL, NULL, cpu_backend == CPU_BACKEND_INTERPRETER, true))
+                cpu_backend = CPU_BACKEND_INTERPRETER;
+
+            if (igMenuItemEx("Threaded interpreter", NULL, NULL, cpu_backend == CPU_BACKEND_THREADED_INTERPRETER, true))
+                cpu_backend = CPU_BACKEND_THREADED_INTERPRETER;
+
+            if (igMenuItemEx("Cached interpreter", NULL, NULL, cpu_backend == CPU_BACKEND_CACHED_INTERPRETER, true))
+                cpu_backend = CPU_BACKEND_CACHED_INTERPRETER;
+
+            if (igMenuItemEx("Recompiler", NULL, NULL, cpu_backend == CPU_BACKEND_RECOMPILER, true))
+                cpu_backend = CPU_BACKEND_RECOMPILER;
+
+            igEndMenu();
+        }
+
+        if (igBeginMenu("GPU backend", true))
+        {
+            if (igMenuItemEx("OpenGL", NULL, NULL, gpu_backend == GPU_BACKEND_OPENGL, true))
+            {
+                flush_rasterizer();
+                gpu_backend = GPU_BACKEND_OPENGL;
+            }
+
+            if (igMenuItemEx("Software", NULL, NULL, gpu_backend == GPU_BACKEND_SOFTWARE, true))
+            {
+                flush_render_batch();
+                gpu_backend = GPU_BACKEND_SOFTWARE;
+            }
+
+            igEndMenu();
+        }
+
+        if (igMenuItemEx("Limit speed", NULL, NULL, main_state.limit_speed, true))
+            main_state.limit_speed = !main_state.limit_speed;
+
+        if (igMenuItemEx("Record rewind history", NULL, NULL, rewind_state.enabled, true))
+        {
+            rewind_state.enabled = !rewind_state.enabled;
+            reset_rewind();
+        }
+
         igEndMenu();
     }
 
+    igText("Speed: %.0f%%", main_state.emulation_speed * 100.0);
+
     igEndMainMenuBar();
 
     // We want to create a full size window
@@ -306,5 +361,36 @@ void gui_update()
 
     igEnd();
 
+    igBegin("Rewind", NULL, ImGuiWindowFlags_None);
+
+    int snapshot_count = get_rewind_snapshot_count();
+
+    igText("%d snapshots, %.1f MiB", snapshot_count, rewind_state.memory_used / (1024.0 * 1024.0));
+
+    if (snapshot_count > 0)
+    {
+        // Stays on the newest snapshot unless it was moved
+        static int selected_snapshot = -1;
+        static int previous_count = 0;
+
+        if (selected_snapshot < 0 || selected_snapshot >= snapshot_count || selected_snapshot == previous_count - 1)
+            selected_snapshot = snapshot_count - 1;
+
+        previous_count = snapshot_count;
+
+        char frame_text[32];
+        snprintf(frame_text, sizeof(frame_text), "Frame %llu", (unsigned long long)get_rewind_snapshot_frame(selected_snapshot));
+
+        igPushItemWidth(300);
+        igSliderInt("##Snapshot", &selected_snapshot, 0, snapshot_count - 1, frame_text, 0);
+        igPopItemWidth();
+        igSameLine(0, -1);
+
+        if (igButton("Rewind", (struct ImVec2) { 80, 20 }))
+            rewind_to_frame(get_rewind_snapshot_frame(selected_snapshot));
+    }
+
+    igEnd();
+
     igEnd();
 }
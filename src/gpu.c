@@ -5,8 +5,13 @@
 #include "logging.h"
 #include "cpu.h"
 #include "memory.h"
+#include "timer.h"
+#include "interrupt.h"
+#include "scheduler.h"
+#include "dirty_pages.h"
+#include "rasterizer.h"
 
-GPU gpu_state = {
+PSX_THREAD_LOCAL GPU gpu_state = {
 	.gpu_read = 0,
 	.gpu_stat = 0,
 	.gpu_status = {0},
@@ -26,12 +31,32 @@ GPU gpu_state = {
 	.display_area_start = 0,
 	.display_range_horizontal = 0,
 	.display_range_vertical = 0,
+	.scanline = 0,
+	.in_vblank = false,
+	.frame_count = 0,
+	.scanline_cycle_remainder = 0,
 	.vram = {0},
 };
 
+PSX_THREAD_LOCAL GPUBackend gpu_backend = GPU_BACKEND_OPENGL;
+
+/// <summary>
+/// Whether the GPU output goes to the frontend renderer. It needs the OpenGL context, which only the thread that
+/// started the interface owns, so the other consoles (tests, benchmarks, worker threads) don't draw anything. The
+/// software backend never draws to it, the frontend presents the display area of VRAM instead
+/// </summary>
+static bool draws_to_frontend()
+{
+	return gpu_backend == GPU_BACKEND_OPENGL && frontend_state.window != NULL;
+}
+
 void reset_gpu_state()
 {
+	flush_rasterizer();
 	memset(&gpu_state, 0, sizeof(gpu_state));
+	mark_all_pages_dirty();
+
+	schedule_event(EVENT_HBLANK, get_scanline_cpu_cycles());
 }
 
 uint32_t read_gpu(uint32_t address)
@@ -40,11 +65,7 @@ uint32_t read_gpu(uint32_t address)
 		return gpu_state.gpu_read;
 
 	if (address == 0x1F801814)
-	{
-		gpu_state.gpu_status.drawing_odd_lines = !gpu_state.gpu_status.drawing_odd_lines;
-		update_gpustat();
 		return gpu_state.gpu_stat;
-	}
 
 	log_warning("Unhandled GPU register read at address %x\n", address);
 
@@ -90,6 +111,10 @@ static void gp0_env(uint32_t value)
 			break;
 
 		case 0x03:
+			// The batched primitives belong to the previous drawing area
+			if (draws_to_frontend())
+				flush_render_batch();
+
 			// Bottom right x value from lowest 10 bits
 			gpu_state.drawing_area_top_left.x = value & 0x3FF;
 			// Bottom right y value from bits 10-19
@@ -97,6 +122,9 @@ static void gp0_env(uint32_t value)
 			break;
 
 		case 0x04:
+			if (draws_to_frontend())
+				flush_render_batch();
+
 			// Bottom right x value from lowest 10 bits
 			gpu_state.drawing_area_bottom_right.x = value & 0x3FF;
 			// Bottom right y value from bits 10-19
@@ -105,6 +133,9 @@ static void gp0_env(uint32_t value)
 
 		case 0x05:
 		{
+			if (draws_to_frontend())
+				flush_render_batch();
+
 			// x signed value from lowest 11 bits
 			uint16_t x_value = value & 0x7FF;
 			if (x_value & (1 << 10))
@@ -165,8 +196,13 @@ static void gp0_misc(uint32_t value)
 		uint16_t x_coord = value & 0xFFFF;
 		uint16_t y_coord = (value & 0xFFFF0000) >> 16;
 
-		if (rect_size == SINGLE_PIXEL)
-			draw_pixel(x_coord, y_coord, red, green, blue);
+		if (rect_size == SINGLE_PIXEL && gpu_backend == GPU_BACKEND_SOFTWARE)
+			rasterize_rectangle(x_coord, y_coord, 1, 1, red, green, blue);
+		else if (rect_size == SINGLE_PIXEL)
+		{
+			if (draws_to_frontend())
+				draw_pixel(x_coord, y_coord, red, green, blue);
+		}
 		else
 			log_warning("Unhandled rectangle draw with size %x\n", rect_size);
 	}
@@ -305,7 +341,36 @@ static void gp0_misc(uint32_t value)
 				}
 			}
 
-			if (is_rectangle)
+			if (gpu_backend == GPU_BACKEND_SOFTWARE)
+			{
+				RasterVertex vertices[4];
+				uint32_t flags = 0;
+
+				if (is_gouraud_shading)
+					flags |= RASTER_GOURAUD;
+				if (is_textured)
+					flags |= RASTER_TEXTURED;
+				if (is_semi_transparent)
+					flags |= RASTER_SEMI_TRANSPARENT;
+				if (use_raw_texture)
+					flags |= RASTER_RAW_TEXTURE;
+
+				for (int i = 0; i < vertices_count; i++)
+				{
+					vertices[i] = (RasterVertex){
+						.x = positions[i].x,
+						.y = positions[i].y,
+						.r = colors[i].r,
+						.g = colors[i].g,
+						.b = colors[i].b,
+						.u = uv_coords[i].x,
+						.v = uv_coords[i].y,
+					};
+				}
+
+				rasterize_polygon(vertices, vertices_count, texture_page_info, clut_index, flags);
+			}
+			else if (is_rectangle && draws_to_frontend())
 			{
 				Quad quad = {
 					.v1 = { positions[0], colors[0], uv_coords[0] },
@@ -320,7 +385,7 @@ static void gp0_misc(uint32_t value)
 				else
 					draw_quad(quad);
 			}
-			else
+			else if (draws_to_frontend())
 			{
 				Triangle triangle = {
 					.v1 = { positions[0], colors[0], uv_coords[0] },
@@ -364,6 +429,7 @@ static void handle_gp0_command(uint32_t value)
 		int y_pos = (gpu_state.blit_position.y + gpu_state.blit_y_count) & 0x1FF;
 
 		gpu_state.vram[y_pos * 1024 + x_pos] = value & 0xFFFF;
+		mark_vram_dirty(y_pos * 1024 + x_pos);
 
 		gpu_state.blit_x_count++;
 
@@ -382,6 +448,7 @@ static void handle_gp0_command(uint32_t value)
 
 		// Transfer second half word
 		gpu_state.vram[y_pos * 1024 + x_pos] = (value & 0xFFFF0000) >> 16;
+		mark_vram_dirty(y_pos * 1024 + x_pos);
 
 		gpu_state.blit_x_count++;
 
@@ -436,10 +503,18 @@ static void handle_gp0_command(uint32_t value)
 			break;
 
 		case GP0_CPU_TO_VRAM_BLIT:
+			// The batched primitives must sample VRAM as it is before the blit
+			if (draws_to_frontend())
+				flush_render_batch();
+			flush_rasterizer();
 			start_gp0_command(value, GP0_CPU_TO_VRAM_BLIT);
 			break;
 
 		case GP0_VRAM_TO_CPU_BLIT:
+			// The read back must see everything drawn before it
+			if (draws_to_frontend())
+				flush_render_batch();
+			flush_rasterizer();
 			log_warning("Received GPU VRAM-to-CPU blit command -- value is %x\n", value);
 			break;
 
@@ -480,6 +555,11 @@ static inline Vec2 get_screen_resolution(DisplayMode display_mode)
 	return new_size;
 }
 
+Vec2 get_display_resolution()
+{
+	return get_screen_resolution(gpu_state.display_mode);
+}
+
 /// <summary>
 /// Updates the integer GPUSTAT register using the state in GPUStatus
 /// </summary>
@@ -559,8 +639,14 @@ static void gp1_display_mode(uint32_t value)
 	// Update GPUSTAT register
 	update_gpustat_display_mode(gpu_state.display_mode);
 
-	Vec2 screen_size = get_screen_resolution(gpu_state.display_mode);
-	resize_psx_framebuffer(screen_size);
+	// The dot clock used by timer 0 depends on the horizontal resolution
+	update_timer_rates();
+
+	if (draws_to_frontend())
+	{
+		Vec2 screen_size = get_screen_resolution(gpu_state.display_mode);
+		resize_psx_framebuffer(screen_size);
+	}
 }
 
 static void handle_gp1_command(uint32_t value)
@@ -641,3 +727,94 @@ static void handle_gp1_command(uint32_t value)
 			break;
 	}
 }
+
+/// <summary>
+/// Gets the length of the current scanline in CPU cycles, keeping the leftover fraction
+/// of cycle for the next scanlines
+/// </summary>
+static uint64_t get_scanline_cpu_cycles()
+{
+	bool pal = gpu_state.gpu_status.video_mode == PAL;
+
+	uint64_t gpu_frequency = pal ? PAL_GPU_FREQ : GPU_FREQ;
+	uint64_t scanline_cycles = pal ? PAL_SCANLINE_CYCLES : NTSC_SCANLINE_CYCLES;
+
+	gpu_state.scanline_cycle_remainder += scanline_cycles * CPU_FREQ;
+
+	uint64_t cpu_cycles = gpu_state.scanline_cycle_remainder / gpu_frequency;
+	gpu_state.scanline_cycle_remainder %= gpu_frequency;
+
+	return cpu_cycles;
+}
+
+/// <summary>
+/// Updates the GPUSTAT interlace bits for the current scanline
+/// </summary>
+static void update_scanline_status()
+{
+	GPUStatus* status = &gpu_state.gpu_status;
+
+	bool interlaced = status->v_res == V_RES_480 && status->use_vertical_interlace;
+
+	if (!status->use_vertical_interlace)
+		status->interlace_field = true;
+
+	// The odd lines bit alternates with each field when interlaced, and with each scanline otherwise.
+	// It is always 0 during VBlank
+	if (gpu_state.in_vblank)
+		status->drawing_odd_lines = false;
+	else if (interlaced)
+		status->drawing_odd_lines = !status->interlace_field;
+	else
+		status->drawing_odd_lines = gpu_state.scanline & 1;
+
+	update_gpustat();
+}
+
+void handle_hblank_event(uint64_t deadline)
+{
+	bool pal = gpu_state.gpu_status.video_mode == PAL;
+
+	uint32_t scanline_count = pal ? PAL_SCANLINE_COUNT : NTSC_SCANLINE_COUNT;
+	uint32_t default_range = pal ? PAL_DISPLAY_RANGE_V : NTSC_DISPLAY_RANGE_V;
+	uint32_t display_range = gpu_state.display_range_vertical;
+
+	if (display_range == 0)
+		display_range = default_range;
+
+	uint32_t display_start = display_range & 0x3FF;
+	uint32_t display_end = (display_range >> 10) & 0x3FF;
+
+	if (display_end > scanline_count)
+		display_end = scanline_count;
+
+	// An empty range, or one covering every scanline, would never enter VBlank. The hardware still
+	// starts it once per field, so it falls back to the scanlines of the default range
+	if (display_start >= display_end || (display_start == 0 && display_end == scanline_count))
+	{
+		display_start = default_range & 0x3FF;
+		display_end = (default_range >> 10) & 0x3FF;
+	}
+
+	gpu_state.scanline = (gpu_state.scanline + 1) % scanline_count;
+
+	bool in_vblank = gpu_state.scanline < display_start || gpu_state.scanline >= display_end;
+
+	if (in_vblank && !gpu_state.in_vblank)
+	{
+		// Start of a new field, the software rasterizer shows the whole frame
+		flush_rasterizer();
+		gpu_state.frame_count++;
+		gpu_state.gpu_status.interlace_field = !gpu_state.gpu_status.interlace_field;
+
+		request_interrupt(IRQ_VBLANK);
+	}
+
+	gpu_state.in_vblank = in_vblank;
+
+	update_scanline_status();
+
+	tick_hblank_timers();
+
+	schedule_event_at(EVENT_HBLANK, deadline + get_scanline_cpu_cycles());
+}
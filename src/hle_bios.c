@@ -0,0 +1,1267 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "hle_bios.h"
+#include "main.h"
+#include "cpu.h"
+#include "coprocessor.h"
+#include "memory.h"
+#include "interrupt.h"
+#include "block_cache.h"
+#include "icache.h"
+#include "debug.h"
+#include "logging.h"
+
+#define HLE_STRING_SIZE 1024
+#define HLE_PATH_SIZE (sizeof(HLE_FILE_DIRECTORY) + HLE_STRING_SIZE) // Room for the directory and the longest guest name
+
+PSX_THREAD_LOCAL HLEState hle_state = {0};
+
+/// <summary>
+/// Signature of the native kernel functions, the arguments are read from the guest registers
+/// </summary>
+typedef void (*HLEFunction)();
+
+/// <summary>
+/// Gets an argument of the kernel function being called, the first 4 are in registers and the others on the stack
+/// </summary>
+/// <param name="index">The index of the argument</param>
+/// <returns>The value of the argument</returns>
+static uint32_t get_argument(int index)
+{
+	if (index < 4)
+		return R(4 + index);
+
+	return read_word(R29 + index * WORD_SIZE);
+}
+
+/// <summary>
+/// Copies a null terminated string from guest memory, truncating it if it doesn't fit
+/// </summary>
+static void read_guest_string(uint32_t address, char* buffer, size_t size)
+{
+	size_t length = 0;
+
+	while (length < size - 1)
+	{
+		char c = (char)read_byte(address + length);
+
+		if (c == '\0')
+			break;
+
+		buffer[length++] = c;
+	}
+
+	buffer[length] = '\0';
+}
+
+/// <summary>
+/// Prints a character to the TTY, also echoed on the host console so batch runs can capture it
+/// </summary>
+static void output_char(char c)
+{
+	debug_state.tty[debug_state.char_index] = c;
+	debug_state.char_index = (debug_state.char_index + 1) % TTY_BUFFER_SIZE;
+
+	putchar(c);
+}
+
+static void output_string(const char* string)
+{
+	while (*string != '\0')
+		output_char(*string++);
+}
+
+static void save_context(HLEContext* context, uint32_t pc)
+{
+	memcpy(context->registers, cpu_state.registers, sizeof(context->registers));
+	context->pc = pc;
+	context->hi = cpu_state.hi;
+	context->lo = cpu_state.lo;
+	context->sr = SR;
+}
+
+static void restore_context(const HLEContext* context)
+{
+	memcpy(cpu_state.registers, context->registers, sizeof(context->registers));
+	cpu_state.pc = context->pc;
+	cpu_state.hi = context->hi;
+	cpu_state.lo = context->lo;
+	cpu_state.delay_jump = false;
+	SR = context->sr;
+}
+
+/// <summary>
+/// Loads the registers saved in a guest jmp_buf, laid out as ra, sp, fp, s0-s7, gp, and jumps to its return address
+/// </summary>
+static void jump_to_buffer(uint32_t buffer, uint32_t value)
+{
+	cpu_state.pc = read_word(buffer);
+	R29 = read_word(buffer + 0x04);
+	R30 = read_word(buffer + 0x08);
+
+	for (int i = 0; i < 8; i++)
+		R(16 + i) = read_word(buffer + 0x0C + i * WORD_SIZE);
+
+	R28 = read_word(buffer + 0x2C);
+	R2 = value;
+	cpu_state.delay_jump = false;
+}
+
+/// <summary>
+/// Runs the next pending event callback, or leaves the callbacks when they all returned
+/// </summary>
+static void run_next_callback()
+{
+	if (hle_state.pending_callback_count > 0)
+	{
+		uint32_t function = hle_state.pending_callbacks[0];
+
+		hle_state.pending_callback_count--;
+		memmove(&hle_state.pending_callbacks[0], &hle_state.pending_callbacks[1], hle_state.pending_callback_count * sizeof(uint32_t));
+
+		cpu_state.pc = function;
+		cpu_state.delay_jump = false;
+		R31 = HLE_CALLBACK_RETURN_ADDRESS;
+
+		return;
+	}
+
+	// Interrupts leave through the custom exit if the game hooked it, which ends with ReturnFromException()
+	if (hle_state.callbacks_from_exception && hle_state.custom_exit != 0)
+	{
+		jump_to_buffer(hle_state.custom_exit, 1);
+		return;
+	}
+
+	restore_context(&hle_state.callback_context);
+}
+
+/// <summary>
+/// Starts running the pending callbacks with interrupts disabled, then returns to a context
+/// </summary>
+static void start_callbacks(const HLEContext* context, bool from_exception)
+{
+	hle_state.callback_context = *context;
+	hle_state.callbacks_from_exception = from_exception;
+
+	SR &= ~1;
+
+	run_next_callback();
+}
+
+/// <summary>
+/// Marks the matching enabled events as ready, or queues their callback
+/// </summary>
+static void deliver_event(uint32_t event_class, uint32_t spec)
+{
+	for (int i = 0; i < HLE_MAX_EVENTS; i++)
+	{
+		HLEEvent* event = &hle_state.events[i];
+
+		if (event->status != 0x2000 || event->event_class != event_class || event->spec != spec)
+			continue;
+
+		if (event->mode == 0x1000 && event->function != 0)
+		{
+			if (hle_state.pending_callback_count < HLE_MAX_CALLBACKS)
+				hle_state.pending_callbacks[hle_state.pending_callback_count++] = event->function;
+		}
+		else
+			event->status = 0x4000;
+	}
+}
+
+/// <summary>
+/// Gets the event of a handle returned by OpenEvent()
+/// </summary>
+/// <returns>The event, or NULL if the handle isn't valid</returns>
+static HLEEvent* get_event(uint32_t handle)
+{
+	uint32_t index = handle & 0xFFFF;
+
+	if ((handle & 0xFFFF0000) != 0xF1000000 || index >= HLE_MAX_EVENTS || hle_state.events[index].status == 0)
+		return NULL;
+
+	return &hle_state.events[index];
+}
+
+/// <summary>
+/// Converts a guest file name like "cdrom:\DATA\FILE.BIN;1" into a path in HLE_FILE_DIRECTORY
+/// </summary>
+/// <returns>False if the name tries to leave the directory, or if the path doesn't fit in the buffer</returns>
+static bool get_host_path(uint32_t name_address, char* path, size_t size)
+{
+	char name[HLE_STRING_SIZE];
+	read_guest_string(name_address, name, sizeof(name));
+
+	// Drop the device and the version number
+	char* start = strchr(name, ':');
+	start = start != NULL ? start + 1 : name;
+
+	char* version = strchr(start, ';');
+	if (version != NULL)
+		*version = '\0';
+
+	while (*start == '\\' || *start == '/')
+		start++;
+
+	for (char* c = start; *c != '\0'; c++)
+	{
+		if (*c == '\\')
+			*c = '/';
+	}
+
+	if (strstr(start, "..") != NULL)
+		return false;
+
+	int length = snprintf(path, size, "%s%s", HLE_FILE_DIRECTORY, start);
+
+	// A truncated path could name another file
+	if (length < 0 || (size_t)length >= size)
+	{
+		log_warning("HLE BIOS file name is too long: %s\n", start);
+		return false;
+	}
+
+	return true;
+}
+
+/// <summary>
+/// Gets the host file of a descriptor returned by FileOpen()
+/// </summary>
+/// <returns>The file, or NULL if the descriptor isn't valid</returns>
+static FILE* get_file(uint32_t fd)
+{
+	return fd < HLE_MAX_FILES ? hle_state.files[fd] : NULL;
+}
+
+/// <summary>
+/// Allocates memory in the heap set with InitHeap()
+/// </summary>
+/// <returns>The guest address of the memory, 0 if there is no chunk big enough</returns>
+static uint32_t heap_allocate(uint32_t size)
+{
+	size = (size + 3) & ~3;
+
+	for (int i = 0; i < hle_state.heap_chunk_count; i++)
+	{
+		HLEHeapChunk* chunk = &hle_state.heap[i];
+
+		if (chunk->used || chunk->size < size)
+			continue;
+
+		// Split the rest of the chunk off when there is room to track it
+		if (chunk->size > size && hle_state.heap_chunk_count < HLE_MAX_HEAP_CHUNKS)
+		{
+			memmove(&hle_state.heap[i + 2], &hle_state.heap[i + 1], (hle_state.heap_chunk_count - i - 1) * sizeof(HLEHeapChunk));
+			hle_state.heap_chunk_count++;
+
+			hle_state.heap[i + 1].address = chunk->address + size;
+			hle_state.heap[i + 1].size = chunk->size - size;
+			hle_state.heap[i + 1].used = false;
+			chunk->size = size;
+		}
+
+		chunk->used = true;
+
+		return chunk->address;
+	}
+
+	return 0;
+}
+
+/// <summary>
+/// Frees memory allocated with heap_allocate(), merging it with the free chunks around it
+/// </summary>
+/// <returns>The size of the freed chunk, 0 if the address wasn't allocated</returns>
+static uint32_t heap_free(uint32_t address)
+{
+	for (int i = 0; i < hle_state.heap_chunk_count; i++)
+	{
+		if (!hle_state.heap[i].used || hle_state.heap[i].address != address)
+			continue;
+
+		uint32_t size = hle_state.heap[i].size;
+		hle_state.heap[i].used = false;
+
+		if (i + 1 < hle_state.heap_chunk_count && !hle_state.heap[i + 1].used)
+		{
+			hle_state.heap[i].size += hle_state.heap[i + 1].size;
+			memmove(&hle_state.heap[i + 1], &hle_state.heap[i + 2], (hle_state.heap_chunk_count - i - 2) * sizeof(HLEHeapChunk));
+			hle_state.heap_chunk_count--;
+		}
+
+		if (i > 0 && !hle_state.heap[i - 1].used)
+		{
+			hle_state.heap[i - 1].size += hle_state.heap[i].size;
+			memmove(&hle_state.heap[i], &hle_state.heap[i + 1], (hle_state.heap_chunk_count - i - 1) * sizeof(HLEHeapChunk));
+			hle_state.heap_chunk_count--;
+		}
+
+		return size;
+	}
+
+	return 0;
+}
+
+/// <summary>
+/// Formats a string like printf(), reading the arguments from the guest registers and stack
+/// </summary>
+/// <returns>The number of characters printed</returns>
+static int guest_printf(uint32_t format_address, int first_argument)
+{
+	char format[HLE_STRING_SIZE];
+	read_guest_string(format_address, format, sizeof(format));
+
+	int argument = first_argument;
+	int printed = 0;
+
+	for (const char* c = format; *c != '\0'; c++)
+	{
+		if (*c != '%')
+		{
+			output_char(*c);
+			printed++;
+			continue;
+		}
+
+		// Copy the flags, width and precision of the conversion for the host printf, leaving room for the conversion
+		// character and the terminator
+		const char* conversion_start = c;
+		char specification[32] = "%";
+		int length = 1;
+		bool fits = true;
+
+		for (c++; *c != '\0' && strchr("-+ #0123456789.*hlL", *c) != NULL; c++)
+		{
+			if (*c == '*')
+			{
+				char width[16];
+				int width_length = snprintf(width, sizeof(width), "%d", (int32_t)get_argument(argument++));
+
+				if (width_length < 0 || width_length > (int)sizeof(specification) - length - 2)
+					fits = false;
+				else if (fits)
+				{
+					memcpy(&specification[length], width, width_length);
+					length += width_length;
+				}
+			}
+			else if (*c != 'h' && *c != 'l' && *c != 'L')
+			{
+				if (length > (int)sizeof(specification) - 3)
+					fits = false;
+				else if (fits)
+					specification[length++] = *c;
+			}
+		}
+
+		if (*c == '\0')
+			break;
+
+		// A specification too long for the host printf is printed as it was written
+		if (!fits)
+		{
+			for (const char* literal = conversion_start; literal <= c; literal++)
+			{
+				output_char(*literal);
+				printed++;
+			}
+
+			continue;
+		}
+
+		char output[HLE_STRING_SIZE];
+		char string[HLE_STRING_SIZE];
+		output[0] = '\0';
+
+		specification[length] = *c == 'i' ? 'd' : *c == 'p' ? 'x' : *c;
+		specification[length + 1] = '\0';
+
+		switch (*c)
+		{
+			case 'd': case 'i': case 'c':
+				snprintf(output, sizeof(output), specification, (int32_t)get_argument(argument++));
+				break;
+
+			case 'u': case 'x': case 'X': case 'o': case 'p':
+				snprintf(output, sizeof(output), specification, get_argument(argument++));
+				break;
+
+			case 's':
+				read_guest_string(get_argument(argument++), string, sizeof(string));
+				snprintf(output, sizeof(output), specification, string);
+				break;
+
+			case '%':
+				strcpy(output, "%");
+				break;
+
+			default:
+				log_warning("Unhandled printf conversion %%%c in the HLE BIOS\n", *c);
+				break;
+		}
+
+		output_string(output);
+		printed += strlen(output);
+	}
+
+	return printed;
+}
+
+/// <summary>
+/// C LIBRARY FUNCTIONS START
+/// </summary>
+
+static void hle_strcat()
+{
+	uint32_t destination = R4;
+	uint32_t end = destination;
+
+	while (read_byte(end) != 0)
+		end++;
+
+	for (uint32_t source = R5; ; source++, end++)
+	{
+		uint8_t c = read_byte(source);
+		write_byte(end, c);
+
+		if (c == 0)
+			break;
+	}
+
+	R2 = destination;
+}
+
+static void hle_strcmp()
+{
+	for (uint32_t i = 0; ; i++)
+	{
+		uint8_t a = read_byte(R4 + i);
+		uint8_t b = read_byte(R5 + i);
+
+		if (a != b || a == 0)
+		{
+			R2 = (int32_t)a - (int32_t)b;
+			return;
+		}
+	}
+}
+
+static void hle_strncmp()
+{
+	for (uint32_t i = 0; i < R6; i++)
+	{
+		uint8_t a = read_byte(R4 + i);
+		uint8_t b = read_byte(R5 + i);
+
+		if (a != b || a == 0)
+		{
+			R2 = (int32_t)a - (int32_t)b;
+			return;
+		}
+	}
+
+	R2 = 0;
+}
+
+static void hle_strcpy()
+{
+	for (uint32_t i = 0; ; i++)
+	{
+		uint8_t c = read_byte(R5 + i);
+		write_byte(R4 + i, c);
+
+		if (c == 0)
+			break;
+	}
+
+	R2 = R4;
+}
+
+static void hle_strncpy()
+{
+	bool ended = false;
+
+	// Like the C library, the rest of the destination is padded with zeroes
+	for (uint32_t i = 0; i < R6; i++)
+	{
+		uint8_t c = ended ? 0 : read_byte(R5 + i);
+		write_byte(R4 + i, c);
+
+		ended = ended || c == 0;
+	}
+
+	R2 = R4;
+}
+
+static void hle_strlen()
+{
+	uint32_t length = 0;
+
+	while (read_byte(R4 + length) != 0)
+		length++;
+
+	R2 = length;
+}
+
+static void hle_strchr()
+{
+	for (uint32_t address = R4; ; address++)
+	{
+		uint8_t c = read_byte(address);
+
+		if (c == (uint8_t)R5)
+		{
+			R2 = address;
+			return;
+		}
+
+		if (c == 0)
+			break;
+	}
+
+	R2 = 0;
+}
+
+static void hle_toupper()
+{
+	R2 = toupper((uint8_t)R4);
+}
+
+static void hle_tolower()
+{
+	R2 = tolower((uint8_t)R4);
+}
+
+/// <summary>
+/// Copies guest memory, going backwards when the destination overlaps the end of the source
+/// </summary>
+static void copy_guest_memory(uint32_t destination, uint32_t source, uint32_t size)
+{
+	if (destination > source && destination < source + size)
+	{
+		for (uint32_t i = size; i > 0; i--)
+			write_byte(destination + i - 1, read_byte(source + i - 1));
+	}
+	else
+	{
+		for (uint32_t i = 0; i < size; i++)
+			write_byte(destination + i, read_byte(source + i));
+	}
+}
+
+static void hle_bcopy()
+{
+	copy_guest_memory(R5, R4, R6);
+}
+
+static void hle_bzero()
+{
+	for (uint32_t i = 0; i < R5; i++)
+		write_byte(R4 + i, 0);
+}
+
+static void hle_memcmp()
+{
+	for (uint32_t i = 0; i < R6; i++)
+	{
+		uint8_t a = read_byte(R4 + i);
+		uint8_t b = read_byte(R5 + i);
+
+		if (a != b)
+		{
+			R2 = (int32_t)a - (int32_t)b;
+			return;
+		}
+	}
+
+	R2 = 0;
+}
+
+static void hle_memcpy()
+{
+	copy_guest_memory(R4, R5, R6);
+	R2 = R4;
+}
+
+static void hle_memset()
+{
+	for (uint32_t i = 0; i < R6; i++)
+		write_byte(R4 + i, (uint8_t)R5);
+
+	R2 = R4;
+}
+
+static void hle_memchr()
+{
+	for (uint32_t i = 0; i < R6; i++)
+	{
+		if (read_byte(R4 + i) == (uint8_t)R5)
+		{
+			R2 = R4 + i;
+			return;
+		}
+	}
+
+	R2 = 0;
+}
+
+static void hle_rand()
+{
+	hle_state.random_seed = hle_state.random_seed * 0x41C64E6D + 0x3039;
+	R2 = (hle_state.random_seed >> 16) & 0x7FFF;
+}
+
+static void hle_srand()
+{
+	hle_state.random_seed = R4;
+}
+
+static void hle_malloc()
+{
+	R2 = heap_allocate(R4);
+}
+
+static void hle_free()
+{
+	heap_free(R4);
+}
+
+static void hle_calloc()
+{
+	uint32_t size = R4 * R5;
+	uint32_t address = heap_allocate(size);
+
+	for (uint32_t i = 0; address != 0 && i < size; i++)
+		write_byte(address + i, 0);
+
+	R2 = address;
+}
+
+static void hle_realloc()
+{
+	uint32_t old_address = R4;
+	uint32_t size = R5;
+	uint32_t old_size = 0;
+
+	for (int i = 0; i < hle_state.heap_chunk_count; i++)
+	{
+		if (hle_state.heap[i].used && hle_state.heap[i].address == old_address)
+			old_size = hle_state.heap[i].size;
+	}
+
+	uint32_t address = heap_allocate(size);
+
+	if (address != 0 && old_address != 0)
+	{
+		copy_guest_memory(address, old_address, old_size < size ? old_size : size);
+		heap_free(old_address);
+	}
+
+	R2 = address;
+}
+
+static void hle_init_heap()
+{
+	hle_state.heap[0].address = (R4 + 3) & ~3;
+	hle_state.heap[0].size = R5 & ~3;
+	hle_state.heap[0].used = false;
+	hle_state.heap_chunk_count = 1;
+}
+
+static void hle_setjmp()
+{
+	uint32_t buffer = R4;
+
+	write_word(buffer, R31);
+	write_word(buffer + 0x04, R29);
+	write_word(buffer + 0x08, R30);
+
+	for (int i = 0; i < 8; i++)
+		write_word(buffer + 0x0C + i * WORD_SIZE, R(16 + i));
+
+	write_word(buffer + 0x2C, R28);
+
+	R2 = 0;
+}
+
+static void hle_longjmp()
+{
+	jump_to_buffer(R4, R5);
+}
+
+static void hle_putchar()
+{
+	output_char((char)R4);
+	R2 = R4;
+}
+
+static void hle_puts()
+{
+	char string[HLE_STRING_SIZE];
+	read_guest_string(R4, string, sizeof(string));
+
+	output_string(string);
+	output_char('\n');
+}
+
+static void hle_printf()
+{
+	R2 = guest_printf(R4, 1);
+}
+
+static void hle_flush_cache()
+{
+	reset_icache_state();
+}
+
+/// <summary>
+/// FILE FUNCTIONS START
+/// </summary>
+
+static void hle_file_open()
+{
+	char path[HLE_PATH_SIZE];
+	uint32_t mode = R5;
+
+	R2 = 0xFFFFFFFF;
+
+	if (!get_host_path(R4, path, sizeof(path)))
+		return;
+
+	// Bit 0 is read, bit 1 is write and bit 9 creates the file
+	const char* host_mode = (mode & 0x200) ? "w+b" : (mode & 0x2) ? "r+b" : "rb";
+
+	for (int fd = 2; fd < HLE_MAX_FILES; fd++)
+	{
+		if (hle_state.files[fd] != NULL)
+			continue;
+
+		hle_state.files[fd] = fopen(path, host_mode);
+
+		if (hle_state.files[fd] == NULL)
+			log_warning("HLE BIOS couldn't open file %s\n", path);
+		else
+			R2 = fd;
+
+		return;
+	}
+
+	log_warning("HLE BIOS has no file descriptor left to open %s\n", path);
+}
+
+static void hle_file_seek()
+{
+	FILE* file = get_file(R4);
+
+	if (file == NULL || fseek(file, (int32_t)R5, R6 == 1 ? SEEK_CUR : SEEK_SET) != 0)
+	{
+		R2 = 0xFFFFFFFF;
+		return;
+	}
+
+	R2 = ftell(file);
+}
+
+static void hle_file_read()
+{
+	FILE* file = get_file(R4);
+
+	if (file == NULL)
+	{
+		R2 = 0xFFFFFFFF;
+		return;
+	}
+
+	uint8_t buffer[4096];
+	uint32_t total = 0;
+
+	while (total < R6)
+	{
+		size_t chunk = R6 - total < sizeof(buffer) ? R6 - total : sizeof(buffer);
+		size_t read = fread(buffer, 1, chunk, file);
+
+		for (size_t i = 0; i < read; i++)
+			write_byte(R5 + total + i, buffer[i]);
+
+		total += read;
+
+		if (read < chunk)
+			break;
+	}
+
+	R2 = total;
+}
+
+static void hle_file_write()
+{
+	uint32_t fd = R4;
+	FILE* file = get_file(fd);
+
+	// Descriptors 0 and 1 are the TTY
+	if (file == NULL && fd > 1)
+	{
+		R2 = 0xFFFFFFFF;
+		return;
+	}
+
+	for (uint32_t i = 0; i < R6; i++)
+	{
+		uint8_t c = read_byte(R5 + i);
+
+		if (file != NULL)
+			fputc(c, file);
+		else
+			output_char((char)c);
+	}
+
+	R2 = R6;
+}
+
+static void hle_file_close()
+{
+	FILE* file = get_file(R4);
+
+	if (file == NULL)
+	{
+		R2 = 0xFFFFFFFF;
+		return;
+	}
+
+	fclose(file);
+	hle_state.files[R4] = NULL;
+
+	R2 = R4;
+}
+
+/// <summary>
+/// EVENT FUNCTIONS START
+/// </summary>
+
+static void hle_deliver_event()
+{
+	deliver_event(R4, R5);
+
+	// Callbacks run before returning to the caller
+	if (hle_state.pending_callback_count > 0)
+	{
+		HLEContext context;
+		save_context(&context, cpu_state.pc);
+
+		start_callbacks(&context, false);
+	}
+}
+
+static void hle_open_event()
+{
+	for (int i = 0; i < HLE_MAX_EVENTS; i++)
+	{
+		HLEEvent* event = &hle_state.events[i];
+
+		if (event->status != 0)
+			continue;
+
+		event->event_class = R4;
+		event->spec = R5;
+		event->mode = R6;
+		event->function = R7;
+		event->status = 0x1000;
+
+		R2 = 0xF1000000 | i;
+
+		return;
+	}
+
+	R2 = 0xFFFFFFFF;
+}
+
+static void hle_close_event()
+{
+	HLEEvent* event = get_event(R4);
+
+	if (event != NULL)
+		event->status = 0;
+
+	R2 = 1;
+}
+
+static void hle_wait_event()
+{
+	HLEEvent* event = get_event(R4);
+
+	if (event == NULL || (event->status != 0x2000 && event->status != 0x4000))
+	{
+		R2 = 0;
+		return;
+	}
+
+	if (event->status == 0x4000)
+	{
+		event->status = 0x2000;
+		R2 = 1;
+		return;
+	}
+
+	// Call the function again until an interrupt delivers the event
+	cpu_state.pc = 0xB0;
+}
+
+static void hle_test_event()
+{
+	HLEEvent* event = get_event(R4);
+
+	if (event != NULL && event->status == 0x4000)
+	{
+		event->status = 0x2000;
+		R2 = 1;
+	}
+	else
+		R2 = 0;
+}
+
+static void hle_enable_event()
+{
+	HLEEvent* event = get_event(R4);
+
+	if (event != NULL)
+		event->status = 0x2000;
+
+	R2 = 1;
+}
+
+static void hle_disable_event()
+{
+	HLEEvent* event = get_event(R4);
+
+	if (event != NULL)
+		event->status = 0x1000;
+
+	R2 = 1;
+}
+
+static void hle_undeliver_event()
+{
+	for (int i = 0; i < HLE_MAX_EVENTS; i++)
+	{
+		HLEEvent* event = &hle_state.events[i];
+
+		if (event->status == 0x4000 && event->event_class == R4 && event->spec == R5)
+			event->status = 0x2000;
+	}
+}
+
+/// <summary>
+/// THREAD AND EXCEPTION FUNCTIONS START
+/// </summary>
+
+static void hle_open_thread()
+{
+	for (int i = 1; i < HLE_MAX_THREADS; i++)
+	{
+		if (hle_state.thread_used[i])
+			continue;
+
+		HLEContext* thread = &hle_state.threads[i];
+		memset(thread, 0, sizeof(HLEContext));
+
+		thread->pc = R4;
+		thread->registers[29] = R5;
+		thread->registers[30] = R5;
+		thread->registers[28] = R6;
+		thread->sr = SR;
+
+		hle_state.thread_used[i] = true;
+		R2 = 0xFF000000 | i;
+
+		return;
+	}
+
+	R2 = 0xFFFFFFFF;
+}
+
+static void hle_close_thread()
+{
+	uint32_t index = R4 & 0xFFFF;
+
+	if (index < HLE_MAX_THREADS && (int)index != hle_state.current_thread)
+		hle_state.thread_used[index] = false;
+
+	R2 = 1;
+}
+
+static void hle_change_thread()
+{
+	uint32_t index = R4 & 0xFFFF;
+
+	if (index >= HLE_MAX_THREADS || !hle_state.thread_used[index])
+	{
+		R2 = 0;
+		return;
+	}
+
+	// The current thread gets 1 as the return value when it is resumed
+	R2 = 1;
+
+	if ((int)index == hle_state.current_thread)
+		return;
+
+	save_context(&hle_state.threads[hle_state.current_thread], cpu_state.pc);
+	restore_context(&hle_state.threads[index]);
+
+	hle_state.current_thread = index;
+}
+
+static void hle_return_from_exception()
+{
+	restore_context(&hle_state.exception_context);
+}
+
+static void hle_reset_entry_int()
+{
+	hle_state.custom_exit = 0;
+}
+
+static void hle_hook_entry_int()
+{
+	hle_state.custom_exit = R4;
+}
+
+static const HLEFunction a0_functions[0x100] = {
+	[0x00] = hle_file_open,
+	[0x01] = hle_file_seek,
+	[0x02] = hle_file_read,
+	[0x03] = hle_file_write,
+	[0x04] = hle_file_close,
+	[0x13] = hle_setjmp,
+	[0x14] = hle_longjmp,
+	[0x15] = hle_strcat,
+	[0x17] = hle_strcmp,
+	[0x18] = hle_strncmp,
+	[0x19] = hle_strcpy,
+	[0x1A] = hle_strncpy,
+	[0x1B] = hle_strlen,
+	[0x1C] = hle_strchr, // index
+	[0x1E] = hle_strchr,
+	[0x25] = hle_toupper,
+	[0x26] = hle_tolower,
+	[0x27] = hle_bcopy,
+	[0x28] = hle_bzero,
+	[0x29] = hle_memcmp, // bcmp
+	[0x2A] = hle_memcpy,
+	[0x2B] = hle_memset,
+	[0x2C] = hle_memcpy, // memmove, copy_guest_memory() handles overlaps
+	[0x2D] = hle_memcmp,
+	[0x2E] = hle_memchr,
+	[0x2F] = hle_rand,
+	[0x30] = hle_srand,
+	[0x33] = hle_malloc,
+	[0x34] = hle_free,
+	[0x37] = hle_calloc,
+	[0x38] = hle_realloc,
+	[0x39] = hle_init_heap,
+	[0x3C] = hle_putchar,
+	[0x3E] = hle_puts,
+	[0x3F] = hle_printf,
+	[0x44] = hle_flush_cache,
+};
+
+static const HLEFunction b0_functions[0x100] = {
+	[0x07] = hle_deliver_event,
+	[0x08] = hle_open_event,
+	[0x09] = hle_close_event,
+	[0x0A] = hle_wait_event,
+	[0x0B] = hle_test_event,
+	[0x0C] = hle_enable_event,
+	[0x0D] = hle_disable_event,
+	[0x0E] = hle_open_thread,
+	[0x0F] = hle_close_thread,
+	[0x10] = hle_change_thread,
+	[0x17] = hle_return_from_exception,
+	[0x18] = hle_reset_entry_int,
+	[0x19] = hle_hook_entry_int,
+	[0x20] = hle_undeliver_event,
+	[0x32] = hle_file_open,
+	[0x33] = hle_file_seek,
+	[0x34] = hle_file_read,
+	[0x35] = hle_file_write,
+	[0x36] = hle_file_close,
+	[0x3D] = hle_putchar,
+	[0x3F] = hle_puts,
+};
+
+/// <summary>
+/// Runs a function of the A0h, B0h or C0h table, returning to the caller unless the function jumps elsewhere
+/// </summary>
+/// <param name="table">0 for A0h, 1 for B0h, 2 for C0h</param>
+static void call_kernel_function(int table)
+{
+	static const HLEFunction* const tables[3] = { a0_functions, b0_functions, NULL };
+	uint8_t function = R9 & 0xFF;
+
+	cpu_state.pc = R31;
+
+	HLEFunction handler = tables[table] != NULL ? tables[table][function] : NULL;
+
+	if (handler != NULL)
+	{
+		handler();
+		return;
+	}
+
+	// The C0h functions set up the kernel internals, which are native here
+	if (table != 2 && !(hle_state.reported_functions[table][function / 32] & (1 << (function % 32))))
+	{
+		hle_state.reported_functions[table][function / 32] |= 1 << (function % 32);
+		log_warning("Unimplemented HLE BIOS function %X0h:%02Xh called from %x\n", 0xA + table, function, R31);
+	}
+
+	R2 = 0;
+}
+
+/// <summary>
+/// Handles syscalls and interrupts like the kernel exception handler
+/// </summary>
+static void handle_hle_exception()
+{
+	uint32_t exception = (CAUSE >> 2) & 0x1F;
+
+	cpu_state.delay_jump = false;
+
+	if (exception == SYSCALL)
+	{
+		cpu_state.pc = EPC + 4;
+
+		switch (R4)
+		{
+			case 1: // EnterCriticalSection
+				R2 = (SR & 0x401) == 0x401;
+				SR &= ~0x401;
+				break;
+
+			case 2: // ExitCriticalSection
+				SR |= 0x401;
+				break;
+
+			default:
+				log_warning("Unhandled HLE BIOS syscall %x\n", R4);
+				break;
+		}
+
+		return;
+	}
+
+	if (exception != INTERRUPT)
+	{
+		log_error("Unhandled exception %x in the HLE BIOS at %x\n", exception, EPC);
+		debug_state.in_debug = true;
+		cpu_state.pc = EPC;
+		return;
+	}
+
+	// Interrupts are taken between instructions, when EPC is one instruction behind
+	HLEContext context;
+	save_context(&context, EPC + 4);
+	hle_state.exception_context = context;
+
+	uint32_t irqs = interrupt_regs.serviced_irqs;
+	interrupt_regs.serviced_irqs = 0;
+
+	// The root counter events, VBlank being the 4th counter
+	if (irqs & (1 << IRQ_VBLANK))
+		deliver_event(0xF2000003, 0x0002);
+
+	for (int i = 0; i < 3; i++)
+	{
+		if (irqs & (1 << (IRQ_TMR0 + i)))
+			deliver_event(0xF2000000 + i, 0x0002);
+	}
+
+	start_callbacks(&context, true);
+}
+
+/// <summary>
+/// Initializes the kernel state and the vectors in RAM, then jumps to the shell entry point where the EXE is sideloaded
+/// </summary>
+static void hle_reset()
+{
+	for (int i = 0; i < HLE_MAX_FILES; i++)
+	{
+		if (hle_state.files[i] != NULL)
+			fclose(hle_state.files[i]);
+	}
+
+	bool enabled = hle_state.enabled;
+	memset(&hle_state, 0, sizeof(hle_state));
+	hle_state.enabled = enabled;
+
+	hle_state.thread_used[0] = true;
+	hle_state.random_seed = 1;
+
+	write_word(0x000000A0, HLE_OPCODE | HLE_TRAP_A0);
+	write_word(0x000000B0, HLE_OPCODE | HLE_TRAP_B0);
+	write_word(0x000000C0, HLE_OPCODE | HLE_TRAP_C0);
+	write_word(0x00000080, HLE_OPCODE | HLE_TRAP_EXCEPTION);
+	write_word(HLE_CALLBACK_RETURN_ADDRESS, HLE_OPCODE | HLE_TRAP_CALLBACK_RETURN);
+
+	// Exceptions now go to the RAM vector
+	SR &= ~(1 << 22);
+
+	cpu_state.pc = SHELL_ENTRY_POINT;
+}
+
+void init_hle_bios()
+{
+	hle_state.enabled = true;
+
+	// Nothing of a BIOS loaded before must run
+	clear_bios_rom();
+	bios_rom[0] = HLE_OPCODE | HLE_TRAP_RESET;
+	bios_rom[0x180 / WORD_SIZE] = HLE_OPCODE | HLE_TRAP_EXCEPTION;
+
+	flush_block_cache();
+}
+
+void hle_bios_trap()
+{
+	if (!hle_state.enabled)
+	{
+		undefined();
+		return;
+	}
+
+	switch ((HLETrap)(cpu_state.current_opcode & 0xFF))
+	{
+		case HLE_TRAP_RESET:
+			hle_reset();
+			break;
+
+		case HLE_TRAP_A0:
+			call_kernel_function(0);
+			break;
+
+		case HLE_TRAP_B0:
+			call_kernel_function(1);
+			break;
+
+		case HLE_TRAP_C0:
+			call_kernel_function(2);
+			break;
+
+		case HLE_TRAP_EXCEPTION:
+			handle_hle_exception();
+			break;
+
+		case HLE_TRAP_CALLBACK_RETURN:
+			run_next_callback();
+			break;
+
+		default:
+			undefined();
+			break;
+	}
+}
@@ -0,0 +1,69 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "icache.h"
+#include "memory.h"
+
+PSX_THREAD_LOCAL ICacheState icache_state = {0};
+
+void reset_icache_state()
+{
+	memset(&icache_state, 0, sizeof(icache_state));
+}
+
+int fill_icache_line(uint32_t address)
+{
+	uint32_t line = (address / ICACHE_LINE_SIZE) % ICACHE_LINE_COUNT;
+	uint32_t word = (address / WORD_SIZE) % (ICACHE_LINE_SIZE / WORD_SIZE);
+	uint32_t words_per_line = ICACHE_LINE_SIZE / WORD_SIZE;
+
+	// A new tag drops the words of the previous one
+	if (icache_state.tags[line] != (address & ICACHE_TAG_MASK))
+	{
+		icache_state.tags[line] = address & ICACHE_TAG_MASK;
+		icache_state.valid[line] = 0;
+	}
+
+	// The line is filled from the missed word to its end
+	uint32_t* page = read_page_table[address >> MEMORY_PAGE_SHIFT];
+
+	for (uint32_t i = word; i < words_per_line; i++)
+	{
+		uint32_t word_address = (address & ~(ICACHE_LINE_SIZE - 1)) + i * WORD_SIZE;
+
+		if (page != NULL)
+			icache_state.data[line * words_per_line + i] = page[(word_address & (MEMORY_PAGE_SIZE - 1)) / WORD_SIZE];
+
+		icache_state.valid[line] |= 1 << i;
+	}
+
+	return get_uncached_fetch_cycles(address) + (words_per_line - 1 - word) * BURST_FETCH_CYCLES;
+}
+
+int fetch_icache_range(uint32_t address, int count)
+{
+	int cycles = 0;
+
+	for (int i = 0; i < count; i++)
+		cycles += fetch_icache(address + i * WORD_SIZE);
+
+	return cycles;
+}
+
+uint32_t read_isolated_icache(uint32_t address)
+{
+	return icache_state.data[(address / WORD_SIZE) % (ICACHE_SIZE / WORD_SIZE)];
+}
+
+void write_isolated_icache(uint32_t address, uint32_t value)
+{
+	if (cpu_cache_control[CACHE_CONTROL_INDEX] & CACHE_CONTROL_TAG_TEST)
+	{
+		uint32_t line = (address / ICACHE_LINE_SIZE) % ICACHE_LINE_COUNT;
+
+		icache_state.tags[line] = address & ICACHE_TAG_MASK;
+		icache_state.valid[line] = 0;
+	}
+	else
+		icache_state.data[(address / WORD_SIZE) % (ICACHE_SIZE / WORD_SIZE)] = value;
+}
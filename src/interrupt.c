@@ -6,15 +6,17 @@
 #include "logging.h"
 #include "coprocessor.h"
 
-InterruptState interrupt_regs = {
+PSX_THREAD_LOCAL InterruptState interrupt_regs = {
 	.I_STAT = 0,
-	.I_MASK = 0
+	.I_MASK = 0,
+	.serviced_irqs = 0
 };
 
 void reset_interrupt_state()
 {
 	interrupt_regs.I_STAT = 0;
 	interrupt_regs.I_MASK = 0;
+	interrupt_regs.serviced_irqs = 0;
 }
 
 uint32_t read_interrupt_control(uint32_t address)
@@ -79,6 +81,7 @@ void service_interrupts()
 			CPR0(13) |= 1 << 10;
 			// Clear I_STAT bit
 			interrupt_regs.I_STAT &= ~mask;
+			interrupt_regs.serviced_irqs |= mask;
 		}
 	}
 
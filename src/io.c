@@ -1,3 +1,5 @@
+#include <stdbool.h>
+
 #include "io.h"
 #include "cpu.h"
 #include "gpu.h"
@@ -7,9 +9,27 @@
 #include "timer.h"
 #include "cdrom.h"
 #include "debug.h"
+#include "block_cache.h"
 
 #define IGNORE_SPU_LOGS
 
+/// <summary>
+/// Checks if reading a register can give a different value without any write or scheduler event in between
+/// </summary>
+static bool is_volatile_register(uint32_t address)
+{
+	// Timer counters change with every cycle
+	if (address >= TIMERS_REGS_START && address < TIMERS_REGS_END)
+		return true;
+
+	// Only the CDROM status register has no side effect when read
+	if (address >= CDROM_REGS_START && address < CDROM_REGS_END)
+		return address != CDROM_REGS_START;
+
+	// GPUREAD returns the next word of a VRAM transfer
+	return address == GPU_REGS_START;
+}
+
 /// <summary>
 /// Reads a word from an IO port
 /// </summary>
@@ -20,6 +40,10 @@ uint32_t read_io(uint32_t address)
 	if (debug_state.print_instructions)
 		log_debug("IO Read at ADR %x\n", address);
 
+	// Idle loops polling this register must run normally
+	if (is_volatile_register(address))
+		block_cache.volatile_io_read = true;
+
 	if (address >= MEM_CTRL1_START && address < MEM_CTRL1_END)
 	{
 		log_warning("Unhandled memory control 1 read at address %x\n", address);
@@ -164,3 +188,46 @@ void write_io(uint32_t address, uint32_t value)
 	else
 		log_warning("Unhandled IO write at address %x\n", address);
 }
+
+/// <summary>
+/// Checks if the registers at an address are narrower than a word and addressed individually
+/// </summary>
+/// <param name="address">The IO port address</param>
+/// <returns>Whether the register should be accessed at its exact address</returns>
+static bool is_narrow_register(uint32_t address)
+{
+	return (address >= CDROM_REGS_START && address < CDROM_REGS_END)
+		|| (address >= SPU_VOICE_START && address < SPU_INTERNAL_END);
+}
+
+uint8_t read_io_byte(uint32_t address)
+{
+	if (is_narrow_register(address))
+		return read_io(address) & 0xFF;
+
+	return (read_io(address & ~0b11) >> ((address & 0b11) * 8)) & 0xFF;
+}
+
+uint16_t read_io_half(uint32_t address)
+{
+	if (is_narrow_register(address))
+		return read_io(address) & 0xFFFF;
+
+	return (read_io(address & ~0b11) >> ((address & 0b10) * 8)) & 0xFFFF;
+}
+
+void write_io_byte(uint32_t address, uint8_t value)
+{
+	if (is_narrow_register(address))
+		write_io(address, value);
+	else
+		write_io(address & ~0b11, (uint32_t)value << ((address & 0b11) * 8));
+}
+
+void write_io_half(uint32_t address, uint16_t value)
+{
+	if (is_narrow_register(address))
+		write_io(address, value);
+	else
+		write_io(address & ~0b11, (uint32_t)value << ((address & 0b10) * 8));
+}
@@ -12,34 +12,37 @@
 #include "logging.h"
 #include "gpu.h"
 #include "interrupt.h"
+#include "scheduler.h"
+#include "timer.h"
+#include "hle_bios.h"
+#include "boot_snapshot.h"
+#include "rewind.h"
+#include "context.h"
 
 const char bios_path[] = "roms/Sony PlayStation SCPH-1002 BIOS v2.0 (1995-05-10)(Sony)(EU).bin";
 const char exe_path[] = "roms/psxtest_cpu.exe";
 
-MainState main_state = {
+PSX_THREAD_LOCAL MainState main_state = {
 	.finished_bios_boot = false,
 	.file_header = {0},
+	.exe_file = { .data = NULL, .size = 0, .fd = -1 },
 	.exe_contents = NULL,
+	.fast_boot = false,
+	.boot_snapshot_pending = false,
+	.limit_speed = true,
+	.emulation_speed = 0.0,
+	.speed_measure_cycles = 0,
+	.speed_measure_time = 0.0,
 };
 
 static int load_bios(const char* path)
 {
-	FILE* bios_file = fopen(path, "rb");
-	if (!bios_file)
+	if (map_bios_into_mem(path) != 0)
 	{
 		log_error("Error while trying to load the BIOS file!\n");
 		return -1;
 	}
 
-	fseek(bios_file, 0, SEEK_END);
-	size_t bios_size = ftell(bios_file);
-	rewind(bios_file);
-
-	if (bios_size != 512 * KIB_SIZE)
-		log_warning("BIOS file size is not 512 KiB\n");
-
-	load_bios_into_mem(bios_file);
-
 	return 0;
 }
 
@@ -62,45 +65,39 @@ static void print_exe_header(EXEHeader file_header)
 
 int load_exe(const char* exe_path)
 {
-	FILE* exe_file = fopen(exe_path, "rb");
-	if (!exe_file)
+	FileMapping exe_file;
+
+	if (map_file(exe_path, &exe_file) != 0)
 	{
 		log_error("Error while trying to load the EXE file!\n");
 		return -1;
 	}
 
-	fseek(exe_file, 0, SEEK_END);
-	size_t exe_size = ftell(exe_file);
-	rewind(exe_file);
-
-	if (exe_size < 0x800)
+	if (exe_file.size < 0x800)
 	{
 		log_error("File is too small! This is probably not a PSX exe!\n");
+		unmap_file(&exe_file);
 		return -1;
 	}
 
-	memset(&main_state.file_header, 0, sizeof(main_state.file_header));
-	fread(&main_state.file_header, sizeof(uint8_t), sizeof(main_state.file_header), exe_file);
-	rewind(exe_file);
-
-	print_exe_header(main_state.file_header);
-
-	if (main_state.exe_contents != NULL)
-		free(main_state.exe_contents);
+	EXEHeader file_header;
+	memcpy(&file_header, exe_file.data, sizeof(file_header));
 
-	main_state.exe_contents = malloc(main_state.file_header.file_size);
+	print_exe_header(file_header);
 
-	if (main_state.exe_contents == NULL)
+	// The EXE data follows the header, it is only copied once when sideloaded into RAM
+	if (file_header.file_size > exe_file.size - 0x800)
 	{
-		log_error("Error while trying to allocate memory for the EXE contents!\n");
+		log_error("EXE file is truncated! The header gives %x bytes of data\n", file_header.file_size);
+		unmap_file(&exe_file);
 		return -1;
 	}
 
-	// Seek the end of the header to load the actual EXE data
-	fseek(exe_file, 0x800, SEEK_SET);
-	// Load the EXE data into RAM
-	fread(main_state.exe_contents, sizeof(uint32_t), main_state.file_header.file_size / 4, exe_file);
+	unmap_file(&main_state.exe_file);
 
+	main_state.exe_file = exe_file;
+	main_state.file_header = file_header;
+	main_state.exe_contents = (const uint32_t*)&exe_file.data[0x800];
 	main_state.finished_bios_boot = false;
 
 	return 0;
@@ -112,35 +109,131 @@ int load_exe(const char* exe_path)
 /// <returns>0 if the sideloading worked, -1 otherwise</returns>
 static int sideload_exe()
 {
-	sideload_exe_into_mem(main_state.file_header, main_state.exe_contents);
+	// Not tried again if it fails, the BIOS shell keeps running instead
 	main_state.finished_bios_boot = true;
 
-	return 0;
+	return sideload_exe_into_mem(main_state.file_header, main_state.exe_contents, main_state.exe_file.size - 0x800);
+}
+
+/// <summary>
+/// Measures the emulation speed, and waits when the emulation runs ahead of real time
+/// </summary>
+static void pace_frame()
+{
+	double time = glfwGetTime();
+
+	// The cycle count goes back to 0 when the emulator is reset
+	if (scheduler_state.cycles < main_state.speed_measure_cycles)
+	{
+		main_state.speed_measure_cycles = scheduler_state.cycles;
+		main_state.speed_measure_time = time;
+	}
+
+	// The emulated time and real time elapsed since the last measurement
+	double emulated_time = (double)(scheduler_state.cycles - main_state.speed_measure_cycles) / CPU_FREQ;
+	double real_time = time - main_state.speed_measure_time;
+
+	if (main_state.limit_speed && emulated_time > real_time)
+	{
+		glfwWaitEventsTimeout(emulated_time - real_time);
+		real_time = glfwGetTime() - main_state.speed_measure_time;
+	}
+
+	if (real_time >= SPEED_MEASURE_INTERVAL)
+	{
+		main_state.emulation_speed = emulated_time / real_time;
+		main_state.speed_measure_cycles = scheduler_state.cycles;
+		main_state.speed_measure_time = glfwGetTime();
+	}
+}
+
+/// <summary>
+/// Releases the console state and the EXE mapped for it, on every way out of main
+/// </summary>
+static void free_main_state()
+{
+	unmap_file(&main_state.exe_file);
+	main_state.exe_contents = NULL;
+
+	free_context();
 }
 
 int main(int argc, char** argv)
 {
+	if (init_context() != 0)
+		return -1;
+
 	// Unit tests
 	test_memory();
 	test_instructions();
 
-	// We need a loaded BIOS for the emulator to work
-	if (load_bios(bios_path) != 0)
+	bool use_hle_bios = false;
+
+	for (int i = 1; i < argc; i++)
 	{
-		log_error("Couldn't load BIOS at startup!\n");
-		return -1;
+		// Compare the CPU backends on the same code and exit, no BIOS or interface needed
+		if (strcmp(argv[i], "--benchmark") == 0)
+		{
+			benchmark_cpu_backends();
+			free_main_state();
+			return 0;
+		}
+
+		if (strcmp(argv[i], "--hle") == 0)
+			use_hle_bios = true;
+
+		if (strcmp(argv[i], "--fast-boot") == 0)
+			main_state.fast_boot = true;
+
+		if (strcmp(argv[i], "--software-gpu") == 0)
+			gpu_backend = GPU_BACKEND_SOFTWARE;
 	}
 
-	if (load_exe(exe_path) != 0)
+	reset_scheduler_state();
+	reset_timer_state();
+	reset_gpu_state();
+
+	bool loaded_exe = load_exe(exe_path) == 0;
+
+	if (!loaded_exe)
 		log_warning("Couldn't load EXE file at startup!\n");
 
+	// Without a BIOS the kernel is emulated, which can only boot an EXE
+	if (use_hle_bios || load_bios(bios_path) != 0)
+	{
+		if (!loaded_exe)
+		{
+			log_error("Couldn't load BIOS at startup!\n");
+			free_main_state();
+			return -1;
+		}
+
+		log_info("Booting the EXE with the HLE BIOS\n");
+		init_hle_bios();
+	}
+	else if (main_state.fast_boot)
+	{
+		if (load_boot_snapshot(BOOT_SNAPSHOT_PATH) == 0)
+		{
+			log_info("Restored the boot snapshot, skipping the BIOS boot\n");
+			main_state.speed_measure_cycles = scheduler_state.cycles;
+
+			if (loaded_exe && sideload_exe() != 0)
+				log_error("Couldn't sideload the EXE, staying in the BIOS shell\n");
+		}
+		else
+			main_state.boot_snapshot_pending = true;
+	}
+
 	if (start_interface() != 0)
 	{
 		log_error("Couldn't start interface!\n");
+		free_main_state();
 		return -1;
 	}
 
-	int frame_count = 0;
+	if (init_rewind() != 0)
+		log_warning("Couldn't enable rewinding!\n");
 
 	// Emulation loop
 	while (update_interface() == 0)
@@ -148,32 +241,33 @@ int main(int argc, char** argv)
 		if (debug_state.in_debug)
 			continue;
 
-		int cycle_count = 0;
+		uint64_t frame_count = gpu_state.frame_count;
 
-		// Run emulation until we finish a frame or we encounter a breakpoint
-		while (cycle_count < NTSC_FRAME_CYCLE_COUNT && !debug_state.in_debug)
+		// Run emulation until the next VBlank or until we encounter a breakpoint,
+		// the devices are updated by the scheduler events in between
+		while (gpu_state.frame_count == frame_count && !debug_state.in_debug)
 		{
-			handle_instruction(debug_state.print_instructions);
-			cycle_count++;
+			run_cpu(debug_state.print_instructions);
 
-			if (!main_state.finished_bios_boot && cpu_state.pc == 0x80030000)
-				sideload_exe();
-		}
+			if (!main_state.finished_bios_boot && cpu_state.pc == SHELL_ENTRY_POINT)
+			{
+				// Taken before the EXE is loaded, so the snapshot can start any EXE
+				if (main_state.boot_snapshot_pending && save_boot_snapshot(BOOT_SNAPSHOT_PATH) == 0)
+					log_info("Saved the boot snapshot at %s\n", BOOT_SNAPSHOT_PATH);
 
-		frame_count++;
+				main_state.boot_snapshot_pending = false;
 
-		if (frame_count == 59)
-		{
-			frame_count = 0;
-			request_interrupt(IRQ_VBLANK);
+				if (sideload_exe() != 0)
+					log_error("Couldn't sideload the EXE, staying in the BIOS shell\n");
+			}
 		}
 
-		// TODO : Implement proper timings and emulate this correctly
-		gpu_state.gpu_status.drawing_odd_lines = !gpu_state.gpu_status.drawing_odd_lines;
-		update_gpustat();
+		record_rewind_frame();
+		pace_frame();
 	}
 
 	stop_interface();
+	free_main_state();
 
 	return 0;
 }
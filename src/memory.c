@@ -1,6 +1,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdbool.h>
 
 #include "memory.h"
 #include "logging.h"
@@ -8,57 +9,290 @@
 #include "coprocessor.h"
 #include "cpu.h"
 #include "io.h"
+#include "block_cache.h"
+#include "fastmem.h"
+#include "icache.h"
+#include "dirty_pages.h"
+#include "file_mapping.h"
+
+/// <summary>
+/// Host memory for RAM, BIOS ROM and scratchpad when fastmem is unavailable, allocated by init_memory()
+/// </summary>
+static PSX_THREAD_LOCAL uint32_t* memory_backing = NULL;
 
 /// <summary>
 /// 2048 KiB
 /// </summary>
-uint32_t ram[2048 * KIB_TO_WORD_SIZE] = { 0 };
+PSX_THREAD_LOCAL uint32_t* ram = NULL;
 
 /// <summary>
-/// 8192 KiB
+/// 8192 KiB, allocated on the first write. Nothing is connected there for most games, reads before that come from zero_page
 /// </summary>
-uint32_t expansion_1[8192 * KIB_TO_WORD_SIZE] = { 0 };
+static PSX_THREAD_LOCAL uint32_t* expansion_1 = NULL;
 
 /// <summary>
 /// 1 KiB
 /// </summary>
-uint32_t scratchpad[1 * KIB_TO_WORD_SIZE] = { 0 };
+PSX_THREAD_LOCAL uint32_t* scratchpad = NULL;
 
 /// <summary>
 /// 4 KiB
 /// </summary>
-uint32_t io_ports[4 * KIB_TO_WORD_SIZE] = { 0 };
+PSX_THREAD_LOCAL uint32_t io_ports[4 * KIB_TO_WORD_SIZE] = { 0 };
 
 /// <summary>
 /// 8 KiB
 /// </summary>
-uint32_t expansion_2[8 * KIB_TO_WORD_SIZE] = { 0 };
+PSX_THREAD_LOCAL uint32_t expansion_2[8 * KIB_TO_WORD_SIZE] = { 0 };
 
 /// <summary>
-/// 2048 KiB
+/// 2048 KiB, allocated on the first write like expansion region 1
+/// </summary>
+static PSX_THREAD_LOCAL uint32_t* expansion_3 = NULL;
+
+/// <summary>
+/// 512 KiB, either the mapped BIOS file or bios_rom_memory
 /// </summary>
-uint32_t expansion_3[2048 * KIB_TO_WORD_SIZE] = { 0 };
+PSX_THREAD_LOCAL uint32_t* bios_rom = NULL;
 
 /// <summary>
-/// 512 KiB - Doesn't correspond to actual BIOS ROM size
+/// The writable memory of the BIOS ROM, used once the mapped BIOS file gets written to or when there is none
 /// </summary>
-uint32_t bios_rom[2048 * KIB_TO_WORD_SIZE] = { 0 };
+static PSX_THREAD_LOCAL uint32_t* bios_rom_memory = NULL;
+
+/// <summary>
+/// The BIOS file mapped read only as the BIOS ROM, shared with any other process mapping it
+/// </summary>
+static PSX_THREAD_LOCAL FileMapping bios_file = {
+	.data = NULL,
+	.size = 0,
+	.fd = -1,
+};
 
 /// <summary>
 /// 0.5 KiB
 /// </summary>
-uint32_t cpu_cache_control[512 / WORD_SIZE] = { 0 };
+PSX_THREAD_LOCAL uint32_t cpu_cache_control[CONTROL_REGISTERS_SIZE / WORD_SIZE] = { 0 };
+
+/// <summary>
+/// Backs the reads of the expansion regions that aren't allocated yet, never written as it is only in the read page
+/// tables. Shared by the consoles of all threads
+/// </summary>
+static uint32_t zero_page[MEMORY_PAGE_SIZE / WORD_SIZE] = { 0 };
+
+PSX_THREAD_LOCAL uint32_t** read_page_table = NULL;
+PSX_THREAD_LOCAL uint32_t** write_page_table = NULL;
+
+/// <summary>
+/// Maps a region of host memory in the page tables for all three segments
+/// </summary>
+/// <param name="physical_address">The physical address of the region, must be page aligned</param>
+/// <param name="memory">The host memory of the region</param>
+/// <param name="size">The size of the region in bytes, must be a multiple of the page size</param>
+/// <param name="writable">Whether writes can go directly to the host memory</param>
+static void map_pages(uint32_t physical_address, uint32_t* memory, uint32_t size, bool writable)
+{
+	static const uint32_t segments[] = { 0x00000000, 0x80000000, 0xA0000000 }; // KUSEG, KSEG0, KSEG1
+
+	for (int i = 0; i < 3; i++)
+	{
+		for (uint32_t offset = 0; offset < size; offset += MEMORY_PAGE_SIZE)
+		{
+			uint32_t page = (segments[i] + physical_address + offset) >> MEMORY_PAGE_SHIFT;
+
+			read_page_table[page] = &memory[offset / WORD_SIZE];
+			write_page_table[page] = writable ? &memory[offset / WORD_SIZE] : NULL;
+		}
+	}
+}
+
+/// <summary>
+/// Maps the zero page for reads over a whole region, writes go through the segment handlers
+/// </summary>
+/// <param name="physical_address">The physical address of the region, must be page aligned</param>
+/// <param name="size">The size of the region in bytes, must be a multiple of the page size</param>
+static void map_zero_pages(uint32_t physical_address, uint32_t size)
+{
+	static const uint32_t segments[] = { 0x00000000, 0x80000000, 0xA0000000 }; // KUSEG, KSEG0, KSEG1
+
+	for (int i = 0; i < 3; i++)
+	{
+		for (uint32_t offset = 0; offset < size; offset += MEMORY_PAGE_SIZE)
+		{
+			uint32_t page = (segments[i] + physical_address + offset) >> MEMORY_PAGE_SHIFT;
+
+			read_page_table[page] = zero_page;
+			write_page_table[page] = NULL;
+		}
+	}
+}
+
+/// <summary>
+/// Drops the memory of the expansion regions 1 and 3, they read as zero again until written
+/// </summary>
+static void free_expansion_regions()
+{
+	free(expansion_1);
+	free(expansion_3);
+	expansion_1 = NULL;
+	expansion_3 = NULL;
+
+	map_zero_pages(0x1F000000, EXPANSION_1_SIZE);
+	map_zero_pages(0x1FA00000, EXPANSION_3_SIZE);
+}
+
+/// <summary>
+/// Reads a word of expansion region 1 or 3, zero if the region isn't allocated
+/// </summary>
+/// <param name="physical_address">The physical address to read, inside one of the regions</param>
+static uint32_t read_expansion(uint32_t physical_address)
+{
+	if (physical_address < 0x1FA00000)
+		return expansion_1 != NULL ? expansion_1[(physical_address - 0x1F000000) / WORD_SIZE] : 0;
+
+	return expansion_3 != NULL ? expansion_3[(physical_address - 0x1FA00000) / WORD_SIZE] : 0;
+}
+
+/// <summary>
+/// Writes a word of expansion region 1 or 3, the region is allocated and mapped in the page tables on its first write
+/// </summary>
+/// <param name="physical_address">The physical address to write, inside one of the regions</param>
+/// <param name="value">The value to be written</param>
+static void write_expansion(uint32_t physical_address, uint32_t value)
+{
+	bool is_expansion_1 = physical_address < 0x1FA00000;
+	uint32_t** region = is_expansion_1 ? &expansion_1 : &expansion_3;
+	uint32_t start = is_expansion_1 ? 0x1F000000 : 0x1FA00000;
+	uint32_t size = is_expansion_1 ? EXPANSION_1_SIZE : EXPANSION_3_SIZE;
+
+	if (*region == NULL)
+	{
+		*region = calloc(size, 1);
+
+		if (*region == NULL)
+		{
+			log_error("Error while trying to allocate memory for the expansion region at %x!\n", start);
+			return;
+		}
+
+		map_pages(start, *region, size, true);
+	}
+
+	(*region)[(physical_address - start) / WORD_SIZE] = value;
+}
+
+/// <summary>
+/// Moves the BIOS ROM from the mapped BIOS file to bios_rom_memory, so that it can be written to
+/// </summary>
+/// <param name="copy_contents">Whether the contents of the file are kept, they are left undefined otherwise</param>
+static void use_bios_rom_memory(bool copy_contents)
+{
+	if (bios_file.data == NULL)
+		return;
+
+	if (copy_contents)
+		memcpy(bios_rom_memory, bios_file.data, BIOS_ROM_SIZE);
+
+	bios_rom = bios_rom_memory;
+	map_pages(0x1FC00000, bios_rom, BIOS_ROM_SIZE, false);
+
+	if (map_fastmem_bios(-1) != 0)
+		log_warning("Couldn't map the BIOS ROM memory in the fastmem arena, disabling fastmem\n");
+
+	unmap_file(&bios_file);
+
+	// The cached code pointed into the file
+	flush_block_cache();
+}
+
+/// <summary>
+/// Writes a word of the BIOS ROM, the mapped BIOS file is never modified
+/// </summary>
+/// <param name="physical_address">The physical address to write, inside the BIOS ROM</param>
+/// <param name="value">The value to be written</param>
+static void write_bios_rom(uint32_t physical_address, uint32_t value)
+{
+	use_bios_rom_memory(true);
+
+	bios_rom[(physical_address - 0x1FC00000) / WORD_SIZE] = value;
+	flush_block_cache();
+}
+
+int init_memory()
+{
+	read_page_table = calloc(MEMORY_PAGE_COUNT, sizeof(uint32_t*));
+	write_page_table = calloc(MEMORY_PAGE_COUNT, sizeof(uint32_t*));
+
+	// The memory regions go in the fastmem arena if possible, so that they are also mapped at their guest addresses
+	uint8_t* backing = init_fastmem();
+
+	if (backing == NULL)
+	{
+		memory_backing = calloc(MEMORY_BACKING_SIZE, 1);
+		backing = (uint8_t*)memory_backing;
+	}
+
+	if (read_page_table == NULL || write_page_table == NULL || backing == NULL)
+	{
+		log_error("Error while trying to allocate memory for the guest memory!\n");
+		free_memory();
+		return -1;
+	}
+
+	ram = (uint32_t*)(backing + RAM_OFFSET);
+	bios_rom = (uint32_t*)(backing + BIOS_ROM_OFFSET);
+	bios_rom_memory = bios_rom;
+	scratchpad = (uint32_t*)(backing + SCRATCHPAD_OFFSET);
+
+	// The page containing the scratchpad, IO ports and expansion region 2 stays on the slow path
+	for (uint32_t mirror = 0; mirror < RAM_MIRROR_SIZE; mirror += RAM_SIZE)
+		map_pages(mirror, ram, RAM_SIZE, true);
+
+	free_expansion_regions();
+
+	// BIOS writes need to drop the cached code
+	map_pages(0x1FC00000, bios_rom, BIOS_ROM_SIZE, false);
+
+	return 0;
+}
+
+void free_memory()
+{
+	unmap_file(&bios_file);
+
+	free(expansion_1);
+	free(expansion_3);
+	free(memory_backing);
+	free(read_page_table);
+	free(write_page_table);
+	free_fastmem();
+
+	expansion_1 = NULL;
+	expansion_3 = NULL;
+	memory_backing = NULL;
+	read_page_table = NULL;
+	write_page_table = NULL;
+	ram = NULL;
+	bios_rom = NULL;
+	bios_rom_memory = NULL;
+	scratchpad = NULL;
+}
 
 void clear_memory()
 {
-	memset(ram, 0, sizeof(ram));
-	memset(expansion_1, 0, sizeof(expansion_1));
-	memset(scratchpad, 0, sizeof(scratchpad));
+	memset(ram, 0, RAM_SIZE);
+	memset(scratchpad, 0, SCRATCHPAD_SIZE);
 	memset(io_ports, 0, sizeof(io_ports));
 	memset(expansion_2, 0, sizeof(expansion_2));
-	memset(expansion_3, 0, sizeof(expansion_3));
-	memset(bios_rom, 0, sizeof(bios_rom));
+	clear_bios_rom();
+
+	free_expansion_regions();
+
 	memset(cpu_cache_control, 0, sizeof(cpu_cache_control));
+
+	flush_block_cache();
+	reset_icache_state();
+	mark_all_pages_dirty();
 }
 
 /// <summary>
@@ -73,15 +307,15 @@ static uint32_t read_word_kuseg(uint32_t address)
 	if (address < RAM_SIZE) // Main RAM
 		return ram[word_index];
 	else if (address >= 0x1F000000 && address < 0x1F000000 + EXPANSION_1_SIZE) // Expansion region 1
-		return expansion_1[word_index - 0x1F000000 / WORD_SIZE];
+		return read_expansion(address & 0x1FFFFFFF);
 	else if (address >= 0x1F800000 && address < 0x1F800000 + SCRATCHPAD_SIZE) // Scratchpad (D-cache)
 		return scratchpad[word_index - 0x1F800000 / WORD_SIZE];
 	else if (address >= 0x1F801000 && address < 0x1F801000 + IO_PORTS_SIZE) // IO ports
-		return read_io(address);
+		return read_io(address & 0x1FFFFFFF);
 	else if (address >= 0x1F802000 && address < 0x1F802000 + EXPANSION_2_SIZE) // Expansion region 2
 		return expansion_2[word_index - 0x1F802000 / WORD_SIZE];
 	else if (address >= 0x1FA00000 && address < 0x1FA00000 + EXPANSION_3_SIZE) // Expansion region 3
-		return expansion_3[word_index - 0x1FA00000 / WORD_SIZE];
+		return read_expansion(address & 0x1FFFFFFF);
 	else if (address >= 0x1FC00000 && address < 0x1FC00000 + BIOS_ROM_SIZE) // BIOS ROM
 		return bios_rom[word_index - 0x1FC00000 / WORD_SIZE];
 
@@ -103,15 +337,15 @@ static uint32_t read_word_kseg0(uint32_t address)
 	if (address >= 0x80000000 && address < 0x80000000 + RAM_SIZE) // Main RAM
 		return ram[word_index - 0x80000000 / WORD_SIZE];
 	else if (address >= 0x9F000000 && address < 0x9F000000 + EXPANSION_1_SIZE) // Expansion region 1
-		return expansion_1[word_index - 0x9F000000 / WORD_SIZE];
+		return read_expansion(address & 0x1FFFFFFF);
 	else if (address >= 0x9F800000 && address < 0x9F800000 + SCRATCHPAD_SIZE) // Scratchpad (D-cache)
 		return scratchpad[word_index - 0x9F800000 / WORD_SIZE];
 	else if (address >= 0x9F801000 && address < 0x9F801000 + IO_PORTS_SIZE) // IO ports
-		return read_io(address);
+		return read_io(address & 0x1FFFFFFF);
 	else if (address >= 0x9F802000 && address < 0x9F802000 + EXPANSION_2_SIZE) // Expansion region 2
 		return expansion_2[word_index - 0x9F802000 / WORD_SIZE];
 	else if (address >= 0x9FA00000 && address < 0x9FA00000 + EXPANSION_3_SIZE) // Expansion region 3
-		return expansion_3[word_index - 0x9FA00000 / WORD_SIZE];
+		return read_expansion(address & 0x1FFFFFFF);
 	else if (address >= 0x9FC00000 && address < 0x9FC00000 + BIOS_ROM_SIZE) // BIOS ROM
 		return bios_rom[word_index - 0x9FC00000 / WORD_SIZE];
 
@@ -133,13 +367,13 @@ static uint32_t read_word_kseg1(uint32_t address)
 	if (address >= 0xA0000000 && address < 0xA0000000 + RAM_SIZE) // Main RAM
 		return ram[word_index - 0xA0000000 / WORD_SIZE];
 	else if (address >= 0xBF000000 && address < 0xBF000000 + EXPANSION_1_SIZE) // Expansion region 1
-		return expansion_1[word_index - 0xBF000000 / WORD_SIZE];
+		return read_expansion(address & 0x1FFFFFFF);
 	else if (address >= 0xBF801000 && address < 0xBF801000 + IO_PORTS_SIZE) // IO ports
-		return read_io(address);
+		return read_io(address & 0x1FFFFFFF);
 	else if (address >= 0xBF802000 && address < 0xBF802000 + EXPANSION_2_SIZE) // Expansion region 2
 		return expansion_2[word_index - 0xBF802000 / WORD_SIZE];
 	else if (address >= 0xBFA00000 && address < 0xBFA00000 + EXPANSION_3_SIZE) // Expansion region 3
-		return expansion_3[word_index - 0xBFA00000 / WORD_SIZE];
+		return read_expansion(address & 0x1FFFFFFF);
 	else if (address >= 0xBFC00000 && address < 0xBFC00000 + BIOS_ROM_SIZE) // BIOS ROM
 		return bios_rom[word_index - 0xBFC00000 / WORD_SIZE];
 
@@ -174,19 +408,28 @@ static uint32_t read_word_kseg2(uint32_t address)
 /// <returns>The word at the address</returns>
 uint32_t read_word(uint32_t address)
 {
-	// If bit 16 of reg 12 in CPR0 is set, writes are directed to the data cache
+	// If bit 16 of reg 12 in CPR0 is set, reads are directed to the instruction cache
 	if (CPR0(12) & 0x10000)
 	{
-		//log_warning("Unhandled isolated cache mem read at %x\n", address);
-		return 0xFFFFFFFF;
+		if (debug_state.breakpoint_count > 0)
+			check_data_breakpoints(address);
+
+		return read_isolated_icache(address);
 	}
 
+	// The data breakpoints are checked there
 	return read_word_internal(address);
 }
 
 uint32_t read_word_internal(uint32_t address)
 {
-	check_data_breakpoints(address);
+	if (debug_state.breakpoint_count > 0)
+		check_data_breakpoints(address);
+
+	uint32_t* page = read_page_table[address >> MEMORY_PAGE_SHIFT];
+
+	if (page != NULL)
+		return page[(address & (MEMORY_PAGE_SIZE - 1)) / WORD_SIZE];
 
 	if (address <= 0x1FC00000) // KUSEG read
 		return read_word_kuseg(address);
@@ -213,19 +456,23 @@ static void write_word_kuseg(uint32_t address, uint32_t value)
 	uint32_t word_index = address / WORD_SIZE;
 
 	if (address < RAM_SIZE) // Main RAM
+	{
 		ram[word_index] = value;
+		mark_ram_dirty(address);
+		invalidate_cached_code(address);
+	}
 	else if (address >= 0x1F000000 && address < 0x1F000000 + EXPANSION_1_SIZE) // Expansion region 1
-		expansion_1[word_index - 0x1F000000 / WORD_SIZE] = value;
+		write_expansion(address & 0x1FFFFFFF, value);
 	else if (address >= 0x1F800000 && address < 0x1F800000 + SCRATCHPAD_SIZE) // Scratchpad (D-cache)
 		scratchpad[word_index - 0x1F800000 / WORD_SIZE] = value;
 	else if (address >= 0x1F801000 && address < 0x1F801000 + IO_PORTS_SIZE) // IO ports
-		write_io(address, value);
+		write_io(address & 0x1FFFFFFF, value);
 	else if (address >= 0x1F802000 && address < 0x1F802000 + EXPANSION_2_SIZE) // Expansion region 2
 		expansion_2[word_index - 0x1F802000 / WORD_SIZE] = value;
 	else if (address >= 0x1FA00000 && address < 0x1FA00000 + RAM_SIZE) // Expansion region 3
-		expansion_3[word_index - 0x1FA00000 / WORD_SIZE] = value;
+		write_expansion(address & 0x1FFFFFFF, value);
 	else if (address >= 0x1FC00000 && address < 0x1FC00000 + BIOS_ROM_SIZE) // BIOS ROM
-		bios_rom[word_index - 0x1FC00000 / WORD_SIZE] = value;
+		write_bios_rom(address & 0x1FFFFFFF, value);
 	else
 	{
 		log_error("Attempted to write outside of usable address space in KUSEG! ADDRESS %x VALUE %x\n", address, value);
@@ -243,19 +490,23 @@ static void write_word_kseg0(uint32_t address, uint32_t value)
 	uint32_t word_index = address / WORD_SIZE;
 
 	if (address >= 0x80000000 && address < 0x80000000 + RAM_SIZE) // Main RAM
+	{
 		ram[word_index - 0x80000000 / WORD_SIZE] = value;
+		mark_ram_dirty(address - 0x80000000);
+		invalidate_cached_code(address - 0x80000000);
+	}
 	else if (address >= 0x9F000000 && address < 0x9F000000 + EXPANSION_1_SIZE) // Expansion region 1
-		expansion_1[word_index - 0x9F000000 / WORD_SIZE] = value;
+		write_expansion(address & 0x1FFFFFFF, value);
 	else if (address >= 0x9F800000 && address < 0x9F800000 + SCRATCHPAD_SIZE) // Scratchpad (D-cache)
 		scratchpad[word_index - 0x9F800000 / WORD_SIZE] = value;
 	else if (address >= 0x9F801000 && address < 0x9F801000 + IO_PORTS_SIZE) // IO ports
-		write_io(address, value);
+		write_io(address & 0x1FFFFFFF, value);
 	else if (address >= 0x9F802000 && address < 0x9F802000 + EXPANSION_2_SIZE) // Expansion region 2
 		expansion_2[word_index - 0x9F802000 / WORD_SIZE] = value;
 	else if (address >= 0x9FA00000 && address < 0x9FA00000 + RAM_SIZE) // Expansion region 3
-		expansion_3[word_index - 0x9FA00000 / WORD_SIZE] = value;
+		write_expansion(address & 0x1FFFFFFF, value);
 	else if (address >= 0x9FC00000 && address < 0x9FC00000 + BIOS_ROM_SIZE) // BIOS ROM
-		bios_rom[word_index - 0x9FC00000 / WORD_SIZE] = value;
+		write_bios_rom(address & 0x1FFFFFFF, value);
 	else
 	{
 		log_error("Attempted to write outside of usable address space in KSEG0! ADDRESS %x VALUE %x\n", address, value);
@@ -273,17 +524,21 @@ static void write_word_kseg1(uint32_t address, uint32_t value)
 	uint32_t word_index = address / WORD_SIZE;
 
 	if (address >= 0xA0000000 && address < 0xA0000000 + RAM_SIZE) // Main RAM
+	{
 		ram[word_index - 0xA0000000 / WORD_SIZE] = value;
+		mark_ram_dirty(address - 0xA0000000);
+		invalidate_cached_code(address - 0xA0000000);
+	}
 	else if (address >= 0xBF000000 && address < 0xBF000000 + EXPANSION_1_SIZE) // Expansion region 1
-		expansion_1[word_index - 0xBF000000 / WORD_SIZE] = value;
+		write_expansion(address & 0x1FFFFFFF, value);
 	else if (address >= 0xBF801000 && address < 0xBF801000 + IO_PORTS_SIZE) // IO ports
-		write_io(address, value);
+		write_io(address & 0x1FFFFFFF, value);
 	else if (address >= 0xBF802000 && address < 0xBF802000 + EXPANSION_2_SIZE) // Expansion region 2
 		expansion_2[word_index - 0xBF802000 / WORD_SIZE] = value;
 	else if (address >= 0xBFA00000 && address < 0xBFA00000 + RAM_SIZE) // Expansion region 3
-		expansion_3[word_index - 0xBFA00000 / WORD_SIZE] = value;
+		write_expansion(address & 0x1FFFFFFF, value);
 	else if (address >= 0xBFC00000 && address < 0xBFC00000 + BIOS_ROM_SIZE) // BIOS ROM
-		bios_rom[word_index - 0xBFC00000 / WORD_SIZE] = value;
+		write_bios_rom(address & 0x1FFFFFFF, value);
 	else
 	{
 		log_error("Attempted to write outside of usable address space in KSEG1! ADDRESS %x VALUE %x\n", address, value);
@@ -316,12 +571,29 @@ static void write_word_kseg2(uint32_t address, uint32_t value)
 /// <param name="value">The value to be written</param>
 void write_word(uint32_t address, uint32_t value)
 {
-	check_data_breakpoints(address);
+	if (debug_state.breakpoint_count > 0)
+		check_data_breakpoints(address);
 
-	// If bit 16 of reg 12 in CPR0 is set, writes are directed to the data cache
+	// If bit 16 of reg 12 in CPR0 is set, writes are directed to the instruction cache
 	if (CPR0(12) & 0x10000)
 	{
-		//log_warning("Unhandled isolated cache mem write at %x value %x\n", address, value);
+		write_isolated_icache(address, value);
+		return;
+	}
+
+	uint32_t* page = write_page_table[address >> MEMORY_PAGE_SHIFT];
+
+	if (page != NULL)
+	{
+		page[(address & (MEMORY_PAGE_SIZE - 1)) / WORD_SIZE] = value;
+
+		// Main RAM may contain cached code
+		if ((address & 0x1FFFFFFF) < RAM_MIRROR_SIZE)
+		{
+			mark_ram_dirty(address & (RAM_SIZE - 1));
+			invalidate_cached_code(address & (RAM_SIZE - 1));
+		}
+
 		return;
 	}
 
@@ -338,13 +610,189 @@ void write_word(uint32_t address, uint32_t value)
 	handle_mem_exception(ADES, address);
 }
 
-void load_bios_into_mem(FILE* bios_file)
+/// <summary>
+/// Checks if an address is in the IO ports, in any segment
+/// </summary>
+/// <param name="address">The address to check</param>
+/// <returns>Whether the address is in the IO ports</returns>
+static bool is_io_address(uint32_t address)
+{
+	uint32_t physical_address = address & 0x1FFFFFFF;
+
+	return physical_address >= 0x1F801000 && physical_address < 0x1F801000 + IO_PORTS_SIZE;
+}
+
+uint8_t read_byte(uint32_t address)
+{
+	if (debug_state.breakpoint_count > 0)
+		check_data_breakpoints(address);
+
+	// Reads from the isolated cache return a part of the cached word, like read_word()
+	if (CPR0(12) & 0x10000)
+		return read_isolated_icache(address & ~0b11) >> ((address & 0b11) * 8);
+
+	uint32_t* page = read_page_table[address >> MEMORY_PAGE_SHIFT];
+
+	if (page != NULL)
+		return ((uint8_t*)page)[address & (MEMORY_PAGE_SIZE - 1)];
+
+	if (is_io_address(address))
+		return read_io_byte(address & 0x1FFFFFFF);
+
+	// Plain memory outside of the page tables (scratchpad, cache control), read from the containing word
+	uint32_t shift = (address & 0b11) * 8;
+	return read_word_internal(address & ~0b11) >> shift;
+}
+
+uint16_t read_half(uint32_t address)
+{
+	if (debug_state.breakpoint_count > 0)
+		check_data_breakpoints(address);
+
+	if (CPR0(12) & 0x10000)
+		return read_isolated_icache(address & ~0b11) >> ((address & 0b10) * 8);
+
+	uint32_t* page = read_page_table[address >> MEMORY_PAGE_SHIFT];
+
+	if (page != NULL)
+		return ((uint16_t*)page)[(address & (MEMORY_PAGE_SIZE - 1)) / HALF_WORD_SIZE];
+
+	if (is_io_address(address))
+		return read_io_half(address & 0x1FFFFFFF);
+
+	uint32_t shift = (address & 0b10) * 8;
+	return read_word_internal(address & ~0b11) >> shift;
+}
+
+void write_byte(uint32_t address, uint8_t value)
+{
+	if (debug_state.breakpoint_count > 0)
+		check_data_breakpoints(address);
+
+	if (CPR0(12) & 0x10000)
+		return;
+
+	uint32_t* page = write_page_table[address >> MEMORY_PAGE_SHIFT];
+
+	if (page != NULL)
+	{
+		((uint8_t*)page)[address & (MEMORY_PAGE_SIZE - 1)] = value;
+
+		if ((address & 0x1FFFFFFF) < RAM_MIRROR_SIZE)
+		{
+			mark_ram_dirty(address & (RAM_SIZE - 1));
+			invalidate_cached_code(address & (RAM_SIZE - 1));
+		}
+
+		return;
+	}
+
+	if (is_io_address(address))
+	{
+		write_io_byte(address & 0x1FFFFFFF, value);
+		return;
+	}
+
+	// Plain memory outside of the page tables (scratchpad, BIOS ROM, cache control), update the containing word
+	uint32_t aligned_address = address & ~0b11;
+	uint32_t shift = (address & 0b11) * 8;
+	uint32_t word = read_word_internal(aligned_address);
+
+	write_word(aligned_address, (word & ~(0xFF << shift)) | ((uint32_t)value << shift));
+}
+
+void write_half(uint32_t address, uint16_t value)
+{
+	if (debug_state.breakpoint_count > 0)
+		check_data_breakpoints(address);
+
+	if (CPR0(12) & 0x10000)
+		return;
+
+	uint32_t* page = write_page_table[address >> MEMORY_PAGE_SHIFT];
+
+	if (page != NULL)
+	{
+		((uint16_t*)page)[(address & (MEMORY_PAGE_SIZE - 1)) / HALF_WORD_SIZE] = value;
+
+		if ((address & 0x1FFFFFFF) < RAM_MIRROR_SIZE)
+		{
+			mark_ram_dirty(address & (RAM_SIZE - 1));
+			invalidate_cached_code(address & (RAM_SIZE - 1));
+		}
+
+		return;
+	}
+
+	if (is_io_address(address))
+	{
+		write_io_half(address & 0x1FFFFFFF, value);
+		return;
+	}
+
+	uint32_t aligned_address = address & ~0b11;
+	uint32_t shift = (address & 0b10) * 8;
+	uint32_t word = read_word_internal(aligned_address);
+
+	write_word(aligned_address, (word & ~(0xFFFF << shift)) | ((uint32_t)value << shift));
+}
+
+int map_bios_into_mem(const char* path)
+{
+	use_bios_rom_memory(false);
+
+	if (map_file(path, &bios_file) != 0)
+		return -1;
+
+	if (bios_file.size != BIOS_ROM_SIZE)
+		log_warning("BIOS file size is not 512 KiB\n");
+
+	// Mapping a smaller file would fault past its end, it is copied instead like when it couldn't be mapped
+	if (bios_file.size != BIOS_ROM_SIZE || bios_file.fd == -1)
+	{
+		memset(bios_rom_memory, 0, BIOS_ROM_SIZE);
+		memcpy(bios_rom_memory, bios_file.data, bios_file.size < BIOS_ROM_SIZE ? bios_file.size : BIOS_ROM_SIZE);
+		unmap_file(&bios_file);
+
+		flush_block_cache();
+		return 0;
+	}
+
+	bios_rom = (uint32_t*)bios_file.data;
+	map_pages(0x1FC00000, bios_rom, BIOS_ROM_SIZE, false);
+
+	if (map_fastmem_bios(bios_file.fd) != 0)
+		log_warning("Couldn't map the BIOS file in the fastmem arena, disabling fastmem\n");
+
+	flush_block_cache();
+
+	return 0;
+}
+
+void clear_bios_rom()
 {
-	fread(&bios_rom, sizeof(uint8_t), 512 * KIB_SIZE, bios_file);
+	use_bios_rom_memory(false);
+	memset(bios_rom, 0, BIOS_ROM_SIZE);
 }
 
-void sideload_exe_into_mem(EXEHeader file_header, uint32_t* exe_file)
+int sideload_exe_into_mem(EXEHeader file_header, const uint32_t* exe_file, size_t exe_size)
 {
+	// Get the mapped address in RAM, and file size
+	uint32_t destination_address = file_header.destination_address & 0x1FFFFFFF;
+	uint32_t file_size = file_header.file_size;
+
+	if (file_size > exe_size)
+	{
+		log_error("Sideloaded EXE is truncated! The header gives %x bytes of data, the file has %zx\n", file_size, exe_size);
+		return -1;
+	}
+
+	if ((destination_address & 0b11) != 0 || destination_address >= RAM_SIZE || file_size > RAM_SIZE - destination_address)
+	{
+		log_error("Sideloaded EXE doesn't fit in RAM! Destination %x, size %x\n", file_header.destination_address, file_size);
+		return -1;
+	}
+
 	// Set the registers using the header info
 	cpu_state.pc = file_header.initial_pc;
 	R28 = file_header.initial_r28;
@@ -355,12 +803,14 @@ void sideload_exe_into_mem(EXEHeader file_header, uint32_t* exe_file)
 		R30 = file_header.initial_r29_r30_address + file_header.initial_r29_r30_offset;
 	}
 
-	// Get the mapped address in RAM, and file size
-	uint32_t destination_address = file_header.destination_address - 0x80000000;
-	uint32_t file_size = file_header.file_size;
-
 	if ((file_size % 0x800) != 0)
 		log_error("Sideloaded EXE file size is not a multiple of 0x800!\n");
 
 	memcpy(&ram[destination_address / 4], exe_file, file_size);
+
+	// The EXE may overwrite code that was already decoded
+	mark_ram_range_dirty(destination_address, file_size);
+	invalidate_cached_code_range(destination_address, file_size);
+
+	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,755 @@
+#if defined(__unix__) || defined(__APPLE__)
+#define RASTERIZER_THREADS_SUPPORTED
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef RASTERIZER_THREADS_SUPPORTED
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "rasterizer.h"
+#include "gpu.h"
+#include "dirty_pages.h"
+#include "logging.h"
+
+#define VRAM_WIDTH 1024
+#define VRAM_HEIGHT 512
+
+/// <summary>
+/// A worker thread and the bands it draws
+/// </summary>
+typedef struct
+{
+	RasterizerPool* pool;
+	int index;
+} RasterizerWorker;
+
+struct RasterizerPool
+{
+#ifdef RASTERIZER_THREADS_SUPPORTED
+	pthread_t threads[RASTERIZER_MAX_THREADS - 1];
+	RasterizerWorker workers[RASTERIZER_MAX_THREADS - 1];
+	int started_threads;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work_ready;
+	pthread_cond_t work_done;
+
+	/// <summary>
+	/// Increased for each flush, the workers wait for it to change
+	/// </summary>
+	uint64_t generation;
+
+	/// <summary>
+	/// The number of workers still drawing the current flush
+	/// </summary>
+	int pending;
+	bool quit;
+#endif
+
+	/// <summary>
+	/// The primitives of the current flush and the VRAM they are drawn into
+	/// </summary>
+	const RasterPrimitive* primitives;
+	int primitive_count;
+	uint16_t* vram;
+	int thread_count;
+};
+
+PSX_THREAD_LOCAL RasterizerState rasterizer_state = {
+	.queue = NULL,
+	.queue_count = 0,
+	.queued_writes = { 0, 0, -1, -1 },
+	.queued_reads = { 0, 0, -1, -1 },
+	.pool = NULL,
+	.thread_count = 1,
+};
+
+static const RasterRect empty_rect = { 0, 0, -1, -1 };
+
+// Offsets added to the 8 bit colors before they are truncated to 5 bits
+static const int dither_matrix[4][4] = {
+	{ -4, 0, -3, 1 },
+	{ 2, -2, 3, -1 },
+	{ -3, 1, -4, 0 },
+	{ 3, -1, 2, -2 },
+};
+
+static inline int clamp_color(int value)
+{
+	return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+static inline int min_int(int a, int b)
+{
+	return a < b ? a : b;
+}
+
+static inline int max_int(int a, int b)
+{
+	return a > b ? a : b;
+}
+
+/// <summary>
+/// Reads a texel of the texture page of a primitive, through its CLUT for the 4 and 8 bit modes
+/// </summary>
+static uint16_t sample_texture(const uint16_t* vram, const RasterPrimitive* primitive, uint8_t u, uint8_t v)
+{
+	// The texture window replaces the masked UV bits with the offset ones, both are in 8 pixel steps
+	u = (u & ~(primitive->texture_window_mask_x * 8)) | ((primitive->texture_window_offset_x & primitive->texture_window_mask_x) * 8);
+	v = (v & ~(primitive->texture_window_mask_y * 8)) | ((primitive->texture_window_offset_y & primitive->texture_window_mask_y) * 8);
+
+	uint32_t page_x = (primitive->texture_page & 0xF) * 64;
+	uint32_t page_y = ((primitive->texture_page >> 4) & 1) * 256;
+	uint32_t colors = (primitive->texture_page >> 7) & 3;
+
+	uint32_t clut_x = (primitive->clut & 0x3F) * 16;
+	uint32_t clut_y = (primitive->clut >> 6) & 0x1FF;
+
+	uint32_t line = (page_y + v) * VRAM_WIDTH;
+
+	// 4 and 8 bit pages pack 4 and 2 CLUT indices in each halfword, from the lowest bits
+	if (colors == PAGE_4_BIT)
+	{
+		uint16_t indices = vram[line + ((page_x + u / 4) & (VRAM_WIDTH - 1))];
+		uint32_t index = (indices >> ((u & 3) * 4)) & 0xF;
+		return vram[clut_y * VRAM_WIDTH + ((clut_x + index) & (VRAM_WIDTH - 1))];
+	}
+	else if (colors == PAGE_8_BIT)
+	{
+		uint16_t indices = vram[line + ((page_x + u / 2) & (VRAM_WIDTH - 1))];
+		uint32_t index = (indices >> ((u & 1) * 8)) & 0xFF;
+		return vram[clut_y * VRAM_WIDTH + ((clut_x + index) & (VRAM_WIDTH - 1))];
+	}
+
+	return vram[line + ((page_x + u) & (VRAM_WIDTH - 1))];
+}
+
+/// <summary>
+/// Blends a 5 bit color channel with the one already in VRAM
+/// </summary>
+static inline int blend_channel(int back, int front, int mode)
+{
+	switch (mode)
+	{
+		case 0:
+			return (back + front) >> 1;
+		case 1:
+			return min_int(back + front, 31);
+		case 2:
+			return max_int(back - front, 0);
+		default:
+			return min_int(back + (front >> 2), 31);
+	}
+}
+
+/// <summary>
+/// Shades a pixel of a primitive and writes it to VRAM, following the texture, dither, semi transparency and mask rules
+/// </summary>
+/// <param name="red">The 8 bit red value of the pixel</param>
+/// <param name="green">The 8 bit green value of the pixel</param>
+/// <param name="blue">The 8 bit blue value of the pixel</param>
+static void draw_pixel_to_vram(uint16_t* vram, const RasterPrimitive* primitive, int x, int y, int red, int green, int blue,
+	uint8_t u, uint8_t v)
+{
+	uint16_t* pixel = &vram[y * VRAM_WIDTH + x];
+
+	if (primitive->check_mask && (*pixel & 0x8000))
+		return;
+
+	bool blend = primitive->flags & RASTER_SEMI_TRANSPARENT;
+	uint16_t texel_mask = 0;
+
+	if (primitive->flags & RASTER_TEXTURED)
+	{
+		uint16_t texel = sample_texture(vram, primitive, u, v);
+
+		// A texel of 0 is fully transparent
+		if (texel == 0)
+			return;
+
+		// Only the texels with their top bit set are semi transparent
+		texel_mask = texel & 0x8000;
+		blend = blend && texel_mask;
+
+		int texel_red = (texel & 0x1F) << 3;
+		int texel_green = ((texel >> 5) & 0x1F) << 3;
+		int texel_blue = ((texel >> 10) & 0x1F) << 3;
+
+		if (primitive->flags & RASTER_RAW_TEXTURE)
+		{
+			red = texel_red;
+			green = texel_green;
+			blue = texel_blue;
+		}
+		else
+		{
+			// A color of 128 leaves the texel as it is
+			red = min_int((texel_red * red) >> 7, 255);
+			green = min_int((texel_green * green) >> 7, 255);
+			blue = min_int((texel_blue * blue) >> 7, 255);
+		}
+	}
+
+	if (primitive->dither)
+	{
+		int offset = dither_matrix[y & 3][x & 3];
+
+		red = clamp_color(red + offset);
+		green = clamp_color(green + offset);
+		blue = clamp_color(blue + offset);
+	}
+
+	red >>= 3;
+	green >>= 3;
+	blue >>= 3;
+
+	if (blend)
+	{
+		int mode = (primitive->texture_page >> 5) & 3;
+
+		red = blend_channel(*pixel & 0x1F, red, mode);
+		green = blend_channel((*pixel >> 5) & 0x1F, green, mode);
+		blue = blend_channel((*pixel >> 10) & 0x1F, blue, mode);
+	}
+
+	*pixel = red | (green << 5) | (blue << 10) | texel_mask | (primitive->set_mask ? 0x8000 : 0);
+}
+
+/// <summary>
+/// Gets the edge function of a triangle edge at a pixel, positive on the inner side of the edge
+/// </summary>
+static inline int64_t get_edge_value(const RasterVertex* a, const RasterVertex* b, int x, int y)
+{
+	return (int64_t)(b->x - a->x) * (y - a->y) - (int64_t)(b->y - a->y) * (x - a->x);
+}
+
+/// <summary>
+/// Checks if an edge is a top or a left edge, the pixels right on those edges are drawn while the ones on the
+/// bottom and right edges are not
+/// </summary>
+static inline bool is_top_left_edge(const RasterVertex* a, const RasterVertex* b)
+{
+	return (a->y == b->y && b->x > a->x) || b->y < a->y;
+}
+
+static inline int interpolate(int64_t w0, int64_t w1, int64_t w2, int a0, int a1, int a2, int64_t area)
+{
+	return (int)((w0 * a0 + w1 * a1 + w2 * a2 + area / 2) / area);
+}
+
+/// <summary>
+/// Draws the lines of a triangle from top to bottom, the vertices are in the order giving it a positive area
+/// </summary>
+static void draw_triangle_lines(uint16_t* vram, const RasterPrimitive* primitive, int top, int bottom)
+{
+	const RasterVertex* v0 = &primitive->vertices[0];
+	const RasterVertex* v1 = &primitive->vertices[1];
+	const RasterVertex* v2 = &primitive->vertices[2];
+
+	int64_t area = get_edge_value(v0, v1, v2->x, v2->y);
+
+	// The pixels on a bottom or right edge get a bias that keeps them out
+	int64_t bias0 = is_top_left_edge(v1, v2) ? 0 : 1;
+	int64_t bias1 = is_top_left_edge(v2, v0) ? 0 : 1;
+	int64_t bias2 = is_top_left_edge(v0, v1) ? 0 : 1;
+
+	bool gouraud = primitive->flags & RASTER_GOURAUD;
+	bool textured = primitive->flags & RASTER_TEXTURED;
+
+	for (int y = top; y <= bottom; y++)
+	{
+		int x = primitive->min_x;
+
+		int64_t w0 = get_edge_value(v1, v2, x, y);
+		int64_t w1 = get_edge_value(v2, v0, x, y);
+		int64_t w2 = get_edge_value(v0, v1, x, y);
+
+		// Moving one pixel right changes each edge value by a constant
+		int64_t step0 = v1->y - v2->y;
+		int64_t step1 = v2->y - v0->y;
+		int64_t step2 = v0->y - v1->y;
+
+		for (; x <= primitive->max_x; x++, w0 += step0, w1 += step1, w2 += step2)
+		{
+			if (w0 < bias0 || w1 < bias1 || w2 < bias2)
+				continue;
+
+			int red = v0->r;
+			int green = v0->g;
+			int blue = v0->b;
+
+			if (gouraud)
+			{
+				red = interpolate(w0, w1, w2, v0->r, v1->r, v2->r, area);
+				green = interpolate(w0, w1, w2, v0->g, v1->g, v2->g, area);
+				blue = interpolate(w0, w1, w2, v0->b, v1->b, v2->b, area);
+			}
+
+			uint8_t u = 0;
+			uint8_t v = 0;
+
+			if (textured)
+			{
+				u = interpolate(w0, w1, w2, v0->u, v1->u, v2->u, area);
+				v = interpolate(w0, w1, w2, v0->v, v1->v, v2->v, area);
+			}
+
+			draw_pixel_to_vram(vram, primitive, x, y, red, green, blue, u, v);
+		}
+	}
+}
+
+static void draw_rectangle_lines(uint16_t* vram, const RasterPrimitive* primitive, int top, int bottom)
+{
+	const RasterVertex* corner = &primitive->vertices[0];
+
+	for (int y = top; y <= bottom; y++)
+	{
+		for (int x = primitive->min_x; x <= primitive->max_x; x++)
+			draw_pixel_to_vram(vram, primitive, x, y, corner->r, corner->g, corner->b, 0, 0);
+	}
+}
+
+/// <summary>
+/// Draws the part of the primitives on the bands of lines of a thread
+/// </summary>
+/// <param name="thread_index">The thread drawing, it draws every thread_count band starting from this one</param>
+static void draw_primitives(uint16_t* vram, const RasterPrimitive* primitives, int count, int thread_index, int thread_count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		const RasterPrimitive* primitive = &primitives[i];
+
+		int first_band = primitive->min_y / RASTERIZER_BAND_HEIGHT;
+		int last_band = primitive->max_y / RASTERIZER_BAND_HEIGHT;
+
+		for (int band = first_band; band <= last_band; band++)
+		{
+			if (band % thread_count != thread_index)
+				continue;
+
+			int top = max_int(band * RASTERIZER_BAND_HEIGHT, primitive->min_y);
+			int bottom = min_int(band * RASTERIZER_BAND_HEIGHT + RASTERIZER_BAND_HEIGHT - 1, primitive->max_y);
+
+			if (primitive->type == RASTER_TRIANGLE)
+				draw_triangle_lines(vram, primitive, top, bottom);
+			else
+				draw_rectangle_lines(vram, primitive, top, bottom);
+		}
+	}
+}
+
+#ifdef RASTERIZER_THREADS_SUPPORTED
+static void* run_rasterizer_worker(void* argument)
+{
+	RasterizerWorker* worker = argument;
+	RasterizerPool* pool = worker->pool;
+	uint64_t generation = 0;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	while (true)
+	{
+		while (!pool->quit && pool->generation == generation)
+			pthread_cond_wait(&pool->work_ready, &pool->mutex);
+
+		if (pool->quit)
+			break;
+
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->mutex);
+
+		draw_primitives(pool->vram, pool->primitives, pool->primitive_count, worker->index, pool->thread_count);
+
+		pthread_mutex_lock(&pool->mutex);
+
+		if (--pool->pending == 0)
+			pthread_cond_signal(&pool->work_done);
+	}
+
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+#endif
+
+/// <summary>
+/// Starts the worker threads, one less than the number of cores as the emulator thread draws too
+/// </summary>
+static void start_rasterizer_threads()
+{
+	rasterizer_state.pool = calloc(1, sizeof(RasterizerPool));
+	rasterizer_state.thread_count = 1;
+
+	if (rasterizer_state.pool == NULL)
+		return;
+
+#ifdef RASTERIZER_THREADS_SUPPORTED
+	RasterizerPool* pool = rasterizer_state.pool;
+
+	long core_count = sysconf(_SC_NPROCESSORS_ONLN);
+	int worker_count = (int)min_int(core_count > 0 ? core_count : 1, RASTERIZER_MAX_THREADS) - 1;
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work_ready, NULL);
+	pthread_cond_init(&pool->work_done, NULL);
+
+	for (int i = 0; i < worker_count; i++)
+	{
+		pool->workers[i].pool = pool;
+		pool->workers[i].index = i + 1;
+
+		if (pthread_create(&pool->threads[i], NULL, run_rasterizer_worker, &pool->workers[i]) != 0)
+		{
+			log_warning("Couldn't start a rasterizer thread, drawing with %d threads\n", i + 1);
+			break;
+		}
+
+		pool->started_threads++;
+	}
+
+	rasterizer_state.thread_count = pool->started_threads + 1;
+#endif
+}
+
+/// <summary>
+/// Draws the queued primitives into VRAM and empties the queue
+/// </summary>
+/// <param name="thread_count">The number of threads drawing, 1 draws them on this thread only</param>
+static void draw_queued_primitives(int thread_count)
+{
+	RasterizerPool* pool = rasterizer_state.pool;
+
+	if (thread_count == 1)
+		draw_primitives(gpu_state.vram, rasterizer_state.queue, rasterizer_state.queue_count, 0, 1);
+#ifdef RASTERIZER_THREADS_SUPPORTED
+	else
+	{
+		pool->primitives = rasterizer_state.queue;
+		pool->primitive_count = rasterizer_state.queue_count;
+		pool->vram = gpu_state.vram;
+		pool->thread_count = thread_count;
+
+		pthread_mutex_lock(&pool->mutex);
+		pool->pending = thread_count - 1;
+		pool->generation++;
+		pthread_cond_broadcast(&pool->work_ready);
+		pthread_mutex_unlock(&pool->mutex);
+
+		// This thread draws the first bands while the workers draw the others
+		draw_primitives(gpu_state.vram, rasterizer_state.queue, rasterizer_state.queue_count, 0, thread_count);
+
+		pthread_mutex_lock(&pool->mutex);
+
+		while (pool->pending != 0)
+			pthread_cond_wait(&pool->work_done, &pool->mutex);
+
+		pthread_mutex_unlock(&pool->mutex);
+	}
+#endif
+
+	for (int i = 0; i < rasterizer_state.queue_count; i++)
+	{
+		const RasterPrimitive* primitive = &rasterizer_state.queue[i];
+		mark_vram_rect_dirty(primitive->min_x, primitive->min_y, primitive->max_x, primitive->max_y);
+	}
+
+	rasterizer_state.queue_count = 0;
+	rasterizer_state.queued_writes = empty_rect;
+	rasterizer_state.queued_reads = empty_rect;
+}
+
+static inline bool is_rect_empty(RasterRect rect)
+{
+	return rect.left > rect.right || rect.top > rect.bottom;
+}
+
+static inline bool overlaps(RasterRect rect, RasterRect other)
+{
+	return !is_rect_empty(rect) && !is_rect_empty(other) &&
+		rect.left <= other.right && rect.right >= other.left && rect.top <= other.bottom && rect.bottom >= other.top;
+}
+
+/// <summary>
+/// Gets the bounding box of two rectangles
+/// </summary>
+static RasterRect merge_rects(RasterRect rect, RasterRect other)
+{
+	if (is_rect_empty(rect))
+		return other;
+
+	if (is_rect_empty(other))
+		return rect;
+
+	return (RasterRect){
+		.left = min_int(rect.left, other.left),
+		.top = min_int(rect.top, other.top),
+		.right = max_int(rect.right, other.right),
+		.bottom = max_int(rect.bottom, other.bottom),
+	};
+}
+
+/// <summary>
+/// Gets the pixels of a block of texture rows, rows crossing the right edge of VRAM wrap around so they cover the whole width
+/// </summary>
+static RasterRect get_texture_rows_rect(int x, int y, int width, int height)
+{
+	if (x + width > VRAM_WIDTH)
+		return (RasterRect){ 0, y, VRAM_WIDTH - 1, y + height - 1 };
+
+	return (RasterRect){ x, y, x + width - 1, y + height - 1 };
+}
+
+/// <summary>
+/// Gets the pixels a texture page can be sampled from
+/// </summary>
+static RasterRect get_texture_page_rect(uint16_t texture_page)
+{
+	int colors = (texture_page >> 7) & 3;
+
+	// A texture page is 256 pixels wide, so 64, 128 or 256 halfwords depending on the color mode
+	int width = colors == PAGE_4_BIT ? 64 : (colors == PAGE_8_BIT ? 128 : 256);
+
+	return get_texture_rows_rect((texture_page & 0xF) * 64, ((texture_page >> 4) & 1) * 256, width, 256);
+}
+
+/// <summary>
+/// Gets the pixels of the CLUT of a texture page, empty for the 15 bit pages
+/// </summary>
+static RasterRect get_clut_rect(uint16_t texture_page, uint16_t clut)
+{
+	int colors = (texture_page >> 7) & 3;
+
+	if (colors != PAGE_4_BIT && colors != PAGE_8_BIT)
+		return empty_rect;
+
+	return get_texture_rows_rect((clut & 0x3F) * 16, (clut >> 6) & 0x1FF, colors == PAGE_4_BIT ? 16 : 256, 1);
+}
+
+/// <summary>
+/// Checks if a textured primitive can sample pixels of a rectangle of VRAM
+/// </summary>
+static bool reads_rect(uint16_t texture_page, uint16_t clut, RasterRect rect)
+{
+	return overlaps(get_texture_page_rect(texture_page), rect) || overlaps(get_clut_rect(texture_page, clut), rect);
+}
+
+/// <summary>
+/// Makes room for a primitive in the queue and fills in the drawing environment it is drawn with
+/// </summary>
+/// <param name="bounds">The bounding box of the primitive, with the drawing offset applied</param>
+/// <returns>The primitive to fill, or NULL if it is outside of the drawing area or the queue couldn't be allocated</returns>
+static RasterPrimitive* queue_primitive(RasterPrimitiveType type, uint32_t flags, uint16_t texture_page, uint16_t clut,
+	RasterRect bounds)
+{
+	RasterRect area = {
+		.left = max_int(bounds.left, gpu_state.drawing_area_top_left.x),
+		.top = max_int(bounds.top, gpu_state.drawing_area_top_left.y),
+		.right = min_int(bounds.right, min_int(gpu_state.drawing_area_bottom_right.x, VRAM_WIDTH - 1)),
+		.bottom = min_int(bounds.bottom, min_int(gpu_state.drawing_area_bottom_right.y, VRAM_HEIGHT - 1)),
+	};
+
+	if (is_rect_empty(area))
+		return NULL;
+
+	if (rasterizer_state.queue == NULL)
+	{
+		rasterizer_state.queue = malloc(RASTERIZER_QUEUE_SIZE * sizeof(RasterPrimitive));
+
+		if (rasterizer_state.queue == NULL)
+		{
+			log_error("Error while trying to allocate memory for the rasterizer queue!\n");
+			return NULL;
+		}
+	}
+
+	bool textured = flags & RASTER_TEXTURED;
+
+	// The threads draw the queued primitives in any order across bands, so a primitive reading pixels written by the
+	// queued ones, or writing pixels they read, has to wait for them to be drawn
+	if (overlaps(area, rasterizer_state.queued_reads) ||
+		(textured && reads_rect(texture_page, clut, rasterizer_state.queued_writes)))
+		flush_rasterizer();
+
+	if (rasterizer_state.queue_count == RASTERIZER_QUEUE_SIZE)
+		flush_rasterizer();
+
+	rasterizer_state.queued_writes = merge_rects(rasterizer_state.queued_writes, area);
+
+	if (textured)
+	{
+		rasterizer_state.queued_reads = merge_rects(rasterizer_state.queued_reads, get_texture_page_rect(texture_page));
+		rasterizer_state.queued_reads = merge_rects(rasterizer_state.queued_reads, get_clut_rect(texture_page, clut));
+	}
+
+	RasterPrimitive* primitive = &rasterizer_state.queue[rasterizer_state.queue_count++];
+	memset(primitive, 0, sizeof(RasterPrimitive));
+
+	primitive->type = type;
+	primitive->flags = flags;
+	primitive->texture_page = texture_page;
+	primitive->clut = clut;
+
+	primitive->min_x = area.left;
+	primitive->min_y = area.top;
+	primitive->max_x = area.right;
+	primitive->max_y = area.bottom;
+
+	primitive->texture_window_mask_x = gpu_state.texture_window_mask.x;
+	primitive->texture_window_mask_y = gpu_state.texture_window_mask.y;
+	primitive->texture_window_offset_x = gpu_state.texture_window_offset.x;
+	primitive->texture_window_offset_y = gpu_state.texture_window_offset.y;
+
+	// Only the gouraud shaded and modulated textured primitives are dithered
+	bool modulated = textured && !(flags & RASTER_RAW_TEXTURE);
+	primitive->dither = gpu_state.gpu_status.dither_24_to_15 && ((flags & RASTER_GOURAUD) || modulated);
+
+	primitive->set_mask = gpu_state.set_mask_while_drawing;
+	primitive->check_mask = gpu_state.check_mask_before_draw;
+
+	return primitive;
+}
+
+/// <summary>
+/// Sign extends a GP0 coordinate from its 11 bits and applies the drawing offset
+/// </summary>
+static inline int16_t get_drawing_coordinate(int16_t value, float offset)
+{
+	return (int16_t)(((int16_t)((uint16_t)value << 5) >> 5) + (int)offset);
+}
+
+static void queue_triangle(const RasterVertex* v0, const RasterVertex* v1, const RasterVertex* v2, uint16_t texture_page,
+	uint16_t clut, uint32_t flags)
+{
+	RasterVertex vertices[3] = { *v0, *v1, *v2 };
+
+	for (int i = 0; i < 3; i++)
+	{
+		vertices[i].x = get_drawing_coordinate(vertices[i].x, gpu_state.drawing_area_offset.x);
+		vertices[i].y = get_drawing_coordinate(vertices[i].y, gpu_state.drawing_area_offset.y);
+	}
+
+	RasterRect bounds = {
+		.left = min_int(vertices[0].x, min_int(vertices[1].x, vertices[2].x)),
+		.top = min_int(vertices[0].y, min_int(vertices[1].y, vertices[2].y)),
+		.right = max_int(vertices[0].x, max_int(vertices[1].x, vertices[2].x)),
+		.bottom = max_int(vertices[0].y, max_int(vertices[1].y, vertices[2].y)),
+	};
+
+	// The GPU skips the polygons too big to be drawn
+	if (bounds.right - bounds.left >= VRAM_WIDTH || bounds.bottom - bounds.top >= VRAM_HEIGHT)
+		return;
+
+	int64_t area = get_edge_value(&vertices[0], &vertices[1], vertices[2].x, vertices[2].y);
+
+	if (area == 0)
+		return;
+
+	// The edge functions expect the vertices in the order giving a positive area
+	if (area < 0)
+	{
+		RasterVertex vertex = vertices[1];
+		vertices[1] = vertices[2];
+		vertices[2] = vertex;
+	}
+
+	RasterPrimitive* primitive = queue_primitive(RASTER_TRIANGLE, flags, texture_page, clut, bounds);
+
+	if (primitive == NULL)
+		return;
+
+	memcpy(primitive->vertices, vertices, sizeof(vertices));
+
+	// A primitive sampling its own pixels is drawn by one thread, so it reads them in the same order every time
+	RasterRect drawn = { primitive->min_x, primitive->min_y, primitive->max_x, primitive->max_y };
+
+	if ((flags & RASTER_TEXTURED) && reads_rect(texture_page, clut, drawn))
+		draw_queued_primitives(1);
+}
+
+void rasterize_polygon(const RasterVertex* vertices, int vertex_count, uint16_t texture_page, uint16_t clut, uint32_t flags)
+{
+	// The untextured primitives use the semi transparency mode of the drawing mode
+	if (!(flags & RASTER_TEXTURED))
+		texture_page = gpu_state.gpu_status.semi_transparency << 5;
+
+	queue_triangle(&vertices[0], &vertices[1], &vertices[2], texture_page, clut, flags);
+
+	if (vertex_count == 4)
+		queue_triangle(&vertices[1], &vertices[2], &vertices[3], texture_page, clut, flags);
+}
+
+void rasterize_rectangle(int16_t x, int16_t y, uint16_t width, uint16_t height, uint8_t red, uint8_t green, uint8_t blue)
+{
+	if (width == 0 || height == 0)
+		return;
+
+	int16_t left = get_drawing_coordinate(x, gpu_state.drawing_area_offset.x);
+	int16_t top = get_drawing_coordinate(y, gpu_state.drawing_area_offset.y);
+	RasterRect bounds = { left, top, left + width - 1, top + height - 1 };
+
+	RasterPrimitive* primitive = queue_primitive(RASTER_RECTANGLE, 0, 0, 0, bounds);
+
+	if (primitive == NULL)
+		return;
+
+	RasterVertex* corner = &primitive->vertices[0];
+	corner->x = left;
+	corner->y = top;
+	corner->r = red;
+	corner->g = green;
+	corner->b = blue;
+
+	primitive->width = width;
+	primitive->height = height;
+}
+
+void flush_rasterizer()
+{
+	if (rasterizer_state.queue_count == 0)
+		return;
+
+	if (rasterizer_state.pool == NULL)
+		start_rasterizer_threads();
+
+	draw_queued_primitives(rasterizer_state.pool != NULL ? rasterizer_state.thread_count : 1);
+}
+
+void free_rasterizer()
+{
+	rasterizer_state.queue_count = 0;
+	rasterizer_state.queued_writes = empty_rect;
+	rasterizer_state.queued_reads = empty_rect;
+
+	free(rasterizer_state.queue);
+	rasterizer_state.queue = NULL;
+
+	if (rasterizer_state.pool == NULL)
+		return;
+
+#ifdef RASTERIZER_THREADS_SUPPORTED
+	RasterizerPool* pool = rasterizer_state.pool;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->work_ready);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (int i = 0; i < pool->started_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_cond_destroy(&pool->work_ready);
+	pthread_cond_destroy(&pool->work_done);
+#endif
+
+	free(rasterizer_state.pool);
+	rasterizer_state.pool = NULL;
+	rasterizer_state.thread_count = 1;
+}
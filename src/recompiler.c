@@ -0,0 +1,1118 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define RECOMPILER_X64
+#endif
+
+#ifdef RECOMPILER_X64
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+#include "recompiler.h"
+#include "block_cache.h"
+#include "cpu.h"
+#include "memory.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "scheduler.h"
+#include "coprocessor.h"
+#include "fastmem.h"
+#include "icache.h"
+#include "logging.h"
+#include "dirty_pages.h"
+
+PSX_THREAD_LOCAL RecompilerState recompiler_state = {
+	.code_buffer = NULL,
+	.code_used = 0,
+	.fastmem_sites = NULL,
+	.flush_count = 0,
+	.unavailable = false,
+};
+
+#ifdef RECOMPILER_X64
+
+// Stores compute one page index for both the code and the dirty page bitmaps
+#if DIRTY_PAGE_SHIFT != CODE_PAGE_SHIFT
+#error "The dirty pages must have the size of the code pages"
+#endif
+
+// x86-64 register numbers
+enum
+{
+	X64_RAX = 0, X64_RCX = 1, X64_RDX = 2, X64_RBX = 3, X64_RSP = 4, X64_RBP = 5, X64_RSI = 6, X64_RDI = 7,
+	X64_R8 = 8, X64_R9 = 9, X64_R10 = 10, X64_R11 = 11, X64_R12 = 12, X64_R13 = 13, X64_R14 = 14, X64_R15 = 15,
+};
+
+// x86-64 condition codes
+enum
+{
+	CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xC,
+};
+
+// The register holding the first integer argument of a call
+#ifdef _WIN32
+#define ARG0 X64_RCX
+#else
+#define ARG0 X64_RDI
+#endif
+
+// rbx holds the address of cpu_state for the whole block, so fields are accessed as [rbx + offset]
+#define STATE_OFFSET(field) ((uint32_t)offsetof(cpu, field))
+#define REGISTER_OFFSET(reg) ((uint32_t)(offsetof(cpu, registers) + (reg) * sizeof(uint32_t)))
+
+// Callee saved host registers used to keep guest registers inside a block
+static const int cache_host_registers[RECOMPILER_CACHED_REGISTERS] = { X64_R12, X64_R13, X64_R14, X64_R15 };
+
+/// <summary>
+/// Where the next byte of native code gets written
+/// </summary>
+static PSX_THREAD_LOCAL uint8_t* emit_pointer;
+
+/// <summary>
+/// The host register holding each guest register in the block being translated, -1 if it lives in cpu_state
+/// </summary>
+static PSX_THREAD_LOCAL int host_registers[32];
+
+/// <summary>
+/// Whether each cached guest register was modified since it was last written back to cpu_state
+/// </summary>
+static PSX_THREAD_LOCAL bool dirty_registers[32];
+
+static void emit_byte(uint8_t value)
+{
+	*emit_pointer++ = value;
+}
+
+static void emit_dword(uint32_t value)
+{
+	memcpy(emit_pointer, &value, sizeof(value));
+	emit_pointer += sizeof(value);
+}
+
+static void emit_qword(uint64_t value)
+{
+	memcpy(emit_pointer, &value, sizeof(value));
+	emit_pointer += sizeof(value);
+}
+
+/// <summary>
+/// Emits a REX prefix if one is needed to encode the operands
+/// </summary>
+static void emit_rex(bool wide, int reg, int rm)
+{
+	uint8_t rex = 0x40 | (wide << 3) | ((reg >> 3) << 2) | (rm >> 3);
+
+	if (rex != 0x40)
+		emit_byte(rex);
+}
+
+/// <summary>
+/// Emits an instruction operating on two registers, reg being encoded in the ModRM reg field
+/// </summary>
+static void emit_register_operation(uint8_t operation, int reg, int rm)
+{
+	emit_rex(false, reg, rm);
+	emit_byte(operation);
+	emit_byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/// <summary>
+/// Emits an instruction operating on a register and a 32 bit field of cpu_state
+/// </summary>
+static void emit_state_operation(uint8_t operation, int reg, uint32_t offset)
+{
+	emit_rex(false, reg, X64_RBX);
+	emit_byte(operation);
+	emit_byte(0x80 | ((reg & 7) << 3) | X64_RBX);
+	emit_dword(offset);
+}
+
+// mov dst, src
+static void emit_mov_register(int dst, int src)
+{
+	emit_register_operation(0x89, src, dst);
+}
+
+// mov dst, [rbx + offset]
+static void emit_load_state(int dst, uint32_t offset)
+{
+	emit_state_operation(0x8B, dst, offset);
+}
+
+// mov [rbx + offset], src
+static void emit_store_state(uint32_t offset, int src)
+{
+	emit_state_operation(0x89, src, offset);
+}
+
+// mov dword [rbx + offset], value
+static void emit_store_state_immediate(uint32_t offset, uint32_t value)
+{
+	emit_state_operation(0xC7, 0, offset);
+	emit_dword(value);
+}
+
+// mov dst, value
+static void emit_mov_immediate(int dst, uint32_t value)
+{
+	emit_rex(false, 0, dst);
+	emit_byte(0xB8 + (dst & 7));
+	emit_dword(value);
+}
+
+// mov dst, value (64 bit)
+static void emit_mov_immediate64(int dst, uint64_t value)
+{
+	emit_rex(true, 0, dst);
+	emit_byte(0xB8 + (dst & 7));
+	emit_qword(value);
+}
+
+// add/or/and/sub/xor/cmp dst, value, digit selects the operation
+static void emit_alu_immediate(int digit, int dst, uint32_t value)
+{
+	emit_register_operation(0x81, digit, dst);
+	emit_dword(value);
+}
+
+// shl/shr/sar dst, amount, digit selects the operation
+static void emit_shift_immediate(int digit, int dst, uint8_t amount)
+{
+	emit_register_operation(0xC1, digit, dst);
+	emit_byte(amount);
+}
+
+// setcc al -- movzx eax, al
+static void emit_set_condition(int condition)
+{
+	emit_byte(0x0F);
+	emit_byte(0x90 | condition);
+	emit_byte(0xC0);
+
+	emit_byte(0x0F);
+	emit_byte(0xB6);
+	emit_byte(0xC0);
+}
+
+// mov rax, function -- call rax
+static void emit_call(void* function)
+{
+	emit_mov_immediate64(X64_RAX, (uint64_t)(uintptr_t)function);
+	emit_byte(0xFF);
+	emit_byte(0xD0);
+}
+
+/// <summary>
+/// Emits a conditional jump with a 32 bit displacement
+/// </summary>
+/// <returns>The displacement to patch with patch_jump()</returns>
+static uint8_t* emit_jump_condition(int condition)
+{
+	emit_byte(0x0F);
+	emit_byte(0x80 | condition);
+	emit_dword(0);
+
+	return emit_pointer - 4;
+}
+
+/// <summary>
+/// Emits an unconditional jump with a 32 bit displacement
+/// </summary>
+/// <returns>The displacement to patch with patch_jump()</returns>
+static uint8_t* emit_jump()
+{
+	emit_byte(0xE9);
+	emit_dword(0);
+
+	return emit_pointer - 4;
+}
+
+/// <summary>
+/// Makes an emitted jump land on the target
+/// </summary>
+static void patch_jump(uint8_t* displacement, uint8_t* target)
+{
+	int32_t value = (int32_t)(target - (displacement + 4));
+	memcpy(displacement, &value, sizeof(value));
+}
+
+/// <summary>
+/// Emits code reading a guest register into a host register
+/// </summary>
+static void emit_read_guest(int host, int guest)
+{
+	if (guest == 0)
+		emit_register_operation(0x31, host, host); // xor host, host
+	else if (host_registers[guest] != -1)
+		emit_mov_register(host, host_registers[guest]);
+	else
+		emit_load_state(host, REGISTER_OFFSET(guest));
+}
+
+/// <summary>
+/// Emits code writing a host register into a guest register
+/// </summary>
+static void emit_write_guest(int guest, int host)
+{
+	if (guest == 0)
+		return;
+
+	if (host_registers[guest] != -1)
+	{
+		emit_mov_register(host_registers[guest], host);
+		dirty_registers[guest] = true;
+	}
+	else
+		emit_store_state(REGISTER_OFFSET(guest), host);
+}
+
+/// <summary>
+/// Emits code writing back the modified cached guest registers into cpu_state
+/// </summary>
+static void emit_flush_registers()
+{
+	for (int i = 1; i < 32; i++)
+	{
+		if (host_registers[i] != -1 && dirty_registers[i])
+		{
+			emit_store_state(REGISTER_OFFSET(i), host_registers[i]);
+			dirty_registers[i] = false;
+		}
+	}
+}
+
+/// <summary>
+/// Emits code loading a cached guest register from cpu_state
+/// </summary>
+static void emit_reload_register(int guest)
+{
+	if (guest != 0 && host_registers[guest] != -1)
+		emit_load_state(host_registers[guest], REGISTER_OFFSET(guest));
+}
+
+/// <summary>
+/// Checks if an instruction is translated into native code rather than calling its interpreter function
+/// </summary>
+static bool is_native_instruction(uint32_t opcode)
+{
+	uint8_t primary_opcode = (opcode & 0xFC000000) >> 26;
+	uint8_t secondary_opcode = opcode & 0x3F;
+
+	// ADDIU, SLTI, SLTIU, ANDI, ORI, XORI, LUI
+	if (primary_opcode >= 0x09 && primary_opcode <= 0x0F)
+		return true;
+
+	if (primary_opcode != 0x00)
+		return false;
+
+	switch (secondary_opcode)
+	{
+		case 0x00: case 0x02: case 0x03: // SLL, SRL, SRA
+		case 0x04: case 0x06: case 0x07: // SLLV, SRLV, SRAV
+		case 0x10: case 0x11: case 0x12: case 0x13: // MFHI, MTHI, MFLO, MTLO
+		case 0x21: case 0x23: case 0x24: case 0x25: case 0x26: case 0x27: // ADDU, SUBU, AND, OR, XOR, NOR
+		case 0x2A: case 0x2B: // SLT, SLTU
+			return true;
+	}
+
+	return false;
+}
+
+/// <summary>
+/// Picks the guest registers of the block to keep in host registers, the most used ones by native instructions
+/// </summary>
+static void allocate_registers(Block* block)
+{
+	int uses[32] = {0};
+
+	for (int i = 0; i < block->length; i++)
+	{
+		uint32_t opcode = block->instructions[i].opcode;
+
+		if (!is_native_instruction(opcode))
+			continue;
+
+		uses[rs(opcode)]++;
+		uses[rt(opcode)]++;
+
+		if ((opcode & 0xFC000000) == 0)
+			uses[rd(opcode)]++;
+	}
+
+	for (int i = 0; i < 32; i++)
+	{
+		host_registers[i] = -1;
+		dirty_registers[i] = false;
+	}
+
+	for (int slot = 0; slot < RECOMPILER_CACHED_REGISTERS; slot++)
+	{
+		int best = 0;
+
+		for (int i = 1; i < 32; i++)
+			if (host_registers[i] == -1 && uses[i] > uses[best])
+				best = i;
+
+		// Loading and writing back a register used only once costs more than it saves
+		if (best == 0 || uses[best] < 2)
+			break;
+
+		host_registers[best] = cache_host_registers[slot];
+	}
+}
+
+/// <summary>
+/// Emits the native code for an instruction accepted by is_native_instruction()
+/// </summary>
+static void emit_native_instruction(uint32_t opcode)
+{
+	uint8_t primary_opcode = (opcode & 0xFC000000) >> 26;
+	uint8_t secondary_opcode = opcode & 0x3F;
+
+	int source = rs(opcode);
+	int target = rt(opcode);
+	int destination = rd(opcode);
+	uint8_t shift = imm5(opcode);
+	uint32_t immediate = opcode & 0xFFFF;
+	uint32_t signed_immediate = (uint32_t)(int32_t)(int16_t)immediate;
+
+	if (primary_opcode != 0x00)
+	{
+		// Writes to r0 are discarded and these instructions have no other side effect
+		if (target == 0)
+			return;
+
+		switch (primary_opcode)
+		{
+			case 0x09: // ADDIU
+				emit_read_guest(X64_RAX, source);
+				if (signed_immediate != 0)
+					emit_alu_immediate(0, X64_RAX, signed_immediate);
+				break;
+
+			case 0x0A: // SLTI
+			case 0x0B: // SLTIU
+				emit_read_guest(X64_RAX, source);
+				emit_alu_immediate(7, X64_RAX, signed_immediate);
+				emit_set_condition(primary_opcode == 0x0A ? CC_L : CC_B);
+				break;
+
+			case 0x0C: // ANDI
+				emit_read_guest(X64_RAX, source);
+				emit_alu_immediate(4, X64_RAX, immediate);
+				break;
+
+			case 0x0D: // ORI
+				emit_read_guest(X64_RAX, source);
+				if (immediate != 0)
+					emit_alu_immediate(1, X64_RAX, immediate);
+				break;
+
+			case 0x0E: // XORI
+				emit_read_guest(X64_RAX, source);
+				if (immediate != 0)
+					emit_alu_immediate(6, X64_RAX, immediate);
+				break;
+
+			case 0x0F: // LUI
+				emit_mov_immediate(X64_RAX, immediate << 16);
+				break;
+		}
+
+		emit_write_guest(target, X64_RAX);
+		return;
+	}
+
+	switch (secondary_opcode)
+	{
+		case 0x11: // MTHI
+			emit_read_guest(X64_RAX, source);
+			emit_store_state(STATE_OFFSET(hi), X64_RAX);
+			return;
+
+		case 0x13: // MTLO
+			emit_read_guest(X64_RAX, source);
+			emit_store_state(STATE_OFFSET(lo), X64_RAX);
+			return;
+	}
+
+	if (destination == 0)
+		return;
+
+	switch (secondary_opcode)
+	{
+		case 0x00: // SLL
+		case 0x02: // SRL
+		case 0x03: // SRA
+		{
+			static const int shift_digits[4] = { 4, 0, 5, 7 };
+
+			emit_read_guest(X64_RAX, target);
+			if (shift != 0)
+				emit_shift_immediate(shift_digits[secondary_opcode], X64_RAX, shift);
+			break;
+		}
+
+		case 0x04: // SLLV
+		case 0x06: // SRLV
+		case 0x07: // SRAV
+		{
+			static const int shift_digits[4] = { 4, 0, 5, 7 };
+
+			// The shift amount is masked to 5 bits by the host like on the R3000A
+			emit_read_guest(X64_RCX, source);
+			emit_read_guest(X64_RAX, target);
+			emit_register_operation(0xD3, shift_digits[secondary_opcode - 0x04], X64_RAX);
+			break;
+		}
+
+		case 0x10: // MFHI
+			emit_load_state(X64_RAX, STATE_OFFSET(hi));
+			break;
+
+		case 0x12: // MFLO
+			emit_load_state(X64_RAX, STATE_OFFSET(lo));
+			break;
+
+		default:
+		{
+			emit_read_guest(X64_RAX, source);
+			emit_read_guest(X64_RCX, target);
+
+			switch (secondary_opcode)
+			{
+				case 0x21: emit_register_operation(0x01, X64_RCX, X64_RAX); break; // ADDU
+				case 0x23: emit_register_operation(0x29, X64_RCX, X64_RAX); break; // SUBU
+				case 0x24: emit_register_operation(0x21, X64_RCX, X64_RAX); break; // AND
+				case 0x25: emit_register_operation(0x09, X64_RCX, X64_RAX); break; // OR
+				case 0x26: emit_register_operation(0x31, X64_RCX, X64_RAX); break; // XOR
+
+				case 0x27: // NOR
+					emit_register_operation(0x09, X64_RCX, X64_RAX);
+					emit_register_operation(0xF7, 2, X64_RAX);
+					break;
+
+				case 0x2A: // SLT
+				case 0x2B: // SLTU
+					emit_register_operation(0x39, X64_RCX, X64_RAX);
+					emit_set_condition(secondary_opcode == 0x2A ? CC_L : CC_B);
+					break;
+			}
+			break;
+		}
+	}
+
+	emit_write_guest(destination, X64_RAX);
+}
+
+/// <summary>
+/// Emits the pc update of an instruction that may be in a delay slot, jumping if a branch is pending
+/// </summary>
+/// <param name="address">The address of the instruction</param>
+static void emit_delay_slot_jump(uint32_t address)
+{
+	// cmp byte [rbx + delay_jump], 0
+	emit_state_operation(0x80, 7, STATE_OFFSET(delay_jump));
+	emit_byte(0);
+
+	uint8_t* not_taken = emit_jump_condition(CC_E);
+
+	emit_load_state(X64_RAX, STATE_OFFSET(jmp_address));
+	emit_store_state(STATE_OFFSET(pc), X64_RAX);
+
+	// mov byte [rbx + delay_jump], 0
+	emit_state_operation(0xC6, 0, STATE_OFFSET(delay_jump));
+	emit_byte(0);
+
+	uint8_t* done = emit_jump();
+
+	patch_jump(not_taken, emit_pointer);
+	emit_store_state_immediate(STATE_OFFSET(pc), address + WORD_SIZE);
+
+	patch_jump(done, emit_pointer);
+}
+
+/// <summary>
+/// Called by the native code to execute an instruction using its interpreter function
+/// </summary>
+/// <param name="function">The function implementing the opcode</param>
+/// <returns>Whether the native code must stop executing the block</returns>
+static int run_interpreted_instruction(void* function)
+{
+	uint32_t pc = cpu_state.pc;
+	uint32_t invalidation_count = block_cache.invalidation_count;
+	uint32_t status = SR;
+
+	run_instruction_handler(function);
+
+	// Exceptions move pc, writes to the code of the block drop it, and fastmem can't be used while the cache is isolated
+	return cpu_state.pc != pc || invalidation_count != block_cache.invalidation_count || status != SR || debug_state.in_debug;
+}
+
+/// <summary>
+/// Called by the native code after a fastmem store to a page of main RAM containing code
+/// </summary>
+/// <param name="ram_address">The offset of the written word in main RAM</param>
+/// <returns>Whether blocks were dropped, in which case the native code must stop executing the block</returns>
+static int invalidate_stored_code(uint32_t ram_address)
+{
+	uint32_t invalidation_count = block_cache.invalidation_count;
+
+	invalidate_cached_code_word(ram_address);
+
+	return invalidation_count != block_cache.invalidation_count;
+}
+
+typedef enum
+{
+	SLOW_PATH_INTERPRETER, // Runs the instruction through its interpreter function, then resumes the block
+	SLOW_PATH_INVALIDATE, // Drops the blocks overwritten by a store to a code page, and exits the block if there were any
+} SlowPathType;
+
+/// <summary>
+/// Out of line code taken by a fastmem access when it can't be done with a host memory access
+/// </summary>
+typedef struct
+{
+	SlowPathType type;
+
+	/// <summary>
+	/// The jump to patch so that it lands on the slow path, NULL if only reached through the fault handler
+	/// </summary>
+	uint8_t* jump;
+
+	/// <summary>
+	/// The fault site of the access, for SLOW_PATH_INTERPRETER
+	/// </summary>
+	FastmemSite* site;
+
+	/// <summary>
+	/// Where the block continues after the slow path
+	/// </summary>
+	uint8_t* resume;
+
+	/// <summary>
+	/// The index of the instruction in the block
+	/// </summary>
+	int index;
+
+	/// <summary>
+	/// Whether pc was set dynamically for the instruction
+	/// </summary>
+	bool in_delay_slot;
+
+	/// <summary>
+	/// The cached registers not written back yet at the time of the access
+	/// </summary>
+	bool dirty_registers[32];
+} SlowPath;
+
+// Jumps leaving the block early, with the number of instructions executed at that point
+static PSX_THREAD_LOCAL uint8_t* exit_jumps[BLOCK_MAX_INSTRUCTIONS];
+static PSX_THREAD_LOCAL int exit_counts[BLOCK_MAX_INSTRUCTIONS];
+static PSX_THREAD_LOCAL int exit_count;
+
+// Slow paths of the fastmem accesses of the block, emitted after the main code
+static PSX_THREAD_LOCAL SlowPath slow_paths[BLOCK_MAX_INSTRUCTIONS * 2];
+static PSX_THREAD_LOCAL int slow_path_count;
+
+/// <summary>
+/// Emits a call to the interpreter function of an instruction of the block
+/// </summary>
+/// <param name="block">The block being translated</param>
+/// <param name="index">The index of the instruction in the block</param>
+/// <param name="in_delay_slot">Whether pc was set dynamically for the instruction</param>
+static void emit_interpreter_call(Block* block, int index, bool in_delay_slot)
+{
+	uint32_t opcode = block->instructions[index].opcode;
+	uint32_t address = block->address + index * WORD_SIZE;
+
+	emit_flush_registers();
+
+	emit_store_state_immediate(STATE_OFFSET(current_opcode), opcode);
+	if (!in_delay_slot)
+		emit_store_state_immediate(STATE_OFFSET(pc), address + WORD_SIZE);
+
+	emit_mov_immediate64(ARG0, (uint64_t)(uintptr_t)block->instructions[index].function);
+	emit_call(run_interpreted_instruction);
+
+	// r0 must read as 0 for the next instruction even if this one wrote to it
+	emit_store_state_immediate(REGISTER_OFFSET(0), 0);
+
+	// test eax, eax
+	emit_register_operation(0x85, X64_RAX, X64_RAX);
+	exit_jumps[exit_count] = emit_jump_condition(CC_NE);
+	exit_counts[exit_count++] = index + 1;
+
+	// Instructions only ever write to the registers in their rt/rd fields, or r31 for linking
+	emit_reload_register(rt(opcode));
+	if (rd(opcode) != rt(opcode))
+		emit_reload_register(rd(opcode));
+	if (rt(opcode) != 31 && rd(opcode) != 31)
+		emit_reload_register(31);
+}
+
+/// <summary>
+/// Checks if an instruction is translated into a host memory access in the fastmem arena
+/// </summary>
+static bool is_fastmem_instruction(uint32_t opcode)
+{
+	uint8_t primary_opcode = (opcode & 0xFC000000) >> 26;
+
+	if (!fastmem_state.enabled)
+		return false;
+
+	switch (primary_opcode)
+	{
+		case 0x20: case 0x21: case 0x23: case 0x24: case 0x25: // LB, LH, LW, LBU, LHU
+		case 0x28: case 0x29: case 0x2B: // SB, SH, SW
+			return true;
+	}
+
+	return false;
+}
+
+/// <summary>
+/// Adds a slow path for the instruction being translated
+/// </summary>
+static SlowPath* add_slow_path(SlowPathType type, uint8_t* jump, int index, bool in_delay_slot)
+{
+	SlowPath* slow_path = &slow_paths[slow_path_count++];
+
+	slow_path->type = type;
+	slow_path->jump = jump;
+	slow_path->site = NULL;
+	slow_path->resume = NULL;
+	slow_path->index = index;
+	slow_path->in_delay_slot = in_delay_slot;
+	memcpy(slow_path->dirty_registers, dirty_registers, sizeof(dirty_registers));
+
+	return slow_path;
+}
+
+/// <summary>
+/// Emits a load or store accepted by is_fastmem_instruction() as a host memory access in the arena.
+/// Misaligned addresses jump to the slow path, and so do accesses faulting on pages that aren't mapped,
+/// through the fault handler
+/// </summary>
+static void emit_fastmem_instruction(Block* block, int index, bool in_delay_slot)
+{
+	uint32_t opcode = block->instructions[index].opcode;
+	uint8_t primary_opcode = (opcode & 0xFC000000) >> 26;
+	bool store = primary_opcode >= 0x28;
+	uint32_t signed_immediate = (uint32_t)(int32_t)(int16_t)(opcode & 0xFFFF);
+
+	// The host opcode of the access, and the address bits that must be clear
+	static const struct { uint8_t prefix; uint8_t escape; uint8_t opcode; uint32_t alignment; } accesses[0x0C] = {
+		[0x00] = { 0x00, 0x0F, 0xBE, 0b00 }, // LB: movsx eax, byte
+		[0x01] = { 0x00, 0x0F, 0xBF, 0b01 }, // LH: movsx eax, word
+		[0x03] = { 0x00, 0x00, 0x8B, 0b11 }, // LW: mov eax, dword
+		[0x04] = { 0x00, 0x0F, 0xB6, 0b00 }, // LBU: movzx eax, byte
+		[0x05] = { 0x00, 0x0F, 0xB7, 0b01 }, // LHU: movzx eax, word
+		[0x08] = { 0x00, 0x00, 0x88, 0b00 }, // SB: mov byte, al
+		[0x09] = { 0x66, 0x00, 0x89, 0b01 }, // SH: mov word, ax
+		[0x0B] = { 0x00, 0x00, 0x89, 0b11 }, // SW: mov dword, eax
+	};
+	const int access = primary_opcode - 0x20;
+
+	// ecx = rs + offset
+	emit_read_guest(X64_RCX, rs(opcode));
+	if (signed_immediate != 0)
+		emit_alu_immediate(0, X64_RCX, signed_immediate);
+
+	SlowPath* slow_path = add_slow_path(SLOW_PATH_INTERPRETER, NULL, index, in_delay_slot);
+	SlowPath* invalidate_path = NULL;
+
+	// test ecx, alignment -- misaligned accesses raise an exception in the interpreter
+	if (accesses[access].alignment != 0)
+	{
+		emit_register_operation(0xF7, 0, X64_RCX);
+		emit_dword(accesses[access].alignment);
+		slow_path->jump = emit_jump_condition(CC_NE);
+	}
+
+	if (store)
+		emit_read_guest(X64_RAX, rt(opcode));
+
+	FastmemSite* site = &recompiler_state.fastmem_sites[recompiler_state.fastmem_site_count++];
+	site->access = emit_pointer;
+	site->slow_path = NULL;
+	slow_path->site = site;
+
+	// op eax, [rbp + rcx + 0] -- op [rbp + rcx + 0], eax
+	// The 32 bit displacement leaves room to patch in a jump to the slow path
+	if (accesses[access].prefix != 0)
+		emit_byte(accesses[access].prefix);
+	if (accesses[access].escape != 0)
+		emit_byte(accesses[access].escape);
+	emit_byte(accesses[access].opcode);
+	emit_byte(0x84);
+	emit_byte(0x0D);
+	emit_dword(0);
+
+	if (!store)
+		emit_write_guest(rt(opcode), X64_RAX);
+	else
+	{
+		// Writes to the RAM mirrors must drop the cached code if the page contains decoded words
+		emit_mov_register(X64_RDX, X64_RCX);
+		emit_alu_immediate(4, X64_RDX, 0x1FFFFFFF);
+		emit_alu_immediate(7, X64_RDX, RAM_MIRROR_SIZE);
+		uint8_t* not_ram = emit_jump_condition(CC_AE);
+
+		// ecx = offset in RAM, edx = page index
+		emit_alu_immediate(4, X64_RDX, RAM_SIZE - 1);
+		emit_mov_register(X64_RCX, X64_RDX);
+		emit_shift_immediate(5, X64_RDX, CODE_PAGE_SHIFT);
+
+		// bts dword [rax], edx -- the page is copied by the next incremental snapshot
+		emit_mov_immediate64(X64_RAX, (uint64_t)(uintptr_t)dirty_pages.ram);
+		emit_byte(0x0F);
+		emit_byte(0xAB);
+		emit_byte(0x10);
+
+		// bt dword [rax], edx
+		emit_mov_immediate64(X64_RAX, (uint64_t)(uintptr_t)block_cache.code_pages);
+		emit_byte(0x0F);
+		emit_byte(0xA3);
+		emit_byte(0x10);
+
+		invalidate_path = add_slow_path(SLOW_PATH_INVALIDATE, emit_jump_condition(CC_B), index, in_delay_slot);
+
+		patch_jump(not_ram, emit_pointer);
+	}
+
+	slow_path->resume = emit_pointer;
+
+	if (invalidate_path != NULL)
+		invalidate_path->resume = emit_pointer;
+}
+
+/// <summary>
+/// Emits the slow paths of the fastmem accesses of a block
+/// </summary>
+static void emit_slow_paths(Block* block, uint8_t* epilogue)
+{
+	for (int i = 0; i < slow_path_count; i++)
+	{
+		SlowPath* slow_path = &slow_paths[i];
+
+		if (slow_path->jump != NULL)
+			patch_jump(slow_path->jump, emit_pointer);
+		memcpy(dirty_registers, slow_path->dirty_registers, sizeof(dirty_registers));
+
+		if (slow_path->type == SLOW_PATH_INTERPRETER)
+		{
+			slow_path->site->slow_path = emit_pointer;
+
+			emit_interpreter_call(block, slow_path->index, slow_path->in_delay_slot);
+			patch_jump(emit_jump(), slow_path->resume);
+		}
+		else
+		{
+			emit_mov_register(ARG0, X64_RCX);
+			emit_call(invalidate_stored_code);
+
+			// test eax, eax -- continue the block if the store didn't overwrite code
+			emit_register_operation(0x85, X64_RAX, X64_RAX);
+			patch_jump(emit_jump_condition(CC_E), slow_path->resume);
+
+			emit_flush_registers();
+
+			if (!slow_path->in_delay_slot)
+				emit_store_state_immediate(STATE_OFFSET(pc), block->address + (slow_path->index + 1) * WORD_SIZE);
+
+			emit_mov_immediate(X64_RAX, slow_path->index + 1);
+			patch_jump(emit_jump(), epilogue);
+		}
+	}
+}
+
+/// <summary>
+/// Translates a block into native code, the code buffer must have at least RECOMPILER_MAX_BLOCK_SIZE bytes left
+/// </summary>
+/// <param name="block">The block to translate</param>
+/// <returns>The native function, which returns the number of instructions executed</returns>
+static void* recompile_block(Block* block)
+{
+	uint8_t* start = recompiler_state.code_buffer + recompiler_state.code_used;
+	emit_pointer = start;
+
+	exit_count = 0;
+	slow_path_count = 0;
+
+	allocate_registers(block);
+
+	// push rbx -- push rbp -- push r12 -- push r13 -- push r14 -- push r15
+	emit_byte(0x53);
+	emit_byte(0x55);
+	for (int i = 0; i < RECOMPILER_CACHED_REGISTERS; i++)
+	{
+		emit_rex(false, 0, cache_host_registers[i]);
+		emit_byte(0x50 + (cache_host_registers[i] & 7));
+	}
+
+	// sub rsp, 40 -- keeps the stack aligned and reserves the shadow space of Windows calls
+	emit_byte(0x48);
+	emit_byte(0x83);
+	emit_byte(0xEC);
+	emit_byte(0x28);
+
+	emit_mov_immediate64(X64_RBX, (uint64_t)(uintptr_t)&cpu_state);
+	emit_mov_immediate64(X64_RBP, (uint64_t)(uintptr_t)fastmem_state.base);
+
+	for (int i = 1; i < 32; i++)
+		emit_reload_register(i);
+
+	// The first instruction can be in the delay slot of a branch ending the previous block
+	bool in_delay_slot = true;
+	bool after_branch = true;
+
+	for (int i = 0; i < block->length; i++)
+	{
+		uint32_t opcode = block->instructions[i].opcode;
+		uint32_t address = block->address + i * WORD_SIZE;
+
+		in_delay_slot = after_branch;
+
+		// pc is only kept up to date for interpreted instructions and at the end of the block
+		if (in_delay_slot)
+			emit_delay_slot_jump(address);
+
+		if (is_native_instruction(opcode))
+			emit_native_instruction(opcode);
+		else if (is_fastmem_instruction(opcode))
+			emit_fastmem_instruction(block, i, in_delay_slot);
+		else
+			emit_interpreter_call(block, i, in_delay_slot);
+
+		after_branch = is_branch_instruction(opcode);
+	}
+
+	// Otherwise the last instruction already set pc to the branch target or the next instruction
+	if (!in_delay_slot)
+		emit_store_state_immediate(STATE_OFFSET(pc), block->address + block->length * WORD_SIZE);
+
+	emit_flush_registers();
+	emit_mov_immediate(X64_RAX, block->length);
+
+	uint8_t* epilogue = emit_pointer;
+
+	// add rsp, 40
+	emit_byte(0x48);
+	emit_byte(0x83);
+	emit_byte(0xC4);
+	emit_byte(0x28);
+
+	// pop r15 -- pop r14 -- pop r13 -- pop r12 -- pop rbp -- pop rbx -- ret
+	for (int i = RECOMPILER_CACHED_REGISTERS - 1; i >= 0; i--)
+	{
+		emit_rex(false, 0, cache_host_registers[i]);
+		emit_byte(0x58 + (cache_host_registers[i] & 7));
+	}
+	emit_byte(0x5D);
+	emit_byte(0x5B);
+	emit_byte(0xC3);
+
+	emit_slow_paths(block, epilogue);
+
+	// Early exits, the cached registers were already written back before calling the interpreter
+	for (int i = 0; i < exit_count; i++)
+	{
+		patch_jump(exit_jumps[i], emit_pointer);
+		emit_mov_immediate(X64_RAX, exit_counts[i]);
+		patch_jump(emit_jump(), epilogue);
+	}
+
+	recompiler_state.code_used += emit_pointer - start;
+
+	return start;
+}
+
+uint8_t* handle_fastmem_fault(uint8_t* host_pc)
+{
+	int low = 0;
+	int high = recompiler_state.fastmem_site_count - 1;
+
+	// The sites are sorted, as the code buffer is filled linearly
+	while (low <= high)
+	{
+		int middle = (low + high) / 2;
+		FastmemSite* site = &recompiler_state.fastmem_sites[middle];
+
+		if (site->access == host_pc)
+		{
+			// This access is likely to fault again (MMIO), jump straight to the slow path from now on
+			site->access[0] = 0xE9;
+			patch_jump(&site->access[1], site->slow_path);
+
+			return site->slow_path;
+		}
+
+		if (site->access < host_pc)
+			low = middle + 1;
+		else
+			high = middle - 1;
+	}
+
+	return NULL;
+}
+
+/// <summary>
+/// Allocates the executable code buffer
+/// </summary>
+/// <returns>0 if the allocation worked, -1 otherwise</returns>
+static int init_recompiler()
+{
+#ifdef _WIN32
+	recompiler_state.code_buffer = VirtualAlloc(NULL, RECOMPILER_CODE_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+	recompiler_state.code_buffer = mmap(NULL, RECOMPILER_CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (recompiler_state.code_buffer == MAP_FAILED)
+		recompiler_state.code_buffer = NULL;
+#endif
+
+	if (recompiler_state.code_buffer == NULL)
+	{
+		log_error("Couldn't allocate executable memory for the recompiler, using the cached interpreter instead\n");
+		return -1;
+	}
+
+	recompiler_state.fastmem_sites = malloc(RECOMPILER_MAX_FASTMEM_SITES * sizeof(FastmemSite));
+
+	if (recompiler_state.fastmem_sites == NULL)
+	{
+		log_error("Couldn't allocate the fastmem sites of the recompiler, using the cached interpreter instead\n");
+		free_recompiler();
+		return -1;
+	}
+
+	recompiler_state.code_used = 0;
+	recompiler_state.fastmem_site_count = 0;
+	recompiler_state.flush_count = block_cache.flush_count;
+
+	return 0;
+}
+
+void free_recompiler()
+{
+	if (recompiler_state.code_buffer != NULL)
+	{
+#ifdef _WIN32
+		VirtualFree(recompiler_state.code_buffer, 0, MEM_RELEASE);
+#else
+		munmap(recompiler_state.code_buffer, RECOMPILER_CODE_BUFFER_SIZE);
+#endif
+	}
+
+	free(recompiler_state.fastmem_sites);
+
+	recompiler_state.code_buffer = NULL;
+	recompiler_state.fastmem_sites = NULL;
+	recompiler_state.code_used = 0;
+	recompiler_state.fastmem_site_count = 0;
+}
+
+/// <summary>
+/// Drops the native code of blocks that were removed from the block cache
+/// </summary>
+static void sync_code_buffer()
+{
+	if (recompiler_state.flush_count != block_cache.flush_count)
+	{
+		recompiler_state.code_used = 0;
+		recompiler_state.fastmem_site_count = 0;
+		recompiler_state.flush_count = block_cache.flush_count;
+	}
+}
+
+int run_recompiled_block(bool debug_info)
+{
+	// Printing instructions and code breakpoints need to see every instruction, and isolated cache writes must be ignored
+	if (recompiler_state.unavailable || debug_info || debug_state.breakpoint_count > 0 || (SR & 0x10000))
+		return run_cached_block(debug_info);
+
+	if (recompiler_state.code_buffer == NULL && init_recompiler() != 0)
+	{
+		recompiler_state.unavailable = true;
+		return run_cached_block(debug_info);
+	}
+
+	Block* block = get_block(cpu_state.pc);
+
+	// Code outside of RAM/BIOS is never translated, and the native code has the addresses of the block built-in
+	if (block == NULL || block->address != cpu_state.pc)
+		return run_cached_block(debug_info);
+
+	sync_code_buffer();
+
+	if (block->recompiled == NULL)
+	{
+		// Start over when running out of space, the blocks will get translated again when needed
+		if (recompiler_state.code_used + RECOMPILER_MAX_BLOCK_SIZE > RECOMPILER_CODE_BUFFER_SIZE
+			|| recompiler_state.fastmem_site_count + BLOCK_MAX_INSTRUCTIONS > RECOMPILER_MAX_FASTMEM_SITES)
+		{
+			flush_block_cache();
+			sync_code_buffer();
+
+			block = get_block(cpu_state.pc);
+		}
+
+		block->recompiled = recompile_block(block);
+	}
+
+	R0 = 0;
+
+	service_interrupts();
+
+	// An interrupt moved pc to the exception handler
+	if (cpu_state.pc != block->address)
+		return 0;
+
+	check_tty_output();
+
+	uint64_t deadline = scheduler_state.next_deadline;
+	block_cache.volatile_io_read = false;
+
+	int executed = ((int (*)(void))block->recompiled)();
+
+	scheduler_tick(executed * CYCLES_PER_INSTRUCTION + fetch_icache_range(block->address, executed));
+
+	if (executed == block->length)
+		skip_idle_loop(block, block->address, deadline);
+
+	return executed;
+}
+
+#else
+
+int run_recompiled_block(bool debug_info)
+{
+	if (!recompiler_state.unavailable)
+	{
+		log_warning("The recompiler only supports x86-64 hosts, using the cached interpreter instead\n");
+		recompiler_state.unavailable = true;
+	}
+
+	return run_cached_block(debug_info);
+}
+
+uint8_t* handle_fastmem_fault(uint8_t* host_pc)
+{
+	return NULL;
+}
+
+void free_recompiler()
+{
+}
+
+#endif
@@ -0,0 +1,309 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rewind.h"
+#include "save_state.h"
+#include "dirty_pages.h"
+#include "gpu.h"
+#include "logging.h"
+
+#define WORDS_PER_BLOCK ((1 << SAVE_STATE_BLOCK_SHIFT) / sizeof(uint64_t))
+
+PSX_THREAD_LOCAL RewindState rewind_state = {
+	.enabled = false,
+	.latest_state = NULL,
+	.work_state = NULL,
+	.written_blocks = NULL,
+	.encode_buffer = NULL,
+};
+
+static inline bool is_block_written(const uint32_t* written_blocks, size_t word)
+{
+	size_t block = word / WORDS_PER_BLOCK;
+	return written_blocks[block / 32] & (1u << (block % 32));
+}
+
+static inline bool is_word_changed(const uint64_t* old_state, const uint64_t* new_state, const uint32_t* written_blocks, size_t word)
+{
+	return is_block_written(written_blocks, word) && old_state[word] != new_state[word];
+}
+
+static size_t get_written_blocks_size()
+{
+	return ((rewind_state.state_size >> SAVE_STATE_BLOCK_SHIFT) / 32 + 1) * sizeof(uint32_t);
+}
+
+/// <summary>
+/// Compresses the XOR of two states as a list of runs, each one a word count of zeroes
+/// and a word count of literals followed by the literals
+/// </summary>
+/// <param name="written_blocks">The blocks of new_state that can differ from old_state, the others aren't compared</param>
+/// <param name="output">The buffer receiving the delta, must be able to hold 1.5 times the size of the states plus 8 bytes</param>
+/// <returns>The size of the delta</returns>
+static size_t encode_delta(const uint64_t* old_state, const uint64_t* new_state, size_t word_count, const uint32_t* written_blocks,
+	uint8_t* output)
+{
+	size_t size = 0;
+	size_t i = 0;
+
+	while (i < word_count)
+	{
+		uint32_t zero_count = 0;
+		while (i + zero_count < word_count)
+		{
+			size_t word = i + zero_count;
+
+			// The rest of a block that wasn't written is skipped at once
+			if (!is_block_written(written_blocks, word))
+			{
+				size_t block_end = (word / WORDS_PER_BLOCK + 1) * WORDS_PER_BLOCK;
+				zero_count += (block_end < word_count ? block_end : word_count) - word;
+			}
+			else if (old_state[word] == new_state[word])
+				zero_count++;
+			else
+				break;
+		}
+
+		i += zero_count;
+
+		// Single unchanged words stay in the literals, a new run would cost more than the word
+		uint32_t literal_count = 0;
+		while (i + literal_count < word_count &&
+			(is_word_changed(old_state, new_state, written_blocks, i + literal_count) ||
+			(i + literal_count + 1 < word_count && is_word_changed(old_state, new_state, written_blocks, i + literal_count + 1))))
+			literal_count++;
+
+		memcpy(&output[size], &zero_count, sizeof(uint32_t));
+		memcpy(&output[size + 4], &literal_count, sizeof(uint32_t));
+		size += 8;
+
+		for (uint32_t j = 0; j < literal_count; j++, i++)
+		{
+			uint64_t delta = old_state[i] ^ new_state[i];
+			memcpy(&output[size], &delta, sizeof(uint64_t));
+			size += 8;
+		}
+	}
+
+	return size;
+}
+
+/// <summary>
+/// Applies a delta made by encode_delta() to a state, which turns one of the states it was made from into the other one
+/// </summary>
+static void apply_delta(uint64_t* state, const uint8_t* delta, size_t delta_size)
+{
+	size_t offset = 0;
+	size_t i = 0;
+
+	while (offset < delta_size)
+	{
+		uint32_t zero_count;
+		uint32_t literal_count;
+		memcpy(&zero_count, &delta[offset], sizeof(uint32_t));
+		memcpy(&literal_count, &delta[offset + 4], sizeof(uint32_t));
+		offset += 8;
+
+		i += zero_count;
+
+		for (uint32_t j = 0; j < literal_count; j++, i++)
+		{
+			uint64_t word;
+			memcpy(&word, &delta[offset], sizeof(uint64_t));
+			state[i] ^= word;
+			offset += 8;
+		}
+	}
+}
+
+static RewindSnapshot* get_snapshot(int index)
+{
+	return &rewind_state.snapshots[(rewind_state.first_snapshot + index) % REWIND_MAX_SNAPSHOTS];
+}
+
+static void drop_oldest_snapshot()
+{
+	RewindSnapshot* snapshot = get_snapshot(0);
+
+	rewind_state.memory_used -= snapshot->delta_size;
+	free(snapshot->delta);
+	snapshot->delta = NULL;
+
+	rewind_state.first_snapshot = (rewind_state.first_snapshot + 1) % REWIND_MAX_SNAPSHOTS;
+	rewind_state.snapshot_count--;
+}
+
+static void drop_newest_snapshot()
+{
+	RewindSnapshot* snapshot = get_snapshot(rewind_state.snapshot_count - 1);
+
+	rewind_state.memory_used -= snapshot->delta_size;
+	free(snapshot->delta);
+	snapshot->delta = NULL;
+
+	rewind_state.snapshot_count--;
+}
+
+int init_rewind()
+{
+	if (rewind_state.latest_state == NULL)
+	{
+		rewind_state.state_size = (get_save_state_size() + 7) & ~(size_t)7;
+		rewind_state.latest_state = calloc(rewind_state.state_size, 1);
+		rewind_state.work_state = calloc(rewind_state.state_size, 1);
+		rewind_state.written_blocks = malloc(get_written_blocks_size());
+		rewind_state.encode_buffer = malloc(rewind_state.state_size * 3 / 2 + 8);
+
+		if (rewind_state.latest_state == NULL || rewind_state.work_state == NULL || rewind_state.written_blocks == NULL ||
+			rewind_state.encode_buffer == NULL)
+		{
+			log_error("Error while trying to allocate memory for the rewind buffers!\n");
+			return -1;
+		}
+	}
+
+	reset_rewind();
+	rewind_state.enabled = true;
+
+	return 0;
+}
+
+void free_rewind()
+{
+	reset_rewind();
+
+	free(rewind_state.latest_state);
+	free(rewind_state.work_state);
+	free(rewind_state.written_blocks);
+	free(rewind_state.encode_buffer);
+
+	rewind_state.latest_state = NULL;
+	rewind_state.work_state = NULL;
+	rewind_state.written_blocks = NULL;
+	rewind_state.encode_buffer = NULL;
+	rewind_state.enabled = false;
+}
+
+void reset_rewind()
+{
+	while (rewind_state.snapshot_count > 0)
+		drop_oldest_snapshot();
+
+	rewind_state.first_snapshot = 0;
+	rewind_state.has_latest_state = false;
+}
+
+void record_rewind_frame()
+{
+	if (!rewind_state.enabled || rewind_state.latest_state == NULL)
+		return;
+
+	uint64_t frame = gpu_state.frame_count;
+
+	// The frame count goes back to 0 on reset, the history doesn't lead to the new state anymore
+	if (rewind_state.has_latest_state && frame < rewind_state.latest_frame)
+		reset_rewind();
+
+	if (rewind_state.has_latest_state && frame - rewind_state.latest_frame < REWIND_INTERVAL_FRAMES)
+		return;
+
+	if (!rewind_state.has_latest_state)
+	{
+		// A full state to start from, the next ones only copy the pages written since the previous one
+		save_state(rewind_state.latest_state, rewind_state.state_size);
+		memcpy(rewind_state.work_state, rewind_state.latest_state, rewind_state.state_size);
+		clear_dirty_pages();
+	}
+	else
+	{
+		memset(rewind_state.written_blocks, 0, get_written_blocks_size());
+		update_save_state(rewind_state.work_state, rewind_state.state_size, rewind_state.written_blocks);
+
+		size_t delta_size = encode_delta((const uint64_t*)rewind_state.latest_state, (const uint64_t*)rewind_state.work_state,
+			rewind_state.state_size / sizeof(uint64_t), rewind_state.written_blocks, rewind_state.encode_buffer);
+
+		uint8_t* delta = malloc(delta_size);
+
+		if (delta == NULL)
+		{
+			log_warning("Couldn't allocate a rewind snapshot, dropping the history\n");
+			reset_rewind();
+		}
+		else
+		{
+			memcpy(delta, rewind_state.encode_buffer, delta_size);
+
+			if (rewind_state.snapshot_count == REWIND_MAX_SNAPSHOTS)
+				drop_oldest_snapshot();
+
+			RewindSnapshot* snapshot = get_snapshot(rewind_state.snapshot_count);
+			snapshot->frame = rewind_state.latest_frame;
+			snapshot->delta = delta;
+			snapshot->delta_size = delta_size;
+
+			rewind_state.snapshot_count++;
+			rewind_state.memory_used += delta_size;
+
+			while (rewind_state.memory_used > REWIND_MEMORY_BUDGET && rewind_state.snapshot_count > 0)
+				drop_oldest_snapshot();
+		}
+
+		// Applying the delta brings the newest snapshot up to date without copying the whole state
+		apply_delta((uint64_t*)rewind_state.latest_state, rewind_state.encode_buffer, delta_size);
+	}
+
+	rewind_state.latest_frame = frame;
+	rewind_state.has_latest_state = true;
+}
+
+int get_rewind_snapshot_count()
+{
+	return rewind_state.has_latest_state ? rewind_state.snapshot_count + 1 : 0;
+}
+
+uint64_t get_rewind_snapshot_frame(int index)
+{
+	if (index >= rewind_state.snapshot_count)
+		return rewind_state.latest_frame;
+
+	return get_snapshot(index)->frame;
+}
+
+int rewind_to_frame(uint64_t frame)
+{
+	if (!rewind_state.has_latest_state)
+		return -1;
+
+	int target = rewind_state.snapshot_count;
+
+	while (target > 0 && get_rewind_snapshot_frame(target) != frame)
+		target--;
+
+	if (get_rewind_snapshot_frame(target) != frame)
+		return -1;
+
+	// Undo the deltas from the newest snapshot down to the target
+	memcpy(rewind_state.work_state, rewind_state.latest_state, rewind_state.state_size);
+
+	for (int i = rewind_state.snapshot_count - 1; i >= target; i--)
+	{
+		RewindSnapshot* snapshot = get_snapshot(i);
+		apply_delta((uint64_t*)rewind_state.work_state, snapshot->delta, snapshot->delta_size);
+	}
+
+	if (load_state(rewind_state.work_state, rewind_state.state_size) != 0)
+		return -1;
+
+	// The target becomes the newest snapshot, loading it marked all the pages dirty so the next update copies everything
+	while (rewind_state.snapshot_count > target)
+		drop_newest_snapshot();
+
+	memcpy(rewind_state.latest_state, rewind_state.work_state, rewind_state.state_size);
+
+	rewind_state.latest_frame = frame;
+
+	return 0;
+}
@@ -0,0 +1,327 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "save_state.h"
+#include "memory.h"
+#include "cpu.h"
+#include "coprocessor.h"
+#include "interrupt.h"
+#include "timer.h"
+#include "dma.h"
+#include "cdrom.h"
+#include "gpu.h"
+#include "scheduler.h"
+#include "icache.h"
+#include "block_cache.h"
+#include "dirty_pages.h"
+#include "rasterizer.h"
+#include "hle_bios.h"
+#include "logging.h"
+
+#define SAVE_STATE_MAX_SECTIONS 16
+
+/// <summary>
+/// A part of the emulator state saved as a section
+/// </summary>
+typedef struct
+{
+	uint32_t tag;
+	uint16_t version;
+	void* data;
+	uint32_t size;
+
+	/// <summary>
+	/// The dirty page bitmap of the data after paged_offset, NULL if the section is always copied whole
+	/// </summary>
+	const uint32_t* dirty_pages;
+	uint32_t paged_offset;
+} SaveStateSection;
+
+/// <summary>
+/// Gets the sections of the save state, the memory regions are only known at run time
+/// </summary>
+/// <returns>The number of sections</returns>
+static int get_sections(SaveStateSection* sections)
+{
+	const SaveStateSection all_sections[] = {
+		{ .tag = SAVE_STATE_TAG('C', 'P', 'U', ' '), .version = 1, .data = &cpu_state, .size = sizeof(cpu_state) },
+		{ .tag = SAVE_STATE_TAG('C', 'O', 'P', '0'), .version = 1, .data = _cop0_registers, .size = sizeof(_cop0_registers) },
+		{ .tag = SAVE_STATE_TAG('I', 'R', 'Q', ' '), .version = 1, .data = &interrupt_regs, .size = sizeof(interrupt_regs) },
+		{ .tag = SAVE_STATE_TAG('T', 'I', 'M', 'R'), .version = 1, .data = &timer_state, .size = sizeof(timer_state) },
+		{ .tag = SAVE_STATE_TAG('D', 'M', 'A', ' '), .version = 1, .data = &dma_regs, .size = sizeof(dma_regs) },
+		{ .tag = SAVE_STATE_TAG('C', 'D', 'R', 'M'), .version = 1, .data = &cd_controller, .size = sizeof(cd_controller) },
+		{ .tag = SAVE_STATE_TAG('G', 'P', 'U', ' '), .version = 1, .data = &gpu_state, .size = sizeof(gpu_state), .dirty_pages = dirty_pages.vram, .paged_offset = offsetof(GPU, vram) },
+		{ .tag = SAVE_STATE_TAG('S', 'C', 'H', 'D'), .version = 1, .data = &scheduler_state, .size = sizeof(scheduler_state) },
+		{ .tag = SAVE_STATE_TAG('I', 'C', 'A', 'C'), .version = 1, .data = &icache_state, .size = sizeof(icache_state) },
+		{ .tag = SAVE_STATE_TAG('R', 'A', 'M', ' '), .version = 1, .data = ram, .size = RAM_SIZE, .dirty_pages = dirty_pages.ram, .paged_offset = 0 },
+		{ .tag = SAVE_STATE_TAG('S', 'P', 'A', 'D'), .version = 1, .data = scratchpad, .size = SCRATCHPAD_SIZE },
+		{ .tag = SAVE_STATE_TAG('I', 'O', ' ', ' '), .version = 1, .data = io_ports, .size = IO_PORTS_SIZE },
+		{ .tag = SAVE_STATE_TAG('E', 'X', 'P', '2'), .version = 1, .data = expansion_2, .size = EXPANSION_2_SIZE },
+		{ .tag = SAVE_STATE_TAG('C', 'C', 'T', 'L'), .version = 1, .data = cpu_cache_control, .size = CONTROL_REGISTERS_SIZE },
+		{ .tag = SAVE_STATE_TAG('H', 'L', 'E', ' '), .version = 1, .data = &hle_state, .size = sizeof(hle_state) },
+	};
+
+	memcpy(sections, all_sections, sizeof(all_sections));
+
+	return sizeof(all_sections) / sizeof(all_sections[0]);
+}
+
+size_t get_save_state_size()
+{
+	SaveStateSection sections[SAVE_STATE_MAX_SECTIONS];
+	int section_count = get_sections(sections);
+
+	size_t size = sizeof(SaveStateHeader);
+
+	for (int i = 0; i < section_count; i++)
+		size += sizeof(SaveStateSectionHeader) + sections[i].size;
+
+	return size;
+}
+
+size_t save_state(uint8_t* buffer, size_t capacity)
+{
+	// The queued primitives belong in the saved VRAM
+	flush_rasterizer();
+
+	SaveStateSection sections[SAVE_STATE_MAX_SECTIONS];
+	int section_count = get_sections(sections);
+
+	size_t size = get_save_state_size();
+
+	if (capacity < size)
+		return 0;
+
+	SaveStateHeader header = {
+		.magic = SAVE_STATE_MAGIC,
+		.version = SAVE_STATE_VERSION,
+		.section_count = section_count,
+		.size = size,
+	};
+
+	memcpy(buffer, &header, sizeof(header));
+	size_t offset = sizeof(header);
+
+	for (int i = 0; i < section_count; i++)
+	{
+		SaveStateSectionHeader section_header = {
+			.tag = sections[i].tag,
+			.version = sections[i].version,
+			.reserved = 0,
+			.size = sections[i].size,
+		};
+
+		memcpy(&buffer[offset], &section_header, sizeof(section_header));
+		memcpy(&buffer[offset + sizeof(section_header)], sections[i].data, sections[i].size);
+
+		offset += sizeof(section_header) + sections[i].size;
+	}
+
+	return size;
+}
+
+/// <summary>
+/// Copies a part of the emulator state into a save state, and marks the blocks it covers as written
+/// </summary>
+static void update_section_data(uint8_t* buffer, size_t offset, const void* data, size_t size, uint32_t* written_blocks)
+{
+	memcpy(&buffer[offset], data, size);
+
+	if (written_blocks == NULL || size == 0)
+		return;
+
+	for (size_t block = offset >> SAVE_STATE_BLOCK_SHIFT; block <= (offset + size - 1) >> SAVE_STATE_BLOCK_SHIFT; block++)
+		written_blocks[block / 32] |= 1 << (block % 32);
+}
+
+size_t update_save_state(uint8_t* buffer, size_t capacity, uint32_t* written_blocks)
+{
+	flush_rasterizer();
+
+	SaveStateSection sections[SAVE_STATE_MAX_SECTIONS];
+	int section_count = get_sections(sections);
+
+	size_t size = get_save_state_size();
+
+	if (capacity < size)
+		return 0;
+
+	// The headers don't change, only the data is copied
+	size_t offset = sizeof(SaveStateHeader);
+
+	for (int i = 0; i < section_count; i++)
+	{
+		const SaveStateSection* section = &sections[i];
+		const uint8_t* data = section->data;
+		offset += sizeof(SaveStateSectionHeader);
+
+		if (section->dirty_pages == NULL)
+			update_section_data(buffer, offset, data, section->size, written_blocks);
+		else
+		{
+			update_section_data(buffer, offset, data, section->paged_offset, written_blocks);
+
+			for (uint32_t page_offset = section->paged_offset; page_offset < section->size; page_offset += DIRTY_PAGE_SIZE)
+			{
+				uint32_t page = (page_offset - section->paged_offset) >> DIRTY_PAGE_SHIFT;
+				uint32_t page_size = section->size - page_offset < DIRTY_PAGE_SIZE ? section->size - page_offset : DIRTY_PAGE_SIZE;
+
+				if (is_page_dirty(section->dirty_pages, page))
+					update_section_data(buffer, offset + page_offset, &data[page_offset], page_size, written_blocks);
+			}
+		}
+
+		offset += section->size;
+	}
+
+	clear_dirty_pages();
+
+	return size;
+}
+
+int load_state(const uint8_t* buffer, size_t size)
+{
+	// The queued primitives must not be drawn over the loaded VRAM
+	flush_rasterizer();
+
+	SaveStateSection sections[SAVE_STATE_MAX_SECTIONS];
+	int section_count = get_sections(sections);
+
+	// Where the data of each known section is in the buffer, NULL if the state doesn't have it
+	const uint8_t* section_data[SAVE_STATE_MAX_SECTIONS] = { NULL };
+
+	SaveStateHeader header;
+
+	if (size < sizeof(header))
+		return -1;
+
+	memcpy(&header, buffer, sizeof(header));
+
+	if (header.magic != SAVE_STATE_MAGIC || header.version != SAVE_STATE_VERSION)
+	{
+		log_warning("Save state is not valid or was saved by another version\n");
+		return -1;
+	}
+
+	if (header.size > size)
+	{
+		log_warning("Save state is truncated\n");
+		return -1;
+	}
+
+	// Validate all the sections first, so an invalid state doesn't get partially restored
+	size_t offset = sizeof(header);
+
+	for (int i = 0; i < header.section_count; i++)
+	{
+		SaveStateSectionHeader section_header;
+
+		if (offset + sizeof(section_header) > header.size)
+		{
+			log_warning("Save state is truncated\n");
+			return -1;
+		}
+
+		memcpy(&section_header, &buffer[offset], sizeof(section_header));
+		offset += sizeof(section_header);
+
+		if (offset + section_header.size > header.size)
+		{
+			log_warning("Save state is truncated\n");
+			return -1;
+		}
+
+		for (int j = 0; j < section_count; j++)
+		{
+			if (sections[j].tag != section_header.tag)
+				continue;
+
+			if (sections[j].version != section_header.version || sections[j].size != section_header.size)
+			{
+				log_warning("Save state section %.4s doesn't match this version\n", (const char*)&section_header.tag);
+				return -1;
+			}
+
+			section_data[j] = &buffer[offset];
+		}
+
+		offset += section_header.size;
+	}
+
+	// The host files can't be saved, the ones open now stay open whatever the state had
+	FILE* hle_files[HLE_MAX_FILES];
+	memcpy(hle_files, hle_state.files, sizeof(hle_files));
+
+	for (int i = 0; i < section_count; i++)
+	{
+		if (section_data[i] != NULL)
+			memcpy(sections[i].data, section_data[i], sections[i].size);
+		else
+			log_warning("Save state has no section %.4s, keeping the current state\n", (const char*)&sections[i].tag);
+	}
+
+	memcpy(hle_state.files, hle_files, sizeof(hle_files));
+
+	// The decoded code belongs to the previous memory contents, and the incremental snapshots too
+	flush_block_cache();
+	mark_all_pages_dirty();
+
+	return 0;
+}
+
+int save_state_to_file(const char* path)
+{
+	size_t size = get_save_state_size();
+	uint8_t* buffer = malloc(size);
+
+	if (buffer == NULL)
+	{
+		log_error("Error while trying to allocate memory for the save state!\n");
+		return -1;
+	}
+
+	FILE* file = fopen(path, "wb");
+	int result = -1;
+
+	if (file != NULL)
+	{
+		save_state(buffer, size);
+		result = fwrite(buffer, 1, size, file) == size ? 0 : -1;
+		fclose(file);
+	}
+
+	if (result != 0)
+		log_error("Error while trying to write the save state at %s!\n", path);
+
+	free(buffer);
+
+	return result;
+}
+
+int load_state_from_file(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file)
+	{
+		log_error("Error while trying to open the save state at %s!\n", path);
+		return -1;
+	}
+
+	fseek(file, 0, SEEK_END);
+	size_t size = ftell(file);
+	rewind(file);
+
+	uint8_t* buffer = malloc(size);
+	int result = -1;
+
+	if (buffer != NULL && fread(buffer, 1, size, file) == size)
+		result = load_state(buffer, size);
+
+	fclose(file);
+	free(buffer);
+
+	return result;
+}
@@ -0,0 +1,169 @@
+#include <string.h>
+
+#include "scheduler.h"
+#include "timer.h"
+#include "gpu.h"
+#include "cdrom.h"
+#include "dma.h"
+
+PSX_THREAD_LOCAL SchedulerState scheduler_state = {
+	.cycles = 0,
+	.next_deadline = SCHEDULER_NO_EVENT,
+	.heap_size = 0,
+	// heap_index is filled with -1 by reset_scheduler_state(), which init_context() calls
+};
+
+/// <summary>
+/// The handler called for each event type
+/// </summary>
+static const EventHandler event_handlers[EVENT_COUNT] = {
+	[EVENT_HBLANK] = handle_hblank_event,
+	[EVENT_TIMERS] = handle_timer_event,
+	[EVENT_CDROM_IRQ] = handle_cdrom_irq_event,
+	[EVENT_DMA_COMPLETE] = handle_dma_complete_event,
+};
+
+void reset_scheduler_state()
+{
+	memset(&scheduler_state, 0, sizeof(scheduler_state));
+
+	scheduler_state.next_deadline = SCHEDULER_NO_EVENT;
+
+	for (int i = 0; i < EVENT_COUNT; i++)
+		scheduler_state.heap_index[i] = -1;
+}
+
+static void swap_heap_entries(int a, int b)
+{
+	ScheduledEvent temp = scheduler_state.heap[a];
+	scheduler_state.heap[a] = scheduler_state.heap[b];
+	scheduler_state.heap[b] = temp;
+
+	scheduler_state.heap_index[scheduler_state.heap[a].type] = a;
+	scheduler_state.heap_index[scheduler_state.heap[b].type] = b;
+}
+
+static void sift_up(int index)
+{
+	while (index > 0)
+	{
+		int parent = (index - 1) / 2;
+
+		if (scheduler_state.heap[parent].deadline <= scheduler_state.heap[index].deadline)
+			break;
+
+		swap_heap_entries(parent, index);
+		index = parent;
+	}
+}
+
+static void sift_down(int index)
+{
+	while (true)
+	{
+		int left = index * 2 + 1;
+		int right = left + 1;
+		int smallest = index;
+
+		if (left < scheduler_state.heap_size && scheduler_state.heap[left].deadline < scheduler_state.heap[smallest].deadline)
+			smallest = left;
+
+		if (right < scheduler_state.heap_size && scheduler_state.heap[right].deadline < scheduler_state.heap[smallest].deadline)
+			smallest = right;
+
+		if (smallest == index)
+			break;
+
+		swap_heap_entries(smallest, index);
+		index = smallest;
+	}
+}
+
+static void update_next_deadline()
+{
+	if (scheduler_state.heap_size > 0)
+		scheduler_state.next_deadline = scheduler_state.heap[0].deadline;
+	else
+		scheduler_state.next_deadline = SCHEDULER_NO_EVENT;
+}
+
+static void remove_heap_entry(int index)
+{
+	int last = --scheduler_state.heap_size;
+
+	scheduler_state.heap_index[scheduler_state.heap[index].type] = -1;
+
+	if (index != last)
+	{
+		// Move the last event in the hole, then restore the heap order around it
+		ScheduledEvent moved = scheduler_state.heap[last];
+		scheduler_state.heap[index] = moved;
+		scheduler_state.heap_index[moved.type] = index;
+
+		sift_up(index);
+		sift_down(scheduler_state.heap_index[moved.type]);
+	}
+}
+
+void schedule_event(EventType type, uint64_t cycles)
+{
+	schedule_event_at(type, scheduler_state.cycles + cycles);
+}
+
+void schedule_event_at(EventType type, uint64_t deadline)
+{
+	int index = scheduler_state.heap_index[type];
+
+	if (index < 0)
+	{
+		// New events start at the bottom of the heap
+		index = scheduler_state.heap_size++;
+		scheduler_state.heap[index].type = type;
+		scheduler_state.heap[index].deadline = deadline;
+		scheduler_state.heap_index[type] = index;
+
+		sift_up(index);
+	}
+	else
+	{
+		uint64_t previous_deadline = scheduler_state.heap[index].deadline;
+		scheduler_state.heap[index].deadline = deadline;
+
+		if (deadline < previous_deadline)
+			sift_up(index);
+		else
+			sift_down(index);
+	}
+
+	update_next_deadline();
+}
+
+void cancel_event(EventType type)
+{
+	int index = scheduler_state.heap_index[type];
+
+	if (index < 0)
+		return;
+
+	remove_heap_entry(index);
+	update_next_deadline();
+}
+
+bool is_event_scheduled(EventType type)
+{
+	return scheduler_state.heap_index[type] >= 0;
+}
+
+void run_scheduled_events()
+{
+	while (scheduler_state.heap_size > 0 && scheduler_state.heap[0].deadline <= scheduler_state.cycles)
+	{
+		ScheduledEvent event = scheduler_state.heap[0];
+
+		// Remove the event before calling the handler so it can schedule itself again
+		remove_heap_entry(0);
+		update_next_deadline();
+
+		event_handlers[event.type](event.deadline);
+	}
+}
@@ -1,7 +1,31 @@
+#if defined(__unix__) || defined(__APPLE__)
+#define CONSOLE_THREADS_SUPPORTED
+#endif
+
+#include <time.h>
+#include <string.h>
+
+#ifdef CONSOLE_THREADS_SUPPORTED
+#include <pthread.h>
+#endif
+
 #include "tests.h"
 #include "cpu.h"
 #include "logging.h"
 #include "memory.h"
+#include "block_cache.h"
+#include "recompiler.h"
+#include "scheduler.h"
+#include "threaded_interpreter.h"
+#include "icache.h"
+#include "coprocessor.h"
+#include "hle_bios.h"
+#include "main.h"
+#include "save_state.h"
+#include "gpu.h"
+#include "rewind.h"
+#include "dirty_pages.h"
+#include "rasterizer.h"
 
 void test_addi()
 {
@@ -177,6 +201,28 @@ void test_sw()
     reset_cpu_state();
 }
 
+void test_sb()
+{
+    R1 = 0x12345678;
+    R2 = 0xAABBCCDD;
+    write_word(0x100, R1);
+
+    // SB r2 at address r0 offset by 0x101
+    cpu_state.current_opcode = 0b10100000000000100000000100000001;
+
+    sb();
+
+    uint32_t value = read_word(0x100);
+
+    if (value != 0x1234DD78)
+        log_error("SB instruction did not correctly store the byte in memory! Got %x\n", value);
+
+    log_info("Finished testing SB\n");
+
+    reset_cpu_state();
+    clear_memory();
+}
+
 void test_addiu()
 {
     R0 = 13;
@@ -217,6 +263,570 @@ void test_or()
     reset_cpu_state();
 }
 
+void test_block_cache()
+{
+    // ADDIU r1, r0, 5 -- ADDIU r2, r1, 3 -- J 0x80001000 -- NOP
+    write_word(0x80001000, 0x24010005);
+    write_word(0x80001004, 0x24220003);
+    write_word(0x80001008, 0x08000400);
+    write_word(0x8000100C, 0x00000000);
+
+    cpu_state.pc = 0x80001000;
+    int executed = run_cached_block(false);
+
+    if (executed != 4 || R2 != 8)
+        log_error("Cached block did not execute correctly! Got %d instructions and r2 %x\n", executed, R2);
+
+    if (cpu_state.pc != 0x80001000)
+        log_error("Cached block did not jump at the end of the block! Got pc %x\n", cpu_state.pc);
+
+    // Overwrite the second instruction with ADDIU r2, r1, 7, the block must be decoded again
+    write_word(0x80001004, 0x24220007);
+    run_cached_block(false);
+
+    if (R2 != 12)
+        log_error("Cached block was not invalidated after writing to its code! Got r2 %x\n", R2);
+
+    // Writing data next to the code must keep the block, and overwriting the code must not flush the whole cache
+    Block* block = get_block(0x80001000);
+    uint32_t flush_count = block_cache.flush_count;
+    write_word(0x80001100, 0x12345678);
+
+    if (get_block(0x80001000) != block)
+        log_error("Cached block was dropped after writing data to the same page!\n");
+
+    ram[0x1004 / 4] = 0x24220003;
+    invalidate_cached_code_range(0x1000, 0x10);
+
+    if (get_block(0x80001000) == block || flush_count != block_cache.flush_count)
+        log_error("Cached block was not dropped on its own after writing to its code!\n");
+
+    log_info("Finished testing block cache\n");
+
+    reset_cpu_state();
+    flush_block_cache();
+}
+
+void test_idle_loop()
+{
+    // BEQ r0, r0, -1 -- NOP: a branch to itself can only be left by an interrupt
+    write_word(0x80001000, 0x1000FFFF);
+    write_word(0x80001004, 0x00000000);
+
+    // LW r1, 0x100(r0) -- NOP -- BEQ r1, r0, -3 -- NOP: polls a word of memory until it changes
+    write_word(0x80002000, 0x8C010100);
+    write_word(0x80002004, 0x00000000);
+    write_word(0x80002008, 0x1020FFFD);
+    write_word(0x8000200C, 0x00000000);
+
+    // SW r1, 0x100(r0) -- BEQ r0, r0, -2 -- NOP: stores to memory every iteration
+    write_word(0x80003000, 0xAC010100);
+    write_word(0x80003004, 0x1000FFFE);
+    write_word(0x80003008, 0x00000000);
+
+    // ADDIU r2, r2, 1 -- BEQ r0, r0, -2 -- NOP: counts in a register every iteration
+    write_word(0x80004000, 0x24420001);
+    write_word(0x80004004, 0x1000FFFE);
+    write_word(0x80004008, 0x00000000);
+
+    static const uint32_t idle_addresses[] = { 0x80001000, 0x80002000 };
+    static const uint32_t busy_addresses[] = { 0x80003000, 0x80004000 };
+
+    // The loops are fast forwarded to the next event instead of running until it
+    for (int i = 0; i < 2; i++)
+    {
+        reset_scheduler_state();
+        schedule_event_at(EVENT_TIMERS, 100000);
+
+        cpu_state.pc = idle_addresses[i];
+        run_cached_block(false);
+
+        if (!get_block(idle_addresses[i])->idle_loop || scheduler_state.cycles < 100000)
+            log_error("Idle loop at %x was not fast forwarded! Got cycle %llu\n", idle_addresses[i], (unsigned long long)scheduler_state.cycles);
+    }
+
+    // The threaded interpreter watches the loops it branches back into the same way
+    reset_scheduler_state();
+    schedule_event_at(EVENT_TIMERS, 1000000);
+    cpu_state.pc = 0x80001000;
+
+    for (int i = 0; i < 4 && scheduler_state.cycles < 1000000; i++)
+        run_threaded_interpreter(false);
+
+    if (scheduler_state.cycles < 1000000)
+        log_error("Idle loop was not fast forwarded by the threaded interpreter! Got cycle %llu\n", (unsigned long long)scheduler_state.cycles);
+
+    // Loops with side effects must run every iteration
+    for (int i = 0; i < 2; i++)
+    {
+        reset_scheduler_state();
+        schedule_event_at(EVENT_TIMERS, 100000);
+
+        cpu_state.pc = busy_addresses[i];
+        run_cached_block(false);
+
+        if (get_block(busy_addresses[i])->idle_loop || scheduler_state.cycles >= 100000)
+            log_error("Loop with side effects at %x was fast forwarded! Got cycle %llu\n", busy_addresses[i], (unsigned long long)scheduler_state.cycles);
+    }
+
+    log_info("Finished testing idle loop detection\n");
+
+    reset_cpu_state();
+    reset_scheduler_state();
+    flush_block_cache();
+    clear_memory();
+}
+
+void test_recompiler()
+{
+    // ADDIU r1, r0, 5 -- SW r1, 0x100(r0) -- ADDU r2, r1, r1 -- BNE r2, r0, 0x80001000 -- SUBU r3, r2, r1
+    write_word(0x80001000, 0x24010005);
+    write_word(0x80001004, 0xAC010100);
+    write_word(0x80001008, 0x00211021);
+    write_word(0x8000100C, 0x1440FFFC);
+    write_word(0x80001010, 0x00411823);
+
+    cpu_state.pc = 0x80001000;
+    int executed = run_recompiled_block(false);
+
+    if (executed != 5 || R2 != 10 || R3 != 5 || read_word(0x100) != 5)
+        log_error("Recompiled block did not execute correctly! Got %d instructions, r2 %x and r3 %x\n", executed, R2, R3);
+
+    if (cpu_state.pc != 0x80001000)
+        log_error("Recompiled block did not branch at the end of the block! Got pc %x\n", cpu_state.pc);
+
+    log_info("Finished testing recompiler\n");
+
+    reset_cpu_state();
+    clear_memory();
+}
+
+void test_threaded_interpreter()
+{
+    // ADDIU r1, r0, 5 -- ADDU r2, r1, r1 -- JR r3 -- ADDIU r4, r0, 1
+    write_word(0x80001000, 0x24010005);
+    write_word(0x80001004, 0x00211021);
+    write_word(0x80001008, 0x00600008);
+    write_word(0x8000100C, 0x24040001);
+
+    R3 = 0x80001000;
+    cpu_state.pc = 0x80001000;
+    int executed = run_threaded_interpreter(false);
+
+    // The interpreter returns once the register jump lands
+    if (executed != 4 || R2 != 10 || R4 != 1)
+        log_error("Threaded interpreter did not execute correctly! Got %d instructions, r2 %x and r4 %x\n", executed, R2, R4);
+
+    if (cpu_state.pc != 0x80001000)
+        log_error("Threaded interpreter did not jump to the register address! Got pc %x\n", cpu_state.pc);
+
+    log_info("Finished testing threaded interpreter\n");
+
+    reset_cpu_state();
+    reset_scheduler_state();
+    clear_memory();
+}
+
+void test_icache()
+{
+    reset_icache_state();
+    cpu_cache_control[CACHE_CONTROL_INDEX] = CACHE_CONTROL_ICACHE_ENABLE;
+
+    // The first fetch fills the line, the rest of the line then hits
+    int miss_cycles = fetch_icache(0x80001000);
+    int hit_cycles = fetch_icache(0x8000100C);
+
+    if (miss_cycles != RAM_FETCH_CYCLES + 3 * BURST_FETCH_CYCLES || hit_cycles != 0)
+        log_error("Instruction cache did not fill a line correctly! Got %d cycles on miss and %d on hit\n", miss_cycles, hit_cycles);
+
+    if (fetch_icache(0xA0001000) != RAM_FETCH_CYCLES || fetch_icache(0xBFC00000) != BIOS_FETCH_CYCLES)
+        log_error("Instruction cache did not treat KSEG1 fetches as uncached!\n");
+
+    // Isolated writes in tag test mode invalidate the line, like the BIOS cache flush does
+    cpu_cache_control[CACHE_CONTROL_INDEX] |= CACHE_CONTROL_TAG_TEST;
+    SR |= 0x10000;
+    write_word(0x00001000, 0);
+    SR &= ~0x10000;
+
+    if (fetch_icache(0x80001000) == 0)
+        log_error("Instruction cache line was not invalidated in tag test mode!\n");
+
+    log_info("Finished testing instruction cache\n");
+
+    cpu_cache_control[CACHE_CONTROL_INDEX] = 0;
+    reset_icache_state();
+}
+
+void test_hle_bios()
+{
+    init_hle_bios();
+    cpu_state.pc = 0xBFC00000;
+    handle_instruction(false);
+
+    if (cpu_state.pc != SHELL_ENTRY_POINT || read_word(0xA0) != (HLE_OPCODE | HLE_TRAP_A0))
+        log_error("HLE BIOS did not initialize the kernel! Got pc %x\n", cpu_state.pc);
+
+    // JAL A0h -- ADDIU r9, r0, 1Bh (strlen)
+    write_word(0x80001000, 0x0C000028);
+    write_word(0x80001004, 0x2409001B);
+    write_word(0x80002000, 0x00636261);
+
+    R4 = 0x80002000;
+    cpu_state.pc = 0x80001000;
+
+    for (int i = 0; i < 3; i++)
+        handle_instruction(false);
+
+    if (R2 != 3 || cpu_state.pc != 0x80001008)
+        log_error("HLE BIOS did not return from strlen()! Got r2 %x and pc %x\n", R2, cpu_state.pc);
+
+    // JAL A0h -- ADDIU r9, r0, 3Fh (printf), the width argument is too long for the specification buffer
+    const char format[] = "%----------------------*d\n";
+    const int format_length = sizeof(format) - 1;
+
+    for (int i = 0; i < format_length + 1; i++)
+        write_byte(0x80002000 + i, format[i]);
+
+    write_word(0x80001004, 0x2409003F);
+
+    R4 = 0x80002000;
+    R5 = 0x80000000;
+    R6 = 42;
+    cpu_state.pc = 0x80001000;
+
+    for (int i = 0; i < 3; i++)
+        handle_instruction(false);
+
+    if (R2 != format_length || cpu_state.pc != 0x80001008)
+        log_error("HLE BIOS printf() did not print the long specification as written! Got r2 %x and pc %x\n", R2, cpu_state.pc);
+
+    log_info("Finished testing HLE BIOS\n");
+
+    hle_state.enabled = false;
+    reset_cpu_state();
+    reset_scheduler_state();
+    clear_memory();
+}
+
+void test_save_state()
+{
+    static uint8_t state[4 * 1024 * KIB_SIZE];
+    size_t size = get_save_state_size();
+
+    if (size > sizeof(state))
+    {
+        log_error("Save state is bigger than expected! Got %zu bytes\n", size);
+        return;
+    }
+
+    cpu_state.pc = 0x80001000;
+    R5 = 0x1234;
+    write_word(0x80002000, 0xCAFE);
+    gpu_state.vram[10] = 0x7FFF;
+
+    if (save_state(state, sizeof(state)) != size)
+        log_error("Save state was not written entirely!\n");
+
+    reset_cpu_state();
+    clear_memory();
+    gpu_state.vram[10] = 0;
+
+    // A truncated state must be rejected without touching anything
+    if (load_state(state, size / 2) == 0 || R5 != 0)
+        log_error("Truncated save state was loaded!\n");
+
+    if (load_state(state, size) != 0 || cpu_state.pc != 0x80001000 || R5 != 0x1234 || read_word(0x80002000) != 0xCAFE || gpu_state.vram[10] != 0x7FFF)
+        log_error("Save state was not restored! Got pc %x and r5 %x\n", cpu_state.pc, R5);
+
+    log_info("Finished testing save states\n");
+
+    gpu_state.vram[10] = 0;
+    reset_cpu_state();
+    clear_memory();
+}
+
+void test_dirty_pages()
+{
+    static uint8_t state[4 * 1024 * KIB_SIZE];
+    size_t size = get_save_state_size();
+
+    if (size > sizeof(state) || save_state(state, sizeof(state)) != size)
+        return;
+
+    clear_dirty_pages();
+    write_word(0x80005004, 0xBEEF);
+
+    if (!is_page_dirty(dirty_pages.ram, 5) || is_page_dirty(dirty_pages.ram, 4) || is_page_dirty(dirty_pages.ram, 6))
+        log_error("Store did not mark its RAM page dirty!\n");
+
+    // A page that isn't dirty must be left as it is in the state
+    ram[0x8000 / 4] = 0x1234;
+
+    update_save_state(state, sizeof(state), NULL);
+    write_word(0x80005004, 0);
+    ram[0x8000 / 4] = 0;
+
+    if (load_state(state, size) != 0 || read_word(0x80005004) != 0xBEEF || ram[0x8000 / 4] != 0)
+        log_error("Incremental save state did not copy the dirty pages only! Got %x\n", read_word(0x80005004));
+
+    // A VRAM write at (200, 300) is in the tile 3 of the tile row 18
+    memset(dirty_pages.vram_tiles, 0, sizeof(dirty_pages.vram_tiles));
+    mark_vram_dirty(300 * 1024 + 200);
+    clear_dirty_pages();
+
+    if (dirty_pages.vram_tiles[18] != 1 << 3 || dirty_pages.vram_tiles[17] != 0 || dirty_pages.vram_tiles[19] != 0)
+        log_error("VRAM write did not mark its tile dirty! Got %x\n", dirty_pages.vram_tiles[18]);
+
+    log_info("Finished testing dirty pages\n");
+
+    reset_cpu_state();
+    clear_memory();
+}
+
+void test_rewind()
+{
+    if (init_rewind() != 0)
+        return;
+
+    // Snapshots at frames 0, 10 and 20, with a different word in RAM each time
+    for (int i = 0; i < 3; i++)
+    {
+        gpu_state.frame_count = i * REWIND_INTERVAL_FRAMES;
+        write_word(0x80002000, 0x100 + i);
+        record_rewind_frame();
+    }
+
+    if (get_rewind_snapshot_count() != 3 || get_rewind_snapshot_frame(0) != 0)
+        log_error("Rewind did not record the snapshots! Got %d\n", get_rewind_snapshot_count());
+
+    if (rewind_to_frame(REWIND_INTERVAL_FRAMES) != 0 || read_word(0x80002000) != 0x101 || gpu_state.frame_count != REWIND_INTERVAL_FRAMES)
+        log_error("Rewind did not restore the state! Got %x\n", read_word(0x80002000));
+
+    if (rewind_to_frame(0) != 0 || read_word(0x80002000) != 0x100 || get_rewind_snapshot_count() != 1)
+        log_error("Rewind did not restore the oldest state! Got %x\n", read_word(0x80002000));
+
+    log_info("Finished testing rewind\n");
+
+    reset_rewind();
+    rewind_state.enabled = false;
+    gpu_state.frame_count = 0;
+    reset_cpu_state();
+    clear_memory();
+}
+
+void test_scheduler()
+{
+    reset_scheduler_state();
+
+    schedule_event(EVENT_CDROM_IRQ, 300);
+    schedule_event(EVENT_TIMERS, 100);
+    schedule_event(EVENT_DMA_COMPLETE, 200);
+    cancel_event(EVENT_TIMERS);
+
+    if (scheduler_state.next_deadline != 200 || is_event_scheduled(EVENT_TIMERS))
+        log_error("Scheduler did not cancel an event! Next deadline is %llu\n", (unsigned long long)scheduler_state.next_deadline);
+
+    // Moving an event earlier should put it first
+    schedule_event(EVENT_CDROM_IRQ, 50);
+
+    if (scheduler_state.next_deadline != 50 || !is_event_scheduled(EVENT_DMA_COMPLETE))
+        log_error("Scheduler did not reschedule an event! Next deadline is %llu\n", (unsigned long long)scheduler_state.next_deadline);
+
+    log_info("Finished testing scheduler\n");
+
+    reset_scheduler_state();
+}
+
+void test_rasterizer()
+{
+    uint16_t* vram = gpu_state.vram;
+
+    gpu_state.drawing_area_bottom_right.x = 1023;
+    gpu_state.drawing_area_bottom_right.y = 511;
+
+    // Flat triangle, the right and bottom edges are not drawn
+    RasterVertex flat[3] = { { .x = 10, .y = 10, .r = 255 }, { .x = 30, .y = 10, .r = 255 }, { .x = 10, .y = 30, .r = 255 } };
+    rasterize_polygon(flat, 3, 0, 0, 0);
+
+    // Gouraud triangle going from black to red over 64 pixels
+    RasterVertex gouraud[3] = { { .x = 200, .y = 0 }, { .x = 264, .y = 0, .r = 248 }, { .x = 200, .y = 64 } };
+    rasterize_polygon(gouraud, 3, 0, 0, RASTER_GOURAUD);
+
+    // Raw textured triangle sampling the texel (5, 5) of the 15 bit page at x = 640
+    vram[5 * 1024 + 645] = 0x7C00;
+    RasterVertex textured[3] = { { .x = 100, .y = 100, .u = 5, .v = 5 }, { .x = 110, .y = 100, .u = 5, .v = 5 },
+        { .x = 100, .y = 110, .u = 5, .v = 5 } };
+    rasterize_polygon(textured, 3, 10 | (PAGE_15_BIT << 7), 0, RASTER_TEXTURED | RASTER_RAW_TEXTURE);
+
+    // Semi transparent quad averaged with the pixel under it
+    vram[50 * 1024 + 52] = 16;
+    RasterVertex blended[4] = { { .x = 50, .y = 50, .r = 255 }, { .x = 60, .y = 50, .r = 255 }, { .x = 50, .y = 60, .r = 255 },
+        { .x = 60, .y = 60, .r = 255 } };
+    rasterize_polygon(blended, 4, 0, 0, RASTER_SEMI_TRANSPARENT);
+
+    // Masked pixels are kept when the mask is checked
+    vram[12 * 1024 + 40] = 0x8000;
+    gpu_state.check_mask_before_draw = true;
+    rasterize_rectangle(40, 12, 2, 1, 0, 255, 0);
+    gpu_state.check_mask_before_draw = false;
+
+    // Pixels right of the drawing area are clipped
+    gpu_state.drawing_area_bottom_right.x = 80;
+    rasterize_rectangle(79, 0, 4, 1, 0, 0, 255);
+
+    flush_rasterizer();
+
+    if (vram[10 * 1024 + 10] != 0x1F || vram[12 * 1024 + 12] != 0x1F || vram[10 * 1024 + 30] != 0 || vram[30 * 1024 + 10] != 0)
+        log_error("Rasterizer did not draw the flat triangle! Got %x\n", vram[12 * 1024 + 12]);
+
+    if (vram[1 * 1024 + 232] != 15)
+        log_error("Rasterizer did not interpolate the gouraud triangle! Got %x\n", vram[1 * 1024 + 232]);
+
+    if (vram[101 * 1024 + 101] != 0x7C00)
+        log_error("Rasterizer did not sample the texture! Got %x\n", vram[101 * 1024 + 101]);
+
+    if (vram[50 * 1024 + 52] != 23 || vram[59 * 1024 + 59] != 15)
+        log_error("Rasterizer did not blend the semi transparent quad! Got %x\n", vram[50 * 1024 + 52]);
+
+    if (vram[12 * 1024 + 40] != 0x8000 || vram[12 * 1024 + 41] != 0x3E0)
+        log_error("Rasterizer did not check the mask bit! Got %x\n", vram[12 * 1024 + 40]);
+
+    if (vram[80] != 0x7C00 || vram[81] != 0)
+        log_error("Rasterizer did not clip to the drawing area! Got %x\n", vram[81]);
+
+    log_info("Finished testing rasterizer\n");
+
+    free_rasterizer();
+    memset(&gpu_state, 0, sizeof(gpu_state));
+}
+
+/// <summary>
+/// Resets the console and writes the loop run by the benchmark, mixing ALU instructions, a store and a load, which
+/// spins at the end once the iterations are done
+/// </summary>
+static void start_benchmark_loop(uint32_t iterations)
+{
+    reset_cpu_state();
+    reset_scheduler_state();
+    clear_memory();
+    flush_block_cache();
+
+    write_word(0x80002000, 0x24210001); // ADDIU r1, r1, 1
+    write_word(0x80002004, 0x00611821); // ADDU r3, r3, r1
+    write_word(0x80002008, 0x00A32826); // XOR r5, r5, r3
+    write_word(0x8000200C, 0x000330C0); // SLL r6, r3, 3
+    write_word(0x80002010, 0xAC860000); // SW r6, 0(r4)
+    write_word(0x80002014, 0x8C870000); // LW r7, 0(r4)
+    write_word(0x80002018, 0x00E3402B); // SLTU r8, r7, r3
+    write_word(0x8000201C, 0x1429FFF8); // BNE r1, r9, 0x80002000
+    write_word(0x80002020, 0x01485021); // ADDU r10, r10, r8
+    write_word(0x80002024, 0x1000FFFF); // BEQ r0, r0, 0x80002024
+    write_word(0x80002028, 0x00000000); // NOP
+
+    R4 = 0x80003000;
+    R9 = iterations;
+    cpu_state.pc = 0x80002000;
+}
+
+static bool finished_benchmark_loop()
+{
+    return cpu_state.pc == 0x80002024 || cpu_state.pc == 0x80002028;
+}
+
+#ifdef CONSOLE_THREADS_SUPPORTED
+
+/// <summary>
+/// A console run on its own thread by test_console_threads()
+/// </summary>
+typedef struct
+{
+    CPUBackend backend;
+    uint32_t iterations;
+    bool finished;
+    uint32_t registers[32];
+    uint32_t stored_word;
+} ConsoleThreadJob;
+
+static void* run_console_thread(void* arg)
+{
+    ConsoleThreadJob* job = arg;
+
+    if (init_context() != 0)
+        return NULL;
+
+    start_benchmark_loop(job->iterations);
+    cpu_backend = job->backend;
+
+    while (!finished_benchmark_loop())
+        run_cpu(false);
+
+    R0 = 0;
+    memcpy(job->registers, cpu_state.registers, sizeof(job->registers));
+    job->stored_word = read_word(0x80003000);
+    job->finished = true;
+
+    free_context();
+
+    return NULL;
+}
+
+/// <summary>
+/// Runs several consoles at once on their own threads, every CPU backend on every loop length, and checks that each
+/// one gets the same result as the others running the same loop without touching the console of the calling thread
+/// </summary>
+void test_console_threads()
+{
+    ConsoleThreadJob jobs[TEST_CONSOLE_THREADS];
+    pthread_t threads[TEST_CONSOLE_THREADS];
+    bool started[TEST_CONSOLE_THREADS];
+
+    write_word(0x80003000, 0xCAFEBABE);
+
+    for (int i = 0; i < TEST_CONSOLE_THREADS; i++)
+    {
+        jobs[i] = (ConsoleThreadJob){
+            .backend = (CPUBackend)(i % 4),
+            .iterations = 1000 + (i / 4) * 500,
+            .finished = false,
+        };
+
+        started[i] = pthread_create(&threads[i], NULL, run_console_thread, &jobs[i]) == 0;
+
+        if (!started[i])
+            log_error("Couldn't start console thread %d!\n", i);
+    }
+
+    for (int i = 0; i < TEST_CONSOLE_THREADS; i++)
+    {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i < TEST_CONSOLE_THREADS; i++)
+    {
+        if (!started[i])
+            continue;
+
+        const ConsoleThreadJob* reference = &jobs[i - i % 4];
+
+        if (!jobs[i].finished)
+            log_error("Console thread %d couldn't set up its context!\n", i);
+        else if (jobs[i].registers[1] != jobs[i].iterations)
+            log_error("Console thread %d stopped after %u iterations instead of %u!\n", i, jobs[i].registers[1], jobs[i].iterations);
+        else if (memcmp(jobs[i].registers, reference->registers, sizeof(jobs[i].registers)) != 0 || jobs[i].stored_word != reference->stored_word)
+            log_error("Console thread %d doesn't match the interpreter thread running the same loop!\n", i);
+    }
+
+    if (read_word(0x80003000) != 0xCAFEBABE)
+        log_error("The console threads wrote to the memory of the calling thread!\n");
+
+    log_info("Finished testing console threads\n");
+
+    clear_memory();
+}
+
+#endif
+
 void test_instructions()
 {
     log_info("Starting CPU instructions unit tests...\n");
@@ -228,7 +838,23 @@ void test_instructions()
     test_ori();
     test_lui();
     test_sw();
+    test_sb();
     test_addiu();
+    test_block_cache();
+    test_idle_loop();
+    test_recompiler();
+    test_threaded_interpreter();
+    test_icache();
+    test_hle_bios();
+    test_save_state();
+    test_dirty_pages();
+    test_rewind();
+    test_scheduler();
+    test_rasterizer();
+
+#ifdef CONSOLE_THREADS_SUPPORTED
+    test_console_threads();
+#endif
 }
 
 void test_memory()
@@ -272,4 +898,76 @@ void test_memory()
     clear_memory();
 
     log_info("Finished testing RAM in KUSEG, KSEG0, KSEG1\n");
+
+    // The BIOS ROM is mapped read only in the page tables, writes must still reach all its mirrors
+    write_word(0xBFC00010, 0x12345678);
+
+    if (read_word(0x1FC00010) != 0x12345678 || read_word(0x9FC00010) != 0x12345678)
+        log_error("BIOS ROM error, did not get written value back from the KUSEG/KSEG0 mirrors\n");
+
+    // The expansion regions read as zero until their first write allocates them, and again after a reset
+    if (read_word(0x1F000084) != 0 || read_byte(0xBFA00010) != 0)
+        log_error("Expansion region error, did not read zero before the first write\n");
+
+    write_byte(0x9FA00011, 0xAB);
+    write_word(0x1F000084, 0xCAFE);
+
+    if (read_word(0xBF000084) != 0xCAFE || read_half(0x1FA00010) != 0xAB00)
+        log_error("Expansion region error, did not get written value back from the mirrors\n");
+
+    clear_memory();
+
+    if (read_word(0x1F000084) != 0)
+        log_error("Expansion region error, was not cleared\n");
+}
+
+void benchmark_cpu_backends()
+{
+    const struct
+    {
+        CPUBackend backend;
+        const char* name;
+    } backends[] = {
+        { CPU_BACKEND_INTERPRETER, "Interpreter" },
+        { CPU_BACKEND_CACHED_INTERPRETER, "Cached interpreter" },
+        { CPU_BACKEND_RECOMPILER, "Recompiler" },
+        { CPU_BACKEND_THREADED_INTERPRETER, "Threaded interpreter" },
+    };
+
+    const int backend_count = sizeof(backends) / sizeof(backends[0]);
+    CPUBackend previous_backend = cpu_backend;
+    uint32_t reference_registers[32];
+
+    log_info("Starting CPU backends benchmark (%d iterations)...\n", BENCHMARK_ITERATIONS);
+
+    for (int i = 0; i < backend_count; i++)
+    {
+        start_benchmark_loop(BENCHMARK_ITERATIONS);
+        cpu_backend = backends[i].backend;
+
+        uint64_t executed = 0;
+        clock_t start = clock();
+
+        while (!finished_benchmark_loop())
+            executed += run_cpu(false);
+
+        double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+        double mips = seconds > 0.0 ? executed / seconds / 1000000.0 : 0.0;
+
+        log_info("%s: %llu instructions in %.3f s (%.1f MIPS)\n", backends[i].name, (unsigned long long)executed, seconds, mips);
+
+        R0 = 0;
+
+        if (i == 0)
+            memcpy(reference_registers, cpu_state.registers, sizeof(reference_registers));
+        else if (memcmp(reference_registers, cpu_state.registers, sizeof(reference_registers)) != 0)
+            log_error("%s registers don't match the interpreter after the benchmark!\n", backends[i].name);
+    }
+
+    cpu_backend = previous_backend;
+
+    reset_cpu_state();
+    reset_scheduler_state();
+    clear_memory();
+    flush_block_cache();
 }
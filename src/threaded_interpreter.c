@@ -0,0 +1,564 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "threaded_interpreter.h"
+#include "cpu.h"
+#include "coprocessor.h"
+#include "memory.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "scheduler.h"
+#include "icache.h"
+#include "hle_bios.h"
+#include "block_cache.h"
+
+#if defined(__GNUC__)
+
+/// <summary>
+/// Fetches the instruction at pc, moves pc past it like execute_instruction() does, and jumps to its label
+/// </summary>
+#define FETCH_AND_DISPATCH() \
+	do \
+	{ \
+		if (pc == 0xA0 || pc == 0xB0) \
+		{ \
+			cpu_state.pc = pc; \
+			check_tty_output(); \
+		} \
+		\
+		uint32_t* page = read_page_table[pc >> MEMORY_PAGE_SHIFT]; \
+		opcode = page != NULL ? page[(pc & (MEMORY_PAGE_SIZE - 1)) / WORD_SIZE] : read_word_internal(pc); \
+		scheduler_state.cycles += fetch_icache(pc); \
+		\
+		if (cpu_state.delay_jump) \
+		{ \
+			cpu_state.delay_jump = false; \
+			pc = cpu_state.jmp_address; \
+		} \
+		else \
+			pc += 0x4; \
+		\
+		goto *primary_labels[opcode >> 26]; \
+	} while (0)
+
+/// <summary>
+/// Ends the current instruction, and goes to the next one unless something needs to be checked first
+/// </summary>
+#define DISPATCH() \
+	do \
+	{ \
+		R0 = 0; \
+		executed++; \
+		scheduler_state.cycles += CYCLES_PER_INSTRUCTION; \
+		\
+		if (boundary || scheduler_state.cycles >= stop_cycle) \
+			goto instruction_boundary; \
+		\
+		FETCH_AND_DISPATCH(); \
+	} while (0)
+
+/// <summary>
+/// Runs an instruction function, which sees the same cpu_state as with the table dispatch
+/// </summary>
+#define CALL_HANDLER(function) \
+	do \
+	{ \
+		cpu_state.pc = pc; \
+		cpu_state.current_opcode = opcode; \
+		run_instruction_handler(function); \
+		pc = cpu_state.pc; \
+	} while (0)
+
+/// <summary>
+/// Runs an instruction function that can change the interrupt state or stop the CPU,
+/// so the interrupts are serviced again before the next instruction
+/// </summary>
+#define CALL_HANDLER_SYNC(function) \
+	do \
+	{ \
+		CALL_HANDLER(function); \
+		boundary = true; \
+	} while (0)
+
+/// <summary>
+/// After a taken branch back to the start of a short block detected as an idle loop by the block cache,
+/// goes through instruction_boundary once the branch lands, so the iteration can be fast forwarded
+/// </summary>
+#define CHECK_IDLE_LOOP() \
+	do \
+	{ \
+		uint32_t target = cpu_state.jmp_address; \
+		if (target < pc && pc - target <= IDLE_LOOP_MAX_INSTRUCTIONS * WORD_SIZE) \
+		{ \
+			/* Busy loops branch back every few instructions, only look the block up when the loop changes */ \
+			if (pc != last_loop_branch || block_cache.invalidation_count != last_loop_invalidation) \
+			{ \
+				Block* loop = get_block(target); \
+				last_loop_branch = pc; \
+				last_loop_invalidation = block_cache.invalidation_count; \
+				last_loop_idle = loop != NULL && loop->idle_loop && target + loop->length * WORD_SIZE == pc + 0x4; \
+			} \
+			\
+			if (last_loop_idle) \
+			{ \
+				idle_countdown = 2; \
+				boundary = true; \
+			} \
+		} \
+	} while (0)
+
+/// <summary>
+/// Gets the cycle at which the dispatch loop has to stop, so the caller gets control back
+/// regularly even when no event is scheduled
+/// </summary>
+/// <param name="slice_end">The cycle at which the time slice of the call ends</param>
+static uint64_t get_stop_cycle(uint64_t slice_end)
+{
+	return slice_end < scheduler_state.next_deadline ? slice_end : scheduler_state.next_deadline;
+}
+
+int run_threaded_interpreter(bool debug_info)
+{
+	// Printing instructions and code breakpoints need to see every instruction
+	if (debug_info || debug_state.breakpoint_count > 0)
+	{
+		handle_instruction(debug_info);
+		return 1;
+	}
+
+	static void* const primary_labels[0x40] = {
+		&&op_special, &&op_b_cond_z, &&op_j, &&op_jal, &&op_beq, &&op_bne, &&op_blez, &&op_bgtz, // 0x00
+		&&op_addi, &&op_addiu, &&op_slti, &&op_sltiu, &&op_andi, &&op_ori, &&op_xori, &&op_lui, // 0x08
+		&&op_cop0, &&op_cop1, &&op_cop2, &&op_cop3, &&op_undefined, &&op_undefined, &&op_undefined, &&op_undefined, // 0x10
+		&&op_undefined, &&op_undefined, &&op_undefined, &&op_undefined, &&op_undefined, &&op_undefined, &&op_undefined, &&op_undefined, // 0x18
+		&&op_lb, &&op_lh, &&op_lwl, &&op_lw, &&op_lbu, &&op_lhu, &&op_lwr, &&op_undefined, // 0x20
+		&&op_sb, &&op_sh, &&op_swl, &&op_sw, &&op_undefined, &&op_undefined, &&op_swr, &&op_undefined, // 0x28
+		&&op_lwc0, &&op_lwc1, &&op_lwc2, &&op_lwc3, &&op_undefined, &&op_undefined, &&op_undefined, &&op_undefined, // 0x30
+		&&op_swc0, &&op_swc1, &&op_swc2, &&op_swc3, &&op_undefined, &&op_undefined, &&op_undefined, &&op_hle, // 0x38
+	};
+
+	static void* const secondary_labels[0x40] = {
+		&&op_sll, &&op_undefined, &&op_srl, &&op_sra, &&op_sllv, &&op_undefined, &&op_srlv, &&op_srav, // 0x00
+		&&op_jr, &&op_jalr, &&op_undefined, &&op_undefined, &&op_syscall, &&op_break, &&op_undefined, &&op_undefined, // 0x08
+		&&op_mfhi, &&op_mthi, &&op_mflo, &&op_mtlo, &&op_undefined, &&op_undefined, &&op_undefined, &&op_undefined, // 0x10
+		&&op_mult, &&op_multu, &&op_div, &&op_divu, &&op_undefined, &&op_undefined, &&op_undefined, &&op_undefined, // 0x18
+		&&op_add, &&op_addu, &&op_sub, &&op_subu, &&op_and, &&op_or, &&op_xor, &&op_nor, // 0x20
+		&&op_undefined, &&op_undefined, &&op_slt, &&op_sltu, &&op_undefined, &&op_undefined, &&op_undefined, &&op_undefined, // 0x28
+		&&op_undefined, &&op_undefined, &&op_undefined, &&op_undefined, &&op_undefined, &&op_undefined, &&op_undefined, &&op_undefined, // 0x30
+		&&op_undefined, &&op_undefined, &&op_undefined, &&op_undefined, &&op_undefined, &&op_undefined, &&op_undefined, &&op_undefined, // 0x38
+	};
+
+	int executed = 0;
+
+	// Local copies of cpu_state.pc and cpu_state.current_opcode
+	uint32_t pc;
+	uint32_t opcode;
+
+	// Whether the next instruction must go through instruction_boundary
+	bool boundary = false;
+
+	// When not 0, how many more instruction boundaries to cross before returning
+	int exit_countdown = 0;
+
+	// When not 0, how many more instruction boundaries to cross before landing at the start of an idle loop
+	int idle_countdown = 0;
+
+	// The start of the idle loop whose iteration is being watched, and the deadline when the iteration started
+	uint32_t idle_loop_address = 0;
+	uint64_t idle_loop_deadline = SCHEDULER_NO_EVENT;
+
+	// The branch of the last short loop checked by CHECK_IDLE_LOOP(), and whether it closes an idle loop
+	uint32_t last_loop_branch = 0;
+	uint32_t last_loop_invalidation = 0;
+	bool last_loop_idle = false;
+
+	// The cycle at which to stop, the next event or the end of the time slice. The slice is fixed
+	// for the whole call, loops crossing instruction boundaries every iteration must not extend it
+	uint64_t slice_end = scheduler_state.cycles + THREADED_INTERPRETER_MAX_CYCLES;
+	uint64_t stop_cycle = get_stop_cycle(slice_end);
+
+	// Return after the delay slot of a pending jump, so the caller sees where it lands
+	if (cpu_state.delay_jump)
+	{
+		exit_countdown = 1;
+		boundary = true;
+	}
+
+	R0 = 0;
+	service_interrupts();
+	pc = cpu_state.pc;
+
+	FETCH_AND_DISPATCH();
+
+instruction_boundary:
+	cpu_state.pc = pc;
+	cpu_state.current_opcode = opcode;
+
+	// Like run_cached_block(), an iteration of an idle loop that read nothing volatile and saw no event
+	// fire would just repeat until the next event, so the cycle counter jumps straight to it
+	if (idle_countdown > 0 && --idle_countdown == 0)
+	{
+		Block* loop = get_block(pc);
+
+		if (loop != NULL && loop->idle_loop)
+		{
+			if (idle_loop_address == pc)
+				skip_idle_loop(loop, pc, idle_loop_deadline);
+
+			idle_loop_address = pc;
+			idle_loop_deadline = scheduler_state.next_deadline;
+			block_cache.volatile_io_read = false;
+		}
+	}
+
+	// Return to the caller once events ran, so it can react to them (a new frame etc.)
+	if (scheduler_state.cycles >= scheduler_state.next_deadline)
+	{
+		run_scheduled_events();
+		return executed;
+	}
+
+	if (scheduler_state.cycles >= stop_cycle || debug_state.in_debug || (exit_countdown > 0 && --exit_countdown == 0))
+		return executed;
+
+	boundary = exit_countdown > 0 || idle_countdown > 0;
+	stop_cycle = get_stop_cycle(slice_end);
+
+	R0 = 0;
+	service_interrupts();
+	pc = cpu_state.pc;
+
+	FETCH_AND_DISPATCH();
+
+op_special:
+	goto *secondary_labels[opcode & 0x3F];
+
+op_undefined:
+	CALL_HANDLER_SYNC(undefined);
+	DISPATCH();
+
+	// Branches and jumps
+
+op_b_cond_z:
+	CALL_HANDLER(b_cond_z);
+	DISPATCH();
+
+op_j:
+	cpu_state.jmp_address = ((pc + 0x4) & 0xF0000000) | ((opcode & 0x03FFFFFF) << 2);
+	cpu_state.delay_jump = true;
+	DISPATCH();
+
+op_jal:
+	R31 = pc + 0x4;
+	cpu_state.jmp_address = ((pc + 0x4) & 0xF0000000) | ((opcode & 0x03FFFFFF) << 2);
+	cpu_state.delay_jump = true;
+	DISPATCH();
+
+op_beq:
+	if (R(rs(opcode)) == R(rt(opcode)))
+	{
+		cpu_state.delay_jump = true;
+		cpu_state.jmp_address = pc + ((int32_t)(int16_t)(opcode & 0xFFFF) << 2);
+		CHECK_IDLE_LOOP();
+	}
+	DISPATCH();
+
+op_bne:
+	if (R(rs(opcode)) != R(rt(opcode)))
+	{
+		cpu_state.delay_jump = true;
+		cpu_state.jmp_address = pc + ((int32_t)(int16_t)(opcode & 0xFFFF) << 2);
+		CHECK_IDLE_LOOP();
+	}
+	DISPATCH();
+
+op_blez:
+	if ((int32_t)R(rs(opcode)) <= 0)
+	{
+		cpu_state.delay_jump = true;
+		cpu_state.jmp_address = pc + ((int32_t)(int16_t)(opcode & 0xFFFF) << 2);
+		CHECK_IDLE_LOOP();
+	}
+	DISPATCH();
+
+op_bgtz:
+	if ((int32_t)R(rs(opcode)) > 0)
+	{
+		cpu_state.delay_jump = true;
+		cpu_state.jmp_address = pc + ((int32_t)(int16_t)(opcode & 0xFFFF) << 2);
+		CHECK_IDLE_LOOP();
+	}
+	DISPATCH();
+
+op_jr:
+	cpu_state.jmp_address = R(rs(opcode));
+	cpu_state.delay_jump = true;
+	// Return once the jump lands, after the delay slot
+	exit_countdown = 2;
+	boundary = true;
+	DISPATCH();
+
+op_jalr:
+	cpu_state.jmp_address = R(rs(opcode));
+	cpu_state.delay_jump = true;
+	R(rd(opcode)) = pc + 0x4;
+	exit_countdown = 2;
+	boundary = true;
+	DISPATCH();
+
+	// ALU instructions with an immediate
+
+op_addi:
+	CALL_HANDLER_SYNC(addi);
+	DISPATCH();
+
+op_addiu:
+	R(rt(opcode)) = R(rs(opcode)) + (int32_t)(int16_t)(opcode & 0xFFFF);
+	DISPATCH();
+
+op_slti:
+	R(rt(opcode)) = (int32_t)R(rs(opcode)) < (int32_t)(int16_t)(opcode & 0xFFFF);
+	DISPATCH();
+
+op_sltiu:
+	R(rt(opcode)) = R(rs(opcode)) < (uint32_t)(int32_t)(int16_t)(opcode & 0xFFFF);
+	DISPATCH();
+
+op_andi:
+	R(rt(opcode)) = R(rs(opcode)) & (opcode & 0xFFFF);
+	DISPATCH();
+
+op_ori:
+	R(rt(opcode)) = R(rs(opcode)) | (opcode & 0xFFFF);
+	DISPATCH();
+
+op_xori:
+	R(rt(opcode)) = R(rs(opcode)) ^ (opcode & 0xFFFF);
+	DISPATCH();
+
+op_lui:
+	R(rt(opcode)) = (opcode & 0xFFFF) << 16;
+	DISPATCH();
+
+	// Coprocessors
+
+op_cop0:
+	CALL_HANDLER_SYNC(handle_cop0_instruction);
+	DISPATCH();
+
+op_cop1:
+	CALL_HANDLER_SYNC(handle_cop1_instruction);
+	DISPATCH();
+
+op_cop2:
+	CALL_HANDLER_SYNC(handle_cop2_instruction);
+	DISPATCH();
+
+op_cop3:
+	CALL_HANDLER_SYNC(handle_cop3_instruction);
+	DISPATCH();
+
+	// Loads can't change the interrupt state, stores can write to the interrupt registers
+
+op_lb:
+	CALL_HANDLER(lb);
+	DISPATCH();
+
+op_lh:
+	CALL_HANDLER(lh);
+	DISPATCH();
+
+op_lwl:
+	CALL_HANDLER(lwl);
+	DISPATCH();
+
+op_lw:
+	CALL_HANDLER(lw);
+	DISPATCH();
+
+op_lbu:
+	CALL_HANDLER(lbu);
+	DISPATCH();
+
+op_lhu:
+	CALL_HANDLER(lhu);
+	DISPATCH();
+
+op_lwr:
+	CALL_HANDLER(lwr);
+	DISPATCH();
+
+op_sb:
+	CALL_HANDLER_SYNC(sb);
+	DISPATCH();
+
+op_sh:
+	CALL_HANDLER_SYNC(sh);
+	DISPATCH();
+
+op_swl:
+	CALL_HANDLER_SYNC(swl);
+	DISPATCH();
+
+op_sw:
+	CALL_HANDLER_SYNC(sw);
+	DISPATCH();
+
+op_swr:
+	CALL_HANDLER_SYNC(swr);
+	DISPATCH();
+
+op_lwc0:
+	CALL_HANDLER_SYNC(lwc0);
+	DISPATCH();
+
+op_lwc1:
+	CALL_HANDLER_SYNC(lwc1);
+	DISPATCH();
+
+op_lwc2:
+	CALL_HANDLER_SYNC(lwc2);
+	DISPATCH();
+
+op_lwc3:
+	CALL_HANDLER_SYNC(lwc3);
+	DISPATCH();
+
+op_swc0:
+	CALL_HANDLER_SYNC(swc0);
+	DISPATCH();
+
+op_swc1:
+	CALL_HANDLER_SYNC(swc1);
+	DISPATCH();
+
+op_swc2:
+	CALL_HANDLER_SYNC(swc2);
+	DISPATCH();
+
+op_swc3:
+	CALL_HANDLER_SYNC(swc3);
+	DISPATCH();
+
+	// Register instructions
+
+op_sll:
+	R(rd(opcode)) = R(rt(opcode)) << imm5(opcode);
+	DISPATCH();
+
+op_srl:
+	R(rd(opcode)) = R(rt(opcode)) >> imm5(opcode);
+	DISPATCH();
+
+op_sra:
+	R(rd(opcode)) = (int32_t)R(rt(opcode)) >> imm5(opcode);
+	DISPATCH();
+
+op_sllv:
+	R(rd(opcode)) = R(rt(opcode)) << (R(rs(opcode)) & 0x1F);
+	DISPATCH();
+
+op_srlv:
+	R(rd(opcode)) = R(rt(opcode)) >> (R(rs(opcode)) & 0x1F);
+	DISPATCH();
+
+op_srav:
+	R(rd(opcode)) = (int32_t)R(rt(opcode)) >> (R(rs(opcode)) & 0x1F);
+	DISPATCH();
+
+op_syscall:
+	CALL_HANDLER_SYNC(syscall);
+	DISPATCH();
+
+op_hle:
+	// Return after kernel calls like after a block, so the caller sees pc reach the shell entry point
+	CALL_HANDLER_SYNC(hle_bios_trap);
+	exit_countdown = 1;
+	DISPATCH();
+
+op_break:
+	CALL_HANDLER_SYNC(op_break);
+	DISPATCH();
+
+op_mfhi:
+	R(rd(opcode)) = cpu_state.hi;
+	DISPATCH();
+
+op_mthi:
+	cpu_state.hi = R(rs(opcode));
+	DISPATCH();
+
+op_mflo:
+	R(rd(opcode)) = cpu_state.lo;
+	DISPATCH();
+
+op_mtlo:
+	cpu_state.lo = R(rs(opcode));
+	DISPATCH();
+
+op_mult:
+	CALL_HANDLER(mult);
+	DISPATCH();
+
+op_multu:
+	CALL_HANDLER(multu);
+	DISPATCH();
+
+op_div:
+	CALL_HANDLER(op_div);
+	DISPATCH();
+
+op_divu:
+	CALL_HANDLER(divu);
+	DISPATCH();
+
+op_add:
+	CALL_HANDLER_SYNC(add);
+	DISPATCH();
+
+op_addu:
+	R(rd(opcode)) = R(rs(opcode)) + R(rt(opcode));
+	DISPATCH();
+
+op_sub:
+	CALL_HANDLER_SYNC(sub);
+	DISPATCH();
+
+op_subu:
+	R(rd(opcode)) = R(rs(opcode)) - R(rt(opcode));
+	DISPATCH();
+
+op_and:
+	R(rd(opcode)) = R(rs(opcode)) & R(rt(opcode));
+	DISPATCH();
+
+op_or:
+	R(rd(opcode)) = R(rs(opcode)) | R(rt(opcode));
+	DISPATCH();
+
+op_xor:
+	R(rd(opcode)) = R(rs(opcode)) ^ R(rt(opcode));
+	DISPATCH();
+
+op_nor:
+	R(rd(opcode)) = ~(R(rs(opcode)) | R(rt(opcode)));
+	DISPATCH();
+
+op_slt:
+	R(rd(opcode)) = (int32_t)R(rs(opcode)) < (int32_t)R(rt(opcode));
+	DISPATCH();
+
+op_sltu:
+	R(rd(opcode)) = R(rs(opcode)) < R(rt(opcode));
+	DISPATCH();
+}
+
+#else
+
+int run_threaded_interpreter(bool debug_info)
+{
+	handle_instruction(debug_info);
+	return 1;
+}
+
+#endif
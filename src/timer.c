@@ -6,13 +6,29 @@
 #include "cpu.h"
 #include "gpu.h"
 #include "interrupt.h"
-#include "cdrom.h"
+#include "scheduler.h"
 
-TimerState timer_state = {0};
+PSX_THREAD_LOCAL TimerState timer_state = {
+	.timers = {
+		{ .time_per_tick = 1, .irq_deadline = SCHEDULER_NO_EVENT },
+		{ .time_per_tick = 1, .irq_deadline = SCHEDULER_NO_EVENT },
+		{ .time_per_tick = 1, .irq_deadline = SCHEDULER_NO_EVENT },
+	},
+	.hblank_count = 0,
+};
 
 void reset_timer_state()
 {
 	memset(&timer_state, 0, sizeof(timer_state));
+
+	for (int i = 0; i < 3; i++)
+	{
+		timer_state.timers[i].base_time = scheduler_state.cycles;
+		timer_state.timers[i].time_per_tick = 1;
+		timer_state.timers[i].irq_deadline = SCHEDULER_NO_EVENT;
+	}
+
+	cancel_event(EVENT_TIMERS);
 }
 
 uint32_t read_timer(uint32_t address)
@@ -24,7 +40,7 @@ uint32_t read_timer(uint32_t address)
 	uint8_t timer_register = address & 0xF;
 
 	if (timer_register == 0)
-		return timer->counter_value;
+		return get_counter_value(timer_channel);
 	
 	if (timer_register == 4)
 	{
@@ -53,6 +69,7 @@ void write_timer(uint32_t address, uint32_t value)
 
 	if (timer_register == 0)
 	{
+		rebase_timer(timer_channel);
 		timer->counter_value = value & 0xFFFF;
 	}
 	else if (timer_register == 4)
@@ -72,9 +89,14 @@ void write_timer(uint32_t address, uint32_t value)
 		timer->irq_bit = (value & (1 << 10)) >> 10;
 		timer->reached_target = (value & (1 << 11)) >> 12;
 		timer->reached_max_value = (value & (1 << 11)) >> 12;
+
+		// The clock source may have changed, restart counting from now
+		rebase_timer(timer_channel);
+		timer->counter_value = 0;
 	}
 	else if (timer_register == 8)
 	{
+		rebase_timer(timer_channel);
 		timer->counter_target = value & 0xFFFF;
 	}
 	else
@@ -86,26 +108,47 @@ void write_timer(uint32_t address, uint32_t value)
 			timer_register
 		);
 	}
+
+	// The write can move the next IRQ of the timer
+	update_irq_deadline(timer_channel);
 }
 
-void system_clock_tick(int cycles)
+static ClockSourceType get_clock_type(int index)
 {
-	tick_cdrom(cycles);
-
-	bool hblank_tick = false;
-	bool dot_clock_tick = false;
-	bool sys_clock_8_tick = false;
-
-	timer_state.hblank_clock_internal += cycles;
+	Timer* timer = &timer_state.timers[index];
 
-	if (timer_state.hblank_clock_internal >= (NTSC_SCANLINE_CYCLES * GPU_TO_CPU_CYCLES))
+	// Check the clock source for the timer
+	switch (timer->clock_source)
 	{
-		timer_state.hblank_clock_internal = 0;
-		hblank_tick = true;
+		case CLOCK_SRC_1:
+			if (index == 0)
+				return DOT_CLOCK;
+			else if (index == 1)
+				return HBLANK_CLOCK;
+			return SYS_CLOCK;
+
+		case CLOCK_SRC_2:
+			if (index == 2)
+				return SYS_CLOCK_8;
+			return SYS_CLOCK;
+
+		case CLOCK_SRC_3:
+			if (index == 0)
+				return DOT_CLOCK;
+			else if (index == 1)
+				return HBLANK_CLOCK;
+			return SYS_CLOCK_8;
+
+		default:
+			return SYS_CLOCK;
 	}
+}
 
-	timer_state.dot_clock_internal += cycles;
-
+/// <summary>
+/// Gets how many system clock cycles one dot clock tick takes with the current horizontal resolution
+/// </summary>
+static int get_dot_clock_divider()
+{
 	int dot_clock = DOT_CLK_256;
 
 	if (gpu_state.gpu_status.h_res_2 == H_RES_368)
@@ -119,90 +162,229 @@ void system_clock_tick(int cycles)
 	else if (gpu_state.gpu_status.h_res_1 == H_RES_640)
 		dot_clock = DOT_CLK_640;
 
-	if (timer_state.dot_clock_internal >= (CPU_FREQ / dot_clock))
+	return CPU_FREQ / dot_clock;
+}
+
+/// <summary>
+/// Gets the current time of the clock source of a timer
+/// </summary>
+static uint64_t get_source_time(int index)
+{
+	if (get_clock_type(index) == HBLANK_CLOCK)
+		return timer_state.hblank_count;
+
+	return scheduler_state.cycles;
+}
+
+/// <summary>
+/// Gets how many units of time one tick of the clock source of a timer takes
+/// </summary>
+static uint32_t get_time_per_tick(int index)
+{
+	switch (get_clock_type(index))
 	{
-		timer_state.dot_clock_internal = 0;
-		dot_clock_tick = true;
+		case SYS_CLOCK_8:
+			return SYS_CLOCK_8_CYCLES;
+
+		case DOT_CLOCK:
+			return get_dot_clock_divider();
+
+		default:
+			return 1;
 	}
+}
 
-	timer_state.sys_clock_8_internal += cycles;
+/// <summary>
+/// Gets the value at which a counter goes back to 0
+/// </summary>
+static uint32_t get_counter_limit(Timer* timer, uint32_t value)
+{
+	// The timer counts up to and including the target value
+	if (timer->reset_on_target && value < timer->counter_target)
+		return timer->counter_target;
 
-	if (timer_state.sys_clock_8_internal >= SYS_CLOCK_8_CYCLES)
+	return 0xFFFF;
+}
+
+/// <summary>
+/// Gets how many ticks the counter takes from its base value to go back to 0
+/// </summary>
+static uint64_t get_ticks_until_reset(Timer* timer)
+{
+	uint32_t limit = get_counter_limit(timer, timer->counter_value);
+
+	return limit > timer->counter_value ? limit - timer->counter_value : 0;
+}
+
+/// <summary>
+/// Computes the counter value after a number of ticks from the base value
+/// </summary>
+static uint32_t compute_counter_value(Timer* timer, uint64_t ticks)
+{
+	uint64_t ticks_until_reset = get_ticks_until_reset(timer);
+
+	if (ticks < ticks_until_reset)
+		return timer->counter_value + ticks;
+
+	// Once back to 0, the counter keeps looping with the same period
+	return (ticks - ticks_until_reset) % get_counter_limit(timer, 0);
+}
+
+uint32_t get_counter_value(int index)
+{
+	Timer* timer = &timer_state.timers[index];
+	uint64_t ticks = (get_source_time(index) - timer->base_time) / timer->time_per_tick;
+
+	return compute_counter_value(timer, ticks);
+}
+
+/// <summary>
+/// Gets whether the timer can request IRQs at all with its current mode
+/// </summary>
+static bool can_request_irq(Timer* timer)
+{
+	return timer->irq_bit && ((timer->reset_on_target && timer->irq_on_target) || timer->irq_on_max_value);
+}
+
+/// <summary>
+/// Gets whether the timer requests an IRQ when it goes back to 0 from its base value
+/// </summary>
+static bool irq_on_reset(Timer* timer)
+{
+	if (!timer->irq_bit)
+		return false;
+
+	if (timer->reset_on_target && get_counter_limit(timer, timer->counter_value) == timer->counter_target)
+		return timer->irq_on_target;
+
+	return timer->irq_on_max_value;
+}
+
+/// <summary>
+/// Requests the IRQ of a timer going back to 0
+/// </summary>
+static void request_timer_irq(int index)
+{
+	Timer* timer = &timer_state.timers[index];
+
+	request_interrupt(IRQ_TMR0 + index);
+
+	if (timer->reset_on_target && get_counter_limit(timer, timer->counter_value) == timer->counter_target)
+		log_warning("Unhandled timer IRQ request on target\n");
+	else
+		log_warning("Unhandled timer IRQ request on max value\n");
+}
+
+/// <summary>
+/// Precomputes the cycle of the next IRQ of a timer and schedules the timer event accordingly
+/// </summary>
+static void update_irq_deadline(int index)
+{
+	Timer* timer = &timer_state.timers[index];
+
+	timer->irq_deadline = SCHEDULER_NO_EVENT;
+
+	// Every reset gets a deadline, as the IRQ may only be requested after a reset without IRQ.
+	// HBlank clocked timers are checked by the HBlank event itself
+	if (can_request_irq(timer) && get_clock_type(index) != HBLANK_CLOCK)
+	{
+		uint64_t ticks = get_ticks_until_reset(timer);
+
+		// A counter at 0xFFFF without a target goes back to 0 on the next tick
+		if (ticks == 0)
+			ticks = 1;
+
+		timer->irq_deadline = timer->base_time + ticks * timer->time_per_tick;
+	}
+
+	uint64_t deadline = SCHEDULER_NO_EVENT;
+
+	for (int i = 0; i < 3; i++)
+	{
+		if (timer_state.timers[i].irq_deadline < deadline)
+			deadline = timer_state.timers[i].irq_deadline;
+	}
+
+	if (deadline == SCHEDULER_NO_EVENT)
+		cancel_event(EVENT_TIMERS);
+	else
+		schedule_event_at(EVENT_TIMERS, deadline);
+}
+
+/// <summary>
+/// Makes the current time the new base of a timer, so its mode or rate can change without affecting the elapsed ticks
+/// </summary>
+static void rebase_timer(int index)
+{
+	Timer* timer = &timer_state.timers[index];
+
+	timer->counter_value = get_counter_value(index);
+	timer->base_time = get_source_time(index);
+	timer->time_per_tick = get_time_per_tick(index);
+}
+
+/// <summary>
+/// Moves the base of a timer to the time where its counter goes back to 0, and requests its IRQ
+/// </summary>
+static void reset_timer_counter(int index)
+{
+	Timer* timer = &timer_state.timers[index];
+	uint64_t ticks = get_ticks_until_reset(timer);
+
+	if (ticks == 0)
+		ticks = 1;
+
+	if (irq_on_reset(timer))
+		request_timer_irq(index);
+
+	timer->base_time += ticks * timer->time_per_tick;
+	timer->counter_value = 0;
+}
+
+void update_timer_rates()
+{
+	for (int i = 0; i < 3; i++)
 	{
-		sys_clock_8_tick = true;
-		timer_state.sys_clock_8_internal = 0;
+		rebase_timer(i);
+		update_irq_deadline(i);
 	}
+}
+
+void tick_hblank_timers()
+{
+	timer_state.hblank_count++;
 
 	for (int i = 0; i < 3; i++)
 	{
 		Timer* timer = &timer_state.timers[i];
-		uint32_t value = timer->counter_value;
-		uint32_t target = timer->counter_target;
 
-		ClockSourceType clock_type = 0;
+		if (get_clock_type(i) != HBLANK_CLOCK)
+			continue;
 
-		// Check the clock source for the timer
-		switch (timer->clock_source)
-		{
-			case CLOCK_SRC_0:
-				clock_type = SYS_CLOCK;
-				break;
-
-			case CLOCK_SRC_1:
-				if (i == 0)
-					clock_type = DOT_CLOCK;
-				else if (i == 1)
-					clock_type = HBLANK_CLOCK;
-				else
-					clock_type = SYS_CLOCK;
-				break;
-
-			case CLOCK_SRC_2:
-				if (i == 2)
-					clock_type = SYS_CLOCK_8;
-				else
-					clock_type = SYS_CLOCK;
-				break;
-
-			case CLOCK_SRC_3:
-				if (i == 0)
-					clock_type = DOT_CLOCK;
-				else if (i == 1)
-					clock_type = HBLANK_CLOCK;
-				else
-					clock_type = SYS_CLOCK_8;
-				break;
-		}
+		// The HBlank clock has no deadline of its own, check if this scanline resets the counter
+		uint64_t ticks = timer_state.hblank_count - timer->base_time;
+		uint64_t ticks_until_reset = get_ticks_until_reset(timer);
 
-		if (clock_type == SYS_CLOCK)
-			timer->counter_value++;
-		else if (clock_type == SYS_CLOCK_8 && sys_clock_8_tick)
-			timer->counter_value++;
-		else if (clock_type == HBLANK_CLOCK && hblank_tick)
-			timer->counter_value++;
-		else if (clock_type == DOT_CLOCK && dot_clock_tick)
-			timer->counter_value++;
-
-		// The timer counts up to and including the target value
-		if (timer->reset_on_target && timer->counter_value == timer->counter_target)
+		if (ticks >= ticks_until_reset && ticks_until_reset > 0)
 		{
-			timer->counter_value = 0;
+			if (irq_on_reset(timer))
+				request_timer_irq(i);
 
-			if (timer->irq_on_target && timer->irq_bit)
-			{
-				request_interrupt(IRQ_TMR0 + i);
-				log_warning("Unhandled timer IRQ request on target\n");
-			}
+			rebase_timer(i);
 		}
-		else if (timer->counter_value == 0xFFFF)
-		{
-			timer->counter_value = 0;
+	}
+}
 
-			if (timer->irq_on_max_value && timer->irq_bit)
-			{
-				request_interrupt(IRQ_TMR0 + i);
-				log_warning("Unhandled timer IRQ request on max value\n");
-			}
-		}
+void handle_timer_event(uint64_t deadline)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		Timer* timer = &timer_state.timers[i];
+
+		if (timer->irq_deadline > scheduler_state.cycles)
+			continue;
+
+		reset_timer_counter(i);
+		update_irq_deadline(i);
 	}
 }